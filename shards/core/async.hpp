@@ -5,6 +5,8 @@
 #include <thread>
 #include <deque>
 #include <future>
+#include <array>
+#include <memory>
 
 #include <shards/shards.h>
 #include <shards/utility.hpp>
@@ -46,6 +48,33 @@
 #endif
 
 namespace shards {
+// Scheduling classes of async work, higher classes are always served first
+enum class WorkPriority { Low, Normal, High, Critical };
+
+struct AwaitOptions {
+  WorkPriority priority{WorkPriority::Normal};
+  // Maximum time the work is allowed to wait in the queue before starting, zero means no deadline
+  std::chrono::nanoseconds deadline{};
+};
+
+// Cooperative cancellation flag handed to async work, signalled when the awaiting wire stops or aborts
+struct CancellationToken {
+  bool cancelled() const { return _cancelled.load(std::memory_order_acquire); }
+  void cancel() { _cancelled.store(true, std::memory_order_release); }
+
+private:
+  std::atomic_bool _cancelled{false};
+};
+
+// Calls func passing the token if it accepts one
+template <typename FUNC> inline decltype(auto) invokeAsyncWork(FUNC &func, const CancellationToken &token) {
+  if constexpr (std::is_invocable_v<FUNC &, const CancellationToken &>) {
+    return func(token);
+  } else {
+    return func();
+  }
+}
+
 #if HAS_ASYNC_SUPPORT
 /*
  * The TidePool class is a simple C++ thread pool implementation designed to manage
@@ -55,7 +84,11 @@ namespace shards {
  * Features:
  * - Abstract Work struct representing tasks to be executed by the worker threads.
  * - Dynamic adjustment of the number of worker threads based on the number of tasks in the queue.
- * - Lock-free queue for efficient task scheduling.
+ * - Lock-free queues (one per WorkPriority class) for efficient task scheduling,
+ *   workers always drain higher priority classes first.
+ * - Optional per work deadline, work that could not start in time is expired instead of called.
+ * - Queued work can be cancelled, its slot is given back at once and it is dropped when dequeued.
+ * - Per priority class queue wait time statistics.
  * - Configurable minimum, initial, and maximum number of worker threads.
  * - Asynchronous controller thread that manages worker threads.
  * - Simple scheduling function for adding tasks to the queue.
@@ -67,15 +100,82 @@ namespace shards {
  * - The pool will automatically adjust the number of worker threads based on the workload.
  */
 struct TidePool {
+  using Clock = std::chrono::steady_clock;
+
+  static constexpr size_t NumPriorities = size_t(WorkPriority::Critical) + 1;
+
   struct Work {
+    enum class State : uint8_t { Queued, Running, Cancelled };
+
+    WorkPriority priority{WorkPriority::Normal};
+    // default constructed means no deadline
+    Clock::time_point deadline{};
+    Clock::time_point scheduledAt{};
+    std::atomic<State> state{State::Queued};
+
     virtual void call() = 0;
+    // called instead of call() if the deadline passed while the work was still queued
+    virtual void expired() { call(); }
+    // called instead of call() when dequeuing work cancelled while queued, the pool is done with it after this
+    virtual void dropped() {}
+  };
+
+  struct PriorityStats {
+    std::atomic_uint64_t scheduled{};
+    std::atomic_uint64_t started{};
+    std::atomic_uint64_t expired{};
+    std::atomic_uint64_t cancelled{};
+    std::atomic_uint64_t totalWaitNs{};
+    std::atomic_uint64_t maxWaitNs{};
   };
 
+  std::array<PriorityStats, NumPriorities> _stats;
+
+  const PriorityStats &stats(WorkPriority priority) const { return _stats[size_t(priority)]; }
+
+  // Runs, expires or drops the work, the work might be gone once this returns
+  // returns false if the work was dropped, its slot was already given back by cancel()
+  bool run(Work *work) {
+    auto queued = Work::State::Queued;
+    if (!work->state.compare_exchange_strong(queued, Work::State::Running, std::memory_order_acq_rel)) {
+      work->dropped();
+      return false;
+    }
+
+    auto now = Clock::now();
+    auto &stats = _stats[size_t(work->priority)];
+    uint64_t waitNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - work->scheduledAt).count();
+    stats.totalWaitNs.fetch_add(waitNs, std::memory_order_relaxed);
+    auto maxWait = stats.maxWaitNs.load(std::memory_order_relaxed);
+    while (maxWait < waitNs && !stats.maxWaitNs.compare_exchange_weak(maxWait, waitNs, std::memory_order_relaxed)) {
+    }
+
+    if (work->deadline != Clock::time_point{} && now > work->deadline) {
+      stats.expired.fetch_add(1, std::memory_order_relaxed);
+      work->expired();
+    } else {
+      stats.started.fetch_add(1, std::memory_order_relaxed);
+      work->call();
+    }
+    return true;
+  }
+
+  // Cancels the work if it did not start yet, in that case ownership passes to the pool
+  // which will call dropped() once the work is dequeued, returns false if already running
+  bool cancel(Work *work) {
+    auto queued = Work::State::Queued;
+    if (!work->state.compare_exchange_strong(queued, Work::State::Cancelled, std::memory_order_acq_rel))
+      return false;
+    _stats[size_t(work->priority)].cancelled.fetch_add(1, std::memory_order_relaxed);
+#if SH_ENABLE_TIDE_POOL
+    _scheduledCounter--;
+#endif
+    return true;
+  }
+
 #if SH_ENABLE_TIDE_POOL
   struct Worker {
-    Worker(boost::lockfree::queue<Work *> &queue, std::atomic_size_t &counter, std::mutex &condMutex,
-           std::condition_variable &cond)
-        : _queue(queue), _counter(counter), _condMutex(condMutex), _cond(cond) {
+    Worker(TidePool &pool) : _pool(pool) {
       _running = true;
       boost::thread::attributes attrs;
       attrs.set_stack_size(SH_STACK_SIZE);
@@ -83,15 +183,15 @@ struct TidePool {
         pushThreadName("TidePool worker");
         while (_running) {
           Work *work{};
-          if (_queue.pop(work)) {
+          if (_pool.pop(work)) {
             // SHLOG_DEBUG("TidePool: calling {}", (void*)work);
-            work->call();
-            _counter--;
+            if (_pool.run(work))
+              _pool._scheduledCounter--;
           }
-          // wait if the queue is empty
-          if (_queue.empty()) {
-            std::unique_lock<std::mutex> lock(_condMutex);
-            _cond.wait(lock, [this]() { return !_queue.empty() || !_running; });
+          // wait if the queues are empty
+          if (_pool.empty()) {
+            std::unique_lock<std::mutex> lock(_pool._condMutex);
+            _pool._cond.wait(lock, [this]() { return !_pool.empty() || !_running; });
           }
         }
       });
@@ -99,20 +199,21 @@ struct TidePool {
 
     boost::thread _thread;
     std::atomic_bool _running;
-    boost::lockfree::queue<Work *> &_queue;
-    std::atomic_size_t &_counter;
-    std::mutex &_condMutex;
-    std::condition_variable &_cond;
+    TidePool &_pool;
   };
 
   static constexpr size_t LowWater = 4;
   static constexpr size_t NumWorkers = 8;
   static constexpr size_t MaxWorkers = 32;
 
+  struct Queue {
+    boost::lockfree::queue<Work *> queue{NumWorkers};
+  };
+
   std::atomic_size_t _scheduledCounter;
   std::atomic_bool _running;
   std::thread _controller;
-  boost::lockfree::queue<Work *> _queue{NumWorkers};
+  std::array<Queue, NumPriorities> _queues;
   std::deque<Worker> _workers;
   std::mutex _condMutex;
   std::condition_variable _cond;
@@ -137,16 +238,35 @@ struct TidePool {
 
   void schedule(Work *work) {
     _scheduledCounter++;
-    _queue.push(work);
+    work->state.store(Work::State::Queued, std::memory_order_relaxed);
+    work->scheduledAt = Clock::now();
+    _stats[size_t(work->priority)].scheduled.fetch_add(1, std::memory_order_relaxed);
+    _queues[size_t(work->priority)].queue.push(work);
     _cond.notify_one();
   }
 
+  bool pop(Work *&work) {
+    for (size_t i = NumPriorities; i-- > 0;) {
+      if (_queues[i].queue.pop(work))
+        return true;
+    }
+    return false;
+  }
+
+  bool empty() const {
+    for (auto &q : _queues) {
+      if (!q.queue.empty())
+        return false;
+    }
+    return true;
+  }
+
   void controllerWorker() {
     pushThreadName("TidePool controller");
 
     // spawn workers first
     for (size_t i = 0; i < NumWorkers; ++i) {
-      _workers.emplace_back(_queue, _scheduledCounter, _condMutex, _cond);
+      _workers.emplace_back(*this);
     }
 
     while (_running) {
@@ -163,7 +283,7 @@ struct TidePool {
         // SHLOG_DEBUG("TidePool: worker removed, count: {}", _workers.size());
       } else if (_scheduledCounter > _workers.size() && _workers.size() < MaxWorkers) {
         // we have more scheduled than workers
-        _workers.emplace_back(_queue, _scheduledCounter, _condMutex, _cond);
+        _workers.emplace_back(*this);
         // SHLOG_DEBUG("TidePool: worker added, count: {}", _workers.size());
       }
       std::this_thread::sleep_for(std::chrono::milliseconds(100));
@@ -182,10 +302,13 @@ struct TidePool {
         worker._thread.join();
     }
   }
-#else // Dummy implementation
+#else // Dummy implementation, priorities are only tracked, taskflow decides the order
   void schedule(Work *work) {
+    work->state.store(Work::State::Queued, std::memory_order_relaxed);
+    work->scheduledAt = Clock::now();
+    _stats[size_t(work->priority)].scheduled.fetch_add(1, std::memory_order_relaxed);
     tf::Taskflow flow;
-    flow.emplace([=]() { work->call(); });
+    flow.emplace([this, work]() { run(work); });
     TaskFlowInstance::instance().run(std::move(flow));
   }
   void terminate() {}
@@ -196,15 +319,22 @@ TidePool &getTidePool();
 
 #endif
 
+/*
+ * Runs func on the TidePool and suspends the wire until it completes.
+ * func may optionally take a `const CancellationToken &`, the token is signalled when the
+ * wire stops or aborts while the work is running so long operations can bail out early.
+ * If the wire stops while the work is still queued the work is dropped and never runs.
+ */
 template <typename FUNC, typename CANCELLATION>
-inline SHVar awaitne(SHContext *context, FUNC &&func, CANCELLATION &&cancel) noexcept {
-  static_assert(std::is_same_v<decltype(func()), SHVar> || std::is_same_v<decltype(func()), Var>,
-                "func must return SHVar or Var");
+inline SHVar awaitne(SHContext *context, FUNC &&func, CANCELLATION &&cancel, const AwaitOptions &options = {}) noexcept {
+  using Result = decltype(invokeAsyncWork(func, std::declval<const CancellationToken &>()));
+  static_assert(std::is_same_v<Result, SHVar> || std::is_same_v<Result, Var>, "func must return SHVar or Var");
   ZoneScopedN("awaitne");
 
   if (context->onWorkerThread) {
     try {
-      return func();
+      CancellationToken token;
+      return invokeAsyncWork(func, token);
     } catch (const std::exception &e) {
       context->cancelFlow(e.what());
     } catch (...) {
@@ -214,13 +344,15 @@ inline SHVar awaitne(SHContext *context, FUNC &&func, CANCELLATION &&cancel) noe
   }
 
 #if !HAS_ASYNC_SUPPORT
-  return func();
+  CancellationToken token;
+  return invokeAsyncWork(func, token);
 #else
   struct BlockingCall : TidePool::Work {
     BlockingCall(FUNC &&func) : func(std::move(func)), exp(), res(), complete(false) {}
 
     FUNC &&func;
 
+    CancellationToken token;
     std::exception_ptr exp;
     SHVar res;
     std::atomic_bool complete;
@@ -229,103 +361,149 @@ inline SHVar awaitne(SHContext *context, FUNC &&func, CANCELLATION &&cancel) noe
       ZoneScopedNC("awaitne-work", 0xFF00FF00);
 
       try {
-        res = func();
+        res = invokeAsyncWork(func, token);
       } catch (...) {
         exp = std::current_exception();
       }
       complete = true;
     }
-  } call{std::forward<FUNC>(func)};
+
+    virtual void expired() {
+      exp = std::make_exception_ptr(ActivationError("Await deadline exceeded before the work could start"));
+      complete = true;
+    }
+
+    // cancelled while queued, the awaiting side gave us up
+    virtual void dropped() { delete this; }
+  };
+
+  // heap allocated as the pool might outlive this frame if the work is dropped
+  std::unique_ptr<BlockingCall> call(new BlockingCall(std::forward<FUNC>(func)));
+
+  call->priority = options.priority;
+  if (options.deadline.count() > 0)
+    call->deadline = TidePool::Clock::now() + options.deadline;
 
   context->onWorkerThread = true;
   DEFER(shassert(!context->onWorkerThread && "context still flagged on worker thread"));
 
-  getTidePool().schedule(&call);
+  getTidePool().schedule(call.get());
 
-  while (!call.complete && context->shouldContinue()) {
+  while (!call->complete && context->shouldContinue()) {
     if (shards::suspend(context, 0) != SHWireState::Continue)
       break;
   }
 
   context->onWorkerThread = false;
 
-  if (unlikely(!call.complete)) {
+  if (unlikely(!call->complete)) {
+    call->token.cancel();
+    if (getTidePool().cancel(call.get())) {
+      // never started, the pool owns it now and will drop it
+      call.release();
+      return SHVar();
+    }
     cancel();
-    while (!call.complete) {
+    while (!call->complete) {
       std::this_thread::yield();
     }
   }
 
-  if (call.exp) {
+  if (call->exp) {
     try {
-      std::rethrow_exception(call.exp);
+      std::rethrow_exception(call->exp);
     } catch (const std::exception &e) {
       context->cancelFlow(e.what());
     } catch (...) {
       context->cancelFlow("foreign exception failure");
     }
-  } else if (call.res.flags == SHVAR_FLAGS_ABORT) { // not a bit check we don't expect any other flags
-    auto msg = SHSTRVIEW(call.res);
+  } else if (call->res.flags == SHVAR_FLAGS_ABORT) { // not a bit check we don't expect any other flags
+    auto msg = SHSTRVIEW(call->res);
     context->cancelFlow(msg);
-    destroyVar(call.res);
+    destroyVar(call->res);
   }
 
-  return call.res;
+  return call->res;
 #endif
 }
 
-template <typename FUNC, typename CANCELLATION> inline void await(SHContext *context, FUNC &&func, CANCELLATION &&cancel) {
+template <typename FUNC, typename CANCELLATION>
+inline void await(SHContext *context, FUNC &&func, CANCELLATION &&cancel, const AwaitOptions &options = {}) {
   ZoneScopedN("await");
 
   if (context->onWorkerThread) {
     // When already on a worker thread, just call the function directly
-    func();
+    CancellationToken token;
+    invokeAsyncWork(func, token);
     return;
   }
 
 #if !HAS_ASYNC_SUPPORT
-  func();
+  CancellationToken token;
+  invokeAsyncWork(func, token);
 #else
   struct BlockingCall : TidePool::Work {
     BlockingCall(FUNC &&func) : func(std::move(func)), exp(), complete(false) {}
 
     FUNC &&func;
 
+    CancellationToken token;
     std::exception_ptr exp;
     std::atomic_bool complete;
 
     virtual void call() {
       ZoneScopedNC("await-work", 0xFF00FF00);
       try {
-        func();
+        invokeAsyncWork(func, token);
       } catch (...) {
         exp = std::current_exception();
       }
-      complete = true;
+      complete.store(true, std::memory_order_release);
+    }
+
+    virtual void expired() {
+      exp = std::make_exception_ptr(ActivationError("Await deadline exceeded before the work could start"));
+      complete.store(true, std::memory_order_release);
     }
-  } call{std::forward<FUNC>(func)};
+
+    // cancelled while queued, the awaiting side gave us up
+    virtual void dropped() { delete this; }
+  };
+
+  // heap allocated as the pool might outlive this frame if the work is dropped
+  std::unique_ptr<BlockingCall> call(new BlockingCall(std::forward<FUNC>(func)));
+
+  call->priority = options.priority;
+  if (options.deadline.count() > 0)
+    call->deadline = TidePool::Clock::now() + options.deadline;
 
   context->onWorkerThread = true;
   DEFER(shassert(!context->onWorkerThread && "context still flagged on worker thread"));
 
-  getTidePool().schedule(&call);
+  getTidePool().schedule(call.get());
 
-  while (!call.complete.load(std::memory_order_acquire) && context->shouldContinue()) {
+  while (!call->complete.load(std::memory_order_acquire) && context->shouldContinue()) {
     if (shards::suspend(context, 0) != SHWireState::Continue)
       break;
   }
 
   context->onWorkerThread = false;
 
-  if (unlikely(!call.complete)) {
+  if (unlikely(!call->complete)) {
+    call->token.cancel();
+    if (getTidePool().cancel(call.get())) {
+      // never started, the pool owns it now and will drop it
+      call.release();
+      return;
+    }
     cancel();
-    while (!call.complete) {
+    while (!call->complete) {
       std::this_thread::yield();
     }
   }
 
-  if (call.exp) {
-    std::rethrow_exception(call.exp);
+  if (call->exp) {
+    std::rethrow_exception(call->exp);
   }
 #endif
 }
@@ -0,0 +1,158 @@
+#ifndef C7E2A91B_4D3F_4B8E_A6C1_2F9D8E7B6A50
+#define C7E2A91B_4D3F_4B8E_A6C1_2F9D8E7B6A50
+
+#include "platform.hpp"
+#include <cstdint>
+#include <cstddef>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if SH_LINUX || SH_APPLE || SH_ANDROID
+#define SH_MAPPED_FILE_MMAP 1
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#define SH_MAPPED_FILE_MMAP 0
+#endif
+
+namespace shards {
+
+// Read only view of a whole file
+// Memory mapped where supported, otherwise (or for small files) the contents are read into memory
+// Accessing a mapping past the end of a file truncated meanwhile raises SIGBUS and kills the process, open files that
+// may be truncated or rewritten while in use without map
+struct MappedFile {
+  // Below this size a plain read is cheaper than setting up a mapping
+  static constexpr size_t MapThreshold = 64 * 1024;
+
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  MappedFile(MappedFile &&other) { *this = std::move(other); }
+  MappedFile &operator=(MappedFile &&other) {
+    close();
+    std::swap(_data, other._data);
+    std::swap(_size, other._size);
+    std::swap(_mapped, other._mapped);
+    std::swap(_open, other._open);
+    _buffer.swap(other._buffer);
+    return *this;
+  }
+  ~MappedFile() { close(); }
+
+  // Returns false if the file could not be opened, without map the contents are always read into memory
+  bool open(const std::string &path, bool map = true) {
+    close();
+#if SH_MAPPED_FILE_MMAP
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+      return false;
+    struct stat st;
+    if (::fstat(fd, &st) != 0) {
+      ::close(fd);
+      return false;
+    }
+    _size = size_t(st.st_size);
+    if (map && _size >= MapThreshold) {
+      void *ptr = ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (ptr != MAP_FAILED) {
+        ::close(fd);
+        _data = static_cast<const uint8_t *>(ptr);
+        _mapped = true;
+        _open = true;
+        return true;
+      }
+    }
+    _open = readAll(fd);
+    ::close(fd);
+    return _open;
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      return false;
+    _buffer.assign(std::istreambuf_iterator<char>(file), {});
+    _size = _buffer.size();
+    _data = _buffer.data();
+    _open = true;
+    return true;
+#endif
+  }
+
+  void close() {
+#if SH_MAPPED_FILE_MMAP
+    if (_mapped)
+      ::munmap(const_cast<uint8_t *>(_data), _size);
+#endif
+    _mapped = false;
+    _open = false;
+    _data = nullptr;
+    _size = 0;
+    _buffer.clear();
+  }
+
+  // Hints the kernel that the file will be read front to back (read ahead aggressively, drop pages behind)
+  void adviseSequential() {
+#if SH_MAPPED_FILE_MMAP
+    if (_mapped)
+      ::madvise(const_cast<uint8_t *>(_data), _size, MADV_SEQUENTIAL);
+#endif
+  }
+
+  // Hints the kernel that the whole file will be needed soon
+  void adviseWillNeed() {
+#if SH_MAPPED_FILE_MMAP
+    if (_mapped)
+      ::madvise(const_cast<uint8_t *>(_data), _size, MADV_WILLNEED);
+#endif
+  }
+
+  const uint8_t *data() const { return _data; }
+  size_t size() const { return _size; }
+  bool isOpen() const { return _open; }
+  bool isMapped() const { return _mapped; }
+
+  // True if the byte past the end is readable and zero, so the contents can be used as a C string
+  bool isNullTerminated() const {
+#if SH_MAPPED_FILE_MMAP
+    if (_mapped) {
+      // the tail of the last page is zero filled by the kernel
+      size_t pageSize = size_t(::sysconf(_SC_PAGESIZE));
+      return _size % pageSize != 0;
+    }
+#endif
+    return false;
+  }
+
+private:
+  const uint8_t *_data{};
+  size_t _size{};
+  bool _mapped{};
+  bool _open{};
+  std::vector<uint8_t> _buffer;
+
+#if SH_MAPPED_FILE_MMAP
+  bool readAll(int fd) {
+    _buffer.resize(_size);
+    size_t offset = 0;
+    while (offset < _size) {
+      auto n = ::read(fd, _buffer.data() + offset, _size - offset);
+      if (n <= 0) {
+        _buffer.clear();
+        _size = 0;
+        return false;
+      }
+      offset += size_t(n);
+    }
+    _data = _buffer.data();
+    return true;
+  }
+#endif
+};
+
+} // namespace shards
+
+#endif /* C7E2A91B_4D3F_4B8E_A6C1_2F9D8E7B6A50 */
@@ -26,6 +26,13 @@ struct BufferRefWriter {
   }
   void operator()(const uint8_t *buf, size_t size) { _buffer.insert(_buffer.end(), buf, buf + size); }
 
+  // reserves the next size bytes for direct encoding
+  uint8_t *claim(size_t size) {
+    auto offset = _buffer.size();
+    _buffer.resize(offset + size);
+    return _buffer.data() + offset;
+  }
+
   // expose data and size
   const uint8_t *data() { return _buffer.data(); }
   size_t size() { return _buffer.size(); }
@@ -53,20 +60,96 @@ struct BytesReader {
     memcpy(buf, buffer + offset, size);
     offset = newOffset;
   }
+
+  // returns a view of the next size bytes without consuming them, nullptr if not available
+  const uint8_t *peek(size_t size) const { return offset + size <= max ? buffer + offset : nullptr; }
+  void skip(size_t size) {
+    if (offset + size > max) {
+      throw std::runtime_error("Overflow requested");
+    }
+    offset += size;
+  }
 };
 
 struct BufferRefReader {
   BytesReader _inner;
   BufferRefReader(const std::vector<uint8_t> &stream) : _inner(stream.data(), stream.size()) {}
   void operator()(uint8_t *buf, size_t size) { _inner(buf, size); }
+  const uint8_t *peek(size_t size) const { return _inner.peek(size); }
+  void skip(size_t size) { _inner.skip(size); }
 };
 
 struct VarReader {
   BytesReader _inner;
   VarReader(const SHVar &var) : _inner(var.payload.bytesValue, var.payload.bytesSize) { assert(var.valueType == SHType::Bytes); }
   void operator()(uint8_t *buf, size_t size) { _inner(buf, size); }
+  const uint8_t *peek(size_t size) const { return _inner.peek(size); }
+  void skip(size_t size) { _inner.skip(size); }
+};
+
+// Counts bytes without writing anything, used by the size pass
+struct SizeWriter {
+  size_t size{};
+  // Set when the value holds objects, shards or wires, their size is only known by running their serialization
+  bool opaque{};
+  void operator()(const uint8_t *buf, size_t size_) { size += size_; }
 };
 
+// Writes into a pre-sized, non owning memory region
+struct SpanWriter {
+  uint8_t *buffer;
+  size_t offset;
+  size_t max;
+
+  SpanWriter(uint8_t *buf, size_t size) : buffer(buf), offset(0), max(size) {}
+  void operator()(const uint8_t *buf, size_t size) { memcpy(claim(size), buf, size); }
+
+  // reserves the next size bytes for direct encoding
+  uint8_t *claim(size_t size) {
+    auto newOffset = offset + size;
+    if (newOffset > max) {
+      throw std::runtime_error("Overflow requested");
+    }
+    auto ptr = buffer + offset;
+    offset = newOffset;
+    return ptr;
+  }
+};
+
+// Size of the payload of types that are serialized as a plain copy of SHVarPayload, 0 otherwise
+inline size_t blittablePayloadSize(SHType type) {
+  switch (type) {
+  case SHType::Enum:
+    return sizeof(int32_t) * 3;
+  case SHType::Bool:
+    return sizeof(SHBool);
+  case SHType::Int:
+    return sizeof(SHInt);
+  case SHType::Int2:
+    return sizeof(SHInt2);
+  case SHType::Int3:
+    return sizeof(SHInt3);
+  case SHType::Int4:
+    return sizeof(SHInt4);
+  case SHType::Int8:
+    return sizeof(SHInt8);
+  case SHType::Int16:
+    return sizeof(SHInt16);
+  case SHType::Float:
+    return sizeof(SHFloat);
+  case SHType::Float2:
+    return sizeof(SHFloat2);
+  case SHType::Float3:
+    return sizeof(SHFloat3);
+  case SHType::Float4:
+    return sizeof(SHFloat4);
+  case SHType::Color:
+    return sizeof(SHColor);
+  default:
+    return 0;
+  }
+}
+
 template <typename T, typename V>
 std::enable_if_t<std::is_integral_v<V> || std::is_floating_point_v<V> || std::is_same_v<V, bool>, void> //
 serde(T &stream, V &v) {
@@ -99,6 +182,11 @@ struct Serialization {
 
   pmr::unordered_map<SHVar, SHWireRef> wires;
 
+  // turn this flag on to deserialize strings and bytes as views into the source buffer instead of copies
+  // views are flagged SHVAR_FLAGS_FOREIGN, strings are not null terminated and the source must outlive them
+  // only applies to readers that can peek into their memory (BytesReader, VarReader, etc)
+  bool views{false};
+
   void reset() {
     for (auto &ref : wires) {
       SHWire::deleteRef(ref.second);
@@ -108,6 +196,51 @@ struct Serialization {
 
   ~Serialization() { reset(); }
 
+  // Sequences shorter than this are not worth scanning for the bulk path
+  static constexpr uint32_t BulkSeqThreshold = 8;
+
+  // Exact number of bytes serialize would produce for input, without side effects on this instance
+  size_t serializedSize(const SHVar &input) {
+    SizeWriter counter;
+    serialize(input, counter);
+    if (!counter.opaque)
+      return counter.size;
+
+    // wire deduplication depends on what was already written, so size against a copy of it
+    Serialization sizing(tempAllocator, private_internal);
+    for (auto &[hash, wire] : wires) {
+      sizing.wires.emplace(hash, SHWire::addRef(wire));
+    }
+    struct Counter {
+      size_t size{};
+      void operator()(const uint8_t *buf, size_t size_) { size += size_; }
+    } exact;
+    sizing.serialize(input, exact);
+    return exact.size;
+  }
+
+  // Two pass serialization: a size pass followed by a single write into buffer, starting at offset
+  // buffer is resized to exactly fit, returns the number of bytes written
+  // values holding objects, shards or wires are serialized once into the growing buffer instead, sizing them would run
+  // their serialization callbacks twice
+  size_t serializeInto(const SHVar &input, std::vector<uint8_t> &buffer, size_t offset = 0) {
+    SizeWriter counter;
+    serialize(input, counter);
+    if (counter.opaque) {
+      buffer.resize(offset);
+      BufferRefWriter writer(buffer, false);
+      serialize(input, writer);
+      return buffer.size() - offset;
+    }
+
+    size_t size = counter.size;
+    buffer.resize(offset + size);
+    SpanWriter writer(buffer.data() + offset, size);
+    serialize(input, writer);
+    assert(writer.offset == size);
+    return size;
+  }
+
   template <class BinaryReader> void deserialize(BinaryReader &read, SHStringPayload &output, bool recycle) {
     auto availChars = recycle ? output.cap : 0;
     read((uint8_t *)&output.len, sizeof(uint32_t));
@@ -152,6 +285,13 @@ struct Serialization {
     SHType nextType;
     read((uint8_t *)&nextType, sizeof(output.valueType));
 
+    // a previous view does not own its memory, never recycle it
+    if (output.flags & SHVAR_FLAGS_FOREIGN) {
+      output.flags &= ~SHVAR_FLAGS_FOREIGN;
+      output.valueType = SHType::None;
+      memset(&output.payload, 0x0, sizeof(SHVarPayload));
+    }
+
     // stop trying to recycle, types differ
     auto recycle = true;
     if (output.valueType != nextType) {
@@ -210,6 +350,17 @@ struct Serialization {
       read((uint8_t *)&output.payload, sizeof(SHColor));
       break;
     case SHType::Bytes: {
+      if constexpr (requires { read.peek(size_t{}); }) {
+        if (views) {
+          uint32_t size;
+          read((uint8_t *)&size, sizeof(uint32_t));
+          auto data = viewInto(read, output, size);
+          output.payload.bytesValue = const_cast<uint8_t *>(data);
+          output.payload.bytesSize = size;
+          break;
+        }
+      }
+
       auto availBytes = recycle ? output.payload.bytesCapacity : 0;
       read((uint8_t *)&output.payload.bytesSize, sizeof(output.payload.bytesSize));
 
@@ -239,6 +390,20 @@ struct Serialization {
       break;
     }
     case SHType::String:
+      if constexpr (requires { read.peek(size_t{}); }) {
+        // empty strings are treated as null terminated by many consumers, those are copied
+        uint32_t len = 0;
+        if (const uint8_t *head = views ? read.peek(sizeof(uint32_t)) : nullptr)
+          memcpy(&len, head, sizeof(uint32_t));
+        if (len > 0) {
+          read.skip(sizeof(uint32_t));
+          auto data = viewInto(read, output, len);
+          output.payload.stringValue = (const char *)data;
+          output.payload.stringLen = len;
+          break;
+        }
+      }
+      [[fallthrough]];
     case SHType::Path:
     case SHType::ContextVar: {
       deserialize(read, output.payload.string, recycle);
@@ -250,6 +415,10 @@ struct Serialization {
       // notice we assume all elements up to capacity are memset to 0x0
       // or are valid SHVars we can overwrite
       shards::arrayResize(output.payload.seqValue, len);
+      if constexpr (requires { read.peek(size_t{}); }) {
+        if (len >= BulkSeqThreshold && deserializeBulk(read, output.payload.seqValue))
+          break;
+      }
       for (uint32_t i = 0; i < len; i++) {
         deserialize(read, output.payload.seqValue.elements[i]);
       }
@@ -507,6 +676,13 @@ struct Serialization {
     ZoneText(c, strlen(c));
 #endif
 
+    if constexpr (std::is_same_v<BinaryWriter, SizeWriter>) {
+      if (input.valueType == SHType::Object || input.valueType == SHType::ShardRef || input.valueType == SHType::Wire) {
+        write.opaque = true;
+        return total;
+      }
+    }
+
     switch (input.valueType) {
     case SHType::None:
       break;
@@ -578,6 +754,12 @@ struct Serialization {
       uint32_t len = input.payload.seqValue.len;
       write((const uint8_t *)&len, sizeof(uint32_t));
       total += sizeof(uint32_t);
+      if (len >= BulkSeqThreshold) {
+        if (size_t bulk = serializeBulk(input.payload.seqValue, write)) {
+          total += bulk;
+          break;
+        }
+      }
       for (uint32_t i = 0; i < len; i++) {
         total += serialize(input.payload.seqValue.elements[i], write);
       }
@@ -778,6 +960,95 @@ struct Serialization {
     return total;
   }
 
+  // Turns output into a foreign view of the next size bytes of the reader
+  template <class BinaryReader> const uint8_t *viewInto(BinaryReader &read, SHVar &output, size_t size) {
+    const uint8_t *data = read.peek(size);
+    if (!data) {
+      throw std::runtime_error("Overflow requested");
+    }
+    read.skip(size);
+    SHType type = output.valueType;
+    destroyVar(output);
+    output.valueType = type;
+    output.flags |= SHVAR_FLAGS_FOREIGN;
+    return data;
+  }
+
+  // Writes a homogeneous sequence of blittable values as a single write
+  // the encoding is the same as the per element path, type tag followed by payload
+  // returns 0 if the sequence does not qualify and nothing was written
+  template <class BinaryWriter> size_t serializeBulk(const SHSeq &seq, BinaryWriter &write) {
+    SHType type = seq.elements[0].valueType;
+    size_t payloadSize = blittablePayloadSize(type);
+    if (payloadSize == 0)
+      return 0;
+    for (uint32_t i = 1; i < seq.len; i++) {
+      if (seq.elements[i].valueType != type)
+        return 0;
+    }
+
+    const size_t stride = sizeof(SHType) + payloadSize;
+    const size_t total = stride * seq.len;
+    if constexpr (std::is_same_v<BinaryWriter, SizeWriter>) {
+      write.size += total;
+    } else {
+      auto encode = [&](uint8_t *dst) {
+        for (uint32_t i = 0; i < seq.len; i++, dst += stride) {
+          dst[0] = uint8_t(type);
+          memcpy(dst + sizeof(SHType), &seq.elements[i].payload, payloadSize);
+        }
+      };
+      if constexpr (requires { write.claim(size_t{}); }) {
+        encode(write.claim(total));
+      } else {
+        pmr::vector<uint8_t> tmp(tempAllocator);
+        tmp.resize(total);
+        encode(tmp.data());
+        write(tmp.data(), total);
+      }
+    }
+    return total;
+  }
+
+  // Reads a homogeneous sequence of blittable values straight from the reader's memory
+  // returns false without consuming anything if the upcoming elements do not qualify
+  template <class BinaryReader> bool deserializeBulk(BinaryReader &read, SHSeq &seq) {
+    const uint8_t *head = read.peek(sizeof(SHType));
+    if (!head)
+      return false;
+    SHType type = SHType(head[0]);
+    size_t payloadSize = blittablePayloadSize(type);
+    if (payloadSize == 0)
+      return false;
+
+    const size_t stride = sizeof(SHType) + payloadSize;
+    const size_t total = stride * seq.len;
+    const uint8_t *src = read.peek(total);
+    if (!src)
+      return false;
+    for (uint32_t i = 0; i < seq.len; i++) {
+      if (SHType(src[i * stride]) != type)
+        return false;
+    }
+
+    for (uint32_t i = 0; i < seq.len; i++, src += stride) {
+      SHVar &dst = seq.elements[i];
+      // a previous view does not own its memory, never recycle it
+      if (dst.flags & SHVAR_FLAGS_FOREIGN) {
+        dst.flags &= ~SHVAR_FLAGS_FOREIGN;
+        dst.valueType = SHType::None;
+        memset(&dst.payload, 0x0, sizeof(SHVarPayload));
+      }
+      if (dst.valueType != type) {
+        destroyVar(dst);
+        dst.valueType = type;
+      }
+      memcpy(&dst.payload, src + sizeof(SHType), payloadSize);
+    }
+    read.skip(total);
+    return true;
+  }
+
   template <class BinaryReader> void deserialize(BinaryReader &read, SHTypeInfo &output) {
     read((uint8_t *)&output.basicType, sizeof(uint8_t));
     switch (output.basicType) {
@@ -0,0 +1,556 @@
+#ifndef A3F1C2D4_7B6E_4E1A_9C2D_5E8F0B1A2C3D
+#define A3F1C2D4_7B6E_4E1A_9C2D_5E8F0B1A2C3D
+
+#include "serialization.hpp"
+#include "hash.hpp"
+#include "type_info.hpp"
+#include <memory>
+#include <shared_mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Schema driven compact encoding
+//
+// Values are encoded following the composed type of the data (SHTypeInfo), when a type is fully known
+// no type tags are written, tables with fixed keys don't write their keys and integers are varints.
+// Whatever the schema cannot describe (Any, objects, wires, ...) falls back to the regular tagged encoding.
+//
+// Frame layout:
+//   u8 CompactMarker | u64 schema hash | u8 flags | [tagged SHTypeInfo if flags & EmbedsSchema] | payload
+// The marker is not a valid SHType so frames can be told apart from regular serialized values.
+
+namespace shards {
+
+struct CompactSchema {
+  enum class Kind : uint8_t {
+    Dynamic, // tagged fallback
+    Fixed,
+    Union,
+  };
+
+  struct Node {
+    Kind kind{Kind::Dynamic};
+    SHType type{SHType::None};
+    SHEnumTypeInfo enumeration{};
+    // Seq element / open table value node or union variants
+    std::vector<Node> children;
+    // Tables with fixed keys, children are in the same order
+    std::vector<OwnedVar> keys;
+  };
+
+  Node root;
+  uint64_t hash{};
+  // Tagged encoding of the source type, embedded in frames when the other side might not know it
+  std::vector<uint8_t> encodedType;
+
+  CompactSchema(const SHTypeInfo &type, uint64_t hash) : hash(hash) {
+    root = compile(type, 0);
+    Serialization s;
+    BufferRefWriter w(encodedType);
+    s.serialize(type, w);
+  }
+
+private:
+  // Deeply recursive types are left to the tagged encoding
+  static constexpr int MaxDepth = 32;
+
+  static Node dynamic() { return Node{}; }
+
+  static Node compileList(const SHTypesInfo &types, int depth) {
+    if (types.len == 0)
+      return dynamic();
+    if (types.len == 1)
+      return compile(types.elements[0], depth);
+
+    Node node;
+    node.kind = Kind::Union;
+    for (uint32_t i = 0; i < types.len; i++) {
+      auto &type = types.elements[i];
+      for (auto &other : node.children) {
+        // Variants are picked by their basic type, it must be unique
+        if (other.type == type.basicType)
+          return dynamic();
+      }
+      auto child = compile(type, depth);
+      if (child.kind == Kind::Dynamic)
+        return dynamic();
+      child.type = type.basicType;
+      node.children.emplace_back(std::move(child));
+    }
+    return node;
+  }
+
+  static Node compile(const SHTypeInfo &type, int depth) {
+    if (depth > MaxDepth || type.recursiveSelf)
+      return dynamic();
+
+    Node node;
+    node.kind = Kind::Fixed;
+    node.type = type.basicType;
+    switch (type.basicType) {
+    case SHType::None:
+    case SHType::Bool:
+    case SHType::Int:
+    case SHType::Int2:
+    case SHType::Int3:
+    case SHType::Int4:
+    case SHType::Int8:
+    case SHType::Int16:
+    case SHType::Float:
+    case SHType::Float2:
+    case SHType::Float3:
+    case SHType::Float4:
+    case SHType::Color:
+    case SHType::Bytes:
+    case SHType::String:
+    case SHType::Path:
+    case SHType::ContextVar:
+      break;
+    case SHType::Enum:
+      node.enumeration = type.enumeration;
+      break;
+    case SHType::Seq:
+      node.children.emplace_back(compileList(type.seqTypes, depth + 1));
+      break;
+    case SHType::Table: {
+      auto &keys = type.table.keys;
+      auto &types = type.table.types;
+      if (keys.len > 0 && keys.len == types.len) {
+        for (uint32_t i = 0; i < keys.len; i++) {
+          node.keys.emplace_back(keys.elements[i]);
+          node.children.emplace_back(compile(types.elements[i], depth + 1));
+        }
+      } else if (keys.len == 0) {
+        node.children.emplace_back(compileList(types, depth + 1));
+      } else {
+        return dynamic();
+      }
+      break;
+    }
+    default:
+      return dynamic();
+    }
+    return node;
+  }
+};
+
+// Process wide cache of the schemas of locally composed types by hash, schemas are immutable and identified by content
+struct CompactSchemaRegistry {
+  static CompactSchemaRegistry &instance() {
+    static CompactSchemaRegistry inst;
+    return inst;
+  }
+
+  std::shared_ptr<const CompactSchema> get(const SHTypeInfo &type) {
+    auto hash = deriveTypeHash64(type);
+    if (auto schema = find(hash))
+      return schema;
+    auto schema = std::make_shared<const CompactSchema>(type, hash);
+    std::unique_lock lock(_mutex);
+    return _schemas.emplace(hash, schema).first->second;
+  }
+
+  std::shared_ptr<const CompactSchema> find(uint64_t hash) {
+    std::shared_lock lock(_mutex);
+    auto it = _schemas.find(hash);
+    return it != _schemas.end() ? it->second : nullptr;
+  }
+
+private:
+  std::shared_mutex _mutex;
+  std::unordered_map<uint64_t, std::shared_ptr<const CompactSchema>> _schemas;
+};
+
+// Schemas received embedded in frames, kept apart from the registry so a sender cannot grow it without bounds
+// They live as long as the stream or connection they came with
+struct CompactSchemaScope {
+  // A sender only embeds the schemas of the types it composed, a stream with more of them is not a legit one
+  static constexpr size_t MaxSchemas = 1024;
+
+  std::shared_ptr<const CompactSchema> find(uint64_t hash) const {
+    auto it = _schemas.find(hash);
+    return it != _schemas.end() ? it->second : nullptr;
+  }
+
+  std::shared_ptr<const CompactSchema> add(const SHTypeInfo &type, uint64_t hash) {
+    if (auto schema = find(hash))
+      return schema;
+    if (_schemas.size() >= MaxSchemas)
+      throw shards::SHException("Too many compact schemas embedded in a single stream");
+    return _schemas.emplace(hash, std::make_shared<const CompactSchema>(type, hash)).first->second;
+  }
+
+  void clear() { _schemas.clear(); }
+  size_t size() const { return _schemas.size(); }
+
+private:
+  std::unordered_map<uint64_t, std::shared_ptr<const CompactSchema>> _schemas;
+};
+
+struct CompactSerialization {
+  static constexpr uint8_t CompactMarker = 0xC5;
+  static constexpr uint8_t EmbedsSchema = 0x1;
+
+  // Used for values the schema does not describe
+  Serialization tagged;
+
+  // Schemas already written to this stream, they are only embedded the first time
+  std::unordered_set<uint64_t> sentSchemas;
+  // Schemas embedded in the frames read from this stream
+  CompactSchemaScope receivedSchemas;
+
+  void reset() {
+    tagged.reset();
+    sentSchemas.clear();
+    receivedSchemas.clear();
+  }
+
+  template <class BinaryWriter>
+  void serialize(const SHVar &input, const CompactSchema &schema, BinaryWriter &write, bool embedSchema) {
+    write(&CompactMarker, 1);
+    write((const uint8_t *)&schema.hash, sizeof(uint64_t));
+    uint8_t flags = embedSchema ? EmbedsSchema : 0;
+    write(&flags, 1);
+    if (embedSchema)
+      write(schema.encodedType.data(), schema.encodedType.size());
+    encode(input, schema.root, write);
+  }
+
+  // Embeds the schema only the first time it is written through this instance
+  template <class BinaryWriter> void serializeOnce(const SHVar &input, const CompactSchema &schema, BinaryWriter &write) {
+    serialize(input, schema, write, sentSchemas.insert(schema.hash).second);
+  }
+
+  static bool isCompact(uint8_t firstByte) { return firstByte == CompactMarker; }
+
+  // Reads a compact frame, the marker is expected to be already consumed
+  template <class BinaryReader> void deserializeFrame(BinaryReader &read, SHVar &output) {
+    deserializeFrame(read, output, receivedSchemas);
+  }
+
+  // Same, embedded schemas are kept in scope instead, for streams that outlive this instance (a connection)
+  template <class BinaryReader> void deserializeFrame(BinaryReader &read, SHVar &output, CompactSchemaScope &scope) {
+    uint64_t hash;
+    read((uint8_t *)&hash, sizeof(uint64_t));
+    uint8_t flags;
+    read(&flags, 1);
+
+    // types composed locally are in the registry, only the ones coming from the other side end up in scope
+    auto schema = CompactSchemaRegistry::instance().find(hash);
+    if (!schema)
+      schema = scope.find(hash);
+    if (flags & EmbedsSchema) {
+      SHTypeInfo type{};
+      tagged.deserialize(read, type);
+      DEFER(freeDerivedInfo(type));
+      if (!schema) {
+        // a schema must not land under a hash that is not its own
+        if (deriveTypeHash64(type) != hash) {
+          throw shards::SHException("Embedded compact schema does not match its hash");
+        }
+        schema = scope.add(type, hash);
+      }
+    } else if (!schema) {
+      throw shards::SHException("Unknown compact schema, the sender must embed it or it must be registered");
+    }
+    decode(read, schema->root, output);
+  }
+
+  // Reads either a compact frame or a regular tagged value, the reader must support peek
+  template <class BinaryReader> void deserialize(BinaryReader &read, SHVar &output) {
+    const uint8_t *head = read.peek(1);
+    if (head && isCompact(*head)) {
+      read.skip(1);
+      deserializeFrame(read, output);
+    } else {
+      tagged.deserialize(read, output);
+    }
+  }
+
+private:
+  template <class BinaryWriter> static void writeVarint(BinaryWriter &write, uint64_t v) {
+    uint8_t buf[10];
+    size_t n = 0;
+    while (v >= 0x80) {
+      buf[n++] = uint8_t(v) | 0x80;
+      v >>= 7;
+    }
+    buf[n++] = uint8_t(v);
+    write(buf, n);
+  }
+
+  template <class BinaryReader> static uint64_t readVarint(BinaryReader &read) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      uint8_t b;
+      read(&b, 1);
+      v |= uint64_t(b & 0x7F) << shift;
+      if (!(b & 0x80))
+        return v;
+    }
+    throw shards::SHException("Invalid varint");
+  }
+
+  static uint64_t zigzag(int64_t v) { return (uint64_t(v) << 1) ^ uint64_t(v >> 63); }
+  static int64_t unzigzag(uint64_t v) { return int64_t(v >> 1) ^ -int64_t(v & 1); }
+
+  [[noreturn]] static void schemaMismatch(const SHVar &value, const CompactSchema::Node &node) {
+    throw shards::SHException(fmt::format("Value of type {} does not match the compact schema (expected {})",
+                                          type2Name(value.valueType), type2Name(node.type)));
+  }
+
+  template <class BinaryWriter> void encode(const SHVar &input, const CompactSchema::Node &node, BinaryWriter &write) {
+    using Kind = CompactSchema::Kind;
+    if (node.kind == Kind::Dynamic) {
+      tagged.serialize(input, write);
+      return;
+    }
+
+    if (node.kind == Kind::Union) {
+      for (size_t i = 0; i < node.children.size(); i++) {
+        if (node.children[i].type == input.valueType) {
+          writeVarint(write, i);
+          encode(input, node.children[i], write);
+          return;
+        }
+      }
+      schemaMismatch(input, node);
+    }
+
+    if (input.valueType != node.type)
+      schemaMismatch(input, node);
+
+    auto &p = input.payload;
+    switch (node.type) {
+    case SHType::None:
+      break;
+    case SHType::Bool:
+      write((const uint8_t *)&p.boolValue, sizeof(SHBool));
+      break;
+    case SHType::Enum:
+      writeVarint(write, zigzag(p.enumValue));
+      break;
+    case SHType::Int:
+      writeVarint(write, zigzag(p.intValue));
+      break;
+    case SHType::Int2:
+      for (int i = 0; i < 2; i++)
+        writeVarint(write, zigzag(p.int2Value[i]));
+      break;
+    case SHType::Int3:
+      for (int i = 0; i < 3; i++)
+        writeVarint(write, zigzag(p.int3Value[i]));
+      break;
+    case SHType::Int4:
+      for (int i = 0; i < 4; i++)
+        writeVarint(write, zigzag(p.int4Value[i]));
+      break;
+    case SHType::Int8:
+    case SHType::Int16:
+    case SHType::Float:
+    case SHType::Float2:
+    case SHType::Float3:
+    case SHType::Float4:
+    case SHType::Color:
+      write((const uint8_t *)&p, blittablePayloadSize(node.type));
+      break;
+    case SHType::Bytes:
+      writeVarint(write, p.bytesSize);
+      write(p.bytesValue, p.bytesSize);
+      break;
+    case SHType::String:
+    case SHType::Path:
+    case SHType::ContextVar: {
+      auto sv = SHSTRVIEW(input);
+      writeVarint(write, sv.size());
+      write((const uint8_t *)sv.data(), sv.size());
+      break;
+    }
+    case SHType::Seq: {
+      auto &seq = p.seqValue;
+      writeVarint(write, seq.len);
+      for (uint32_t i = 0; i < seq.len; i++)
+        encode(seq.elements[i], node.children[0], write);
+      break;
+    }
+    case SHType::Table: {
+      auto &t = p.tableValue;
+      if (!node.keys.empty()) {
+        // Presence bitmap followed by the values in schema order
+        pmr::vector<uint8_t> presence(tempAllocator());
+        presence.resize((node.keys.size() + 7) / 8);
+        size_t present = 0;
+        for (size_t i = 0; i < node.keys.size(); i++) {
+          if (t.api->tableContains(t, node.keys[i])) {
+            presence[i / 8] |= uint8_t(1 << (i % 8));
+            present++;
+          }
+        }
+        if (present != t.api->tableSize(t)) {
+          throw shards::SHException("Table has keys that are not part of the compact schema");
+        }
+        write(presence.data(), presence.size());
+        for (size_t i = 0; i < node.keys.size(); i++) {
+          if (presence[i / 8] & (1 << (i % 8)))
+            encode(*t.api->tableGet(t, node.keys[i]), node.children[i], write);
+        }
+      } else {
+        writeVarint(write, t.api->tableSize(t));
+        SHTableIterator tit;
+        t.api->tableGetIterator(t, &tit);
+        SHVar k;
+        SHVar v;
+        while (t.api->tableNext(t, &tit, &k, &v)) {
+          tagged.serialize(k, write);
+          encode(v, node.children[0], write);
+        }
+      }
+      break;
+    }
+    default:
+      schemaMismatch(input, node);
+    }
+  }
+
+  template <class BinaryReader> void decodeString(BinaryReader &read, SHStringPayload &output, bool recycle) {
+    uint32_t len = uint32_t(readVarint(read));
+    if (!recycle || output.cap < len) {
+      if (recycle)
+        delete[] output.elements;
+      output.elements = new char[len + 1];
+      output.cap = len;
+    }
+    output.len = len;
+    read((uint8_t *)output.elements, len);
+    const_cast<char *>(output.elements)[len] = 0;
+  }
+
+  template <class BinaryReader> void decode(BinaryReader &read, const CompactSchema::Node &node, SHVar &output) {
+    using Kind = CompactSchema::Kind;
+    if (node.kind == Kind::Dynamic) {
+      tagged.deserialize(read, output);
+      return;
+    }
+
+    if (node.kind == Kind::Union) {
+      auto index = readVarint(read);
+      if (index >= node.children.size()) {
+        throw shards::SHException("Invalid compact union variant");
+      }
+      decode(read, node.children[index], output);
+      return;
+    }
+
+    // a previous view does not own its memory, never recycle it
+    if (output.flags & SHVAR_FLAGS_FOREIGN) {
+      output.flags &= ~SHVAR_FLAGS_FOREIGN;
+      output.valueType = SHType::None;
+      memset(&output.payload, 0x0, sizeof(SHVarPayload));
+    }
+
+    bool recycle = output.valueType == node.type;
+    if (!recycle)
+      destroyVar(output);
+    output.valueType = node.type;
+
+    auto &p = output.payload;
+    switch (node.type) {
+    case SHType::None:
+      break;
+    case SHType::Bool:
+      read((uint8_t *)&p.boolValue, sizeof(SHBool));
+      break;
+    case SHType::Enum:
+      p.enumValue = SHEnum(unzigzag(readVarint(read)));
+      p.enumVendorId = node.enumeration.vendorId;
+      p.enumTypeId = node.enumeration.typeId;
+      break;
+    case SHType::Int:
+      p.intValue = unzigzag(readVarint(read));
+      break;
+    case SHType::Int2:
+      for (int i = 0; i < 2; i++)
+        p.int2Value[i] = unzigzag(readVarint(read));
+      break;
+    case SHType::Int3:
+      for (int i = 0; i < 3; i++)
+        p.int3Value[i] = int32_t(unzigzag(readVarint(read)));
+      break;
+    case SHType::Int4:
+      for (int i = 0; i < 4; i++)
+        p.int4Value[i] = int32_t(unzigzag(readVarint(read)));
+      break;
+    case SHType::Int8:
+    case SHType::Int16:
+    case SHType::Float:
+    case SHType::Float2:
+    case SHType::Float3:
+    case SHType::Float4:
+    case SHType::Color:
+      read((uint8_t *)&p, blittablePayloadSize(node.type));
+      break;
+    case SHType::Bytes: {
+      uint32_t size = uint32_t(readVarint(read));
+      if (!recycle || p.bytesCapacity < size) {
+        if (recycle)
+          delete[] p.bytesValue;
+        p.bytesValue = new uint8_t[size];
+        p.bytesCapacity = size;
+      }
+      p.bytesSize = size;
+      read(p.bytesValue, size);
+      break;
+    }
+    case SHType::String:
+    case SHType::Path:
+    case SHType::ContextVar:
+      decodeString(read, p.string, recycle);
+      break;
+    case SHType::Seq: {
+      uint32_t len = uint32_t(readVarint(read));
+      shards::arrayResize(p.seqValue, len);
+      for (uint32_t i = 0; i < len; i++)
+        decode(read, node.children[0], p.seqValue.elements[i]);
+      break;
+    }
+    case SHType::Table: {
+      SHMap *map = nullptr;
+      if (recycle && p.tableValue.api && p.tableValue.opaque) {
+        map = (SHMap *)p.tableValue.opaque;
+        map->clear();
+      } else {
+        map = new SHMap();
+        p.tableValue.api = &GetGlobals().TableInterface;
+        p.tableValue.opaque = map;
+      }
+
+      if (!node.keys.empty()) {
+        pmr::vector<uint8_t> presence(tempAllocator());
+        presence.resize((node.keys.size() + 7) / 8);
+        read(presence.data(), presence.size());
+        for (size_t i = 0; i < node.keys.size(); i++) {
+          if (presence[i / 8] & (1 << (i % 8)))
+            decode(read, node.children[i], (*map)[node.keys[i]]);
+        }
+      } else {
+        uint64_t len = readVarint(read);
+        for (uint64_t i = 0; i < len; i++) {
+          OwnedVar key{};
+          tagged.deserialize(read, key);
+          decode(read, node.children[0], (*map)[std::move(key)]);
+        }
+      }
+      break;
+    }
+    default:
+      throw shards::SHException("Unknown type during compact deserialization!");
+    }
+  }
+
+  pmr::PolymorphicAllocator<> tempAllocator() const { return tagged.tempAllocator; }
+};
+
+} // namespace shards
+
+#endif /* A3F1C2D4_7B6E_4E1A_9C2D_5E8F0B1A2C3D */
@@ -0,0 +1,200 @@
+#ifndef D81F4C27_3A9B_4E5D_B2C6_7F0E1A9D3B48
+#define D81F4C27_3A9B_4E5D_B2C6_7F0E1A9D3B48
+
+#include "serialization.hpp"
+#include <cstring>
+#include <vector>
+
+// Chunked streaming encoding
+//
+// Sequences and tables are written as a record made of bounded size chunks so neither the writer
+// nor the reader ever needs the whole serialized value in memory. Records are written back to back
+// and every chunk starts at an offset reading can be resumed from.
+//
+// Chunk layout:
+//   u8 ChunkMarker | u8 flags | u32 count | u32 payload size | payload
+// The payload is a regular serialized value: a Seq holding `count` elements of the record, a Table holding
+// `count` of its entries or, for any other value, the value itself. The last chunk of a record has
+// flags & LastChunk set.
+
+namespace shards {
+
+struct ChunkedSerialization {
+  static constexpr uint8_t ChunkMarker = 0xC7;
+  static constexpr uint8_t LastChunk = 0x1;
+  static constexpr size_t HeaderSize = 1 + 1 + sizeof(uint32_t) + sizeof(uint32_t);
+  static constexpr size_t DefaultChunkSize = 1 << 20;
+
+  struct Header {
+    uint8_t flags{};
+    uint32_t count{};
+    uint32_t size{};
+
+    bool last() const { return flags & LastChunk; }
+  };
+
+  Serialization serial;
+  // Chunks are flushed once their payload reaches this size, a single element can exceed it
+  size_t chunkSize{DefaultChunkSize};
+
+  // True while a record was started by write(..., last = false) and not ended yet
+  bool isRecordOpen() const { return _kind != SHType::None; }
+
+  // Writes input as part of the current record, starting one if needed
+  // Seq elements and Table entries are spread over chunks, other values are written as a single chunk record
+  // Pass last = false to keep the record open and continue it with more values of the same type
+  template <class BinaryWriter> void write(const SHVar &input, BinaryWriter &write, bool last = true) {
+    if (input.valueType != SHType::Seq && input.valueType != SHType::Table) {
+      if (isRecordOpen())
+        throw shards::SHException("Only a Seq or a Table can continue a chunked record");
+      _chunk.clear();
+      BufferRefWriter w(_chunk);
+      serial.serialize(input, w);
+      emit(write, 1, true);
+      return;
+    }
+
+    if (!isRecordOpen()) {
+      _kind = input.valueType;
+      begin();
+    } else if (_kind != input.valueType) {
+      throw shards::SHException(fmt::format("Chunked record of type {} cannot be continued with a value of type {}",
+                                            type2Name(_kind), type2Name(input.valueType)));
+    }
+
+    // keeps the pending elements of the record
+    BufferRefWriter w(_chunk, false);
+    if (input.valueType == SHType::Seq) {
+      auto &seq = input.payload.seqValue;
+      for (uint32_t i = 0; i < seq.len; i++) {
+        if (_count && _chunk.size() >= chunkSize)
+          flush(write, false);
+        serial.serialize(seq.elements[i], w);
+        _count++;
+      }
+    } else if (input.payload.tableValue.api && input.payload.tableValue.opaque) {
+      auto &t = input.payload.tableValue;
+      SHTableIterator tit;
+      t.api->tableGetIterator(t, &tit);
+      SHVar k;
+      SHVar v;
+      while (t.api->tableNext(t, &tit, &k, &v)) {
+        if (_count && _chunk.size() >= chunkSize)
+          flush(write, false);
+        serial.serialize(k, w);
+        serial.serialize(v, w);
+        _count++;
+      }
+    }
+
+    if (last)
+      endRecord(write);
+  }
+
+  // Ends the open record, if any
+  template <class BinaryWriter> void endRecord(BinaryWriter &write) {
+    if (!isRecordOpen())
+      return;
+    flush(write, true);
+    _kind = SHType::None;
+  }
+
+  // Drops a record left open, nothing is written
+  void reset() {
+    _kind = SHType::None;
+    _chunk.clear();
+    _count = 0;
+  }
+
+  // Reads the next chunk header, the reader is left on its payload
+  // Returns false without consuming anything if no complete chunk is available
+  template <class BinaryReader> bool readHeader(BinaryReader &read, Header &header) {
+    const uint8_t *head = read.peek(HeaderSize);
+    if (!head)
+      return false;
+    if (head[0] != ChunkMarker)
+      throw shards::SHException("Invalid chunk, not a chunked stream or wrong offset");
+    header.flags = head[1];
+    memcpy(&header.count, head + 2, sizeof(uint32_t));
+    memcpy(&header.size, head + 2 + sizeof(uint32_t), sizeof(uint32_t));
+    if (!read.peek(HeaderSize + header.size))
+      return false;
+    read.skip(HeaderSize);
+    return true;
+  }
+
+  // Deserializes the payload following readHeader, output is recycled like Serialization::deserialize
+  template <class BinaryReader> void readChunk(BinaryReader &read, SHVar &output) { serial.deserialize(read, output); }
+
+  // Appends the contents of a chunk to a whole record being reassembled
+  static void appendChunk(const SHVar &chunk, SHVar &record, bool first) {
+    if (first || record.valueType != chunk.valueType) {
+      cloneVar(record, chunk);
+      return;
+    }
+
+    if (chunk.valueType == SHType::Seq) {
+      auto &src = chunk.payload.seqValue;
+      auto &dst = record.payload.seqValue;
+      uint32_t offset = dst.len;
+      shards::arrayResize(dst, offset + src.len);
+      for (uint32_t i = 0; i < src.len; i++) {
+        cloneVar(dst.elements[offset + i], src.elements[i]);
+      }
+    } else if (chunk.valueType == SHType::Table) {
+      auto &src = chunk.payload.tableValue;
+      auto &dst = record.payload.tableValue;
+      SHTableIterator tit;
+      src.api->tableGetIterator(src, &tit);
+      SHVar k;
+      SHVar v;
+      while (src.api->tableNext(src, &tit, &k, &v)) {
+        cloneVar(*dst.api->tableAt(dst, k), v);
+      }
+    } else {
+      cloneVar(record, chunk);
+    }
+  }
+
+private:
+  SHType _kind{SHType::None};
+  uint32_t _count{};
+  std::vector<uint8_t> _chunk;
+
+  // Leaves room for the container header, patched once the element count is known
+  void begin() {
+    _chunk.clear();
+    _count = 0;
+    _chunk.push_back(uint8_t(_kind));
+    _chunk.resize(_kind == SHType::Seq ? 1 + sizeof(uint32_t) : 1 + sizeof(uint64_t));
+  }
+
+  template <class BinaryWriter> void flush(BinaryWriter &write, bool last) {
+    if (_kind == SHType::Seq) {
+      uint32_t len = _count;
+      memcpy(_chunk.data() + 1, &len, sizeof(uint32_t));
+    } else {
+      uint64_t len = _count;
+      memcpy(_chunk.data() + 1, &len, sizeof(uint64_t));
+    }
+    emit(write, _count, last);
+    begin();
+  }
+
+  template <class BinaryWriter> void emit(BinaryWriter &write, uint32_t count, bool last) {
+    if (_chunk.size() > UINT32_MAX)
+      throw shards::SHException("Chunk too large, a single element exceeds 4GB");
+    uint8_t header[HeaderSize];
+    uint32_t size = uint32_t(_chunk.size());
+    header[0] = ChunkMarker;
+    header[1] = last ? LastChunk : 0;
+    memcpy(header + 2, &count, sizeof(uint32_t));
+    memcpy(header + 2 + sizeof(uint32_t), &size, sizeof(uint32_t));
+    write(header, HeaderSize);
+    write(_chunk.data(), _chunk.size());
+  }
+};
+
+} // namespace shards
+
+#endif /* D81F4C27_3A9B_4E5D_B2C6_7F0E1A9D3B48 */
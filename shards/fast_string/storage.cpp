@@ -1,18 +1,31 @@
 #include "storage.hpp"
-#include <shared_mutex>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <memory>
 #include <mutex>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
 #include <boost/container/pmr/monotonic_buffer_resource.hpp>
-#include <boost/container/pmr/polymorphic_allocator.hpp>
-#include <boost/container/flat_map.hpp>
-#include <boost/container/stable_vector.hpp>
-#include <boost/container/allocator.hpp>
-#include <boost/container/scoped_allocator.hpp>
+#include <boost/container/pmr/global_resource.hpp>
 #include <tracy/Wrapper.hpp>
 
 namespace shards::fast_string {
 
-static constexpr size_t Megabyte = 1 << 20;
-static constexpr size_t InitialPoolSize = Megabyte * 8;
+static constexpr size_t Kilobyte = 1 << 10;
+static constexpr size_t InitialShardPoolSize = Kilobyte * 128;
+
+// Strings are spread over shards by hash, each shard is guarded by its own write lock
+// lookups (both by string and by id) never lock
+static constexpr size_t ShardBits = 6;
+static constexpr size_t NumShards = size_t(1) << ShardBits;
+static constexpr size_t InitialTableSize = 256;
+
+// id -> entry lookup table, chunks are allocated on demand and never move
+static constexpr size_t ChunkBits = 12;
+static constexpr size_t ChunkSize = size_t(1) << ChunkBits;
+static constexpr size_t MaxChunks = size_t(1) << 12;
 
 using Alloc = boost::container::pmr::monotonic_buffer_resource;
 struct CountingAllocator : public boost::container::pmr::memory_resource {
@@ -30,75 +43,141 @@ struct CountingAllocator : public boost::container::pmr::memory_resource {
   __attribute__((always_inline)) bool do_is_equal(const memory_resource &_That) const noexcept override { return &_That == this; }
 };
 
-struct KeyLess {
-  using is_transparent = std::true_type;
-  template <typename T, typename U> bool operator()(const T &a, const U &b) const {
-    return std::string_view(a) < std::string_view(b);
-  }
+// Immutable once published, the null terminated string data follows the header
+struct Entry {
+  size_t hash;
+  uint64_t id;
+  size_t length;
+
+  const char *data() const { return reinterpret_cast<const char *>(this + 1); }
+  std::string_view view() const { return std::string_view(data(), length); }
 };
 
-struct Pool {
-  using Pair = std::pair<std::string, uint64_t>;
+// Open addressing hash table, slots are only ever filled, never cleared
+struct Table {
+  size_t mask;
+  std::unique_ptr<std::atomic<Entry *>[]> slots;
 
-  using MapAllocator = boost::container::pmr::polymorphic_allocator<Pair>;
-  using SvAllocator = boost::container::pmr::polymorphic_allocator<std::string_view>;
+  Table(size_t size) : mask(size - 1), slots(new std::atomic<Entry *>[size]{}) {}
 
-  Alloc allocator;
-  CountingAllocator countingAllocator;
-  boost::container::flat_map<std::string, uint64_t, KeyLess, boost::container::stable_vector<Pair, MapAllocator>> map;
-  boost::container::vector<std::string_view, SvAllocator> reverse;
-  std::shared_mutex lock;
+  size_t size() const { return mask + 1; }
 
-  Pool()
-      : allocator(InitialPoolSize, boost::container::pmr::new_delete_resource()), countingAllocator(&allocator),
-        map(&countingAllocator), reverse(&countingAllocator) {}
+  Entry *find(std::string_view str, size_t hash) const {
+    for (size_t i = (hash >> ShardBits) & mask;; i = (i + 1) & mask) {
+      Entry *entry = slots[i].load(std::memory_order_acquire);
+      if (!entry)
+        return nullptr;
+      if (entry->hash == hash && entry->view() == str)
+        return entry;
+    }
+  }
+
+  void insert(Entry *entry) {
+    for (size_t i = (entry->hash >> ShardBits) & mask;; i = (i + 1) & mask) {
+      if (!slots[i].load(std::memory_order_relaxed)) {
+        slots[i].store(entry, std::memory_order_release);
+        return;
+      }
+    }
+  }
 };
 
-struct Storage {
-  Pool pool;
+struct alignas(64) Shard {
+  std::atomic<Table *> table;
+  // Current and retired tables, readers might still be probing retired ones
+  std::vector<std::unique_ptr<Table>> tables;
+  std::atomic<Entry **> chunks[MaxChunks]{};
+  size_t count{};
 
-  template <typename F> auto write(F callback) {
-    std::unique_lock<std::shared_mutex> lock(pool.lock);
-    return callback(lock);
-  }
+  Alloc allocator;
+  CountingAllocator countingAllocator;
+  std::mutex lock;
 
-  template <typename F> auto read(F callback) {
-    std::shared_lock<std::shared_mutex> lock(pool.lock);
-    return callback(lock);
+  Shard()
+      : allocator(InitialShardPoolSize, boost::container::pmr::new_delete_resource()), countingAllocator(&allocator) {
+    table = tables.emplace_back(std::make_unique<Table>(InitialTableSize)).get();
   }
+};
+
+struct Storage {
+  Shard shards[NumShards];
+  std::atomic_size_t totalRequestedBytes{};
 
   uint64_t store(std::string_view str) {
-    return read([&](auto &readLock) -> uint64_t {
-      auto it = pool.map.find(str);
-      if (it != pool.map.end()) {
-        return it->second;
-      } else {
-        readLock.unlock();
-        return write([&](auto &writeLock) -> uint64_t {
-          auto it = pool.map.find(str);
-          if (it != pool.map.end()) {
-            // Double check to make sure it wasn't added in the meantime
-            return it->second;
-          } else {
-            size_t index = pool.reverse.size();
-            auto it = pool.map.emplace(std::string(str), index).first;
-            pool.reverse.emplace_back(it->first);
-
-            TracyPlot("FastString memory", int64_t(pool.countingAllocator.totalRequestedBytes));
-            return (uint64_t)index;
-          }
-        });
-      }
-    });
+    size_t hash = std::hash<std::string_view>{}(str);
+    size_t shardIndex = hash & (NumShards - 1);
+    Shard &shard = shards[shardIndex];
+
+    if (Entry *entry = shard.table.load(std::memory_order_acquire)->find(str, hash))
+      return entry->id;
+
+    std::unique_lock<std::mutex> lock(shard.lock);
+
+    // Double check to make sure it wasn't added in the meantime
+    Table *table = shard.table.load(std::memory_order_relaxed);
+    if (Entry *entry = table->find(str, hash))
+      return entry->id;
+
+    size_t index = shard.count;
+    if ((index >> ChunkBits) >= MaxChunks) {
+      throw std::runtime_error("Fast string storage exhausted");
+    }
+
+    if ((index + 1) * 2 > table->size()) {
+      table = grow(shard, table);
+    }
+
+    size_t allocatedBefore = shard.countingAllocator.totalRequestedBytes;
+
+    auto &chunk = shard.chunks[index >> ChunkBits];
+    Entry **chunkData = chunk.load(std::memory_order_relaxed);
+    if (!chunkData) {
+      chunkData = static_cast<Entry **>(shard.countingAllocator.allocate(sizeof(Entry *) * ChunkSize, alignof(Entry *)));
+      std::memset(chunkData, 0, sizeof(Entry *) * ChunkSize);
+      chunk.store(chunkData, std::memory_order_release);
+    }
+
+    void *mem = shard.countingAllocator.allocate(sizeof(Entry) + str.size() + 1, alignof(Entry));
+    Entry *entry = new (mem) Entry{hash, (uint64_t(index) << ShardBits) | shardIndex, str.size()};
+    char *data = const_cast<char *>(entry->data());
+    std::memcpy(data, str.data(), str.size());
+    data[str.size()] = 0;
+
+    // Publish to the id lookup before the hash table, anyone who can find the entry must be able to load it
+    chunkData[index & (ChunkSize - 1)] = entry;
+    table->insert(entry);
+    shard.count++;
+
+    size_t allocated = shard.countingAllocator.totalRequestedBytes - allocatedBefore;
+    TracyPlot("FastString memory", int64_t(totalRequestedBytes.fetch_add(allocated) + allocated));
+
+    return entry->id;
   }
 
   std::string_view load(uint64_t id) {
-    return read([&](auto &readLock) {
-      if (id >= pool.reverse.size()) {
-        throw std::logic_error("Invalid fast string");
-      }
-      return pool.reverse[id];
-    });
+    Shard &shard = shards[id & (NumShards - 1)];
+    uint64_t index = id >> ShardBits;
+    if ((index >> ChunkBits) >= MaxChunks) {
+      throw std::logic_error("Invalid fast string");
+    }
+    Entry **chunkData = shard.chunks[index >> ChunkBits].load(std::memory_order_acquire);
+    Entry *entry = chunkData ? chunkData[index & (ChunkSize - 1)] : nullptr;
+    if (!entry) {
+      throw std::logic_error("Invalid fast string");
+    }
+    return entry->view();
+  }
+
+private:
+  // Called with the shard lock held
+  Table *grow(Shard &shard, Table *current) {
+    auto &table = shard.tables.emplace_back(std::make_unique<Table>(current->size() * 2));
+    for (size_t i = 0; i < current->size(); i++) {
+      if (Entry *entry = current->slots[i].load(std::memory_order_relaxed))
+        table->insert(entry);
+    }
+    shard.table.store(table.get(), std::memory_order_release);
+    return table.get();
   }
 };
 
@@ -117,4 +196,4 @@ std::string_view load(uint64_t id) {
   ZoneScopedN("fast_string::load");
   return storage->load(id);
 }
-} // namespace shards::fast_string
\ No newline at end of file
+} // namespace shards::fast_string
@@ -1,6 +1,12 @@
 #include <catch2/catch_all.hpp>
 #include <shards/fast_string/fast_string.hpp>
 #include <unordered_map>
+#include <spdlog/spdlog.h>
+#include <spdlog/fmt/fmt.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
 
 using String = shards::fast_string::FastString;
 TEST_CASE("Fast string", "[FastString]") {
@@ -43,4 +49,67 @@ TEST_CASE("Fast string", "[FastString]") {
   hashMap[""] = "empty";
   CHECK(hashMap.size() == 3);
   CHECK(hashMap[empty] == "empty");
-}
\ No newline at end of file
+}
+TEST_CASE("Fast string concurrent interning", "[FastString]") {
+  shards::fast_string::init();
+
+  constexpr size_t NumThreads = 8;
+  constexpr size_t NumStrings = 4096;
+
+  std::vector<std::vector<uint64_t>> ids(NumThreads);
+  std::vector<std::thread> threads;
+  for (size_t t = 0; t < NumThreads; t++) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = 0; i < NumStrings; i++) {
+        String str = fmt::format("concurrent-{}", i);
+        ids[t].push_back(str.id);
+      }
+    });
+  }
+  for (auto &thread : threads)
+    thread.join();
+
+  // Every thread must have gotten the same id for the same string
+  for (size_t t = 1; t < NumThreads; t++) {
+    CHECK(ids[t] == ids[0]);
+  }
+
+  for (size_t i = 0; i < NumStrings; i++) {
+    String str;
+    str.id = ids[0][i];
+    CHECK(str.str() == fmt::format("concurrent-{}", i));
+  }
+
+  CHECK_THROWS(shards::fast_string::load(~uint64_t(0) - 1));
+}
+
+// Interning throughput under contention, run explicitly with [benchmark]
+TEST_CASE("Fast string contention", "[.][benchmark][FastString]") {
+  shards::fast_string::init();
+
+  constexpr size_t NumOps = 1 << 20;
+  constexpr size_t NumUnique = 1 << 14;
+
+  std::vector<std::string> strings;
+  for (size_t i = 0; i < NumUnique; i++) {
+    strings.push_back(fmt::format("bench/shader/field-{}", i));
+  }
+
+  for (size_t numThreads : {1, 2, 4, 8, 16, 32}) {
+    auto start = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < numThreads; t++) {
+      threads.emplace_back([&, t]() {
+        size_t opsPerThread = NumOps / numThreads;
+        for (size_t i = 0; i < opsPerThread; i++) {
+          String str = strings[(i * 7919 + t) % NumUnique];
+          (void)str;
+        }
+      });
+    }
+    for (auto &thread : threads)
+      thread.join();
+    auto duration = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    SPDLOG_INFO("FastString {} threads: {:.2f} Mops/s", numThreads, double(NumOps) / duration / 1e6);
+  }
+}
@@ -4,14 +4,23 @@
 #include <shards/core/module.hpp>
 #include <shards/core/shared.hpp>
 #include <shards/core/runtime.hpp>
+#include <shards/core/params.hpp>
 #include <brotli/decode.h>
 #include <brotli/encode.h>
 
+// custom dictionaries were added in brotli 1.1
+#if __has_include(<brotli/shared_dictionary.h>)
+#define SH_BROTLI_DICTIONARY 1
+#else
+#define SH_BROTLI_DICTIONARY 0
+#endif
+
 namespace shards {
 namespace Brotli {
 struct Compress {
   std::vector<uint8_t> _buffer;
   int _quality{BROTLI_DEFAULT_QUALITY};
+  int _window{BROTLI_DEFAULT_WINDOW};
 
   static SHOptionalString help() {
     return SHCCSTR("This shard compresses the input byte array using the Brotli algorithm and outputs the smaller compressed "
@@ -27,24 +36,43 @@ struct Compress {
   static SHTypesInfo outputTypes() { return CoreInfo::BytesType; }
 
   static inline Parameters params{{"Quality",
-                                   SHCCSTR("Compression quality, higher is better but slower, valid values "
-                                           "from 1 to 11."),
-                                   {CoreInfo::IntType}}};
+                                    SHCCSTR("Compression quality, higher is better but slower, valid values "
+                                            "from 1 to 11."),
+                                    {CoreInfo::IntType}},
+                                   {"Window",
+                                    SHCCSTR("The base 2 logarithm of the sliding window size, valid values from 10 to 24. "
+                                            "Larger windows find matches further back at the cost of memory."),
+                                    {CoreInfo::IntType}}};
 
   SHParametersInfo parameters() { return params; }
 
   void setParam(int index, const SHVar &value) {
-    _quality = int(value.payload.intValue);
-    _quality = std::clamp(_quality, 1, 11);
+    switch (index) {
+    case 0:
+      _quality = std::clamp(int(value.payload.intValue), 1, 11);
+      break;
+    case 1:
+      _window = std::clamp(int(value.payload.intValue), BROTLI_MIN_WINDOW_BITS, BROTLI_MAX_WINDOW_BITS);
+      break;
+    }
   }
 
-  SHVar getParam(int index) { return Var(_quality); }
+  SHVar getParam(int index) {
+    switch (index) {
+    case 0:
+      return Var(_quality);
+    case 1:
+      return Var(_window);
+    default:
+      return Var::Empty;
+    }
+  }
 
   SHVar activate(SHContext *context, const SHVar &input) {
     auto maxLen = BrotliEncoderMaxCompressedSize(input.payload.bytesSize);
     _buffer.resize(maxLen + sizeof(uint32_t));
     size_t outputLen = maxLen;
-    auto res = BrotliEncoderCompress(_quality, BROTLI_DEFAULT_WINDOW, BROTLI_DEFAULT_MODE, input.payload.bytesSize,
+    auto res = BrotliEncoderCompress(_quality, _window, BROTLI_DEFAULT_MODE, input.payload.bytesSize,
                                      input.payload.bytesValue, &outputLen, &_buffer[sizeof(uint32_t)]);
     if (res != BROTLI_TRUE) {
       throw ActivationError("Failed to compress");
@@ -102,9 +130,240 @@ struct Decompress {
   }
 };
 
+// Streaming variants keep their encoder/decoder state across activations, the history of previous chunks is
+// used to compress the next ones, which makes a stream of small similar messages compress much better
+struct CompressStream {
+  static SHOptionalString help() {
+    return SHCCSTR("Compresses a stream of byte arrays chunk by chunk using the Brotli algorithm, keeping the encoder around "
+                   "between activations. Outputs the compressed bytes produced by each chunk, to be concatenated or sent in "
+                   "order to Brotli.DecompressStream.");
+  }
+  static SHOptionalString inputHelp() { return SHCCSTR("The next chunk of the stream."); }
+  static SHOptionalString outputHelp() {
+    return SHCCSTR("The compressed bytes produced so far, might be empty if Flush is false.");
+  }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::BytesType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::BytesType; }
+
+  PARAM_VAR(_quality, "Quality", "Compression quality, higher is better but slower, valid values from 0 to 11.",
+            {CoreInfo::IntType});
+  PARAM_VAR(_window, "Window",
+            "The base 2 logarithm of the sliding window size, valid values from 10 to 24. Larger windows find matches "
+            "further back in the stream at the cost of memory.",
+            {CoreInfo::IntType});
+  PARAM_VAR(_dictionary, "Dictionary",
+            "Data both sides know in advance, messages similar to it compress much better. Brotli.DecompressStream must use "
+            "the same dictionary.",
+            {CoreInfo::NoneType, CoreInfo::BytesType});
+  PARAM_VAR(_flush, "Flush",
+            "If each chunk should be fully output right away so it can be decompressed on its own, as needed when chunks "
+            "are sent as network messages. Otherwise the encoder keeps data back to compress better.",
+            {CoreInfo::BoolType});
+  PARAM_PARAMVAR(_finish, "Finish", "If this chunk ends the stream, the next chunk starts a new one.",
+                 {CoreInfo::BoolType, CoreInfo::BoolVarType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_quality), PARAM_IMPL_FOR(_window), PARAM_IMPL_FOR(_dictionary), PARAM_IMPL_FOR(_flush),
+             PARAM_IMPL_FOR(_finish));
+
+  CompressStream() {
+    _quality = Var(BROTLI_DEFAULT_QUALITY);
+    _window = Var(BROTLI_DEFAULT_WINDOW);
+    _flush = Var(true);
+    _finish = Var(false);
+  }
+
+  BrotliEncoderState *_state{};
+#if SH_BROTLI_DICTIONARY
+  BrotliEncoderPreparedDictionary *_prepared{};
+#endif
+  std::vector<uint8_t> _buffer;
+
+  void destroy() { destroyState(); }
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) {
+    destroyState();
+    PARAM_CLEANUP(context);
+  }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(const SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+#if !SH_BROTLI_DICTIONARY
+    if (_dictionary->valueType == SHType::Bytes)
+      throw ComposeError("Brotli.CompressStream, Dictionary is not supported by this version of brotli");
+#endif
+    return outputTypes().elements[0];
+  }
+
+  void createState() {
+    _state = BrotliEncoderCreateInstance(nullptr, nullptr, nullptr);
+    if (!_state)
+      throw ActivationError("Brotli.CompressStream, failed to create the encoder");
+    BrotliEncoderSetParameter(_state, BROTLI_PARAM_QUALITY,
+                              uint32_t(std::clamp(int(_quality->payload.intValue), BROTLI_MIN_QUALITY, BROTLI_MAX_QUALITY)));
+    BrotliEncoderSetParameter(
+        _state, BROTLI_PARAM_LGWIN,
+        uint32_t(std::clamp(int(_window->payload.intValue), BROTLI_MIN_WINDOW_BITS, BROTLI_MAX_WINDOW_BITS)));
+#if SH_BROTLI_DICTIONARY
+    if (_dictionary->valueType == SHType::Bytes) {
+      // prepared once, the hashing of the dictionary is the expensive part
+      if (!_prepared) {
+        _prepared = BrotliEncoderPrepareDictionary(BROTLI_SHARED_DICTIONARY_RAW, _dictionary->payload.bytesSize,
+                                                   _dictionary->payload.bytesValue, BROTLI_MAX_QUALITY, nullptr, nullptr,
+                                                   nullptr);
+      }
+      if (!_prepared || !BrotliEncoderAttachPreparedDictionary(_state, _prepared))
+        throw ActivationError("Brotli.CompressStream, failed to use the dictionary");
+    }
+#endif
+  }
+
+  void destroyState() {
+    if (_state) {
+      BrotliEncoderDestroyInstance(_state);
+      _state = nullptr;
+    }
+#if SH_BROTLI_DICTIONARY
+    if (_prepared) {
+      BrotliEncoderDestroyPreparedDictionary(_prepared);
+      _prepared = nullptr;
+    }
+#endif
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    if (!_state)
+      createState();
+
+    bool finish = _finish.get().payload.boolValue;
+    auto op = finish ? BROTLI_OPERATION_FINISH : _flush->payload.boolValue ? BROTLI_OPERATION_FLUSH : BROTLI_OPERATION_PROCESS;
+    size_t availIn = input.payload.bytesSize;
+    const uint8_t *nextIn = input.payload.bytesValue;
+    _buffer.clear();
+    while (true) {
+      // output is taken straight from the encoder's own buffer
+      size_t availOut = 0;
+      uint8_t *nextOut = nullptr;
+      if (!BrotliEncoderCompressStream(_state, op, &availIn, &nextIn, &availOut, &nextOut, nullptr)) {
+        destroyState();
+        throw ActivationError("Brotli.CompressStream, failed to compress");
+      }
+      size_t size = 0;
+      const uint8_t *out = BrotliEncoderTakeOutput(_state, &size);
+      _buffer.insert(_buffer.end(), out, out + size);
+      if (availIn == 0 && !BrotliEncoderHasMoreOutput(_state) &&
+          (op != BROTLI_OPERATION_FINISH || BrotliEncoderIsFinished(_state)))
+        break;
+    }
+
+    if (finish) {
+      BrotliEncoderDestroyInstance(_state);
+      _state = nullptr;
+    }
+    return Var(_buffer.data(), uint32_t(_buffer.size()));
+  }
+};
+
+struct DecompressStream {
+  static SHOptionalString help() {
+    return SHCCSTR("Decompresses a Brotli stream chunk by chunk, keeping the decoder around between activations. Chunks can "
+                   "be split anywhere, streams following each other are decoded one after the other.");
+  }
+  static SHOptionalString inputHelp() { return SHCCSTR("The next chunk of compressed bytes."); }
+  static SHOptionalString outputHelp() { return SHCCSTR("The bytes decompressed from the chunk, might be empty."); }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::BytesType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::BytesType; }
+
+  PARAM_VAR(_dictionary, "Dictionary", "The dictionary the stream was compressed with, if any.",
+            {CoreInfo::NoneType, CoreInfo::BytesType});
+  PARAM_VAR(_maxSize, "MaxSize", "The maximum size a single chunk can decompress to, guards against corrupted data.",
+            {CoreInfo::IntType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_dictionary), PARAM_IMPL_FOR(_maxSize));
+
+  DecompressStream() { _maxSize = Var(1 << 30); }
+
+  BrotliDecoderState *_state{};
+  std::vector<uint8_t> _buffer;
+
+  void destroy() { destroyState(); }
+  void cleanup(SHContext *context) { destroyState(); }
+
+  SHTypeInfo compose(const SHInstanceData &data) {
+#if !SH_BROTLI_DICTIONARY
+    if (_dictionary->valueType == SHType::Bytes)
+      throw ComposeError("Brotli.DecompressStream, Dictionary is not supported by this version of brotli");
+#endif
+    return outputTypes().elements[0];
+  }
+
+  void createState() {
+    _state = BrotliDecoderCreateInstance(nullptr, nullptr, nullptr);
+    if (!_state)
+      throw ActivationError("Brotli.DecompressStream, failed to create the decoder");
+#if SH_BROTLI_DICTIONARY
+    if (_dictionary->valueType == SHType::Bytes &&
+        !BrotliDecoderAttachDictionary(_state, BROTLI_SHARED_DICTIONARY_RAW, _dictionary->payload.bytesSize,
+                                       _dictionary->payload.bytesValue))
+      throw ActivationError("Brotli.DecompressStream, failed to use the dictionary");
+#endif
+  }
+
+  void destroyState() {
+    if (_state) {
+      BrotliDecoderDestroyInstance(_state);
+      _state = nullptr;
+    }
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    if (!_state)
+      createState();
+
+    size_t maxSize = size_t(_maxSize->payload.intValue);
+    size_t availIn = input.payload.bytesSize;
+    const uint8_t *nextIn = input.payload.bytesValue;
+    _buffer.clear();
+    while (true) {
+      size_t availOut = 0;
+      uint8_t *nextOut = nullptr;
+      auto res = BrotliDecoderDecompressStream(_state, &availIn, &nextIn, &availOut, &nextOut, nullptr);
+      size_t size = 0;
+      const uint8_t *out = BrotliDecoderTakeOutput(_state, &size);
+      if (_buffer.size() + size > maxSize) {
+        destroyState();
+        throw ActivationError("Brotli.DecompressStream, chunk decompresses past MaxSize, possibly corrupted data");
+      }
+      _buffer.insert(_buffer.end(), out, out + size);
+
+      if (res == BROTLI_DECODER_RESULT_ERROR) {
+        auto error = BrotliDecoderErrorString(BrotliDecoderGetErrorCode(_state));
+        destroyState();
+        throw ActivationError(fmt::format("Brotli.DecompressStream, failed to decompress: {}", error));
+      } else if (res == BROTLI_DECODER_RESULT_SUCCESS) {
+        // the stream ended, whatever follows starts a new one
+        destroyState();
+        if (availIn == 0)
+          break;
+        createState();
+      } else if (res == BROTLI_DECODER_RESULT_NEEDS_MORE_INPUT) {
+        break;
+      }
+    }
+
+    // easy fix for null term strings
+    auto len = _buffer.size();
+    _buffer.push_back(0);
+    return Var(_buffer.data(), uint32_t(len));
+  }
+};
+
 } // namespace Brotli
 SHARDS_REGISTER_FN(brotli) {
   REGISTER_SHARD("Brotli.Compress", Brotli::Compress);
   REGISTER_SHARD("Brotli.Decompress", Brotli::Decompress);
+  REGISTER_SHARD("Brotli.CompressStream", Brotli::CompressStream);
+  REGISTER_SHARD("Brotli.DecompressStream", Brotli::DecompressStream);
 }
 } // namespace shards
@@ -9,10 +9,13 @@ SHARDS_REGISTER_FN(flow) {
   REGISTER_SHARD("Cond", Cond);
   REGISTER_SHARD("Maybe", Maybe);
   REGISTER_SHARD("Await", Await);
+  REGISTER_SHARD("Await.Stats", AwaitStats);
   REGISTER_SHARD("When", When<true>);
   REGISTER_SHARD("WhenNot", When<false>);
   REGISTER_SHARD("If", IfBlock);
   REGISTER_SHARD("Match", Match);
   REGISTER_SHARD("SubFlow", Sub);
+
+  REGISTER_ENUM(AwaitPriorityEnumInfo);
 }
 }; // namespace shards
@@ -466,6 +466,9 @@ private:
                                      {CoreInfo::BoolType}}}};
 };
 
+DECL_ENUM_INFO(WorkPriority, AwaitPriority,
+               "Scheduling class of asynchronous work. Higher classes are always picked up by the worker pool first.", 'awPr');
+
 struct Await : public BaseSubFlow {
   static SHOptionalString help() {
     return SHCCSTR("Executes a shard or a sequence of shards asynchronously "
@@ -477,10 +480,37 @@ struct Await : public BaseSubFlow {
   OwnedVar _output;
   std::mutex mutex;
   bool _alreadyOnWorker{};
+  WorkPriority _priority{WorkPriority::Normal};
+  double _deadline{0.0};
 
-  void setParam(int index, const SHVar &value) { _shards = value; }
+  void setParam(int index, const SHVar &value) {
+    switch (index) {
+    case 0:
+      _shards = value;
+      break;
+    case 1:
+      _priority = WorkPriority(value.payload.enumValue);
+      break;
+    case 2:
+      _deadline = value.payload.floatValue;
+      break;
+    default:
+      throw InvalidParameterIndex();
+    }
+  }
 
-  SHVar getParam(int index) { return _shards; }
+  SHVar getParam(int index) {
+    switch (index) {
+    case 0:
+      return _shards;
+    case 1:
+      return Var::Enum(_priority, AwaitPriorityEnumInfo::Type);
+    case 2:
+      return Var(_deadline);
+    default:
+      throw InvalidParameterIndex();
+    }
+  }
 
   SHTypeInfo compose(const SHInstanceData &data) {
     if (data.onWorkerThread) {
@@ -556,7 +586,11 @@ struct Await : public BaseSubFlow {
           _shards.activate(&*_context, inputCopy, output);
           return output;
         },
-        [] {});
+        [&] {
+          // the wire stopped while our shards are running, let them bail out cooperatively
+          _context->stopFlow();
+        },
+        options());
 
     // need to replicate things that happened in the context
     if (!_context->shouldContinue()) {
@@ -566,6 +600,61 @@ struct Await : public BaseSubFlow {
 
     return _output;
   }
+
+private:
+  AwaitOptions options() const {
+    AwaitOptions opts{};
+    opts.priority = _priority;
+    opts.deadline = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::duration<double>(_deadline));
+    return opts;
+  }
+
+  static inline Parameters _params{
+      BaseSubFlow::_params,
+      {{"Priority",
+        SHCCSTR("The scheduling class of the work, higher classes are served first by the worker pool."),
+        {AwaitPriorityEnumInfo::Type}},
+       {"Deadline",
+        SHCCSTR("The maximum time in seconds the work may wait in the queue before starting. If exceeded the work is "
+                "not run and this shard fails. 0 means no deadline."),
+        {CoreInfo::FloatType}}}};
+};
+
+struct AwaitStats {
+  static SHOptionalString help() {
+    return SHCCSTR("Outputs the asynchronous worker pool statistics for each priority class: the number of scheduled, "
+                   "started, expired and cancelled works and the average and maximum queue wait time in seconds.");
+  }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHOptionalString inputHelp() { return DefaultHelpText::InputHelpIgnored; }
+
+  static SHTypesInfo outputTypes() { return CoreInfo::AnyTableType; }
+  static SHOptionalString outputHelp() { return SHCCSTR("A table of statistics keyed by priority class name."); }
+
+  TableVar _output{};
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+#if HAS_ASYNC_SUPPORT
+    static constexpr std::array<const char *, TidePool::NumPriorities> names{"Low", "Normal", "High", "Critical"};
+    auto &pool = getTidePool();
+    for (size_t i = 0; i < TidePool::NumPriorities; i++) {
+      auto &stats = pool.stats(WorkPriority(i));
+      auto started = stats.started.load(std::memory_order_relaxed);
+      auto expired = stats.expired.load(std::memory_order_relaxed);
+      auto dequeued = started + expired;
+      auto totalWait = double(stats.totalWaitNs.load(std::memory_order_relaxed)) / 1e9;
+      auto &entry = makeTable(_output[names[i]]);
+      entry["scheduled"] = Var(int64_t(stats.scheduled.load(std::memory_order_relaxed)));
+      entry["started"] = Var(int64_t(started));
+      entry["expired"] = Var(int64_t(expired));
+      entry["cancelled"] = Var(int64_t(stats.cancelled.load(std::memory_order_relaxed)));
+      entry["averageWait"] = Var(dequeued > 0 ? totalWait / double(dequeued) : 0.0);
+      entry["maxWait"] = Var(double(stats.maxWaitNs.load(std::memory_order_relaxed)) / 1e9);
+    }
+#endif
+    return _output;
+  }
 };
 
 // Not used actually
@@ -3,6 +3,9 @@
 
 #include "file_base.hpp"
 #include <shards/core/serialization.hpp>
+#include <shards/core/serialization_compact.hpp>
+#include <shards/core/serialization_stream.hpp>
+#include <shards/core/mapped_file.hpp>
 #include <shards/core/shared.hpp>
 #include <shards/core/params.hpp>
 #include <shards/common_types.hpp>
@@ -21,10 +24,16 @@ struct WriteFile {
   PARAM_VAR(_append, "Append", "If we should append to the file if existed already or truncate. (default: false).",
             {CoreInfo::BoolType});
   PARAM_VAR(_flush, "Flush", "If the file should be flushed to disk after every write.", {CoreInfo::BoolType});
-  PARAM_IMPL(PARAM_IMPL_FOR(_filename), PARAM_IMPL_FOR(_append), PARAM_IMPL_FOR(_flush));
+  PARAM_VAR(_compact, "Compact",
+            "If values should be written using the compact encoding derived from the input type. Smaller and faster, the "
+            "type is stored in the file the first time it is written. (default: false).",
+            {CoreInfo::BoolType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_filename), PARAM_IMPL_FOR(_append), PARAM_IMPL_FOR(_flush), PARAM_IMPL_FOR(_compact));
 
   std::ofstream _fileStream;
   Serialization serial;
+  CompactSerialization _compactSerial;
+  std::shared_ptr<const CompactSchema> _schema;
 
   void warmup(SHContext *context) { PARAM_WARMUP(context); }
   void cleanup(SHContext *context) {
@@ -38,9 +47,11 @@ struct WriteFile {
   PARAM_REQUIRED_VARIABLES();
   SHTypeInfo compose(SHInstanceData &data) {
     PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    _schema = getCompact() ? CompactSchemaRegistry::instance().get(data.inputType) : nullptr;
     return outputTypes().elements[0];
   }
 
+  bool getCompact() const { return _compact->isNone() ? false : _compact->payload.boolValue; }
   bool getAppend() const { return _append->isNone() ? false : _append->payload.boolValue; }
   bool getFlush() const { return _flush->isNone() ? false : _flush->payload.boolValue; }
 
@@ -69,11 +80,19 @@ struct WriteFile {
         _fileStream = std::ofstream(filename, std::ios::app | std::ios::binary);
       else
         _fileStream = std::ofstream(filename, std::ios::trunc | std::ios::binary);
+
+      // a new file needs the schema again
+      _compactSerial.reset();
     }
 
     Writer s(_fileStream);
-    serial.reset();
-    serial.serialize(input, s);
+    if (_schema) {
+      _compactSerial.tagged.reset();
+      _compactSerial.serializeOnce(input, *_schema, s);
+    } else {
+      serial.reset();
+      serial.serialize(input, s);
+    }
     if (getFlush()) {
       _fileStream.flush();
     }
@@ -87,16 +106,25 @@ struct ReadFile {
   static SHOptionalString help() { return SHCCSTR(""); }
 
   PARAM_PARAMVAR(_filename, "Filename", "The file to read from.", {CoreInfo::StringStringVarOrNone});
-  PARAM_IMPL(PARAM_IMPL_FOR(_filename));
+  PARAM_VAR(_map, "Map",
+            "If the file should be memory mapped instead of being read into memory. Only for files that are never truncated or "
+            "rewritten while being read, reading a mapped file past its new end crashes the process.",
+            {CoreInfo::BoolType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_filename), PARAM_IMPL_FOR(_map));
 
-  std::ifstream _fileStream;
+  ReadFile() { _map = Var(false); }
+
+  // The whole file is read (or memory mapped with Map) and values are deserialized straight from it
+  MappedFile _file;
+  BytesReader _reader{nullptr, 0};
   SHVar _output{};
-  Serialization serial;
+  CompactSerialization _compactSerial;
 
   void warmup(SHContext *context) { PARAM_WARMUP(context); }
   void cleanup(SHContext *context) {
     destroyVar(_output);
-    _fileStream = {};
+    _reader = BytesReader(nullptr, 0);
+    _file.close();
     PARAM_CLEANUP(context);
   }
 
@@ -106,32 +134,237 @@ struct ReadFile {
     return outputTypes().elements[0];
   }
 
-  struct Reader {
-    std::ifstream &_fileStream;
-    Reader(std::ifstream &stream) : _fileStream(stream) {}
-    void operator()(uint8_t *buf, size_t size) { _fileStream.read((char *)buf, size); }
-  };
-
   SHVar activate(SHContext *context, const SHVar &input) {
-    if (!_fileStream.is_open() || _filename.isVariable()) {
+    if (!_file.isOpen() || _filename.isVariable()) {
       std::string filename;
       if (!getPathChecked(filename, _filename, true)) {
         return Var::Empty;
       }
 
-      _fileStream = std::ifstream(filename, std::ios::binary);
+      _reader = BytesReader(nullptr, 0);
+      // schemas embedded in another file are not this one's
+      _compactSerial.reset();
+      if (!_file.open(filename, _map->payload.boolValue))
+        return Var::Empty;
+      _file.adviseSequential();
+      _reader = BytesReader(_file.data(), _file.size());
     }
 
-    if (_fileStream.peek() == EOF)
+    if (!_reader.peek(1))
       return Var::Empty;
 
-    Reader r(_fileStream);
-    serial.reset();
-    serial.deserialize(r, _output);
+    // handles both regular and compact values
+    _compactSerial.tagged.reset();
+    _compactSerial.deserialize(_reader, _output);
     return _output;
   }
 };
 
+struct WriteStream {
+  static SHTypesInfo inputTypes() { return shards::CoreInfo::AnyType; }
+  static SHTypesInfo outputTypes() { return shards::CoreInfo::AnyType; }
+  static SHOptionalString help() {
+    return SHCCSTR("Writes values as back to back records to a file. Sequences and tables are written incrementally in bounded "
+                   "size chunks, so very large values never need to be serialized in memory as a whole. Read them back with "
+                   "ReadStream.");
+  }
+
+  PARAM_PARAMVAR(_filename, "Filename", "The file to write to.", {CoreInfo::StringStringVarOrNone});
+  PARAM_VAR(_append, "Append", "If we should append to the file if existed already or truncate. (default: false).",
+            {CoreInfo::BoolType});
+  PARAM_VAR(_chunkSize, "ChunkSize", "The size in bytes after which a chunk is written out.", {CoreInfo::IntType});
+  PARAM_PARAMVAR(_endRecord, "EndRecord",
+                 "If the record should end with this value. When false the next values, of the same Seq or Table type, are "
+                 "appended to the same record, allowing to build records larger than memory.",
+                 {CoreInfo::BoolType, CoreInfo::BoolVarType});
+  PARAM_VAR(_flush, "Flush", "If the file should be flushed to disk after every write.", {CoreInfo::BoolType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_filename), PARAM_IMPL_FOR(_append), PARAM_IMPL_FOR(_chunkSize), PARAM_IMPL_FOR(_endRecord),
+             PARAM_IMPL_FOR(_flush));
+
+  WriteStream() {
+    _append = Var(false);
+    _chunkSize = Var(int64_t(ChunkedSerialization::DefaultChunkSize));
+    _endRecord = Var(true);
+    _flush = Var(false);
+  }
+
+  std::ofstream _fileStream;
+  ChunkedSerialization _stream;
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) {
+    closeFile();
+    PARAM_CLEANUP(context);
+  }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    if (_chunkSize->payload.intValue <= 0)
+      throw ComposeError("WriteStream, ChunkSize must be positive");
+    return outputTypes().elements[0];
+  }
+
+  void closeFile() {
+    if (_fileStream.is_open()) {
+      // an unfinished record is still readable
+      WriteFile::Writer s(_fileStream);
+      _stream.endRecord(s);
+      _fileStream.flush();
+    }
+    _stream.reset();
+    _fileStream = {};
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    if (!_fileStream.is_open() || _filename.isVariable()) {
+      std::string filename;
+      if (!getPathChecked(filename, _filename, false)) {
+        return input;
+      }
+
+      closeFile();
+
+      namespace fs = boost::filesystem;
+
+      // make sure to create directories
+      fs::path p(filename);
+      auto parent_path = p.parent_path();
+      if (!parent_path.empty() && !fs::exists(parent_path))
+        fs::create_directories(p.parent_path());
+
+      if (_append->payload.boolValue)
+        _fileStream = std::ofstream(filename, std::ios::app | std::ios::binary);
+      else
+        _fileStream = std::ofstream(filename, std::ios::trunc | std::ios::binary);
+    }
+
+    WriteFile::Writer s(_fileStream);
+    _stream.chunkSize = size_t(_chunkSize->payload.intValue);
+    _stream.write(input, s, _endRecord.get().payload.boolValue);
+    if (_flush->payload.boolValue) {
+      _fileStream.flush();
+    }
+    return input;
+  }
+};
+
+struct ReadStream {
+  static SHTypesInfo inputTypes() { return CoreInfo::NoneType; }
+  static SHTypesInfo outputTypes() { return shards::CoreInfo::AnyType; }
+  static SHOptionalString help() {
+    return SHCCSTR("Reads a file written by WriteStream. Every activation outputs the next chunk, a part of a sequence or table "
+                   "record, so the output stays bounded whatever the size of the records; or the next whole record if Whole "
+                   "is true. Outputs None once the end of the file is reached, data appended later is picked up. Large files "
+                   "are best mapped with Map, the file is read into memory otherwise.");
+  }
+
+  PARAM_PARAMVAR(_filename, "Filename", "The file to read from.", {CoreInfo::StringStringVarOrNone});
+  PARAM_PARAMVAR(_offset, "Offset",
+                 "A variable holding the byte offset to start reading from when the file is opened, it is updated after "
+                 "every read so it can be stored and used to resume later.",
+                 {CoreInfo::NoneType, CoreInfo::IntVarType});
+  PARAM_VAR(_whole, "Whole", "If whole records should be reassembled in memory instead of outputting chunks.",
+            {CoreInfo::BoolType});
+  PARAM_VAR(_map, "Map",
+            "If the file should be memory mapped instead of being read into memory. Only for files that are never truncated or "
+            "rewritten while being read, reading a mapped file past its new end crashes the process.",
+            {CoreInfo::BoolType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_filename), PARAM_IMPL_FOR(_offset), PARAM_IMPL_FOR(_whole), PARAM_IMPL_FOR(_map));
+
+  ReadStream() {
+    _whole = Var(false);
+    _map = Var(false);
+  }
+
+  MappedFile _file;
+  std::string _path;
+  BytesReader _reader{nullptr, 0};
+  ChunkedSerialization _stream;
+  SHVar _chunk{};
+  SHVar _record{};
+
+  void destroy() {
+    destroyVar(_chunk);
+    destroyVar(_record);
+  }
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) {
+    _reader = BytesReader(nullptr, 0);
+    _file.close();
+    PARAM_CLEANUP(context);
+  }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    return outputTypes().elements[0];
+  }
+
+  void open(size_t offset) {
+    _reader = BytesReader(nullptr, 0);
+    if (!_file.open(_path, _map->payload.boolValue))
+      return;
+    _file.adviseSequential();
+    _reader = BytesReader(_file.data(), _file.size());
+    _reader.offset = std::min(offset, _file.size());
+  }
+
+  // Picks up data appended since the file was opened
+  bool refresh() {
+    boost::system::error_code ec;
+    auto size = boost::filesystem::file_size(_path, ec);
+    if (ec || size <= _file.size())
+      return false;
+    open(_reader.offset);
+    return true;
+  }
+
+  bool next(ChunkedSerialization::Header &header) {
+    return _stream.readHeader(_reader, header) || (refresh() && _stream.readHeader(_reader, header));
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    if (!_file.isOpen() || _filename.isVariable()) {
+      if (!getPathChecked(_path, _filename, true)) {
+        return Var::Empty;
+      }
+      auto &offset = _offset.get();
+      open(offset.valueType == SHType::Int ? size_t(std::max<int64_t>(offset.payload.intValue, 0)) : 0);
+      if (!_file.isOpen())
+        return Var::Empty;
+    }
+
+    // a whole record is only consumed once complete, a partially written one is read again later
+    size_t start = _reader.offset;
+    SHVar *output = &_chunk;
+    ChunkedSerialization::Header header;
+    if (_whole->payload.boolValue) {
+      bool first = true;
+      do {
+        if (!next(header)) {
+          _reader.offset = start;
+          return Var::Empty;
+        }
+        _stream.readChunk(_reader, _chunk);
+        ChunkedSerialization::appendChunk(_chunk, _record, first);
+        first = false;
+      } while (!header.last());
+      output = &_record;
+    } else {
+      if (!next(header))
+        return Var::Empty;
+      _stream.readChunk(_reader, _chunk);
+    }
+
+    auto &offset = _offset.get();
+    if (offset.valueType == SHType::Int)
+      offset.payload.intValue = int64_t(_reader.offset);
+    return *output;
+  }
+};
+
 struct ToBytes {
   static SHOptionalString help() {
     return SHCCSTR("This shard takes a value and converts it to a serialized binary representation (a serialized byte array).");
@@ -147,17 +380,36 @@ struct ToBytes {
   static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
   static SHTypesInfo outputTypes() { return CoreInfo::BytesType; }
 
+  PARAM_VAR(_compact, "Compact",
+            "If the output should use the compact encoding derived from the input type. Smaller and faster, but the type is "
+            "not included, other processes need it passed to FromBytes as its Schema parameter.",
+            {CoreInfo::BoolType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_compact));
+
+  ToBytes() { _compact = Var(false); }
+
   Serialization serial;
+  CompactSerialization _compactSerial;
+  std::shared_ptr<const CompactSchema> _schema;
   std::vector<uint8_t> _buffer;
 
   void cleanup(SHContext *context) { _buffer.clear(); }
 
+  SHTypeInfo compose(SHInstanceData &data) {
+    _schema = _compact->payload.boolValue ? CompactSchemaRegistry::instance().get(data.inputType) : nullptr;
+    return outputTypes().elements[0];
+  }
+
   SHVar activate(SHContext *context, const SHVar &input) {
-    BufferRefWriter s(_buffer);
-    _buffer.clear();
-    serial.reset();
-    serial.serialize(input, s);
-    return Var(&_buffer.front(), _buffer.size());
+    if (_schema) {
+      BufferRefWriter w(_buffer);
+      _compactSerial.tagged.reset();
+      _compactSerial.serialize(input, *_schema, w, false);
+    } else {
+      serial.reset();
+      serial.serializeInto(input, _buffer);
+    }
+    return Var(_buffer.data(), _buffer.size());
   }
 };
 
@@ -176,15 +428,47 @@ struct FromBytes {
   static SHTypesInfo inputTypes() { return CoreInfo::BytesType; }
   static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
 
-  Serialization serial;
+  PARAM_VAR(_singleCopy, "SingleCopy",
+            "If the input should be copied once, as a whole, into a buffer kept by this shard, with the strings and byte arrays "
+            "of the output pointing into it instead of each being allocated and copied on their own. Not zero-copy: Bytes "
+            "values can not be referenced, so the input is copied to stay valid until the next activation even if it changes. "
+            "Worth it for values holding many strings or byte arrays.",
+            {CoreInfo::BoolType});
+  PARAM_VAR(_schema, "Schema",
+            "The type of values encoded with ToBytes(Compact: true) by another process, needed to decode them. Also used as "
+            "the output type.",
+            {CoreInfo::NoneType, CoreInfo::TypeType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_singleCopy), PARAM_IMPL_FOR(_schema));
+
+  FromBytes() { _singleCopy = Var(false); }
+
+  CompactSerialization serial;
   SHVar _output{};
+  // The views of the output point into this copy of the input, its capacity is recycled between activations
+  OwnedVar _copy;
 
   void destroy() { destroyVar(_output); }
 
+  SHTypeInfo compose(SHInstanceData &data) {
+    if (_schema->valueType == SHType::Type) {
+      CompactSchemaRegistry::instance().get(*_schema->payload.typeValue);
+      return *_schema->payload.typeValue;
+    }
+    return outputTypes().elements[0];
+  }
+
   SHVar activate(SHContext *context, const SHVar &input) {
-    VarReader r(input);
     serial.reset();
-    serial.deserialize(r, _output);
+    serial.tagged.views = _singleCopy->payload.boolValue;
+    if (serial.tagged.views) {
+      // the previous views into the copy are reset, never read, by the next deserialize
+      _copy = input;
+      VarReader r(_copy);
+      serial.deserialize(r, _output);
+    } else {
+      VarReader r(input);
+      serial.deserialize(r, _output);
+    }
     return _output;
   }
 };
@@ -192,6 +476,8 @@ struct FromBytes {
 SHARDS_REGISTER_FN(serialization) {
   REGISTER_SHARD("WriteFile", WriteFile);
   REGISTER_SHARD("ReadFile", ReadFile);
+  REGISTER_SHARD("WriteStream", WriteStream);
+  REGISTER_SHARD("ReadStream", ReadStream);
   REGISTER_SHARD("FromBytes", FromBytes);
   REGISTER_SHARD("ToBytes", ToBytes);
 }
@@ -1378,7 +1378,13 @@ struct ParallelBase : public CapturingSpawners {
        SHCCSTR("The execution policy for the shard to abide by. A copied Wire is only deemed successful if it did not have an "
                "internal failure (eg.through Assert)"),
        {WaitUntilEnumInfo::Type}},
-      {"Threads", SHCCSTR("The number of cpu threads to use. Number specified can not be lower than 1."), {CoreInfo::IntType}}};
+      {"Threads", SHCCSTR("The number of cpu threads to use. Number specified can not be lower than 1."), {CoreInfo::IntType}},
+      {"Batch",
+       SHCCSTR("When greater than 0 enables the lightweight fan-out mode: a fixed set of one mesh per thread is reused across "
+               "elements, each thread picks this many inputs at a time and captured variables are shared read-only instead of "
+               "copied. The Wire must not modify captured variables nor rely on mesh state being reset between elements. 0 "
+               "schedules a fresh mesh per element."),
+       {CoreInfo::IntType}}};
 
   static SHParametersInfo parameters() { return _params; }
 
@@ -1386,6 +1392,7 @@ struct ParallelBase : public CapturingSpawners {
     // Make sure mesh outlives the wires, because of event handlers
     _pool.reset();
     _meshes.clear();
+    _fanOutMeshes.clear();
   }
 
   void setParam(int index, const SHVar &value) {
@@ -1399,6 +1406,9 @@ struct ParallelBase : public CapturingSpawners {
     case 2:
       _threads = std::max(int64_t(1), value.payload.intValue);
       break;
+    case 3:
+      _batch = std::max(int64_t(0), value.payload.intValue);
+      break;
     default:
       break;
     }
@@ -1412,6 +1422,8 @@ struct ParallelBase : public CapturingSpawners {
       return Var::Enum(_policy, CoreCC, 'tryM');
     case 2:
       return Var(_threads);
+    case 3:
+      return Var(_batch);
     default:
       return Var::Empty;
     }
@@ -1518,16 +1530,19 @@ struct ParallelBase : public CapturingSpawners {
       return Var(_outputs.data(), 0);
     }
 
-    size_t succeeded = 0;
-    size_t failed = 0;
-
     _successes.resize(len);
     std::fill(_successes.begin(), _successes.end(), false);
 
-    _meshes.resize(len);
-
     _outputs.resize(len);
 
+    if (_batch > 0) {
+      if (!runFanOut(context, input, len))
+        return Var::Empty;
+      return gatherOutputs(len);
+    }
+
+    _meshes.resize(len);
+
     // multithreaded
     tf::Taskflow flow;
 
@@ -1623,6 +1638,110 @@ struct ParallelBase : public CapturingSpawners {
       }
     }
 
+    return gatherOutputs(len);
+  }
+
+  // Lightweight fan-out: one task per thread, each owning a persistent mesh and pulling batches of inputs
+  // returns false if interrupted
+  bool runFanOut(SHContext *context, const SHVar &input, size_t len) {
+    const size_t batch = size_t(_batch);
+    const size_t numWorkers = std::min(size_t(_threads), (len + batch - 1) / batch);
+
+    if (_fanOutMeshes.size() < numWorkers) {
+      auto parentMesh = context->main->mesh.lock();
+      while (_fanOutMeshes.size() < numWorkers) {
+        auto &mesh = _fanOutMeshes.emplace_back(SHMesh::make());
+        mesh->parent = bool(parentMesh) ? parentMesh.get() : nullptr; // we need this for any storage
+      }
+      _fanOutViews.resize(numWorkers);
+    }
+
+    std::atomic_size_t cursor = 0;
+    std::atomic_bool anySuccess = false;
+
+    auto poolBatch = _pool->acquireBatch(numWorkers);
+
+    tf::Taskflow flow;
+    flow.for_each_index(size_t(0), numWorkers, size_t(1), [&](auto &workerIdx) {
+      auto &mesh = _fanOutMeshes[workerIdx];
+
+      ManyWire *cref;
+      try {
+        cref = _pool->acquireFromBatch(poolBatch, workerIdx, _composer, mesh.get());
+      } catch (std::exception &e) {
+        SHLOG_ERROR("Failed to acquire wire: {}", e.what());
+        return;
+      }
+
+      cref->mesh = mesh;
+
+      // share captured variables read-only, views are shallow so nothing gets copied or destroyed
+      auto &views = _fanOutViews[workerIdx];
+      views.resize(_vars.size());
+      size_t viewIdx = 0;
+      for (auto &v : _vars) {
+        auto &view = views[viewIdx++];
+        view = v.get();
+        view.refcount = 0;
+        view.flags = (view.flags & ~SHVAR_FLAGS_REF_COUNTED) | SHVAR_FLAGS_EXTERNAL;
+        std::string_view name = v.variableNameView();
+        mesh->addRef(toSWL(name), &view);
+      }
+
+      while (!(_policy == WaitUntil::FirstSuccess && anySuccess)) {
+        const size_t start = cursor.fetch_add(batch);
+        if (start >= len)
+          break;
+
+        const size_t end = std::min(len, start + batch);
+        for (size_t idx = start; idx < end; idx++) {
+          bool success = true;
+          mesh->schedule(cref->wire, getInput(input, idx), false); // don't compose
+          cref->wire->context->onWorkerThread = true;
+          while (!mesh->empty()) {
+            if (!mesh->tick() || (_policy == WaitUntil::FirstSuccess && anySuccess)) {
+              success = false;
+              break;
+            }
+          }
+
+          _successes[idx] = success;
+
+          if (success) {
+            anySuccess = true;
+            stop(cref->wire.get(), &_outputs[idx]);
+          } else {
+            _outputs[idx] = Var::Empty; // flag as empty to signal failure
+            stop(cref->wire.get());
+          }
+        }
+      }
+
+      mesh->terminate();
+      _pool->release(cref);
+    });
+
+    auto future = TaskFlowInstance::instance().run(std::move(flow));
+
+    while (true) {
+      auto suspend_state = shards::suspend(context, 0);
+      if (unlikely(suspend_state != SHWireState::Continue)) {
+        SHLOG_DEBUG("ParallelBase, interrupted!");
+        anySuccess = true; // flags early stop as well
+        cursor = len;
+        future.get(); // wait for all to finish in any case
+        return false;
+      } else if (future.wait_for(std::chrono::milliseconds(0)) == std::future_status::ready) {
+        future.get();
+        return true;
+      }
+    }
+  }
+
+  SHVar gatherOutputs(size_t len) {
+    size_t succeeded = 0;
+    size_t failed = 0;
+
     for (size_t i = 0; i < len; i++) {
       auto success = _successes[i];
       if (success) {
@@ -1669,8 +1788,11 @@ protected:
   std::vector<char>
       _successes; // don't use bool cos std lib uses bit vectors behind the scenes and won't work with multiple threads
   std::vector<std::shared_ptr<SHMesh>> _meshes;
+  std::vector<std::shared_ptr<SHMesh>> _fanOutMeshes;
+  std::vector<std::vector<SHVar>> _fanOutViews;
   std::vector<ManyWire *> _wires;
   int64_t _threads{0};
+  int64_t _batch{0};
 };
 
 struct TryMany : public ParallelBase {
@@ -1704,7 +1826,13 @@ struct TryMany : public ParallelBase {
                "internal "
                "failure (eg.through Assert)"),
        {WaitUntilEnumInfo::Type}},
-      {"Threads", SHCCSTR("The number of cpu threads to use. Number specified can not be lower than 1."), {CoreInfo::IntType}}};
+      {"Threads", SHCCSTR("The number of cpu threads to use. Number specified can not be lower than 1."), {CoreInfo::IntType}},
+      {"Batch",
+       SHCCSTR("When greater than 0 enables the lightweight fan-out mode: a fixed set of one mesh per thread is reused across "
+               "elements, each thread picks this many inputs at a time and captured variables are shared read-only instead of "
+               "copied. The Wire must not modify captured variables nor rely on mesh state being reset between elements. 0 "
+               "schedules a fresh mesh per element."),
+       {CoreInfo::IntType}}};
 
   static SHParametersInfo parameters() { return _params; }
 
@@ -1820,6 +1948,296 @@ struct Expand : public ParallelBase {
   size_t getLength(const SHVar &input) override { return size_t(_width); }
 };
 
+struct StreamMany : public ParallelBase {
+  static inline std::array<SHVar, 3> OutKeys{Var("indices"), Var("results"), Var("done")};
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnySeqType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::AnyTableType; }
+
+  static SHOptionalString inputHelp() { return InputManyWire; }
+
+  static SHOptionalString outputHelp() {
+    return SHCCSTR("A table with the `results` completed since the previous activation in completion order, the `indices` of "
+                   "their respective input elements and a `done` flag set once every element of the stream has been delivered.");
+  }
+
+  SHOptionalString help() {
+    return SHCCSTR(
+        "This shard takes a sequence of values as input and schedules a copy of the specified Wire for each of them, like "
+        "TryMany, but streams the results back instead of waiting for all the copies to end. Every activation suspends until at "
+        "least one copy completed and outputs what completed so far, at most Window elements are in flight at any time. The "
+        "input is only read when starting a new stream, that is on the first activation or the one after `done` was true.");
+  }
+
+  static inline Parameters _params{
+      {"Wire", SHCCSTR("The Wire to copy and schedule."), IntoWire::RunnableTypes},
+      {"Policy",
+       SHCCSTR("WaitUntil::AllSuccess will fail the current Wire as soon as any copy fails, WaitUntil::SomeSuccess will just "
+               "skip failed elements. WaitUntil::FirstSuccess is not supported."),
+       {WaitUntilEnumInfo::Type}},
+      {"Window",
+       SHCCSTR("The maximum number of elements scheduled or completed but not yet delivered at any time. Can not be lower "
+               "than 1."),
+       {CoreInfo::IntType}}};
+
+  static SHParametersInfo parameters() { return _params; }
+
+  void setup() { _threads = 1; }
+
+  ~StreamMany() { drain(); }
+
+  void setParam(int index, const SHVar &value) {
+    switch (index) {
+    case 2:
+      _window = std::max(int64_t(1), value.payload.intValue);
+      break;
+    default:
+      ParallelBase::setParam(index, value);
+      break;
+    }
+  }
+
+  SHVar getParam(int index) {
+    switch (index) {
+    case 2:
+      return Var(_window);
+    default:
+      return ParallelBase::getParam(index);
+    }
+  }
+
+  SHTypeInfo compose(const SHInstanceData &data) {
+    if (_policy == WaitUntil::FirstSuccess) {
+      throw ComposeError("StreamMany, WaitUntil::FirstSuccess policy is not supported");
+    }
+
+    if (data.inputType.seqTypes.len == 1) {
+      _inputType = data.inputType.seqTypes.elements[0];
+    } else {
+      _inputType = CoreInfo::AnyType;
+    }
+
+    ParallelBase::compose(data, _inputType);
+
+    _outputTypes = Types({wire->outputType});
+    _outputSeqType = Type::SeqOf(_outputTypes);
+    _streamTypes = Types({CoreInfo::IntSeqType, _outputSeqType, CoreInfo::BoolType});
+    _streamType = Type::TableOf(_streamTypes, OutKeys);
+    return _streamType;
+  }
+
+  void cleanup(SHContext *context) {
+    drain();
+    _streaming = false;
+    _streamInput.reset();
+    discardCompleted();
+    ParallelBase::cleanup(context);
+  }
+
+  SHVar getInput(const SHVar &input, uint32_t index) override { return input.payload.seqValue.elements[index]; }
+
+  size_t getLength(const SHVar &input) override { return size_t(input.payload.seqValue.len); }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    if (!_streaming) {
+      // what is left of an aborted stream must not be counted as ours
+      discardCompleted();
+      // keep our own copy, elements are read from worker threads, possibly after this stream is aborted
+      _streamInput = std::make_shared<OwnedVar>(input);
+      _length = getLength(*_streamInput);
+      _next = 0;
+      _delivered = 0;
+      _failure = false;
+      _streaming = true;
+    }
+
+    auto &indices = makeSeq(_output["indices"]);
+    auto &results = makeSeq(_output["results"]);
+    indices.clear();
+    results.clear();
+
+    launch(context);
+
+    while (_delivered < _length) {
+      {
+        std::scoped_lock lock(_streamMutex);
+        if (!_completed.empty()) {
+          std::swap(_completed, _ready);
+        }
+      }
+
+      // late results of an aborted stream
+      std::erase_if(_ready, [&](Completed &item) {
+        if (item.generation == _generation)
+          return false;
+        destroyVar(item.result);
+        return true;
+      });
+
+      if (!_ready.empty())
+        break;
+
+      if (shards::suspend(context, 0) != SHWireState::Continue) {
+        return Var::Empty;
+      }
+    }
+
+    for (auto &item : _ready) {
+      _delivered++;
+      if (item.success) {
+        indices.emplace_back(Var(int64_t(item.index)));
+        results.emplace_back(item.result);
+      } else if (_policy == WaitUntil::AllSuccess) {
+        _failure = true;
+      }
+      destroyVar(item.result);
+    }
+    _ready.clear();
+
+    if (_failure) {
+      // whatever is still running stops at its next tick and its result is discarded when it arrives, no need to wait
+      _streaming = false;
+      _generation++;
+      discardCompleted();
+      throw ActivationError("StreamMany, failed some wires!");
+    }
+
+    // keep the window full while our results are consumed downstream
+    launch(context);
+
+    const bool done = _delivered == _length;
+    _output["done"] = Var(done);
+    if (done) {
+      _streaming = false;
+    }
+
+    return _output;
+  }
+
+private:
+  struct Completed {
+    size_t index;
+    bool success;
+    SHVar result;
+    // Of the stream the element belongs to
+    uint64_t generation;
+  };
+
+  void launch(SHContext *context) {
+    auto parentMesh = context->main->mesh.lock();
+    while (_next < _length && (_next - _delivered) < size_t(_window)) {
+      const size_t idx = _next++;
+      _inFlight++;
+      TaskFlowInstance::instance().silent_async(
+          [this, idx, parentMesh, input = _streamInput, generation = _generation.load()]() {
+            DEFER(_inFlight--);
+            runElement(idx, parentMesh.get(), *input, generation);
+          });
+    }
+  }
+
+  void runElement(size_t idx, SHMesh *parentMesh, const SHVar &input, uint64_t generation) {
+    std::shared_ptr<SHMesh> mesh;
+    {
+      std::scoped_lock lock(_streamMutex);
+      if (!_meshes.empty()) {
+        mesh = std::move(_meshes.back());
+        _meshes.pop_back();
+      }
+    }
+    if (!mesh) {
+      mesh = SHMesh::make();
+      mesh->parent = parentMesh; // we need this for any storage
+    }
+
+    Completed item{idx, false, {}, generation};
+
+    ManyWire *cref{};
+    try {
+      cref = _pool->acquire(_composer, mesh.get());
+    } catch (std::exception &e) {
+      SHLOG_ERROR("Failed to acquire wire: {}", e.what());
+    }
+
+    if (cref) {
+      cref->mesh = mesh;
+
+      // setup captured variables as mesh externals
+      std::deque<shards::OwnedVar> capturedVars;
+      for (auto &v : _vars) {
+        auto &ref = capturedVars.emplace_back(v.get());
+        ref.flags |= SHVAR_FLAGS_EXTERNAL;
+        std::string_view name = v.variableNameView();
+        mesh->addRef(toSWL(name), &ref);
+      }
+
+      bool success = true;
+      mesh->schedule(cref->wire, getInput(input, uint32_t(idx)), false); // don't compose
+      cref->wire->context->onWorkerThread = true;
+      while (!mesh->empty()) {
+        if (!mesh->tick() || _generation != generation) {
+          success = false;
+          break;
+        }
+      }
+
+      if (success) {
+        stop(cref->wire.get(), &item.result);
+        item.success = true;
+      } else {
+        stop(cref->wire.get());
+      }
+
+      mesh->terminate();
+      _pool->release(cref);
+    }
+
+    std::scoped_lock lock(_streamMutex);
+    _completed.emplace_back(item);
+    _meshes.emplace_back(std::move(mesh));
+  }
+
+  // stops and waits any in flight element, only when going away as they point to us
+  void drain() {
+    _generation++;
+    while (_inFlight > 0) {
+      std::this_thread::yield();
+    }
+  }
+
+  void discardCompleted() {
+    std::scoped_lock lock(_streamMutex);
+    for (auto &item : _completed) {
+      destroyVar(item.result);
+    }
+    for (auto &item : _ready) {
+      destroyVar(item.result);
+    }
+    _completed.clear();
+    _ready.clear();
+  }
+
+  int64_t _window{16};
+
+  std::shared_ptr<OwnedVar> _streamInput;
+  size_t _length{0};
+  size_t _next{0};
+  size_t _delivered{0};
+  bool _streaming{false};
+  bool _failure{false};
+
+  std::mutex _streamMutex;
+  std::vector<Completed> _completed;
+  std::vector<Completed> _ready;
+  std::atomic_size_t _inFlight{0};
+  // Bumped when a stream is aborted, its elements stop at their next tick
+  std::atomic_uint64_t _generation{0};
+
+  Types _streamTypes;
+  Type _streamType;
+  TableVar _output{};
+};
+
 struct Spawn : public CapturingSpawners {
   Spawn() {
     mode = RunWireMode::Async;
@@ -2348,6 +2766,7 @@ SHARDS_REGISTER_FN(wires) {
   REGISTER_SHARD("TryMany", TryMany);
   REGISTER_SHARD("Spawn", Spawn);
   REGISTER_SHARD("Expand", Expand);
+  REGISTER_SHARD("StreamMany", StreamMany);
   REGISTER_SHARD("Branch", Branch);
   REGISTER_SHARD("DoMany", DoMany);
   REGISTER_SHARD("Peek", Peek);
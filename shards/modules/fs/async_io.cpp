@@ -0,0 +1,418 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#include "async_io.hpp"
+#include <shards/core/platform.hpp>
+#include <shards/core/async.hpp>
+#include <shards/log/log.hpp>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+#if SH_LINUX && __has_include(<linux/io_uring.h>)
+#define SH_FS_IO_URING 1
+#include <linux/io_uring.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#else
+#define SH_FS_IO_URING 0
+#endif
+
+namespace shards::FS {
+
+// Largest read or write done at once by the blocking backend, cancellation is checked in between
+static constexpr size_t BlockingChunk = size_t(4) << 20;
+
+// Plain blocking implementation, used by the fallback backend
+static void performBlocking(FileOp &op) {
+  if (op.kind == FileOp::Kind::Read) {
+    std::ifstream file(op.path, std::ios::binary | std::ios::ate);
+    if (!file) {
+      op.error = ENOENT;
+      return;
+    }
+    auto size = size_t(file.tellg());
+    file.seekg(0);
+    op.data.resize(size);
+    for (size_t offset = 0; offset < size; offset += BlockingChunk) {
+      if (op.cancel.cancelled()) {
+        op.error = ECANCELED;
+        return;
+      }
+      if (!file.read((char *)op.data.data() + offset, std::streamsize(std::min(BlockingChunk, size - offset)))) {
+        op.error = EIO;
+        return;
+      }
+    }
+  } else {
+    std::ios::openmode flags = std::ios::binary | (op.append ? std::ios::app : std::ios::trunc);
+    std::ofstream file(op.path, flags);
+    if (!file) {
+      op.error = EACCES;
+      return;
+    }
+    for (size_t offset = 0; offset < op.data.size(); offset += BlockingChunk) {
+      if (op.cancel.cancelled()) {
+        op.error = ECANCELED;
+        return;
+      }
+      auto chunk = std::min(BlockingChunk, op.data.size() - offset);
+      if (!file.write((const char *)op.data.data() + offset, std::streamsize(chunk))) {
+        op.error = EIO;
+        return;
+      }
+    }
+  }
+}
+
+struct BlockingFileIO final : AsyncFileIO {
+#if HAS_ASYNC_SUPPORT
+  struct Work final : TidePool::Work {
+    FileOpPtr op;
+    Work(FileOpPtr op) : op(std::move(op)) {}
+    void call() override {
+      performBlocking(*op);
+      op->done.store(true, std::memory_order_release);
+      delete this;
+    }
+    void dropped() override {
+      op->error = ECANCELED;
+      op->done.store(true, std::memory_order_release);
+      delete this;
+    }
+  };
+#endif
+
+  void submit(const std::vector<FileOpPtr> &ops) override {
+    for (auto &op : ops) {
+#if HAS_ASYNC_SUPPORT
+      getTidePool().schedule(new Work(op));
+#else
+      performBlocking(*op);
+      op->done.store(true, std::memory_order_release);
+#endif
+    }
+  }
+
+  const char *name() const override { return "blocking"; }
+};
+
+#if SH_FS_IO_URING
+// Minimal io_uring ring driven through raw syscalls, avoids depending on liburing
+//
+// Submissions happen on the caller thread under a lock, a single completion thread reaps CQEs,
+// resubmits the remainder of short reads/writes and marks ops done
+struct UringFileIO final : AsyncFileIO {
+  static constexpr unsigned Entries = 256;
+  // Largest single read/write request, bigger files take several round trips and cancelled ops stop in between
+  static constexpr size_t MaxChunk = size_t(16) << 20;
+  static constexpr uint64_t WakeUpTag = 0;
+
+  int _ringFd{-1};
+  io_uring_params _params{};
+
+  void *_sqRing{};
+  void *_cqRing{};
+  size_t _sqRingSize{};
+  size_t _cqRingSize{};
+  io_uring_sqe *_sqes{};
+
+  unsigned *_sqHead{};
+  unsigned *_sqTail{};
+  unsigned *_sqMask{};
+  unsigned *_sqArray{};
+  unsigned *_cqHead{};
+  unsigned *_cqTail{};
+  unsigned *_cqMask{};
+  io_uring_cqe *_cqes{};
+
+  std::mutex _mutex;
+  // ops submitted to the kernel, keyed by the user_data we gave it
+  std::unordered_map<FileOp *, FileOpPtr> _inFlight;
+  // ops waiting for room in the completion queue
+  std::deque<FileOpPtr> _pending;
+  unsigned _inFlightRequests{};
+  std::atomic_bool _running{};
+  std::thread _completionThread;
+
+  static int sysSetup(unsigned entries, io_uring_params *p) { return int(syscall(__NR_io_uring_setup, entries, p)); }
+  static int sysEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return int(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+  }
+  static int sysRegister(int fd, unsigned opcode, void *arg, unsigned nrArgs) {
+    return int(syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+  }
+
+  // Returns false if io_uring is unavailable (old kernel, seccomp, disabled by sysctl...)
+  bool init() {
+    _ringFd = sysSetup(Entries, &_params);
+    if (_ringFd < 0)
+      return false;
+
+    // IORING_OP_READ/WRITE need 5.6+, make sure they are there
+    if (!supportsOps())
+      return false;
+
+    _sqRingSize = _params.sq_off.array + _params.sq_entries * sizeof(unsigned);
+    _cqRingSize = _params.cq_off.cqes + _params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = _params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap)
+      _sqRingSize = _cqRingSize = std::max(_sqRingSize, _cqRingSize);
+
+    _sqRing = mmap(nullptr, _sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_SQ_RING);
+    if (_sqRing == MAP_FAILED)
+      return false;
+    if (singleMmap) {
+      _cqRing = _sqRing;
+    } else {
+      _cqRing = mmap(nullptr, _cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _ringFd, IORING_OFF_CQ_RING);
+      if (_cqRing == MAP_FAILED)
+        return false;
+    }
+    void *sqes = mmap(nullptr, _params.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      _ringFd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED)
+      return false;
+    _sqes = static_cast<io_uring_sqe *>(sqes);
+
+    auto sq = static_cast<uint8_t *>(_sqRing);
+    _sqHead = reinterpret_cast<unsigned *>(sq + _params.sq_off.head);
+    _sqTail = reinterpret_cast<unsigned *>(sq + _params.sq_off.tail);
+    _sqMask = reinterpret_cast<unsigned *>(sq + _params.sq_off.ring_mask);
+    _sqArray = reinterpret_cast<unsigned *>(sq + _params.sq_off.array);
+    auto cq = static_cast<uint8_t *>(_cqRing);
+    _cqHead = reinterpret_cast<unsigned *>(cq + _params.cq_off.head);
+    _cqTail = reinterpret_cast<unsigned *>(cq + _params.cq_off.tail);
+    _cqMask = reinterpret_cast<unsigned *>(cq + _params.cq_off.ring_mask);
+    _cqes = reinterpret_cast<io_uring_cqe *>(cq + _params.cq_off.cqes);
+
+    _running = true;
+    _completionThread = std::thread([this]() { completionLoop(); });
+    return true;
+  }
+
+  bool supportsOps() {
+    constexpr unsigned NumOps = 256;
+    std::vector<uint8_t> storage(sizeof(io_uring_probe) + NumOps * sizeof(io_uring_probe_op));
+    auto probe = reinterpret_cast<io_uring_probe *>(storage.data());
+    if (sysRegister(_ringFd, IORING_REGISTER_PROBE, probe, NumOps) < 0)
+      return false;
+    auto supported = [&](unsigned op) { return op <= probe->last_op && (probe->ops[op].flags & IO_URING_OP_SUPPORTED); };
+    return supported(IORING_OP_READ) && supported(IORING_OP_WRITE) && supported(IORING_OP_NOP);
+  }
+
+  ~UringFileIO() {
+    if (_running) {
+      _running = false;
+      {
+        std::unique_lock lock(_mutex);
+        auto sqe = nextSqe();
+        if (sqe) {
+          sqe->opcode = IORING_OP_NOP;
+          sqe->user_data = WakeUpTag;
+          flush(1);
+        }
+      }
+      if (_completionThread.joinable())
+        _completionThread.join();
+    }
+    if (_sqes)
+      munmap(_sqes, _params.sq_entries * sizeof(io_uring_sqe));
+    if (_cqRing && _cqRing != MAP_FAILED && _cqRing != _sqRing)
+      munmap(_cqRing, _cqRingSize);
+    if (_sqRing && _sqRing != MAP_FAILED)
+      munmap(_sqRing, _sqRingSize);
+    if (_ringFd >= 0)
+      close(_ringFd);
+  }
+
+  const char *name() const override { return "io_uring"; }
+
+  void submit(const std::vector<FileOpPtr> &ops) override {
+    std::unique_lock lock(_mutex);
+    unsigned queued = 0;
+    for (auto &op : ops) {
+      if (!open(*op))
+        continue;
+      if (_inFlightRequests >= _params.cq_entries) {
+        // never overflow the completion queue, the completion thread picks these up
+        _pending.push_back(op);
+        continue;
+      }
+      _inFlight.emplace(op.get(), op);
+      push(*op, queued);
+    }
+    // the whole batch is handed to the kernel with a single syscall
+    flush(queued);
+  }
+
+private:
+  // Opens the file and sizes the buffer, failures complete the op right away
+  bool open(FileOp &op) {
+    if (op.kind == FileOp::Kind::Read) {
+      op.fd = ::open(op.path.c_str(), O_RDONLY | O_CLOEXEC);
+      struct stat st;
+      if (op.fd >= 0 && fstat(op.fd, &st) == 0) {
+        op.data.resize(size_t(st.st_size));
+      } else {
+        return fail(op, errno);
+      }
+    } else {
+      int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (op.append ? O_APPEND : O_TRUNC);
+      op.fd = ::open(op.path.c_str(), flags, 0644);
+      if (op.fd < 0)
+        return fail(op, errno);
+    }
+    op.offset = 0;
+    if (op.data.empty()) {
+      finish(op);
+      return false;
+    }
+    return true;
+  }
+
+  bool fail(FileOp &op, int error) {
+    op.error = error;
+    finish(op);
+    return false;
+  }
+
+  void finish(FileOp &op) {
+    if (op.fd >= 0) {
+      ::close(op.fd);
+      op.fd = -1;
+    }
+    op.done.store(true, std::memory_order_release);
+  }
+
+  io_uring_sqe *nextSqe() {
+    unsigned head = __atomic_load_n(_sqHead, __ATOMIC_ACQUIRE);
+    unsigned tail = *_sqTail;
+    if (tail - head >= _params.sq_entries)
+      return nullptr;
+    unsigned index = tail & *_sqMask;
+    io_uring_sqe *sqe = &_sqes[index];
+    memset(sqe, 0, sizeof(io_uring_sqe));
+    _sqArray[index] = index;
+    __atomic_store_n(_sqTail, tail + 1, __ATOMIC_RELEASE);
+    return sqe;
+  }
+
+  // Queues the next chunk of op, returns false if the submission queue is full
+  bool queueChunk(FileOp &op) {
+    io_uring_sqe *sqe = nextSqe();
+    if (!sqe)
+      return false;
+    size_t remaining = op.data.size() - op.offset;
+    sqe->opcode = op.kind == FileOp::Kind::Read ? IORING_OP_READ : IORING_OP_WRITE;
+    sqe->fd = op.fd;
+    sqe->addr = uint64_t(uintptr_t(op.data.data() + op.offset));
+    sqe->len = unsigned(std::min(remaining, MaxChunk));
+    // appends ignore the offset, O_APPEND always writes at the end
+    sqe->off = op.offset;
+    sqe->user_data = uint64_t(uintptr_t(&op));
+    _inFlightRequests++;
+    return true;
+  }
+
+  // Queues the next chunk of op, handing what is already queued to the kernel if needed to make room
+  void push(FileOp &op, unsigned &queued) {
+    if (!queueChunk(op)) {
+      flush(queued);
+      queued = 0;
+      queueChunk(op);
+    }
+    queued++;
+  }
+
+  void flush(unsigned count) {
+    while (count > 0) {
+      int submitted = sysEnter(_ringFd, count, 0, 0);
+      if (submitted < 0) {
+        if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+          continue;
+        SHLOG_ERROR("io_uring_enter failed: {}", strerror(errno));
+        return;
+      }
+      count -= unsigned(submitted);
+    }
+  }
+
+  void completionLoop() {
+    pushThreadName("FS io_uring");
+    while (_running) {
+      if (sysEnter(_ringFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+        SHLOG_ERROR("io_uring_enter failed: {}", strerror(errno));
+        break;
+      }
+
+      std::unique_lock lock(_mutex);
+      unsigned queued = 0;
+      unsigned head = *_cqHead;
+      unsigned tail = __atomic_load_n(_cqTail, __ATOMIC_ACQUIRE);
+      for (; head != tail; head++) {
+        io_uring_cqe &cqe = _cqes[head & *_cqMask];
+        if (cqe.user_data == WakeUpTag)
+          continue;
+        _inFlightRequests--;
+        auto op = reinterpret_cast<FileOp *>(uintptr_t(cqe.user_data));
+        if (cqe.res < 0) {
+          op->error = -cqe.res;
+        } else {
+          op->offset += size_t(cqe.res);
+          // 0 means the file shrunk since we sized the buffer
+          if (cqe.res == 0 && op->kind == FileOp::Kind::Read)
+            op->data.resize(op->offset);
+          if (cqe.res > 0 && op->offset < op->data.size()) {
+            if (!op->cancel.cancelled()) {
+              push(*op, queued);
+              continue;
+            }
+            op->error = ECANCELED;
+          }
+          if (cqe.res == 0 && op->kind == FileOp::Kind::Write)
+            op->error = EIO;
+        }
+        finish(*op);
+        _inFlight.erase(op);
+      }
+      __atomic_store_n(_cqHead, head, __ATOMIC_RELEASE);
+
+      // room freed up in the completion queue
+      while (!_pending.empty() && _inFlightRequests < _params.cq_entries) {
+        auto op = std::move(_pending.front());
+        _pending.pop_front();
+        if (op->cancel.cancelled()) {
+          fail(*op, ECANCELED);
+          continue;
+        }
+        _inFlight.emplace(op.get(), op);
+        push(*op, queued);
+      }
+      flush(queued);
+    }
+  }
+};
+#endif
+
+AsyncFileIO &AsyncFileIO::instance() {
+  static std::unique_ptr<AsyncFileIO> inst = []() -> std::unique_ptr<AsyncFileIO> {
+#if SH_FS_IO_URING
+    auto uring = std::make_unique<UringFileIO>();
+    if (uring->init())
+      return uring;
+    SHLOG_DEBUG("io_uring unavailable, falling back to blocking file I/O");
+#endif
+    return std::make_unique<BlockingFileIO>();
+  }();
+  return *inst;
+}
+
+} // namespace shards::FS
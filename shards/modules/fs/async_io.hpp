@@ -0,0 +1,54 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#ifndef E4B7D2A1_8C3F_4F6E_9A1D_3B5C7E9F1A2B
+#define E4B7D2A1_8C3F_4F6E_9A1D_3B5C7E9F1A2B
+
+#include <shards/core/async.hpp>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace shards::FS {
+
+// A whole file read or write, completed asynchronously
+struct FileOp {
+  enum class Kind : uint8_t { Read, Write };
+
+  Kind kind{Kind::Read};
+  std::string path;
+  // Read: receives the file contents, Write: the contents to write
+  std::vector<uint8_t> data;
+  // Write only, append instead of truncating
+  bool append{};
+
+  // errno style error code, 0 on success, only valid once done
+  int error{};
+  std::atomic_bool done{};
+  // Signalled by the waiting shard when its wire stops, the op then ends with ECANCELED at the next chunk
+  CancellationToken cancel;
+
+  // backend state
+  int fd{-1};
+  size_t offset{};
+};
+
+using FileOpPtr = std::shared_ptr<FileOp>;
+
+// Process wide file I/O backend
+// io_uring on Linux when the kernel supports it, otherwise blocking I/O on the TidePool
+// Backends keep a reference to in-flight ops, callers can drop theirs at any time
+struct AsyncFileIO {
+  virtual ~AsyncFileIO() = default;
+
+  // Submits all the ops as a single batch, completion is signalled through FileOp::done
+  virtual void submit(const std::vector<FileOpPtr> &ops) = 0;
+  virtual const char *name() const = 0;
+
+  static AsyncFileIO &instance();
+};
+
+} // namespace shards::FS
+
+#endif /* E4B7D2A1_8C3F_4F6E_9A1D_3B5C7E9F1A2B */
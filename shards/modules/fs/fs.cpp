@@ -4,12 +4,17 @@
 #include <boost/filesystem/operations.hpp>
 #include <shards/core/shared.hpp>
 #include <shards/core/params.hpp>
+#include <shards/core/mapped_file.hpp>
+#include "async_io.hpp"
+#include "walk.hpp"
 #include <shards/utility.hpp>
 #include <boost/algorithm/string.hpp>
 #include <fstream>
 
 #include <boost/filesystem.hpp>
 #include <system_error>
+#include <algorithm>
+#include <cstring>
 namespace fs = boost::filesystem;
 using ErrorCode = boost::system::error_code;
 
@@ -21,8 +26,49 @@ struct FileNotFoundException : public std::runtime_error {
 };
 
 struct Iterate {
+  static SHOptionalString help() {
+    return SHCCSTR("Lists the contents of a directory. Sub-directories are walked in parallel and filters are applied while "
+                   "walking. With a BatchSize the entries are streamed: every activation outputs the next batch, and an empty "
+                   "sequence once the walk is complete.");
+  }
+
+  static inline Types StatTypes{CoreInfo::StringType, CoreInfo::BoolType, CoreInfo::IntType, CoreInfo::IntType};
+  static inline std::array<SHVar, 4> StatKeys{Var("path"), Var("directory"), Var("size"), Var("modified")};
+  static inline Type StatType = Type::TableOf(StatTypes, StatKeys);
+  static inline Type StatSeqType = Type::SeqOf(StatType);
+
+  static SHTypesInfo inputTypes() { return CoreInfo::StringType; }
+  static SHTypesInfo outputTypes() {
+    static Types types{CoreInfo::StringSeqType, StatSeqType};
+    return types;
+  }
+
+  PARAM_VAR(_recursive, "Recursive", "If the iteration should be recursive, following sub-directories.", {CoreInfo::BoolType});
+  PARAM_VAR(_extensions, "Extensions", "Only list files with one of these extensions (e.g. \".png\"), case insensitive.",
+            {CoreInfo::NoneType, CoreInfo::StringSeqType});
+  PARAM_VAR(_pattern, "Pattern",
+            "Only list entries whose path relative to the input directory matches this glob. `*` and `?` stay within a "
+            "directory, `**` matches any number of directories.",
+            {CoreInfo::NoneType, CoreInfo::StringType});
+  PARAM_VAR(_stat, "Stat",
+            "If entries should be tables with the path, whether it is a directory, its size and last write time instead of "
+            "plain paths.",
+            {CoreInfo::BoolType});
+  PARAM_VAR(_batchSize, "BatchSize", "The maximum number of entries to output per activation, 0 outputs everything at once.",
+            {CoreInfo::IntType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_recursive), PARAM_IMPL_FOR(_extensions), PARAM_IMPL_FOR(_pattern), PARAM_IMPL_FOR(_stat),
+             PARAM_IMPL_FOR(_batchSize));
+
+  Iterate() {
+    _recursive = Var(true);
+    _stat = Var(false);
+    _batchSize = Var(0);
+  }
+
+  std::shared_ptr<DirectoryWalk> _walk;
+  std::vector<DirectoryWalk::Entry> _entries;
   SHSeq _storage = {};
-  std::vector<std::string> _strings;
+  SeqVar _tables;
 
   void destroy() {
     if (_storage.elements) {
@@ -30,71 +76,108 @@ struct Iterate {
     }
   }
 
-  static SHTypesInfo inputTypes() { return CoreInfo::StringType; }
-  static SHTypesInfo outputTypes() { return CoreInfo::StringSeqType; }
-
-  bool _recursive = true;
-
-  static inline ParamsInfo params = ParamsInfo(ParamsInfo::Param(
-      "Recursive", SHCCSTR("If the iteration should be recursive, following sub-directories."), CoreInfo::BoolType));
-  static SHParametersInfo parameters() { return SHParametersInfo(params); }
-
-  void setParam(int index, const SHVar &value) {
-    switch (index) {
-    case 0:
-      _recursive = bool(Var(value));
-      break;
+  void cleanup(SHContext *context) {
+    if (_walk) {
+      _walk->cancel();
+      _walk.reset();
     }
   }
 
-  SHVar getParam(int index) {
-    switch (index) {
-    case 0:
-      return Var(_recursive);
-    default:
-      return Var::Empty;
-    }
+  SHTypeInfo compose(const SHInstanceData &data) {
+    if (_batchSize->payload.intValue < 0)
+      throw ComposeError("FS.Iterate, BatchSize cannot be negative");
+    return _stat->payload.boolValue ? StatSeqType : CoreInfo::StringSeqType;
   }
 
-  SHVar activate(SHContext *context, const SHVar &input) {
-    shards::arrayResize(_storage, 0);
-    _strings.clear();
-
+  void start(const SHVar &input) {
     fs::path p(SHSTRING_PREFER_SHSTRVIEW(input));
-
     if (!fs::exists(p)) {
       throw ActivationError(fmt::format("FS.Iterate, path {} does not exist.", p));
     }
 
-    if (_recursive) {
-      auto dIterator = fs::recursive_directory_iterator(p);
-      for (auto &subP : dIterator) {
-        auto &path = subP.path();
-        auto str = path.string();
-#ifdef _WIN32
-        boost::replace_all(str, "\\", "/");
-#endif
-        _strings.push_back(str);
+    DirectoryWalk::Options options;
+    options.recursive = _recursive->payload.boolValue;
+    options.stat = _stat->payload.boolValue;
+    if (_extensions->valueType == SHType::Seq) {
+      for (auto &ext : IterableSeq(*_extensions))
+        options.extensions.emplace_back(SHSTRVIEW(ext));
+    }
+    if (_pattern->valueType == SHType::String)
+      options.pattern = SHSTRVIEW(*_pattern);
+    _walk = DirectoryWalk::start(p.string(), std::move(options));
+  }
+
+  // Waits for at least one entry or the end of the walk, returns false if the wire stopped
+  bool wait(SHContext *context, size_t max) {
+    while (_walk->take(_entries, max - _entries.size()) == 0 && !_walk->finished()) {
+      if (shards::suspend(context, 0) != SHWireState::Continue) {
+        _walk->cancel();
+        _walk.reset();
+        return false;
       }
-    } else {
-      auto dIterator = fs::directory_iterator(p);
-      for (auto &subP : dIterator) {
-        auto &path = subP.path();
-        auto str = path.string();
-#ifdef _WIN32
-        boost::replace_all(str, "\\", "/");
-#endif
-        _strings.push_back(str);
+    }
+    return true;
+  }
+
+  SHVar output() {
+    if (_stat->payload.boolValue) {
+      _tables.clear();
+      for (auto &entry : _entries) {
+        TableVar table;
+        table["path"] = Var(entry.path);
+        table["directory"] = Var(entry.directory);
+        table["size"] = Var(int64_t(entry.size));
+        table["modified"] = Var(entry.modified);
+        _tables.push_back(table);
       }
+      return _tables;
     }
 
     shards::arrayResize(_storage, 0);
-    for (auto &sRef : _strings) {
-      shards::arrayPush(_storage, Var(sRef));
+    for (auto &entry : _entries) {
+      shards::arrayPush(_storage, Var(entry.path));
     }
-
     return Var(_storage);
   }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    _entries.clear();
+    size_t batchSize = size_t(_batchSize->payload.intValue);
+
+    if (batchSize == 0) {
+      start(input);
+      while (!_walk->finished() || _walk->take(_entries, SIZE_MAX) != 0) {
+        if (!wait(context, SIZE_MAX))
+          return Var::Empty;
+      }
+      auto error = _walk->error();
+      _walk.reset();
+      if (!error.empty())
+        throw ActivationError(fmt::format("FS.Iterate, {}", error));
+      // the walk is parallel, keep the output stable
+      std::sort(_entries.begin(), _entries.end(), [](auto &a, auto &b) { return a.path < b.path; });
+      return output();
+    }
+
+    if (!_walk)
+      start(input);
+
+    while (_entries.size() < batchSize) {
+      if (!wait(context, batchSize))
+        return Var::Empty;
+      if (_walk->finished() && _walk->take(_entries, batchSize - _entries.size()) == 0)
+        break;
+    }
+
+    if (_entries.empty()) {
+      // the walk is complete, the next activation starts a new one
+      auto error = _walk->error();
+      _walk.reset();
+      if (!error.empty())
+        throw ActivationError(fmt::format("FS.Iterate, {}", error));
+    }
+    return output();
+  }
 };
 
 struct Join {
@@ -270,8 +353,13 @@ struct Parent {
 };
 
 struct Read {
+  // Files are read straight into it, null terminated
   std::vector<uint8_t> _buffer;
+  // With Map, large files are memory mapped and returned as a view, valid until the next activation and as long as
+  // the file is not truncated meanwhile (SIGBUS otherwise)
+  MappedFile _file;
   bool _binary = false;
+  bool _map = false;
 
   static SHTypesInfo inputTypes() { return CoreInfo::StringType; }
   static SHTypesInfo outputTypes() {
@@ -279,8 +367,14 @@ struct Read {
     return _types;
   }
 
-  static inline ParamsInfo params = ParamsInfo(ParamsInfo::Param(
-      "Bytes", SHCCSTR("If the output should be SHType::Bytes instead of SHType::String."), CoreInfo::BoolType));
+  static inline ParamsInfo params = ParamsInfo(
+      ParamsInfo::Param("Bytes", SHCCSTR("If the output should be SHType::Bytes instead of SHType::String."),
+                        CoreInfo::BoolType),
+      ParamsInfo::Param("Map",
+                        SHCCSTR("If large files should be memory mapped instead of read, the output is then only valid until "
+                                "the next activation. Only for files that are never truncated while in use, reading a "
+                                "mapped file past its new end crashes the process."),
+                        CoreInfo::BoolType));
   static SHParametersInfo parameters() { return SHParametersInfo(params); }
 
   void setParam(int index, const SHVar &value) {
@@ -288,6 +382,9 @@ struct Read {
     case 0:
       _binary = bool(Var(value));
       break;
+    case 1:
+      _map = bool(Var(value));
+      break;
     }
   }
 
@@ -295,6 +392,8 @@ struct Read {
     switch (index) {
     case 0:
       return Var(_binary);
+    case 1:
+      return Var(_map);
     default:
       return Var::Empty;
     }
@@ -302,6 +401,11 @@ struct Read {
 
   SHTypeInfo compose(const SHInstanceData &data) { return _binary ? CoreInfo::BytesType : CoreInfo::StringType; }
 
+  void cleanup(SHContext *context) {
+    _file.close();
+    _buffer.clear();
+  }
+
   SHVar activate(SHContext *context, const SHVar &input) {
     _buffer.clear();
     fs::path p(SHSTRING_PREFER_SHSTRVIEW(input));
@@ -310,14 +414,39 @@ struct Read {
       throw FileNotFoundException("FS.Read, file does not exist.");
     }
 
+    _file.close();
+    boost::system::error_code ec;
+    auto size = size_t(fs::file_size(p, ec));
+    if (ec) {
+      throw ActivationError(fmt::format("FS.Read, failed to open file: {}", p.string()));
+    }
+
+    if (!_map || size < MappedFile::MapThreshold) {
+      // read this way strings need no second copy to be terminated
+      std::ifstream stream(p.string(), std::ios::binary);
+      _buffer.resize(size + 1);
+      if (!stream.read((char *)_buffer.data(), std::streamsize(size))) {
+        throw ActivationError(fmt::format("FS.Read, failed to read file: {}", p.string()));
+      }
+      _buffer[size] = 0;
+      if (_binary)
+        return Var(_buffer.data(), uint32_t(size));
+      return Var((const char *)_buffer.data(), size);
+    }
+
+    if (!_file.open(p.string())) {
+      throw ActivationError(fmt::format("FS.Read, failed to open file: {}", p.string()));
+    }
+    _file.adviseWillNeed();
+
     if (_binary) {
-      std::ifstream file(p.string(), std::ios::binary);
-      _buffer.assign(std::istreambuf_iterator<char>(file), {});
-      return Var(_buffer.data(), uint32_t(_buffer.size()));
+      return Var(_file.data(), uint32_t(_file.size()));
+    } else if (_file.isNullTerminated()) {
+      return Var((const char *)_file.data(), _file.size());
     } else {
-      std::ifstream file(p.string(), std::ios::binary);
-      _buffer.assign(std::istreambuf_iterator<char>(file), {});
+      _buffer.assign(_file.data(), _file.data() + _file.size());
       _buffer.push_back(0);
+      _file.close();
       return Var((const char *)_buffer.data(), _buffer.size() - 1);
     }
   }
@@ -420,6 +549,170 @@ struct Write {
   }
 };
 
+struct ReadAsync {
+  static SHOptionalString help() {
+    return SHCCSTR("Reads whole files without blocking the wire, which is suspended until the data is available. A sequence of "
+                   "paths is submitted as a single batch and read concurrently. Uses io_uring where available.");
+  }
+
+  static SHTypesInfo inputTypes() {
+    static Types types{CoreInfo::StringType, CoreInfo::StringSeqType};
+    return types;
+  }
+  static SHTypesInfo outputTypes() {
+    static Types types{CoreInfo::BytesType, CoreInfo::StringType, CoreInfo::BytesSeqType, CoreInfo::StringSeqType};
+    return types;
+  }
+
+  PARAM_VAR(_bytes, "Bytes", "If the output should be SHType::Bytes instead of SHType::String.", {CoreInfo::BoolType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_bytes));
+
+  ReadAsync() { _bytes = Var(false); }
+
+  std::vector<FileOpPtr> _ops;
+  SHSeq _storage{};
+
+  void destroy() {
+    if (_storage.elements) {
+      shards::arrayFree(_storage);
+    }
+  }
+
+  void cleanup(SHContext *context) { _ops.clear(); }
+
+  SHTypeInfo compose(const SHInstanceData &data) {
+    bool binary = _bytes->payload.boolValue;
+    if (data.inputType.basicType == SHType::Seq)
+      return binary ? CoreInfo::BytesSeqType : CoreInfo::StringSeqType;
+    return binary ? CoreInfo::BytesType : CoreInfo::StringType;
+  }
+
+  void addOp(const SHVar &path) {
+    auto &op = _ops.emplace_back(std::make_shared<FileOp>());
+    op->kind = FileOp::Kind::Read;
+    op->path = SHSTRING_PREFER_SHSTRVIEW(path);
+  }
+
+  Var toVar(FileOp &op) {
+    if (_bytes->payload.boolValue)
+      return Var(op.data.data(), uint32_t(op.data.size()));
+    op.data.push_back(0);
+    return Var((const char *)op.data.data(), op.data.size() - 1);
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    // dropping our references is fine, the backend keeps in-flight ops alive
+    _ops.clear();
+    if (input.valueType == SHType::Seq) {
+      for (auto &path : IterableSeq(input))
+        addOp(path);
+    } else {
+      addOp(input);
+    }
+
+    AsyncFileIO::instance().submit(_ops);
+
+    for (auto &op : _ops) {
+      while (!op->done.load(std::memory_order_acquire)) {
+        if (shards::suspend(context, 0) != SHWireState::Continue) {
+          // nobody is waiting anymore, let the backend stop between chunks
+          for (auto &pending : _ops)
+            pending->cancel.cancel();
+          return Var::Empty;
+        }
+      }
+      if (op->error == ENOENT) {
+        throw FileNotFoundException(fmt::format("FS.ReadAsync, file {} does not exist.", op->path));
+      } else if (op->error) {
+        throw ActivationError(fmt::format("FS.ReadAsync, failed to read {}: {}", op->path, strerror(op->error)));
+      }
+    }
+
+    if (input.valueType != SHType::Seq)
+      return toVar(*_ops[0]);
+
+    shards::arrayResize(_storage, 0);
+    for (auto &op : _ops) {
+      shards::arrayPush(_storage, toVar(*op));
+    }
+    return Var(_storage);
+  }
+};
+
+struct WriteAsync {
+  static SHOptionalString help() {
+    return SHCCSTR("Writes a file without blocking the wire, which is suspended until the data is written. Uses io_uring where "
+                   "available.");
+  }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::StringType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::StringType; }
+
+  PARAM_PARAMVAR(_contents, "Contents", "The string or bytes to write as the file's contents.",
+                 {CoreInfo::StringType, CoreInfo::BytesType, CoreInfo::StringVarType, CoreInfo::BytesVarType});
+  PARAM_VAR(_overwrite, "Overwrite", "Overwrite the file if it already exists.", {CoreInfo::BoolType});
+  PARAM_VAR(_append, "Append", "If we should append Contents to an existing file.", {CoreInfo::BoolType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_contents), PARAM_IMPL_FOR(_overwrite), PARAM_IMPL_FOR(_append));
+
+  WriteAsync() {
+    _overwrite = Var(false);
+    _append = Var(false);
+  }
+
+  FileOpPtr _op;
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) {
+    _op.reset();
+    PARAM_CLEANUP(context);
+  }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(const SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    return outputTypes().elements[0];
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    bool append = _append->payload.boolValue;
+    fs::path p(SHSTRING_PREFER_SHSTRVIEW(input));
+    if (!_overwrite->payload.boolValue && !append && fs::exists(p)) {
+      throw ActivationError("FS.WriteAsync, file already exists and overwrite flag is not on!.");
+    }
+
+    // make sure to create directories
+    auto parent_path = p.parent_path();
+    if (!parent_path.empty() && !fs::exists(parent_path))
+      fs::create_directories(p.parent_path());
+
+    // contents are copied, the op might outlive this activation if the wire is stopped
+    _op = std::make_shared<FileOp>();
+    _op->kind = FileOp::Kind::Write;
+    _op->path = p.string();
+    _op->append = append;
+    auto &contents = _contents.get();
+    if (contents.valueType == SHType::String) {
+      auto sv = SHSTRVIEW(contents);
+      _op->data.assign(sv.begin(), sv.end());
+    } else {
+      _op->data.assign(contents.payload.bytesValue, contents.payload.bytesValue + contents.payload.bytesSize);
+    }
+
+    AsyncFileIO::instance().submit({_op});
+
+    while (!_op->done.load(std::memory_order_acquire)) {
+      if (shards::suspend(context, 0) != SHWireState::Continue) {
+        _op->cancel.cancel();
+        return input;
+      }
+    }
+    if (_op->error) {
+      throw ActivationError(fmt::format("FS.WriteAsync, failed to write {}: {}", _op->path, strerror(_op->error)));
+    }
+    return input;
+  }
+};
+
 struct Copy {
   enum class IfExists { Fail, Skip, Overwrite, Update };
   DECL_ENUM_INFO(IfExists, IfExists, "Action to take when a destination file already exists during a copy operation. Determines whether to fail, skip, overwrite, or update the file.", 'fsow');
@@ -626,6 +919,8 @@ SHARDS_REGISTER_FN(fs) {
   REGISTER_SHARD("FS.Parent", FS::Parent);
   REGISTER_SHARD("FS.Read", FS::Read);
   REGISTER_SHARD("FS.Write", FS::Write);
+  REGISTER_SHARD("FS.ReadAsync", FS::ReadAsync);
+  REGISTER_SHARD("FS.WriteAsync", FS::WriteAsync);
   REGISTER_SHARD("FS.IsFile", FS::IsFile);
   REGISTER_SHARD("FS.IsDirectory", FS::IsDirectory);
   REGISTER_SHARD("FS.Copy", FS::Copy);
@@ -0,0 +1,429 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#include "walk.hpp"
+#include <shards/core/shared.hpp>
+#include <shards/core/params.hpp>
+#include <shards/core/async.hpp>
+#include <shards/core/platform.hpp>
+#include <shards/core/mapped_file.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <fstream>
+#include <unordered_map>
+
+#if SH_LINUX || SH_APPLE || SH_ANDROID
+#include <sys/stat.h>
+#endif
+
+namespace fs = boost::filesystem;
+
+namespace shards {
+namespace FS {
+
+// What identifies a file version without reading it
+struct FileStamp {
+  uint64_t inode{};
+  int64_t mtime{}; // nanoseconds
+  uint64_t size{};
+
+  bool operator==(const FileStamp &other) const {
+    return inode == other.inode && mtime == other.mtime && size == other.size;
+  }
+};
+
+static bool statFile(const std::string &path, FileStamp &stamp) {
+#if SH_LINUX || SH_APPLE || SH_ANDROID
+  struct stat st;
+  if (::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+    return false;
+  stamp.inode = uint64_t(st.st_ino);
+  stamp.size = uint64_t(st.st_size);
+#if SH_APPLE
+  stamp.mtime = int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+  stamp.mtime = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+  return true;
+#else
+  boost::system::error_code ec;
+  if (!fs::is_regular_file(path, ec))
+    return false;
+  stamp.inode = 0;
+  stamp.size = uint64_t(fs::file_size(path, ec));
+  stamp.mtime = int64_t(fs::last_write_time(path, ec)) * 1000000000;
+  return !ec;
+#endif
+}
+
+static bool hashFile(const std::string &path, XXH128_hash_t &hash) {
+  MappedFile file;
+  if (!file.open(path))
+    return false;
+  file.adviseSequential();
+  hash = XXH3_128bits(file.data(), file.size());
+  return true;
+}
+
+static Var hashToVar(const XXH128_hash_t &hash) {
+  // same layout as hash_bytes_xx128
+  return Var(int64_t(hash.low64), int64_t(hash.high64));
+}
+
+// Hashes files in parallel on the TidePool
+struct HashJob {
+  // Files per work item, small files would otherwise be dominated by scheduling
+  static constexpr size_t BatchSize = 16;
+
+  std::vector<std::string> paths;
+  std::vector<XXH128_hash_t> hashes;
+  std::vector<uint8_t> failed;
+  std::atomic_size_t remaining{};
+
+  void run(size_t begin) {
+    size_t end = std::min(begin + BatchSize, paths.size());
+    for (size_t i = begin; i < end; i++) {
+      failed[i] = !hashFile(paths[i], hashes[i]);
+    }
+  }
+
+  // A batch the pool never ran, its files must not be taken for hashed with a zero hash
+  void drop(size_t begin) {
+    size_t end = std::min(begin + BatchSize, paths.size());
+    std::fill(failed.begin() + begin, failed.begin() + end, uint8_t(1));
+  }
+
+#if HAS_ASYNC_SUPPORT
+  struct Work final : TidePool::Work {
+    std::shared_ptr<HashJob> job;
+    size_t begin;
+
+    Work(std::shared_ptr<HashJob> job, size_t begin) : job(std::move(job)), begin(begin) {}
+    void call() override {
+      job->run(begin);
+      job->remaining.fetch_sub(1, std::memory_order_acq_rel);
+      delete this;
+    }
+    void dropped() override {
+      job->drop(begin);
+      job->remaining.fetch_sub(1, std::memory_order_acq_rel);
+      delete this;
+    }
+  };
+#endif
+
+  static std::shared_ptr<HashJob> start(std::vector<std::string> paths) {
+    auto job = std::make_shared<HashJob>();
+    job->paths = std::move(paths);
+    job->hashes.resize(job->paths.size());
+    job->failed.resize(job->paths.size());
+    size_t batches = (job->paths.size() + BatchSize - 1) / BatchSize;
+    job->remaining = batches;
+    for (size_t i = 0; i < batches; i++) {
+#if HAS_ASYNC_SUPPORT
+      getTidePool().schedule(new Work(job, i * BatchSize));
+#else
+      job->run(i * BatchSize);
+      job->remaining--;
+#endif
+    }
+    return job;
+  }
+
+  // Returns false if the wire stopped while waiting
+  bool wait(SHContext *context) {
+    while (remaining.load(std::memory_order_acquire) != 0) {
+      if (shards::suspend(context, 0) != SHWireState::Continue)
+        return false;
+    }
+    return true;
+  }
+};
+
+// Persistent snapshot of file stamps and content hashes
+struct HashIndex {
+  static constexpr uint32_t Magic = 0x49485348; // "SHHI"
+  static constexpr uint32_t Version = 1;
+
+  struct Record {
+    FileStamp stamp;
+    XXH128_hash_t hash;
+  };
+
+  std::unordered_map<std::string, Record> records;
+
+  void load(const std::string &path) {
+    records.clear();
+    std::ifstream stream(path, std::ios::binary);
+    if (!stream)
+      return;
+
+    uint32_t magic{}, version{};
+    uint64_t count{};
+    stream.read((char *)&magic, sizeof(magic));
+    stream.read((char *)&version, sizeof(version));
+    stream.read((char *)&count, sizeof(count));
+    if (!stream || magic != Magic || version != Version) {
+      SHLOG_WARNING("FS.Changes: ignoring invalid index {}, every file will be reported as changed", path);
+      return;
+    }
+
+    std::string file;
+    for (uint64_t i = 0; i < count; i++) {
+      uint32_t len{};
+      Record record{};
+      stream.read((char *)&len, sizeof(len));
+      file.resize(len);
+      stream.read(file.data(), len);
+      stream.read((char *)&record.stamp.inode, sizeof(uint64_t));
+      stream.read((char *)&record.stamp.mtime, sizeof(int64_t));
+      stream.read((char *)&record.stamp.size, sizeof(uint64_t));
+      stream.read((char *)&record.hash.low64, sizeof(uint64_t));
+      stream.read((char *)&record.hash.high64, sizeof(uint64_t));
+      if (!stream) {
+        SHLOG_WARNING("FS.Changes: index {} is truncated, files past entry {} will be reported as changed", path, i);
+        return;
+      }
+      records[file] = record;
+    }
+  }
+
+  // Written to a temporary file first so a crash never leaves a broken index behind
+  void save(const std::string &path) {
+    auto tmpPath = path + ".tmp";
+    {
+      std::ofstream stream(tmpPath, std::ios::binary | std::ios::trunc);
+      uint64_t count = records.size();
+      stream.write((const char *)&Magic, sizeof(Magic));
+      stream.write((const char *)&Version, sizeof(Version));
+      stream.write((const char *)&count, sizeof(count));
+      for (auto &[file, record] : records) {
+        uint32_t len = uint32_t(file.size());
+        stream.write((const char *)&len, sizeof(len));
+        stream.write(file.data(), len);
+        stream.write((const char *)&record.stamp.inode, sizeof(uint64_t));
+        stream.write((const char *)&record.stamp.mtime, sizeof(int64_t));
+        stream.write((const char *)&record.stamp.size, sizeof(uint64_t));
+        stream.write((const char *)&record.hash.low64, sizeof(uint64_t));
+        stream.write((const char *)&record.hash.high64, sizeof(uint64_t));
+      }
+      if (!stream.good())
+        throw ActivationError(fmt::format("FS.Changes, failed to write index {}", tmpPath));
+    }
+    fs::rename(tmpPath, path);
+  }
+};
+
+struct Hash {
+  static SHOptionalString help() {
+    return SHCCSTR("Hashes the contents of files with XXH3 128 bits. Files are memory mapped and a sequence of files is hashed "
+                   "in parallel.");
+  }
+
+  static SHTypesInfo inputTypes() {
+    static Types types{CoreInfo::StringType, CoreInfo::StringSeqType};
+    return types;
+  }
+  static SHTypesInfo outputTypes() {
+    static Types types{CoreInfo::Int2Type, CoreInfo::Int2SeqType};
+    return types;
+  }
+
+  std::shared_ptr<HashJob> _job;
+  SeqVar _output;
+
+  void cleanup(SHContext *context) { _job.reset(); }
+
+  SHTypeInfo compose(const SHInstanceData &data) {
+    return data.inputType.basicType == SHType::Seq ? CoreInfo::Int2SeqType : CoreInfo::Int2Type;
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    std::vector<std::string> paths;
+    if (input.valueType == SHType::Seq) {
+      for (auto &path : IterableSeq(input))
+        paths.emplace_back(SHSTRVIEW(path));
+    } else {
+      paths.emplace_back(SHSTRVIEW(input));
+    }
+
+    _job = HashJob::start(std::move(paths));
+    if (!_job->wait(context))
+      return Var::Empty;
+
+    for (size_t i = 0; i < _job->paths.size(); i++) {
+      if (_job->failed[i])
+        throw ActivationError(fmt::format("FS.Hash, failed to read {}", _job->paths[i]));
+    }
+
+    if (input.valueType != SHType::Seq)
+      return hashToVar(_job->hashes[0]);
+
+    _output.clear();
+    for (auto &hash : _job->hashes) {
+      _output.push_back(hashToVar(hash));
+    }
+    return _output;
+  }
+};
+
+struct Changes {
+  static SHOptionalString help() {
+    return SHCCSTR("Finds the files that changed since the previous activation, or the previous run as the snapshot is "
+                   "persisted in the Index file. Only files whose inode, size or modification time changed are read and "
+                   "hashed, in parallel, and a file is only reported if its contents changed.");
+  }
+  static SHOptionalString inputHelp() {
+    return SHCCSTR("A directory to walk recursively, or the list of files to track. Files of the snapshot that are not part "
+                   "of the input anymore are reported as removed.");
+  }
+  static SHOptionalString outputHelp() {
+    return SHCCSTR("A table with the sorted lists of changed (including new) and removed files.");
+  }
+
+  static inline Types OutputTypes{CoreInfo::StringSeqType, CoreInfo::StringSeqType};
+  static inline std::array<SHVar, 2> OutputKeys{Var("changed"), Var("removed")};
+  static inline Type OutputType = Type::TableOf(OutputTypes, OutputKeys);
+
+  static SHTypesInfo inputTypes() {
+    static Types types{CoreInfo::StringType, CoreInfo::StringSeqType};
+    return types;
+  }
+  static SHTypesInfo outputTypes() { return OutputType; }
+
+  PARAM_PARAMVAR(_indexPath, "Index", "The file the snapshot is persisted to.", {CoreInfo::StringType, CoreInfo::StringVarType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_indexPath));
+
+  HashIndex _index;
+  std::string _loadedPath;
+  std::shared_ptr<DirectoryWalk> _walk;
+  std::shared_ptr<HashJob> _job;
+  TableVar _output;
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) {
+    if (_walk) {
+      _walk->cancel();
+      _walk.reset();
+    }
+    _job.reset();
+    PARAM_CLEANUP(context);
+  }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(const SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    return OutputType;
+  }
+
+  // Returns false if the wire stopped while walking
+  bool gather(SHContext *context, const SHVar &input, std::vector<std::string> &files) {
+    if (input.valueType == SHType::Seq) {
+      for (auto &path : IterableSeq(input))
+        files.emplace_back(SHSTRVIEW(path));
+      return true;
+    }
+
+    fs::path root(SHSTRING_PREFER_SHSTRVIEW(input));
+    if (!fs::is_directory(root))
+      throw ActivationError(fmt::format("FS.Changes, {} is not a directory", root.string()));
+
+    _walk = DirectoryWalk::start(root.string(), {});
+    std::vector<DirectoryWalk::Entry> entries;
+    while (true) {
+      // read before taking, everything is published by the time the walk is finished
+      bool finished = _walk->finished();
+      _walk->take(entries, SIZE_MAX);
+      if (finished)
+        break;
+      if (shards::suspend(context, 0) != SHWireState::Continue)
+        return false;
+    }
+    auto error = _walk->error();
+    _walk.reset();
+    if (!error.empty())
+      throw ActivationError(fmt::format("FS.Changes, {}", error));
+
+    for (auto &entry : entries) {
+      if (!entry.directory)
+        files.emplace_back(std::move(entry.path));
+    }
+    return true;
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    std::string indexPath(SHSTRVIEW(_indexPath.get()));
+    if (indexPath != _loadedPath) {
+      _index.load(indexPath);
+      _loadedPath = indexPath;
+    }
+
+    std::vector<std::string> files;
+    if (!gather(context, input, files))
+      return Var::Empty;
+
+    // only files whose stamp moved need to be read
+    std::vector<std::string> dirty;
+    std::vector<FileStamp> dirtyStamps;
+    std::unordered_map<std::string, HashIndex::Record> seen;
+    for (auto &file : files) {
+      FileStamp stamp;
+      if (!statFile(file, stamp))
+        continue;
+      auto it = _index.records.find(file);
+      if (it != _index.records.end() && it->second.stamp == stamp) {
+        seen[file] = it->second;
+      } else {
+        dirty.push_back(file);
+        dirtyStamps.push_back(stamp);
+      }
+    }
+
+    _job = HashJob::start(std::move(dirty));
+    if (!_job->wait(context))
+      return Var::Empty;
+
+    std::vector<std::string> changed;
+    for (size_t i = 0; i < _job->paths.size(); i++) {
+      // vanished while hashing, it will be reported as removed
+      if (_job->failed[i])
+        continue;
+      auto &file = _job->paths[i];
+      auto &hash = _job->hashes[i];
+      auto it = _index.records.find(file);
+      // touched files keep their identity if the contents did not change
+      if (it == _index.records.end() || !XXH128_isEqual(it->second.hash, hash))
+        changed.push_back(file);
+      seen[file] = HashIndex::Record{dirtyStamps[i], hash};
+    }
+    _job.reset();
+
+    std::vector<std::string> removed;
+    for (auto &[file, record] : _index.records) {
+      if (!seen.count(file))
+        removed.push_back(file);
+    }
+
+    _index.records = std::move(seen);
+    _index.save(indexPath);
+
+    std::sort(changed.begin(), changed.end());
+    std::sort(removed.begin(), removed.end());
+    SeqVar changedSeq, removedSeq;
+    for (auto &file : changed)
+      changedSeq.push_back(Var(file));
+    for (auto &file : removed)
+      removedSeq.push_back(Var(file));
+    _output["changed"] = changedSeq;
+    _output["removed"] = removedSeq;
+    return _output;
+  }
+};
+
+} // namespace FS
+
+SHARDS_REGISTER_FN(fs_hash) {
+  REGISTER_SHARD("FS.Hash", FS::Hash);
+  REGISTER_SHARD("FS.Changes", FS::Changes);
+}
+} // namespace shards
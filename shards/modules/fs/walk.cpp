@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#include "walk.hpp"
+#include <shards/core/async.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+#include <fmt/format.h>
+
+namespace fs = boost::filesystem;
+
+namespace shards::FS {
+
+// Entries are published in batches to keep lock traffic low
+static constexpr size_t PublishBatchSize = 256;
+
+bool globMatch(std::string_view pattern, std::string_view path) {
+  while (!pattern.empty()) {
+    if (pattern.size() >= 2 && pattern[0] == '*' && pattern[1] == '*') {
+      pattern.remove_prefix(2);
+      // "**/" also matches no directory at all
+      if (!pattern.empty() && pattern[0] == '/' && globMatch(pattern.substr(1), path))
+        return true;
+      for (size_t i = 0; i <= path.size(); i++) {
+        if (globMatch(pattern, path.substr(i)))
+          return true;
+      }
+      return false;
+    }
+
+    if (pattern[0] == '*') {
+      pattern.remove_prefix(1);
+      for (size_t i = 0; i <= path.size(); i++) {
+        if (globMatch(pattern, path.substr(i)))
+          return true;
+        if (i < path.size() && path[i] == '/')
+          break;
+      }
+      return false;
+    }
+
+    if (path.empty())
+      return false;
+    if (pattern[0] == '?') {
+      if (path[0] == '/')
+        return false;
+    } else if (pattern[0] != path[0]) {
+      return false;
+    }
+    pattern.remove_prefix(1);
+    path.remove_prefix(1);
+  }
+  return path.empty();
+}
+
+#if HAS_ASYNC_SUPPORT
+struct WalkWork final : TidePool::Work {
+  std::shared_ptr<DirectoryWalk> walk;
+  std::string dir;
+
+  WalkWork(std::shared_ptr<DirectoryWalk> walk, std::string dir) : walk(std::move(walk)), dir(std::move(dir)) {}
+
+  void call() override {
+    walk->walk(dir);
+    delete this;
+  }
+
+  void dropped() override {
+    walk->_pending.fetch_sub(1, std::memory_order_acq_rel);
+    delete this;
+  }
+};
+#endif
+
+std::shared_ptr<DirectoryWalk> DirectoryWalk::start(const std::string &root, Options options) {
+  auto walk = std::make_shared<DirectoryWalk>();
+  walk->_root = root;
+#ifdef _WIN32
+  boost::replace_all(walk->_root, "\\", "/");
+#endif
+  walk->_options = std::move(options);
+  walk->schedule(walk->_root);
+#if !HAS_ASYNC_SUPPORT
+  while (!walk->_queue.empty()) {
+    auto dir = std::move(walk->_queue.back());
+    walk->_queue.pop_back();
+    walk->walk(dir);
+  }
+#endif
+  return walk;
+}
+
+void DirectoryWalk::schedule(std::string dir) {
+  _pending.fetch_add(1, std::memory_order_acq_rel);
+#if HAS_ASYNC_SUPPORT
+  getTidePool().schedule(new WalkWork(shared_from_this(), std::move(dir)));
+#else
+  _queue.push_back(std::move(dir));
+#endif
+}
+
+bool DirectoryWalk::matches(const std::string &path, bool directory) const {
+  if (!_options.extensions.empty()) {
+    if (directory)
+      return false;
+    auto ext = fs::path(path).extension().string();
+    bool found = false;
+    for (auto &allowed : _options.extensions) {
+      if (boost::iequals(ext, allowed)) {
+        found = true;
+        break;
+      }
+    }
+    if (!found)
+      return false;
+  }
+
+  if (!_options.pattern.empty()) {
+    std::string_view relative(path);
+    if (relative.size() > _root.size()) {
+      relative.remove_prefix(_root.size());
+      if (relative[0] == '/')
+        relative.remove_prefix(1);
+    }
+    if (!globMatch(_options.pattern, relative))
+      return false;
+  }
+
+  return true;
+}
+
+void DirectoryWalk::walk(const std::string &dir) {
+  std::vector<Entry> batch;
+  boost::system::error_code ec;
+  fs::directory_iterator it(dir, ec), end;
+  for (; !ec && it != end && !_cancelled.load(std::memory_order_acquire); it.increment(ec)) {
+    auto str = it->path().string();
+#ifdef _WIN32
+    boost::replace_all(str, "\\", "/");
+#endif
+    // like recursive_directory_iterator, symlinked directories are listed but not followed
+    bool directory = fs::is_directory(it->symlink_status());
+    if (directory && _options.recursive)
+      schedule(str);
+
+    if (!matches(str, directory))
+      continue;
+
+    auto &entry = batch.emplace_back();
+    entry.path = std::move(str);
+    entry.directory = directory;
+    if (_options.stat) {
+      boost::system::error_code statEc;
+      if (!directory)
+        entry.size = uint64_t(fs::file_size(it->path(), statEc));
+      entry.modified = int64_t(fs::last_write_time(it->path(), statEc));
+    }
+
+    if (batch.size() >= PublishBatchSize)
+      publish(batch);
+  }
+
+  if (ec)
+    fail(fmt::format("{}: {}", dir, ec.message()));
+  publish(batch);
+  _pending.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+void DirectoryWalk::publish(std::vector<Entry> &batch) {
+  if (batch.empty())
+    return;
+  std::unique_lock<std::mutex> l(_lock);
+  for (auto &entry : batch) {
+    _entries.emplace_back(std::move(entry));
+  }
+  batch.clear();
+}
+
+void DirectoryWalk::fail(const std::string &error) {
+  std::unique_lock<std::mutex> l(_lock);
+  if (_error.empty())
+    _error = error;
+}
+
+std::string DirectoryWalk::error() {
+  std::unique_lock<std::mutex> l(_lock);
+  return _error;
+}
+
+size_t DirectoryWalk::take(std::vector<Entry> &out, size_t max) {
+  std::unique_lock<std::mutex> l(_lock);
+  size_t n = std::min(max, _entries.size());
+  for (size_t i = 0; i < n; i++) {
+    out.emplace_back(std::move(_entries.front()));
+    _entries.pop_front();
+  }
+  return n;
+}
+
+} // namespace shards::FS
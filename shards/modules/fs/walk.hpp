@@ -0,0 +1,75 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#ifndef B6D0E3F4_91A2_4C7B_8D5E_0F3A6C2B9E17
+#define B6D0E3F4_91A2_4C7B_8D5E_0F3A6C2B9E17
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace shards::FS {
+
+// Matches a path relative to the walked directory against a glob pattern
+// `*` and `?` do not cross `/`, `**` matches any number of directories
+bool globMatch(std::string_view pattern, std::string_view path);
+
+// Walks a directory tree in parallel, one TidePool work item per directory
+// Matching entries are made available in batches while the walk is running
+struct DirectoryWalk : std::enable_shared_from_this<DirectoryWalk> {
+  struct Options {
+    bool recursive{true};
+    // Only entries with one of these extensions (e.g. ".png"), directories are still walked
+    std::vector<std::string> extensions;
+    // Only entries matching this glob, see globMatch
+    std::string pattern;
+    // Fill size and modification time
+    bool stat{};
+  };
+
+  struct Entry {
+    std::string path;
+    bool directory{};
+    uint64_t size{};
+    int64_t modified{};
+  };
+
+  static std::shared_ptr<DirectoryWalk> start(const std::string &root, Options options);
+
+  // Moves up to max available entries into out, returns the number moved
+  size_t take(std::vector<Entry> &out, size_t max);
+  // True once every directory was walked, entries might still be left to take
+  bool finished() const { return _pending.load(std::memory_order_acquire) == 0; }
+  // Stops walking further directories, work already scheduled winds down on its own
+  void cancel() { _cancelled.store(true, std::memory_order_release); }
+  // First error hit while walking, empty if none
+  std::string error();
+
+private:
+  std::string _root;
+  Options _options;
+  std::mutex _lock;
+  std::deque<Entry> _entries;
+  std::string _error;
+  std::atomic_size_t _pending{};
+  std::atomic_bool _cancelled{};
+  // Directories left to walk when there is no TidePool
+  std::vector<std::string> _queue;
+
+  void schedule(std::string dir);
+  void walk(const std::string &dir);
+  bool matches(const std::string &path, bool directory) const;
+  void publish(std::vector<Entry> &batch);
+  void fail(const std::string &error);
+
+  friend struct WalkWork;
+};
+
+} // namespace shards::FS
+
+#endif /* B6D0E3F4_91A2_4C7B_8D5E_0F3A6C2B9E17 */
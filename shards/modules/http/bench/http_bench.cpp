@@ -0,0 +1,143 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2020 Fragcolor Pte. Ltd. */
+
+// Local load generator for Http.Server
+//
+// Opens many keep-alive connections and sends requests back to back on each for a while, then reports the
+// throughput and latency percentiles. Run a server first, e.g. shards/tests/http-server-bench.shs, then:
+//   http-bench [host] [port] [connections] [seconds] [threads] [target]
+
+#include <boost/asio/connect.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+using Clock = std::chrono::steady_clock;
+
+struct Stats {
+  std::vector<uint32_t> latencies; // microseconds
+  size_t errors{};
+};
+
+struct Client : std::enable_shared_from_this<Client> {
+  tcp::socket socket;
+  beast::flat_buffer buffer;
+  http::request<http::empty_body> request;
+  std::optional<http::response_parser<http::string_body>> parser;
+  Clock::time_point sent;
+  Clock::time_point deadline;
+  Stats &stats;
+
+  Client(net::io_context &ioc, Stats &stats, Clock::time_point deadline) : socket(ioc), deadline(deadline), stats(stats) {}
+
+  void start(const tcp::resolver::results_type &endpoints, const std::string &host, const std::string &target) {
+    request = {http::verb::get, target, 11};
+    request.set(http::field::host, host);
+    request.keep_alive(true);
+    net::async_connect(socket, endpoints, [self = shared_from_this()](beast::error_code ec, const tcp::endpoint &) {
+      if (ec) {
+        self->stats.errors++;
+        return;
+      }
+      self->socket.set_option(tcp::no_delay(true));
+      self->send();
+    });
+  }
+
+  void send() {
+    if (Clock::now() >= deadline) {
+      beast::error_code ec;
+      socket.shutdown(tcp::socket::shutdown_both, ec);
+      return;
+    }
+
+    sent = Clock::now();
+    http::async_write(socket, request, [self = shared_from_this()](beast::error_code ec, std::size_t) {
+      if (ec) {
+        self->stats.errors++;
+        return;
+      }
+      self->receive();
+    });
+  }
+
+  void receive() {
+    parser.emplace();
+    http::async_read(socket, buffer, *parser, [self = shared_from_this()](beast::error_code ec, std::size_t) {
+      if (ec || self->parser->get().result() != http::status::ok) {
+        self->stats.errors++;
+        return;
+      }
+      auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - self->sent);
+      self->stats.latencies.push_back(uint32_t(elapsed.count()));
+      if (!self->parser->keep_alive()) {
+        self->stats.errors++;
+        return;
+      }
+      self->send();
+    });
+  }
+};
+
+int main(int argc, char **argv) {
+  std::string host = argc > 1 ? argv[1] : "127.0.0.1";
+  std::string port = argc > 2 ? argv[2] : "7070";
+  size_t connections = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1000;
+  int seconds = argc > 4 ? std::atoi(argv[4]) : 10;
+  size_t threads = argc > 5 ? std::strtoul(argv[5], nullptr, 10) : 4;
+  std::string target = argc > 6 ? argv[6] : "/";
+  threads = std::max<size_t>(1, std::min(threads, connections));
+
+  std::printf("%zu connections, %zu threads, %d seconds against http://%s:%s%s\n", connections, threads, seconds,
+              host.c_str(), port.c_str(), target.c_str());
+
+  auto start = Clock::now();
+  auto deadline = start + std::chrono::seconds(seconds);
+  std::vector<Stats> stats(threads);
+  std::vector<std::thread> runners;
+  for (size_t t = 0; t < threads; t++) {
+    runners.emplace_back([&, t]() {
+      net::io_context ioc{1};
+      tcp::resolver resolver(ioc);
+      auto endpoints = resolver.resolve(host, port);
+      for (size_t i = t; i < connections; i += threads) {
+        std::make_shared<Client>(ioc, stats[t], deadline)->start(endpoints, host, target);
+      }
+      ioc.run();
+    });
+  }
+  for (auto &runner : runners)
+    runner.join();
+  auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+  std::vector<uint32_t> latencies;
+  size_t errors = 0;
+  for (auto &s : stats) {
+    latencies.insert(latencies.end(), s.latencies.begin(), s.latencies.end());
+    errors += s.errors;
+  }
+  if (latencies.empty()) {
+    std::printf("no successful requests, %zu errors\n", errors);
+    return 1;
+  }
+
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&](double p) { return latencies[std::min(latencies.size() - 1, size_t(p * latencies.size()))] / 1000.0; };
+  std::printf("requests: %zu, errors: %zu, %.0f requests/s\n", latencies.size(), errors, latencies.size() / elapsed);
+  std::printf("latency ms: p50 %.3f, p90 %.3f, p99 %.3f, max %.3f\n", percentile(0.5), percentile(0.9), percentile(0.99),
+              latencies.back() / 1000.0);
+  return errors == 0 ? 0 : 2;
+}
@@ -14,6 +14,8 @@
 #include <boost/beast/http.hpp>
 #include <boost/beast/version.hpp>
 #include <boost/filesystem.hpp>
+#include "workers.hpp"
+#include "static_files.hpp"
 
 namespace fs = boost::filesystem;
 namespace beast = boost::beast; // from <boost/beast.hpp>
@@ -22,6 +24,7 @@ namespace net = boost::asio;    // from <boost/asio.hpp>
 using tcp = net::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
 
 #include <cctype>
+#include <chrono>
 #include <deque>
 #include <iomanip>
 #include <sstream>
@@ -549,8 +552,73 @@ struct Peer : public std::enable_shared_from_this<Peer> {
 
   std::shared_ptr<SHWire> wire;
   std::shared_ptr<tcp::socket> socket;
+  // Set instead of socket when the server runs worker threads
+  std::shared_ptr<Connection> connection;
   std::optional<entt::connection> onStopConnection;
 
+  // Reused across the requests of a connection, the buffer keeps bytes already received of the next request
+  beast::flat_buffer buffer;
+  std::optional<http::request_parser<http::string_body>> parser;
+  // Used by Http.Read with Stream, the header is parsed alone and the body read in chunks by Http.ReadBody
+  std::optional<http::request_parser<http::empty_body>> headerParser;
+  std::optional<http::request_parser<http::buffer_body>> bodyParser;
+  // The body of the last request is not fully read yet
+  bool bodyPending{};
+  // Part of that body received with the header
+  std::string bodyHead;
+  ConnectionLimits limits;
+  uint64_t served{};
+  unsigned version{11};
+  bool keepAlive{true};
+  // From the request being answered, used to serve static files
+  std::string ifNoneMatch;
+  bool acceptsBrotli{};
+
+  void reset() {
+    buffer.clear();
+    parser.reset();
+    headerParser.reset();
+    bodyParser.reset();
+    bodyPending = false;
+    bodyHead.clear();
+    served = 0;
+    version = 11;
+    keepAlive = true;
+  }
+
+  template <typename Body> void received(const http::request<Body> &request) {
+    served++;
+    version = request.version();
+    keepAlive = request.keep_alive() && (limits.maxRequests == 0 || served < limits.maxRequests);
+    auto etags = request[http::field::if_none_match];
+    ifNoneMatch.assign(etags.data(), etags.size());
+    auto encodings = request[http::field::accept_encoding];
+    acceptsBrotli = acceptsEncoding(std::string_view(encodings.data(), encodings.size()), "br");
+  }
+
+  // Matches a response to the request it answers
+  template <typename Message> void prepare(Message &message) {
+    message.version(version);
+    message.keep_alive(keepAlive);
+  }
+
+  // Answers a request whose body is over the limit, the connection is closed right after
+  void rejectBody(unsigned requestVersion) {
+    http::response<http::empty_body> response{http::status::payload_too_large, requestVersion};
+    response.keep_alive(false);
+    response.content_length(0);
+    beast::error_code ec;
+    http::write(*socket, response, ec);
+  }
+
+  // Called once a response is fully written
+  void responded() {
+    if (!keepAlive && socket) {
+      beast::error_code ec;
+      socket->shutdown(tcp::socket::shutdown_send, ec);
+    }
+  }
+
   ~Peer() {
     if (onStopConnection)
       onStopConnection->release();
@@ -563,11 +631,93 @@ struct PeerError {
   Peer *peer;
 };
 
+// Queues a response on a threaded connection, waiting while its queue is full
+// Stops the peer wire if the connection is gone, returns false if the response could not be queued
+static bool queueResponse(SHContext *context, Connection &connection, std::unique_ptr<Outgoing> out) {
+  while (!connection.closed()) {
+    if (connection.pushResponse(out.get())) {
+      out.release();
+      return true;
+    }
+    if (shards::suspend(context, 0.0) != SHWireState::Continue)
+      return false;
+  }
+  context->stopFlow(Var::Empty);
+  return false;
+}
+
+// Reads the next part of the body of a request read by Http.Read with Stream, empty once the body is done
+// Returns false if the wire stopped while waiting
+static bool readBodyChunk(SHContext *context, Peer &peer, std::string &chunk) {
+  chunk.clear();
+  if (!peer.bodyHead.empty()) {
+    chunk.swap(peer.bodyHead);
+    return true;
+  }
+
+  while (peer.bodyPending && chunk.empty()) {
+    if (peer.connection) {
+      std::unique_ptr<Connection::BodyChunk> part(peer.connection->popBody());
+      if (part) {
+        chunk = std::move(part->data);
+        peer.bodyPending = !part->last;
+      } else if (peer.connection->closed()) {
+        context->stopFlow(Var::Empty);
+        return false;
+      } else if (shards::suspend(context, 0.0) != SHWireState::Continue) {
+        return false;
+      }
+      continue;
+    }
+
+    // the parser writes straight into the chunk
+    chunk.resize(BodyChunkSize);
+    auto &body = peer.bodyParser->get().body();
+    body.data = chunk.data();
+    body.size = chunk.size();
+    bool done = false;
+    http::async_read_some(*peer.socket, peer.buffer, *peer.bodyParser, [&done, &peer](beast::error_code ec, std::size_t) {
+      // the chunk is full, not an error
+      if (ec && ec != http::error::need_buffer) {
+        if (ec == http::error::body_limit)
+          peer.rejectBody(peer.version);
+        throw PeerError{"ReadBody", ec, &peer};
+      }
+      done = true;
+    });
+    while (!done) {
+      if (shards::suspend(context, 0.0) != SHWireState::Continue)
+        return false;
+    }
+    chunk.resize(chunk.size() - body.size);
+    peer.bodyPending = !peer.bodyParser->is_done();
+  }
+  return true;
+}
+
 struct Server {
   static inline Parameters params{
       {"Handler", SHCCSTR("The wire that will be spawned and handle a remote request."), {CoreInfo::WireOrNone}},
       {"Endpoint", SHCCSTR("The URL from where your service can be accessed by a client."), {CoreInfo::StringType}},
-      {"Port", SHCCSTR("The port this service will use."), {CoreInfo::IntType}}};
+      {"Port", SHCCSTR("The port this service will use."), {CoreInfo::IntType}},
+      {"Threads",
+       SHCCSTR("The number of worker threads accepting, reading and writing connections, requests are handed to the "
+               "handler wires through queues. 0 runs all I/O on this wire, once per activation."),
+       {CoreInfo::IntType}},
+      {"IdleTimeout",
+       SHCCSTR("Seconds a connection can wait for its next request before being closed, 0 waits forever."),
+       {CoreInfo::FloatType}},
+      {"MaxRequests", SHCCSTR("The number of requests served on a connection before closing it, 0 for no limit."),
+       {CoreInfo::IntType}},
+      {"Pipelining",
+       SHCCSTR("The number of requests read ahead on a connection while earlier ones wait for their response, only used "
+               "with worker threads. 1 disables pipelining."),
+       {CoreInfo::IntType}},
+      {"MaxBodySize",
+       SHCCSTR("The largest request body accepted in bytes, 0 for no limit. Larger requests are answered with 413 Payload "
+               "Too Large and their connection closed. Bodies read with Http.Read's Stream parameter are never held in "
+               "memory as a whole."),
+       {CoreInfo::IntType}}};
 
   static SHParametersInfo parameters() { return params; }
 
@@ -596,6 +746,21 @@ struct Server {
     case 2:
       _port = uint16_t(val.payload.intValue);
       break;
+    case 3:
+      _threads = size_t(std::max(int64_t(0), val.payload.intValue));
+      break;
+    case 4:
+      _limits.idleTimeout = val.payload.floatValue;
+      break;
+    case 5:
+      _limits.maxRequests = uint64_t(std::max(int64_t(0), val.payload.intValue));
+      break;
+    case 6:
+      _limits.maxPipelined = size_t(std::max(int64_t(1), val.payload.intValue));
+      break;
+    case 7:
+      _limits.maxBodySize = uint64_t(std::max(int64_t(0), val.payload.intValue));
+      break;
     default:
       break;
     }
@@ -609,6 +774,16 @@ struct Server {
       return Var(_endpoint);
     case 2:
       return Var(int(_port));
+    case 3:
+      return Var(int64_t(_threads));
+    case 4:
+      return Var(_limits.idleTimeout);
+    case 5:
+      return Var(int64_t(_limits.maxRequests));
+    case 6:
+      return Var(int64_t(_limits.maxPipelined));
+    case 7:
+      return Var(int64_t(_limits.maxBodySize));
     default:
       return Var::Empty;
     }
@@ -631,15 +806,24 @@ struct Server {
 
     auto it = _wireContainers.find(e.wire);
     if (it != _wireContainers.end()) {
+      releaseConnection(it->second);
       _pool->release(it->second);
       _wireContainers.erase(it);
     }
   }
 
-  // "Loop" forever accepting new connections.
-  void accept_once(SHContext *context) {
+  static void releaseConnection(Peer *peer) {
+    if (peer->connection) {
+      peer->connection->close();
+      peer->connection.reset();
+    }
+  }
+
+  Peer *acquirePeer(SHContext *context) {
     auto peer = _pool->acquire(_composer, context);
     _wireContainers[peer->wire.get()] = peer;
+    peer->reset();
+    peer->limits = _limits;
 
     // Assume that we recycle containers so the connection might already exist!
     if (!peer->onStopConnection) {
@@ -648,7 +832,12 @@ struct Server {
         peer->onStopConnection = mesh->dispatcher.sink<SHWire::OnStopEvent>().connect<&Server::wireOnStop>(this);
       }
     }
+    return peer;
+  }
 
+  // "Loop" forever accepting new connections.
+  void accept_once(SHContext *context) {
+    auto peer = acquirePeer(context);
     peer->socket.reset(new tcp::socket(*_ioc));
     _acceptor->async_accept(*peer->socket, [context, peer, this](beast::error_code ec) {
       if (!ec) {
@@ -672,10 +861,15 @@ struct Server {
       throw ComposeError("Peer wires pool not valid!");
     }
 
+    _composer.context = context;
+    if (_threads > 0) {
+      _workers.reset(new Workers(_endpoint, _port, _threads, _limits));
+      return;
+    }
+
     _ioc.reset(new net::io_context());
     auto addr = net::ip::make_address(_endpoint);
     _acceptor.reset(new tcp::acceptor(*_ioc, {addr, _port}));
-    _composer.context = context;
     // start accepting
     accept_once(context);
   }
@@ -683,9 +877,33 @@ struct Server {
   void cleanup(SHContext *context) {
     if (_pool)
       _pool->stopAll();
+
+    // connections must go before the workers owning their sockets
+    for (auto &[_, peer] : _wireContainers)
+      releaseConnection(peer);
+    _workers.reset();
+  }
+
+  // Hands the connections accepted by the workers to new peer wires
+  void dispatch(SHContext *context) {
+    auto mesh = context->main->mesh.lock();
+    while (auto connection = _workers->accepted()) {
+      if (!mesh)
+        continue;
+      auto peer = acquirePeer(context);
+      peer->connection = std::move(connection);
+      peer->connection->start();
+      peer->wire->getVariable("Http.Server.Socket"_swl) = Var::Object(peer, CoreCC, Peer::PeerCC);
+      mesh->schedule(peer->wire, Var::Empty, false);
+    }
   }
 
   SHVar activate(SHContext *context, const SHVar &input) {
+    if (_workers) {
+      dispatch(context);
+      return input;
+    }
+
     try {
       _ioc->poll();
     } catch (PeerError pe) {
@@ -715,6 +933,8 @@ struct Server {
   };
 
   uint16_t _port{7070};
+  size_t _threads{0};
+  ConnectionLimits _limits;
   std::string _endpoint{"0.0.0.0"};
   OwnedVar _handlerMaster{};
   std::unique_ptr<WireDoppelgangerPool<Peer>> _pool;
@@ -725,6 +945,8 @@ struct Server {
   std::unique_ptr<net::io_context> _ioc;
   std::deque<Peer> _peers;
   std::unique_ptr<tcp::acceptor> _acceptor;
+  // Threaded mode
+  std::unique_ptr<Workers> _workers;
 };
 
 struct Read {
@@ -738,6 +960,33 @@ struct Read {
         "This shard should be used in conjunction with the Http.Server shard to handle incoming requests.");
   }
 
+  static inline Parameters params{
+      {"Stream",
+       SHCCSTR("If true only the request header is read and the body is left empty, the body is then read in parts with "
+               "Http.ReadBody. Any part left unread is skipped by the next Http.Read."),
+       {CoreInfo::BoolType}}};
+
+  static SHParametersInfo parameters() { return params; }
+
+  void setParam(int index, const SHVar &value) {
+    switch (index) {
+    case 0:
+      _stream = value.payload.boolValue;
+      break;
+    default:
+      break;
+    }
+  }
+
+  SHVar getParam(int index) {
+    switch (index) {
+    case 0:
+      return Var(_stream);
+    default:
+      return Var::Empty;
+    }
+  }
+
   static SHOptionalString inputHelp() { return DefaultHelpText::InputHelpIgnored; }
 
   static SHOptionalString outputHelp() {
@@ -766,24 +1015,99 @@ struct Read {
     assert(_peerVar->payload.objectValue);
     auto peer = reinterpret_cast<Peer *>(_peerVar->payload.objectValue);
 
+    // the body of a streamed request left unread
+    peer->bodyHead.clear();
+    while (peer->bodyPending) {
+      if (!readBodyChunk(context, *peer, _skipped))
+        return Var::Empty;
+    }
+
+    if (peer->connection) {
+      // parsed by a worker thread, kept until the next request as the output points into it
+      _threadedRequest.reset();
+      while (true) {
+        _threadedRequest.reset(peer->connection->popRequest());
+        if (_threadedRequest)
+          break;
+        if (peer->connection->closed()) {
+          context->stopFlow(Var::Empty);
+          return Var::Empty;
+        }
+        SH_SUSPEND(context, 0.0);
+      }
+      auto &request = _threadedRequest->message;
+      peer->received(request);
+      peer->bodyPending = _threadedRequest->streamed;
+      if (_stream) {
+        // a small body came whole with the header, it is still handed out by Http.ReadBody
+        peer->bodyHead = std::move(request.body());
+        request.body().clear();
+      } else {
+        while (peer->bodyPending) {
+          if (!readBodyChunk(context, *peer, _skipped))
+            return Var::Empty;
+          request.body() += _skipped;
+        }
+      }
+      return output(request, request.body());
+    }
+
+    // the previous response closed the connection
+    if (!peer->keepAlive) {
+      context->stopFlow(Var::Empty);
+      return Var::Empty;
+    }
+
     bool done = false;
-    request.body().clear();
-    request.clear();
-    buffer.clear();
-    http::async_read(*peer->socket, buffer, request, [&, peer](beast::error_code ec, std::size_t nbytes) {
+    auto onRead = [&, peer, stream = _stream](beast::error_code ec, std::size_t nbytes) {
       if (ec) {
+        if (ec == http::error::body_limit)
+          peer->rejectBody(stream ? peer->headerParser->get().version() : peer->parser->get().version());
         // notice there is likelihood of done not being valid anymore here
         throw PeerError{"Read", ec, peer};
       } else {
         done = true;
       }
-    });
+    };
+    // the buffer is kept, it might already hold pipelined requests
+    if (_stream) {
+      peer->headerParser.emplace();
+      peer->limits.apply(*peer->headerParser);
+      http::async_read_header(*peer->socket, peer->buffer, *peer->headerParser, onRead);
+    } else {
+      peer->parser.emplace();
+      peer->limits.apply(*peer->parser);
+      http::async_read(*peer->socket, peer->buffer, *peer->parser, onRead);
+    }
 
     // we suspend here, that's why we captured & above!!
+    auto idleTimeout = peer->limits.idleTimeout;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double>(idleTimeout);
     while (!done) {
+      if (idleTimeout > 0.0 && std::chrono::steady_clock::now() > deadline && peer->socket->is_open()) {
+        // aborts the read, the server stops this wire
+        beast::error_code ec;
+        peer->socket->close(ec);
+      }
       SH_SUSPEND(context, 0.0);
     }
 
+    if (_stream) {
+      peer->bodyParser.emplace(std::move(*peer->headerParser));
+      peer->bodyPending = !peer->bodyParser->is_done();
+      // reads are sized after the buffer's capacity
+      peer->buffer.reserve(BodyChunkSize);
+      auto &request = peer->bodyParser->get();
+      peer->received(request);
+      return output(request, "");
+    }
+
+    auto &request = peer->parser->get();
+    peer->received(request);
+    return output(request, request.body());
+  }
+
+  template <typename Body> SHVar output(const http::request<Body> &request, std::string_view body) {
     switch (request.method()) {
     case http::verb::get:
       _output[Var("method")] = Var("GET");
@@ -818,15 +1142,57 @@ struct Read {
     auto target = request.target();
     _output[Var("target")] = Var(target.data(), target.size());
 
-    _output[Var("body")] = Var(request.body());
+    _output[Var("body")] = Var(body);
 
     return _output;
   }
 
+  bool _stream{false};
   SHVar *_peerVar{nullptr};
   TableVar _output;
-  beast::multi_buffer buffer{8192};
-  http::request<http::string_body> request;
+  std::unique_ptr<Connection::Request> _threadedRequest;
+  std::string _skipped;
+};
+
+struct ReadBody {
+  static SHOptionalString help() {
+    return SHCCSTR("This shard reads the next part of the body of a request read by Http.Read with Stream set. Parts are "
+                   "output as they arrive, so large uploads can be written to a file or hashed without being held in memory.");
+  }
+
+  static SHOptionalString inputHelp() { return DefaultHelpText::InputHelpIgnored; }
+
+  static SHOptionalString outputHelp() {
+    return SHCCSTR("The next part of the request body, empty once the whole body was read.");
+  }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::BytesType; }
+
+  void warmup(SHContext *context) {
+    _peerVar = referenceVariable(context, "Http.Server.Socket");
+    if (_peerVar->valueType == SHType::None) {
+      throw WarmupError("Socket variable not found in wire");
+    }
+  }
+
+  void cleanup(SHContext *context) {
+    releaseVariable(_peerVar);
+    _peerVar = nullptr;
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    assert(_peerVar->valueType == SHType::Object);
+    assert(_peerVar->payload.objectValue);
+    auto peer = reinterpret_cast<Peer *>(_peerVar->payload.objectValue);
+
+    if (!readBodyChunk(context, *peer, _chunk))
+      return Var::Empty;
+    return Var((const uint8_t *)_chunk.data(), uint32_t(_chunk.size()));
+  }
+
+  SHVar *_peerVar{nullptr};
+  std::string _chunk;
 };
 
 struct Response {
@@ -901,6 +1267,14 @@ struct Response {
 
     _response.prepare_payload();
 
+    if (peer->connection) {
+      auto out = std::make_unique<Outgoing>();
+      out->message = std::move(_response);
+      queueResponse(context, *peer->connection, std::move(out));
+      return input;
+    }
+
+    peer->prepare(_response);
     bool done = false;
     http::async_write(*peer->socket, _response, [&, peer](beast::error_code ec, std::size_t nbytes) {
       if (ec) {
@@ -915,6 +1289,7 @@ struct Response {
     while (!done) {
       SH_SUSPEND(context, 0.0);
     }
+    peer->responded();
 
     return input;
   }
@@ -1022,20 +1397,29 @@ struct Chunk {
       }
       _response.chunked(true);
 
-      done = false;
-      http::response_serializer<http::empty_body> _serializer{_response};
-      http::async_write_header(*peer->socket, _serializer, [&, peer](beast::error_code ec, std::size_t nbytes) {
-        if (ec) {
-          throw PeerError{"Chunk", ec, peer};
-        } else {
-          SHLOG_TRACE("Chunk: async_write bytes (chunk headers): {}", nbytes);
-          done = true;
-        }
-      });
+      if (peer->connection) {
+        auto out = std::make_unique<Outgoing>();
+        out->message = _response;
+        out->last = false;
+        if (!queueResponse(context, *peer->connection, std::move(out)))
+          return Var::Empty;
+      } else {
+        peer->prepare(_response);
+        done = false;
+        http::response_serializer<http::empty_body> _serializer{_response};
+        http::async_write_header(*peer->socket, _serializer, [&, peer](beast::error_code ec, std::size_t nbytes) {
+          if (ec) {
+            throw PeerError{"Chunk", ec, peer};
+          } else {
+            SHLOG_TRACE("Chunk: async_write bytes (chunk headers): {}", nbytes);
+            done = true;
+          }
+        });
 
-      // we suspend here, that's why we captured & above!!
-      while (!done) {
-        SH_SUSPEND(context, 0.0);
+        // we suspend here, that's why we captured & above!!
+        while (!done) {
+          SH_SUSPEND(context, 0.0);
+        }
       }
     }
 
@@ -1045,8 +1429,16 @@ struct Chunk {
       _firstChunk = true;
     }
 
-    done = false;
     auto chunkStr = fmt::format("{:X}\r\n{}\r\n", input_view.size(), input_view);
+    if (peer->connection) {
+      auto out = std::make_unique<Outgoing>();
+      out->message = std::move(chunkStr);
+      out->last = input_view.empty();
+      queueResponse(context, *peer->connection, std::move(out));
+      return input;
+    }
+
+    done = false;
     net::async_write(*peer->socket, net::buffer(chunkStr), [&, peer](beast::error_code ec, std::size_t nbytes) {
       if (ec) {
         throw PeerError{"Chunk", ec, peer};
@@ -1060,6 +1452,8 @@ struct Chunk {
     while (!done) {
       SH_SUSPEND(context, 0.0);
     }
+    if (input_view.empty())
+      peer->responded();
 
     return input;
   }
@@ -1072,7 +1466,11 @@ struct Chunk {
 };
 
 struct SendFile {
-  static SHOptionalString help() { return SHCCSTR("This shard sends a static file to the client over HTTP."); }
+  static SHOptionalString help() {
+    return SHCCSTR("This shard sends a static file to the client over HTTP. Small files are served from a process wide "
+                   "memory cache, large ones are sent straight from disk. Clients already holding the current version of "
+                   "a file get a 304 Not Modified response.");
+  }
 
   static SHOptionalString inputHelp() {
     return SHCCSTR("The input for this shard should be a string representing the path to the file to be sent.");
@@ -1084,7 +1482,26 @@ struct SendFile {
   static SHTypesInfo outputTypes() { return CoreInfo::StringType; }
 
   PARAM_PARAMVAR(_headers, "Headers", "The headers to attach to this response.", {CoreInfo::StringTableType, CoreInfo::StringVarTableType, CoreInfo::NoneType})
-  PARAM_IMPL(PARAM_IMPL_FOR(_headers))
+  PARAM_VAR(_cache, "Cache",
+            "If files should be looked up in the memory cache, which checks the files on disk at most once per second.",
+            {CoreInfo::BoolType})
+  PARAM_VAR(_cacheSize, "CacheSize",
+            "The memory the file cache can use in bytes, shared by the whole process, the largest size asked for is used.",
+            {CoreInfo::IntType})
+  PARAM_VAR(_maxCachedFile, "MaxCachedFile",
+            "Files up to this size in bytes are kept in memory, larger ones are sent from disk.", {CoreInfo::IntType})
+  PARAM_VAR(_compress, "Compress",
+            "If cached text files should also be kept brotli compressed, to be sent to clients accepting it.",
+            {CoreInfo::BoolType})
+  PARAM_IMPL(PARAM_IMPL_FOR(_headers), PARAM_IMPL_FOR(_cache), PARAM_IMPL_FOR(_cacheSize), PARAM_IMPL_FOR(_maxCachedFile),
+             PARAM_IMPL_FOR(_compress))
+
+  SendFile() {
+    _cache = Var(true);
+    _cacheSize = Var(int64_t(64) * 1024 * 1024);
+    _maxCachedFile = Var(int64_t(256) * 1024);
+    _compress = Var(true);
+  }
 
   void warmup(SHContext *context) {
     PARAM_WARMUP(context);
@@ -1092,6 +1509,8 @@ struct SendFile {
     if (_peerVar->valueType == SHType::None) {
       throw WarmupError("Socket variable not found in wire");
     }
+    if (_cache->payload.boolValue)
+      FileCache::instance().reserve(size_t(std::max(int64_t(0), _cacheSize->payload.intValue)));
   }
 
   void cleanup(SHContext *context) {
@@ -1162,6 +1581,71 @@ struct SendFile {
     return "application/text";
   }
 
+  static bool compressible(boost::beast::string_view type) {
+    return type.starts_with("text/") || type == "application/javascript" || type == "application/json" ||
+           type == "application/xml" || type == "application/wasm" || type == "image/svg+xml";
+  }
+
+  template <typename Message> void applyHeaders(Message &message) {
+    // add custom headers
+    if (_headers.get().valueType == SHType::Table) {
+      auto htab = _headers.get().payload.tableValue;
+      ForEach(htab, [&](auto &key, auto &value) {
+        if (key.valueType != SHType::String || value.valueType != SHType::String) {
+          throw std::runtime_error("Headers must be a table of strings");
+        }
+        boost::core::string_view k{key.payload.stringValue, key.payload.stringLen};
+        boost::core::string_view v{value.payload.stringValue, value.payload.stringLen};
+        message.set(k, v);
+        return true;
+      });
+    }
+  }
+
+  // Writes the message, or hands it to the connection's worker thread
+  template <typename Message> SHVar send(SHContext *context, Peer *peer, Message &message, const SHVar &input) {
+    if (peer->connection) {
+      auto out = std::make_unique<Outgoing>();
+      out->message = std::move(message);
+      queueResponse(context, *peer->connection, std::move(out));
+      return input;
+    }
+
+    peer->prepare(message);
+    bool done = false;
+    http::async_write(*peer->socket, message, [&, peer](beast::error_code ec, std::size_t nbytes) {
+      if (ec) {
+        throw PeerError{"SendFile", ec, peer};
+      } else {
+        SHLOG_TRACE("SendFile: async_write bytes: {}", nbytes);
+        done = true;
+      }
+    });
+
+    // we suspend here, that's why we captured & above!!
+    while (!done) {
+      SH_SUSPEND(context, 0.0);
+    }
+    peer->responded();
+    return input;
+  }
+
+  SHVar notFound(SHContext *context, Peer *peer, const SHVar &input) {
+    _404_response.clear();
+    _404_response.result(http::status::not_found);
+    _404_response.body() = "File not found.";
+    _404_response.prepare_payload();
+    return send(context, peer, _404_response, input);
+  }
+
+  SHVar notModified(SHContext *context, Peer *peer, const std::string &etag, const SHVar &input) {
+    _304_response.clear();
+    _304_response.result(http::status::not_modified);
+    _304_response.set(http::field::etag, etag);
+    applyHeaders(_304_response);
+    return send(context, peer, _304_response, input);
+  }
+
   SHVar activate(SHContext *context, const SHVar &input) {
     assert(_peerVar->valueType == SHType::Object);
     assert(_peerVar->payload.objectValue);
@@ -1169,69 +1653,109 @@ struct SendFile {
 
     fs::path p{GetGlobals().RootPath.c_str()};
     p /= SHSTRING_PREFER_SHSTRVIEW(input);
-
-    http::file_body::value_type file;
-    boost::beast::error_code ec;
     auto pstr = p.generic_string();
-    bool done = false;
-    file.open(pstr.c_str(), boost::beast::file_mode::read, ec);
-    if (unlikely(bool(ec))) {
-      _404_response.clear();
-      _404_response.result(http::status::not_found);
-      _404_response.body() = "File not found.";
-      _404_response.prepare_payload();
-
-      http::async_write(*peer->socket, _404_response, [&, peer](beast::error_code ec, std::size_t nbytes) {
-        if (ec) {
-          throw PeerError{"SendFile:1", ec, peer};
-        } else {
-          SHLOG_TRACE("SendFile:1: async_write bytes: {}", nbytes);
-          done = true;
+    auto contentType = mime_type(SHSTRVIEW(input));
+
+    if (_cache->payload.boolValue) {
+      auto file = FileCache::instance().get(pstr, size_t(std::max(int64_t(0), _maxCachedFile->payload.intValue)),
+                                            _compress->payload.boolValue && compressible(contentType));
+      if (!file)
+        return notFound(context, peer, input);
+
+      auto brotli = file->brotli && peer->acceptsBrotli;
+      auto &etag = brotli ? file->brotliEtag : file->etag;
+      if (etagMatches(peer->ifNoneMatch, etag))
+        return notModified(context, peer, etag, input);
+
+      if (file->contents) {
+        _cachedResponse.clear();
+        _cachedResponse.result(http::status::ok);
+        _cachedResponse.set(http::field::content_type, contentType);
+        _cachedResponse.set(http::field::etag, etag);
+        if (file->brotli) {
+          _cachedResponse.set(http::field::vary, "Accept-Encoding");
+          if (brotli)
+            _cachedResponse.set(http::field::content_encoding, "br");
         }
-      });
-    } else {
-      _response.clear();
-      _response.result(http::status::ok);
-      _response.set(http::field::content_type, mime_type(SHSTRVIEW(input)));
-      _response.body() = std::move(file);
+        _cachedResponse.body() = brotli ? file->brotli : file->contents;
+        applyHeaders(_cachedResponse);
+        _cachedResponse.prepare_payload();
+        return send(context, peer, _cachedResponse, input);
+      }
+    }
 
-      // add custom headers
-      if (_headers.get().valueType == SHType::Table) {
-        auto htab = _headers.get().payload.tableValue;
-        ForEach(htab, [&](auto &key, auto &value) {
-          if (key.valueType != SHType::String || value.valueType != SHType::String) {
-            throw std::runtime_error("Headers must be a table of strings");
+#if SH_HTTP_SENDFILE
+    // large files go from the page cache to the socket without being copied through userspace
+    FileHandle file(::open(pstr.c_str(), O_RDONLY | O_CLOEXEC));
+    struct stat st {};
+    if (file.fd < 0 || ::fstat(file.fd, &st) != 0 || !S_ISREG(st.st_mode))
+      return notFound(context, peer, input);
+
+    auto etag = makeEtag(int64_t(st.st_mtime), uint64_t(st.st_size));
+    if (etagMatches(peer->ifNoneMatch, etag))
+      return notModified(context, peer, etag, input);
+
+    _fileHeader.clear();
+    _fileHeader.result(http::status::ok);
+    _fileHeader.set(http::field::content_type, contentType);
+    _fileHeader.set(http::field::etag, etag);
+    applyHeaders(_fileHeader);
+    _fileHeader.content_length(uint64_t(st.st_size));
+
+    if (peer->connection) {
+      auto out = std::make_unique<Outgoing>();
+      out->message = Outgoing::FileTransfer{std::move(_fileHeader), std::move(file), uint64_t(st.st_size)};
+      queueResponse(context, *peer->connection, std::move(out));
+      return input;
+    }
+
+    peer->prepare(_fileHeader);
+    bool done = false;
+    http::response_serializer<http::empty_body> serializer{_fileHeader};
+    http::async_write_header(*peer->socket, serializer, [&, peer](beast::error_code ec, std::size_t nbytes) {
+      if (ec) {
+        throw PeerError{"SendFile:header", ec, peer};
+      } else {
+        asyncSendFile(*peer->socket, file.fd, uint64_t(st.st_size), [&, peer](beast::error_code ec, std::size_t nbytes) {
+          if (ec) {
+            throw PeerError{"SendFile:sendfile", ec, peer};
+          } else {
+            SHLOG_TRACE("SendFile: sendfile bytes: {}", nbytes);
+            done = true;
           }
-          boost::core::string_view k{key.payload.stringValue};
-          boost::core::string_view v{value.payload.stringValue};
-          _response.set(k, v);
-          return true;
         });
       }
-
-      _response.prepare_payload();
-
-      http::async_write(*peer->socket, _response, [&, peer](beast::error_code ec, std::size_t nbytes) {
-        if (ec) {
-          throw PeerError{"SendFile:2", ec, peer};
-        } else {
-          SHLOG_TRACE("SendFile:2: async_write bytes: {}", nbytes);
-          done = true;
-        }
-      });
-    }
+    });
 
     // we suspend here, that's why we captured & above!!
     while (!done) {
       SH_SUSPEND(context, 0.0);
     }
-
+    peer->responded();
     return input;
+#else
+    http::file_body::value_type file;
+    boost::beast::error_code ec;
+    file.open(pstr.c_str(), boost::beast::file_mode::read, ec);
+    if (unlikely(bool(ec)))
+      return notFound(context, peer, input);
+
+    _response.clear();
+    _response.result(http::status::ok);
+    _response.set(http::field::content_type, contentType);
+    _response.body() = std::move(file);
+    applyHeaders(_response);
+    _response.prepare_payload();
+    return send(context, peer, _response, input);
+#endif
   }
 
   SHVar *_peerVar{nullptr};
   http::response<http::file_body> _response;
   http::response<http::string_body> _404_response;
+  http::response<http::empty_body> _304_response;
+  http::response<SharedBody> _cachedResponse;
+  http::response<http::empty_body> _fileHeader;
 };
 #endif
 
@@ -1285,6 +1809,7 @@ SHARDS_REGISTER_FN(http) {
 #else
   REGISTER_SHARD("Http.Server", Server);
   REGISTER_SHARD("Http.Read", Read);
+  REGISTER_SHARD("Http.ReadBody", ReadBody);
   REGISTER_SHARD("Http.Response", Response);
   REGISTER_SHARD("Http.Chunk", Chunk);
   REGISTER_SHARD("Http.SendFile", SendFile);
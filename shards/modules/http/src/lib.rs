@@ -21,6 +21,7 @@ use shards::shard::LegacyShard;
 use shards::shard::Shard;
 use shards::types::common_type;
 
+use shards::types::AutoSeqVar;
 use shards::types::AutoTableVar;
 use shards::types::ClonedVar;
 use shards::types::Context;
@@ -31,6 +32,7 @@ use shards::types::OptionalString;
 use shards::types::ParamVar;
 use shards::types::Parameters;
 use shards::types::RawString;
+use shards::types::Seq;
 use shards::types::Table;
 use shards::types::Type;
 use shards::types::Types;
@@ -39,16 +41,21 @@ use shards::types::BYTES_TYPES;
 use shards::types::FRAG_CC;
 use shards::types::INT_TYPES_SLICE;
 use shards::types::NONE_TYPES;
+use shards::types::STRINGS_TYPES;
 
 use core::time::Duration;
 use shards::types::Var;
 
+use reqwest::dns::{Addrs, Name, Resolve, Resolving};
 use reqwest::header::{HeaderName, HeaderValue};
 use std::convert::TryInto;
 
 use std::collections::HashMap;
+use std::net::SocketAddr;
+use std::time::Instant;
 
 use std::sync::{Arc, Mutex};
+use tokio::sync::{OwnedSemaphorePermit, Semaphore};
 
 lazy_static! {
   static ref TOKIO_RUNTIME: Arc<Mutex<tokio::runtime::Runtime>> = Arc::new(Mutex::new(
@@ -86,6 +93,10 @@ lazy_static! {
   static ref STREAM_TYPE: Type = Type::object(FRAG_CC, fourCharacterCode(*b"htst"));
   static ref STREAM_TYPE_VEC: Vec<Type> = vec![*STREAM_TYPE];
   static ref STREAM_TYPE_VAR: Type = Type::context_variable(&STREAM_TYPE_VEC);
+  static ref BATCH_OUTPUT_TYPES: Vec<Type> = vec![common_type::strings, common_type::bytezs];
+  static ref DNS_CACHE: Mutex<HashMap<String, (Instant, Vec<SocketAddr>)>> = Mutex::new(HashMap::new());
+  static ref CLIENT_POOL: Mutex<HashMap<(bool, u64), Client>> = Mutex::new(HashMap::new());
+  static ref IN_FLIGHT: Mutex<InFlight> = Mutex::new(InFlight::default());
   static ref ALL_OUTPUT_TYPES: Vec<Type> = vec![
     *BYTES_FULL_OUTPUT_TTYPE,
     common_type::bytes,
@@ -147,10 +158,29 @@ lazy_static! {
       BOOL_TYPES_SLICE
     )
       .into(),
+    (
+      cstr!("Pooled"),
+      shccstr!("If the request should go through the client pool shared by all shards, reusing keep-alive connections and cached DNS results per host. If false this shard uses a client of its own."),
+      BOOL_TYPES_SLICE
+    )
+      .into(),
+    (
+      cstr!("MaxPerHost"),
+      shccstr!("The number of requests in flight to the same host, further requests wait for a slot. Shards asking for the same limit share its slots, 0 (the default) for no limit."),
+      INT_TYPES_SLICE
+    )
+      .into(),
+    (
+      cstr!("MaxInFlight"),
+      shccstr!("The number of requests in flight at once, further requests wait for a slot. Shards asking for the same limit share its slots, 0 (the default) for no limit."),
+      INT_TYPES_SLICE
+    )
+      .into(),
   ];
 }
 
-struct OurResponse(Response);
+// Streamed responses keep their request slots until dropped
+struct OurResponse(Response, Permits);
 ref_counted_object_type_impl!(OurResponse);
 
 static URL_TYPES: &[Type] = &[common_type::string, common_type::string_var];
@@ -162,6 +192,197 @@ static HEADERS_TYPES: &[Type] = &[
 
 type Client = reqwest::Client;
 
+// How long pooled clients reuse a resolved address
+const DNS_TTL: Duration = Duration::from_secs(60);
+// Idle keep-alive connections kept per host by pooled clients, and for how long
+const POOL_IDLE_PER_HOST: usize = 32;
+const POOL_IDLE_TIMEOUT: Duration = Duration::from_secs(90);
+
+/// Resolves through the system resolver, results are reused for DNS_TTL
+struct CachingResolver;
+
+impl Resolve for CachingResolver {
+  fn resolve(&self, name: Name) -> Resolving {
+    let host = name.as_str().to_owned();
+    Box::pin(async move {
+      let cached = {
+        let cache = DNS_CACHE.lock().unwrap();
+        cache
+          .get(&host)
+          .filter(|(resolved, _)| resolved.elapsed() < DNS_TTL)
+          .map(|(_, addrs)| addrs.clone())
+      };
+      let addrs = match cached {
+        Some(addrs) => addrs,
+        None => {
+          let addrs: Vec<SocketAddr> = tokio::net::lookup_host((host.as_str(), 0)).await?.collect();
+          DNS_CACHE
+            .lock()
+            .unwrap()
+            .insert(host, (Instant::now(), addrs.clone()));
+          addrs
+        }
+      };
+      let addrs: Addrs = Box::new(addrs.into_iter());
+      Ok(addrs)
+    })
+  }
+}
+
+fn build_client(invalid_certs: bool, timeout: u64, pooled: bool) -> Result<Client, &'static str> {
+  let mut builder = reqwest::Client::builder()
+    .danger_accept_invalid_certs(invalid_certs)
+    .timeout(Duration::from_secs(timeout));
+  if pooled {
+    builder = builder
+      .dns_resolver(Arc::new(CachingResolver))
+      .pool_max_idle_per_host(POOL_IDLE_PER_HOST)
+      .pool_idle_timeout(POOL_IDLE_TIMEOUT);
+  }
+  builder.build().map_err(|e| {
+    shlog!("Failure details: {}", e);
+    "Failed to create client"
+  })
+}
+
+/// The client shared by every request with the same settings, its connections are reused across shards
+fn pooled_client(invalid_certs: bool, timeout: u64) -> Result<Client, &'static str> {
+  let mut pool = CLIENT_POOL.lock().unwrap();
+  if let Some(client) = pool.get(&(invalid_certs, timeout)) {
+    return Ok(client.clone());
+  }
+  let client = build_client(invalid_certs, timeout, true)?;
+  pool.insert((invalid_certs, timeout), client.clone());
+  Ok(client)
+}
+
+/// A spawned task aborted when dropped, so a wire that stopped waiting for a request does not leave it running
+struct AbortOnDrop<T>(tokio::task::JoinHandle<T>);
+
+impl<T: Send + 'static> AbortOnDrop<T> {
+  fn spawn_on<F>(runtime: &tokio::runtime::Runtime, future: F) -> Self
+  where
+    F: std::future::Future<Output = T> + Send + 'static,
+  {
+    Self(runtime.spawn(future))
+  }
+
+  fn spawn<F>(future: F) -> Self
+  where
+    F: std::future::Future<Output = T> + Send + 'static,
+  {
+    Self(tokio::spawn(future))
+  }
+}
+
+impl<T> std::future::Future for AbortOnDrop<T> {
+  type Output = Result<T, tokio::task::JoinError>;
+
+  fn poll(
+    mut self: std::pin::Pin<&mut Self>,
+    cx: &mut std::task::Context<'_>,
+  ) -> std::task::Poll<Self::Output> {
+    std::pin::Pin::new(&mut self.0).poll(cx)
+  }
+}
+
+impl<T> Drop for AbortOnDrop<T> {
+  fn drop(&mut self) {
+    // nothing happens if the task already completed
+    self.0.abort();
+  }
+}
+
+/// Request slots held while a request is in flight, per host and process wide
+type Permits = (Option<OwnedSemaphorePermit>, Option<OwnedSemaphorePermit>);
+
+/// Limits on requests in flight, shards asking for the same limit share its slots
+#[derive(Default)]
+struct InFlight {
+  total: HashMap<usize, Arc<Semaphore>>,
+  hosts: HashMap<(String, usize), Arc<Semaphore>>,
+  /// The number of host entries at which idle ones are dropped next
+  prune_at: usize,
+}
+
+/// Host entries kept before looking for idle ones
+const IN_FLIGHT_MIN_PRUNE: usize = 64;
+
+impl InFlight {
+  fn slots(
+    &mut self,
+    host: &str,
+    max_per_host: usize,
+    max_in_flight: usize,
+  ) -> (Option<Arc<Semaphore>>, Option<Arc<Semaphore>>) {
+    if self.hosts.len() >= self.prune_at.max(IN_FLIGHT_MIN_PRUNE) {
+      self.prune();
+    }
+    let host = (max_per_host > 0).then(|| {
+      self
+        .hosts
+        .entry((host.to_owned(), max_per_host))
+        .or_insert_with(|| Arc::new(Semaphore::new(max_per_host)))
+        .clone()
+    });
+    let total = (max_in_flight > 0).then(|| {
+      self
+        .total
+        .entry(max_in_flight)
+        .or_insert_with(|| Arc::new(Semaphore::new(max_in_flight)))
+        .clone()
+    });
+    (host, total)
+  }
+
+  /// Drops the limits nobody holds, requests and their permits keep their semaphore alive so every slot of a dropped
+  /// one is free and a new one is equivalent
+  fn prune(&mut self) {
+    self.hosts.retain(|_, slots| Arc::strong_count(slots) > 1);
+    self.total.retain(|_, slots| Arc::strong_count(slots) > 1);
+    // amortized, a crawl over many hosts does not scan the map on every request
+    self.prune_at = self.hosts.len() * 2;
+  }
+}
+
+async fn acquire_slots(
+  host: Option<Arc<Semaphore>>,
+  total: Option<Arc<Semaphore>>,
+) -> Result<Permits, &'static str> {
+  // the host slot first, requests queued on a busy host don't hold process wide slots
+  let host = match host {
+    Some(slots) => Some(
+      slots
+        .acquire_owned()
+        .await
+        .map_err(|_| "Failed to acquire a request slot")?,
+    ),
+    None => None,
+  };
+  let total = match total {
+    Some(slots) => Some(
+      slots
+        .acquire_owned()
+        .await
+        .map_err(|_| "Failed to acquire a request slot")?,
+    ),
+    None => None,
+  };
+  Ok((host, total))
+}
+
+/// The host and port a url connects to, requests to it share their in flight limit
+fn host_of(url: &str) -> String {
+  match reqwest::Url::parse(url) {
+    Ok(url) => format!(
+      "{}:{}",
+      url.host_str().unwrap_or_default(),
+      url.port_or_known_default().unwrap_or_default()
+    ),
+    Err(_) => url.to_owned(),
+  }
+}
+
 struct RequestBase {
   client: Option<Client>,
   url: ParamVar,
@@ -175,6 +396,9 @@ struct RequestBase {
   keep_alive: bool,
   required: ExposedTypes,
   streaming: bool,
+  pooled: bool,
+  max_per_host: u64,
+  max_in_flight: u64,
 }
 
 impl Default for RequestBase {
@@ -192,6 +416,9 @@ impl Default for RequestBase {
       keep_alive: false,
       required: Vec::new(),
       streaming: false,
+      pooled: true,
+      max_per_host: 0,
+      max_in_flight: 0,
     }
   }
 }
@@ -224,6 +451,17 @@ impl RequestBase {
       6 => Ok(self.retry = value.try_into().map_err(|_x| "Failed to set retry")?),
       7 => Ok(self.keep_alive = value.try_into().map_err(|_x| "Failed to set keep_alive")?),
       8 => Ok(self.streaming = value.try_into().map_err(|_x| "Failed to set streaming")?),
+      9 => Ok(self.pooled = value.try_into().map_err(|_x| "Failed to set pooled")?),
+      10 => Ok(
+        self.max_per_host = value
+          .try_into()
+          .map_err(|_x| "Failed to set max_per_host")?,
+      ),
+      11 => Ok(
+        self.max_in_flight = value
+          .try_into()
+          .map_err(|_x| "Failed to set max_in_flight")?,
+      ),
       _ => unreachable!(),
     }
   }
@@ -239,6 +477,9 @@ impl RequestBase {
       6 => self.retry.try_into().expect("A valid integer in range"),
       7 => self.keep_alive.into(),
       8 => self.streaming.into(),
+      9 => self.pooled.into(),
+      10 => self.max_per_host.try_into().expect("A valid integer in range"),
+      11 => self.max_in_flight.try_into().expect("A valid integer in range"),
       _ => unreachable!(),
     }
   }
@@ -270,16 +511,11 @@ impl RequestBase {
 
   fn _open_client(&mut self) -> Result<(), &'static str> {
     if self.client.is_none() {
-      self.client = Some(
-        reqwest::Client::builder()
-          .danger_accept_invalid_certs(self.invalid_certs)
-          .timeout(Duration::from_secs(self.timeout))
-          .build()
-          .map_err(|e| {
-            shlog!("Failure details: {}", e);
-            "Failed to create client"
-          })?,
-      );
+      self.client = Some(if self.pooled {
+        pooled_client(self.invalid_certs, self.timeout)?
+      } else {
+        build_client(self.invalid_certs, self.timeout, false)?
+      });
     }
     Ok(())
   }
@@ -326,10 +562,20 @@ impl RequestBase {
     Ok(output_type)
   }
 
-  fn _finalize(&mut self, context: &Context, request: RequestBuilder) -> Result<(), &'static str> {
+  fn _finalize(
+    &mut self,
+    context: &Context,
+    request: RequestBuilder,
+    host: &str,
+  ) -> Result<(), &'static str> {
     let as_bytes = self.as_bytes;
     let full_response = self.full_response;
     let streaming = self.streaming;
+    let (host_slots, total_slots) = IN_FLIGHT.lock().unwrap().slots(
+      host,
+      self.max_per_host as usize,
+      self.max_in_flight as usize,
+    );
 
     let result = run_future(context, async move {
       let runtime = TOKIO_RUNTIME.clone();
@@ -338,7 +584,8 @@ impl RequestBase {
       // Lock the runtime briefly to spawn the task
       let task = {
         let runtime = runtime.lock().unwrap();
-        runtime.spawn(async move {
+        AbortOnDrop::spawn_on(&runtime, async move {
+          let permits = acquire_slots(host_slots, total_slots).await?;
           let response = request.send().await.map_err(|e| {
             shlog_error!("Failure details: {}", e);
             "Failed to send the request"
@@ -364,7 +611,8 @@ impl RequestBase {
 
           if streaming {
             // When streaming, we return a ref counted object with the response it self
-            let response_object = Var::new_ref_counted(OurResponse(response), &*STREAM_TYPE);
+            let response_object =
+              Var::new_ref_counted(OurResponse(response, permits), &*STREAM_TYPE);
             return Ok(response_object.into());
           }
 
@@ -531,6 +779,7 @@ macro_rules! get_like {
 
         let request = self.rb.url.get();
         let request_string: &str = request.try_into()?;
+        let host = host_of(request_string);
         let mut request = self.rb.client.as_ref().unwrap().$call(request_string);
 
         let headers = self.rb.headers.get();
@@ -557,7 +806,7 @@ macro_rules! get_like {
         }
 
         if self.rb.retry == 0 {
-          let _ = self.rb._finalize(context, request)?;
+          let _ = self.rb._finalize(context, request, &host)?;
           return Ok(Some(self.rb.output.0));
         } else {
           let mut retries = self.rb.retry;
@@ -567,7 +816,7 @@ macro_rules! get_like {
               "Failed to clone the request"
             })?;
 
-            let result = self.rb._finalize(context, request);
+            let result = self.rb._finalize(context, request, &host);
 
             if let Ok(()) = result {
               return Ok(Some(self.rb.output.0));
@@ -700,6 +949,7 @@ macro_rules! post_like {
 
         let request = self.rb.url.get();
         let request_string: &str = request.try_into()?;
+        let host = host_of(request_string);
 
         let mut request = self.rb.client.as_ref().unwrap().$call(request_string);
 
@@ -762,7 +1012,7 @@ macro_rules! post_like {
         }
 
         if self.rb.retry == 0 {
-          let _ = self.rb._finalize(context, request)?;
+          let _ = self.rb._finalize(context, request, &host)?;
           return Ok(Some(self.rb.output.0));
         } else {
           let mut retries = self.rb.retry;
@@ -772,7 +1022,7 @@ macro_rules! post_like {
               "Failed to clone the request"
             })?;
 
-            let result = self.rb._finalize(context, request);
+            let result = self.rb._finalize(context, request, &host);
 
             if let Ok(()) = result {
               return Ok(Some(self.rb.output.0));
@@ -859,7 +1109,7 @@ impl Shard for HttpStreamShard {
       let runtime = TOKIO_RUNTIME.clone();
       let task = {
         let runtime = runtime.lock().unwrap();
-        runtime.spawn(async move {
+        AbortOnDrop::spawn_on(&runtime, async move {
           let bytes = response
             .chunk()
             .await
@@ -882,6 +1132,181 @@ impl Shard for HttpStreamShard {
   }
 }
 
+#[derive(shards::shard)]
+#[shard_info(
+  "Http.Batch",
+  "Sends a GET request to every URL of the input at once through the shared client pool, requests to the same host reuse its connections."
+)]
+struct HttpBatchShard {
+  #[shard_required]
+  required: ExposedTypes,
+
+  #[shard_param("Headers", "The headers to use for every request.", HEADERS_TYPES)]
+  headers: ParamVar,
+
+  #[shard_param("Timeout", "How many seconds to wait for each request to complete.", INT_TYPES_SLICE)]
+  timeout: ClonedVar,
+
+  #[shard_param("Bytes", "If instead of strings the shard should output bytes.", BOOL_TYPES_SLICE)]
+  as_bytes: ClonedVar,
+
+  #[shard_param("MaxPerHost", "The number of requests in flight to the same host, the rest of the batch waits for a slot. Shards asking for the same limit share its slots, 0 for no limit.", INT_TYPES_SLICE)]
+  max_per_host: ClonedVar,
+
+  #[shard_param("MaxInFlight", "The number of requests in flight at once, the rest of the batch waits for a slot. Shards asking for the same limit share its slots, 0 for no limit.", INT_TYPES_SLICE)]
+  max_in_flight: ClonedVar,
+
+  output: ClonedVar,
+}
+
+impl Default for HttpBatchShard {
+  fn default() -> Self {
+    Self {
+      required: ExposedTypes::new(),
+      headers: ParamVar::new(().into()),
+      timeout: ClonedVar(Var::from(10i64)),
+      as_bytes: ClonedVar(Var::from(false)),
+      max_per_host: ClonedVar(Var::from(0i64)),
+      max_in_flight: ClonedVar(Var::from(0i64)),
+      output: ClonedVar::default(),
+    }
+  }
+}
+
+#[shards::shard_impl]
+impl Shard for HttpBatchShard {
+  fn input_types(&mut self) -> &Types {
+    &STRINGS_TYPES
+  }
+
+  fn output_types(&mut self) -> &Types {
+    &BATCH_OUTPUT_TYPES
+  }
+
+  fn input_help(&mut self) -> OptionalString {
+    shccstr!("The URLs to request.").into()
+  }
+
+  fn output_help(&mut self) -> OptionalString {
+    shccstr!("The response bodies, in the order of the input URLs.").into()
+  }
+
+  fn warmup(&mut self, ctx: &Context) -> Result<(), &'static str> {
+    self.warmup_helper(ctx)?;
+    Ok(())
+  }
+
+  fn cleanup(&mut self, ctx: Option<&Context>) -> Result<(), &'static str> {
+    self.cleanup_helper(ctx)?;
+    self.output = ClonedVar::default();
+    Ok(())
+  }
+
+  fn compose(&mut self, data: &InstanceData) -> Result<Type, &'static str> {
+    self.compose_helper(data)?;
+    let as_bytes: bool = (&self.as_bytes.0).try_into().unwrap_or(false);
+    if as_bytes {
+      Ok(common_type::bytezs)
+    } else {
+      Ok(common_type::strings)
+    }
+  }
+
+  fn activate(&mut self, context: &Context, input: &Var) -> Result<Option<Var>, &'static str> {
+    let timeout: i64 = (&self.timeout.0).try_into()?;
+    let as_bytes: bool = (&self.as_bytes.0).try_into()?;
+    let max_per_host: i64 = (&self.max_per_host.0).try_into()?;
+    let max_in_flight: i64 = (&self.max_in_flight.0).try_into()?;
+    let client = pooled_client(false, timeout.max(0) as u64)?;
+
+    let mut headers = Vec::new();
+    let headers_var = self.headers.get();
+    if !headers_var.is_none() {
+      let headers_table: Table = headers_var.try_into()?;
+      for (k, v) in headers_table.iter() {
+        let key: &str = k.as_ref().try_into()?;
+        let hname: HeaderName = key
+          .try_into()
+          .map_err(|_| "Could not convert into HeaderName")?;
+        let hvalue = HeaderValue::from_str(v.as_ref().try_into()?)
+          .map_err(|_| "Could not convert into HeaderValue")?;
+        headers.push((hname, hvalue));
+      }
+    }
+
+    // slots are looked up here, the batch shares them with the other shards asking for the same limits
+    let urls: Seq = input.try_into()?;
+    let mut requests = Vec::new();
+    {
+      let mut in_flight = IN_FLIGHT.lock().unwrap();
+      for url in urls.iter() {
+        let url: &str = url.as_ref().try_into()?;
+        let (host_slots, total_slots) = in_flight.slots(
+          &host_of(url),
+          max_per_host.max(0) as usize,
+          max_in_flight.max(0) as usize,
+        );
+        requests.push((url.to_owned(), host_slots, total_slots));
+      }
+    }
+
+    let result = run_future(context, async move {
+      let runtime = TOKIO_RUNTIME.clone();
+      let task = {
+        let runtime = runtime.lock().unwrap();
+        AbortOnDrop::spawn_on(&runtime, async move {
+          let tasks: Vec<_> = requests
+            .into_iter()
+            .map(|(url, host_slots, total_slots)| {
+              let mut request = client.get(url);
+              for (name, value) in &headers {
+                request = request.header(name.clone(), value.clone());
+              }
+              AbortOnDrop::spawn(async move {
+                let _permits = acquire_slots(host_slots, total_slots).await?;
+                let response = request.send().await.map_err(|e| {
+                  shlog_error!("Failure details: {}", e);
+                  "Failed to send the request"
+                })?;
+                if !response.status().is_success() {
+                  shlog_error!("Request failed with status {}", response.status());
+                  return Err("Request failed");
+                }
+                response.bytes().await.map_err(|e| {
+                  shlog!("Failure details: {}", e);
+                  "Failed to decode the response"
+                })
+              })
+            })
+            .collect();
+
+          let mut output = AutoSeqVar::new();
+          for task in tasks {
+            let body = task.await.map_err(|e| {
+              shlog_error!("Task join error: {}", e);
+              "Failed to join task"
+            })??;
+            if as_bytes {
+              output.0.push(&body.as_ref().into());
+            } else {
+              let text = std::str::from_utf8(&body).map_err(|_| "Failed to decode the response")?;
+              output.0.push(&Var::ephemeral_string(text));
+            }
+          }
+          Ok(ClonedVar(output.leak()))
+        })
+      };
+      // Await the spawned task outside the lock
+      task.await.map_err(|e| {
+        shlog_error!("Task join error: {}", e);
+        "Failed to join task"
+      })?
+    })?;
+    self.output = result;
+    Ok(Some(self.output.0))
+  }
+}
+
 #[no_mangle]
 pub extern "C" fn shardsRegister_http_rust(core: *mut shards::shardsc::SHCore) {
   unsafe {
@@ -896,4 +1321,5 @@ pub extern "C" fn shardsRegister_http_rust(core: *mut shards::shardsc::SHCore) {
   register_legacy_shard::<Delete>();
 
   register_shard::<HttpStreamShard>();
+  register_shard::<HttpBatchShard>();
 }
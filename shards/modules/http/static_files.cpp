@@ -0,0 +1,179 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2020 Fragcolor Pte. Ltd. */
+
+#include "static_files.hpp"
+#include <boost/algorithm/string/predicate.hpp>
+#include <boost/filesystem.hpp>
+#include <brotli/encode.h>
+#include <fmt/format.h>
+#include <fstream>
+#include <optional>
+
+namespace fs = boost::filesystem;
+
+namespace shards::Http {
+
+// Compressing is done once per version of a file, but on the wire serving it
+static constexpr int BrotliQuality = 9;
+
+FileCache &FileCache::instance() {
+  static FileCache cache;
+  return cache;
+}
+
+void FileCache::reserve(size_t capacity) {
+  std::unique_lock<std::mutex> l(_lock);
+  _capacity = std::max(_capacity, capacity);
+}
+
+size_t FileCache::cost(const StaticFile &file) {
+  return EntryOverhead + (file.contents ? file.contents->size() : 0) + (file.brotli ? file.brotli->size() : 0);
+}
+
+void FileCache::evict() {
+  while (_used > _capacity && !_order.empty()) {
+    auto it = _entries.find(_order.back());
+    _used -= cost(*it->second.file);
+    _entries.erase(it);
+    _order.pop_back();
+  }
+}
+
+static std::shared_ptr<const std::string> compressBrotli(const std::string &contents) {
+  std::string out;
+  out.resize(BrotliEncoderMaxCompressedSize(contents.size()));
+  size_t size = out.size();
+  if (!BrotliEncoderCompress(BrotliQuality, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_GENERIC, contents.size(),
+                             (const uint8_t *)contents.data(), &size, (uint8_t *)out.data()))
+    return nullptr;
+  // not worth a Content-Encoding if it barely shrinks
+  if (size > contents.size() - contents.size() / 10)
+    return nullptr;
+  out.resize(size);
+  return std::make_shared<const std::string>(std::move(out));
+}
+
+std::shared_ptr<const StaticFile> FileCache::get(const std::string &path, size_t maxFileSize, bool compress) {
+  auto now = std::chrono::steady_clock::now();
+  std::shared_ptr<const StaticFile> cached;
+  size_t capacity;
+  {
+    std::unique_lock<std::mutex> l(_lock);
+    capacity = _capacity;
+    auto it = _entries.find(path);
+    if (it != _entries.end()) {
+      _order.splice(_order.begin(), _order, it->second.order);
+      cached = it->second.file;
+      if (now - cached->checked < RevalidateInterval)
+        return cached;
+    }
+  }
+
+  boost::system::error_code ec;
+  fs::path p(path);
+  auto status = fs::status(p, ec);
+  if (ec || !fs::is_regular_file(status))
+    return nullptr;
+  auto size = uint64_t(fs::file_size(p, ec));
+  if (ec)
+    return nullptr;
+  auto modified = int64_t(fs::last_write_time(p, ec));
+  if (ec)
+    return nullptr;
+
+  auto file = std::make_shared<StaticFile>();
+  file->size = size;
+  file->modified = modified;
+  file->etag = makeEtag(modified, size);
+  file->checked = now;
+
+  bool wanted = capacity > 0 && size <= maxFileSize;
+  if (cached && cached->size == size && cached->modified == modified) {
+    // unchanged, keep what was loaded
+    file->contents = cached->contents;
+    file->brotli = cached->brotli;
+    file->brotliEtag = cached->brotliEtag;
+  } else if (wanted) {
+    std::ifstream stream(path, std::ios::binary);
+    std::string contents(size, '\0');
+    if (!stream.read(contents.data(), std::streamsize(size)))
+      return nullptr;
+    file->contents = std::make_shared<const std::string>(std::move(contents));
+    if (compress)
+      file->brotli = compressBrotli(*file->contents);
+    if (file->brotli)
+      file->brotliEtag = makeEtag(modified, size, true);
+  }
+
+  std::unique_lock<std::mutex> l(_lock);
+  auto it = _entries.find(path);
+  if (it != _entries.end()) {
+    _used -= cost(*it->second.file);
+    it->second.file = file;
+  } else {
+    _order.push_front(path);
+    _entries[path] = Entry{file, _order.begin()};
+  }
+  _used += cost(*file);
+  evict();
+  return file;
+}
+
+std::string makeEtag(int64_t modified, uint64_t size, bool brotli) {
+  return fmt::format("\"{:x}-{:x}{}\"", modified, size, brotli ? "-br" : "");
+}
+
+static std::string_view trim(std::string_view s) {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+    s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+    s.remove_suffix(1);
+  return s;
+}
+
+bool acceptsEncoding(std::string_view acceptEncoding, std::string_view coding) {
+  std::optional<bool> anything;
+  while (!acceptEncoding.empty()) {
+    auto comma = acceptEncoding.find(',');
+    auto item = acceptEncoding.substr(0, comma);
+    acceptEncoding = comma == std::string_view::npos ? std::string_view{} : acceptEncoding.substr(comma + 1);
+
+    auto semicolon = item.find(';');
+    auto name = trim(item.substr(0, semicolon));
+    // only a weight of zero matters, any other one accepts
+    bool accepted = true;
+    while (semicolon != std::string_view::npos) {
+      item.remove_prefix(semicolon + 1);
+      semicolon = item.find(';');
+      auto param = trim(item.substr(0, semicolon));
+      if (param.size() >= 2 && (param[0] == 'q' || param[0] == 'Q') && param[1] == '=') {
+        auto weight = trim(param.substr(2));
+        accepted = weight.find_first_not_of("0.") != std::string_view::npos;
+      }
+    }
+
+    if (boost::algorithm::iequals(name, coding))
+      return accepted;
+    if (name == "*")
+      anything = accepted;
+  }
+  return anything.value_or(false);
+}
+
+bool etagMatches(std::string_view ifNoneMatch, std::string_view etag) {
+  if (ifNoneMatch.empty())
+    return false;
+  if (ifNoneMatch == "*")
+    return true;
+  // a list of possibly weak etags, weak comparison applies
+  size_t pos = 0;
+  while ((pos = ifNoneMatch.find(etag, pos)) != std::string_view::npos) {
+    auto end = pos + etag.size();
+    if (end == ifNoneMatch.size() || ifNoneMatch[end] == ',' || ifNoneMatch[end] == ' ')
+      return true;
+    pos = end;
+  }
+  return false;
+}
+
+} // namespace shards::Http
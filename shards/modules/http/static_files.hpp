@@ -0,0 +1,175 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2020 Fragcolor Pte. Ltd. */
+
+#ifndef E5A1C3D8_27B4_4F96_9C0E_81D6B2F4A7C3
+#define E5A1C3D8_27B4_4F96_9C0E_81D6B2F4A7C3
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#if defined(__linux__)
+#define SH_HTTP_SENDFILE 1
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+#define SH_HTTP_SENDFILE 0
+#endif
+
+namespace shards::Http {
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+// Body of a cached file, shared by every response serving it
+struct SharedBody {
+  using value_type = std::shared_ptr<const std::string>;
+
+  static uint64_t size(const value_type &body) { return body ? body->size() : 0; }
+
+  class writer {
+    const value_type &_body;
+
+  public:
+    using const_buffers_type = net::const_buffer;
+
+    template <bool isRequest, class Fields>
+    explicit writer(const http::header<isRequest, Fields> &, const value_type &body) : _body(body) {}
+
+    void init(beast::error_code &ec) { ec = {}; }
+
+    boost::optional<std::pair<const_buffers_type, bool>> get(beast::error_code &ec) {
+      ec = {};
+      if (!_body)
+        return boost::none;
+      return {{net::const_buffer(_body->data(), _body->size()), false}};
+    }
+  };
+};
+
+struct StaticFile {
+  uint64_t size{};
+  int64_t modified{};
+  std::string etag;
+  // Of the brotli variant, a different representation needs its own strong etag
+  std::string brotliEtag;
+  // Null if the file is too large to be kept in memory
+  std::shared_ptr<const std::string> contents;
+  // Brotli compressed contents, null if not worth it
+  std::shared_ptr<const std::string> brotli;
+  std::chrono::steady_clock::time_point checked;
+};
+
+// Process wide LRU cache of static files, keyed by path and revalidated against the file's size and modification
+// time at most once per RevalidateInterval, hot files are served without touching the disk at all
+struct FileCache {
+  static constexpr auto RevalidateInterval = std::chrono::seconds(1);
+  // Entries of files too large to keep still cost something
+  static constexpr size_t EntryOverhead = 256;
+
+  static FileCache &instance();
+
+  // The cache grows to the largest capacity asked for
+  void reserve(size_t capacity);
+
+  // Null if the file does not exist, contents are loaded if the file is not larger than maxFileSize
+  std::shared_ptr<const StaticFile> get(const std::string &path, size_t maxFileSize, bool compress);
+
+private:
+  struct Entry {
+    std::shared_ptr<const StaticFile> file;
+    std::list<std::string>::iterator order;
+  };
+
+  std::mutex _lock;
+  size_t _capacity{};
+  size_t _used{};
+  std::unordered_map<std::string, Entry> _entries;
+  // Most recently used first
+  std::list<std::string> _order;
+
+  static size_t cost(const StaticFile &file);
+  void evict();
+};
+
+// Derived from size and modification time, like most servers do
+std::string makeEtag(int64_t modified, uint64_t size, bool brotli = false);
+
+// True if an Accept-Encoding header allows the coding, "br;q=0" refuses it and "*" stands for anything not listed
+bool acceptsEncoding(std::string_view acceptEncoding, std::string_view coding);
+
+// True if a request with this If-None-Match header already has the version with this etag
+bool etagMatches(std::string_view ifNoneMatch, std::string_view etag);
+
+#if SH_HTTP_SENDFILE
+// Owns a file descriptor
+struct FileHandle {
+  int fd{-1};
+
+  FileHandle() = default;
+  explicit FileHandle(int fd) : fd(fd) {}
+  FileHandle(FileHandle &&other) noexcept : fd(std::exchange(other.fd, -1)) {}
+  FileHandle &operator=(FileHandle &&other) noexcept {
+    std::swap(fd, other.fd);
+    return *this;
+  }
+  ~FileHandle() {
+    if (fd >= 0)
+      ::close(fd);
+  }
+};
+
+// Sends a whole file with sendfile(2), the data never goes through userspace
+// Yields to other work on the socket's executor every MaxPerTurn bytes
+template <typename Handler> struct SendFileOp {
+  static constexpr size_t MaxPerTurn = 8 * 1024 * 1024;
+
+  tcp::socket &socket;
+  int fd;
+  off_t offset;
+  uint64_t left;
+  Handler handler;
+
+  void operator()(beast::error_code ec = {}) {
+    size_t sent = 0;
+    while (!ec && left > 0) {
+      if (sent >= MaxPerTurn)
+        return socket.async_wait(tcp::socket::wait_write, std::move(*this));
+
+      auto n = ::sendfile(socket.native_handle(), fd, &offset, size_t(std::min<uint64_t>(left, MaxPerTurn)));
+      if (n > 0) {
+        left -= uint64_t(n);
+        sent += size_t(n);
+      } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return socket.async_wait(tcp::socket::wait_write, std::move(*this));
+      } else if (n < 0 && errno == EINTR) {
+        continue;
+      } else {
+        // the file shrunk while sending it
+        ec = n == 0 ? beast::error_code(net::error::eof) : beast::error_code(errno, boost::system::system_category());
+      }
+    }
+    handler(ec, size_t(offset));
+  }
+};
+
+template <typename Handler> void asyncSendFile(tcp::socket &socket, int fd, uint64_t size, Handler &&handler) {
+  beast::error_code ec;
+  socket.native_non_blocking(true, ec);
+  SendFileOp<std::decay_t<Handler>>{socket, fd, 0, size, std::forward<Handler>(handler)}(ec);
+}
+#endif
+
+} // namespace shards::Http
+
+#endif /* E5A1C3D8_27B4_4F96_9C0E_81D6B2F4A7C3 */
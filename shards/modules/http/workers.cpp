@@ -0,0 +1,344 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2020 Fragcolor Pte. Ltd. */
+
+#include "workers.hpp"
+#include <shards/log/log.hpp>
+#include <boost/asio/post.hpp>
+
+namespace shards::Http {
+
+static auto logger = shards::logging::getOrCreate("http");
+
+#if defined(__linux__) && defined(SO_REUSEPORT)
+#define SH_HTTP_REUSE_PORT 1
+using reuse_port = net::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#else
+#define SH_HTTP_REUSE_PORT 0
+#endif
+
+Connection::~Connection() {
+  Request *request{};
+  while (_requests.pop(request))
+    delete request;
+  Outgoing *out{};
+  while (_responses.pop(out))
+    delete out;
+  BodyChunk *chunk{};
+  while (_body.pop(chunk))
+    delete chunk;
+  delete _writing;
+}
+
+Connection::Request *Connection::popRequest() {
+  Request *request{};
+  _requests.pop(request);
+  return request;
+}
+
+Connection::BodyChunk *Connection::popBody() {
+  BodyChunk *chunk{};
+  if (_body.pop(chunk) && _bodyPaused.exchange(false))
+    net::post(_socket.get_executor(), [self = shared_from_this()]() { self->readBody(); });
+  return chunk;
+}
+
+bool Connection::pushResponse(Outgoing *out) {
+  if (!_responses.push(out))
+    return false;
+  net::post(_socket.get_executor(), [self = shared_from_this()]() { self->write(); });
+  return true;
+}
+
+void Connection::close() {
+  net::post(_socket.get_executor(), [self = shared_from_this()]() { self->shutdown(); });
+}
+
+void Connection::start() {
+  net::post(_socket.get_executor(), [self = shared_from_this()]() { self->read(); });
+}
+
+void Connection::read() {
+  if (closed() || _reading || _closing || _pending.size() >= _limits.maxPipelined)
+    return;
+
+  _reading = true;
+  if (_pending.empty())
+    armIdle();
+
+  // emplacing reuses the parser's storage, beast parsers can not be reset
+  _header.emplace();
+  _limits.apply(*_header);
+  http::async_read_header(_socket, _buffer, *_header, [self = shared_from_this()](beast::error_code ec, std::size_t) {
+    // the declared Content-Length is over the limit, the peer wire never sees the request
+    if (ec == http::error::body_limit)
+      return self->rejectBody(self->_header->get().version());
+    if (ec)
+      return self->readFailed(ec);
+
+    self->received();
+    auto length = self->_header->content_length();
+    if (self->_header->is_done() || (length && *length <= EagerBodySize)) {
+      self->_parser.emplace(std::move(*self->_header));
+      if (self->_parser->is_done())
+        return self->readDone();
+      http::async_read(self->_socket, self->_buffer, *self->_parser, [self](beast::error_code ec, std::size_t) {
+        if (ec)
+          return self->readFailed(ec);
+        self->readDone();
+      });
+      return;
+    }
+
+    // large or chunked, the peer wire gets the header now and the body as it arrives
+    self->_stream.emplace(std::move(*self->_header));
+    // reads are sized after the buffer's capacity
+    self->_buffer.reserve(BodyChunkSize);
+    self->_requests.push(new Request{http::request<http::string_body>(self->_stream->get().base()), true});
+    self->readBody();
+  });
+}
+
+void Connection::readBody() {
+  if (closed())
+    return;
+
+  // a full queue pauses reading until the peer wire pops a chunk, tcp flow control slows the client down
+  if (_body.write_available() == 0) {
+    _bodyPaused.store(true);
+    // popBody resumes reading, unless it popped before the flag was set
+    if (_body.write_available() == 0 || !_bodyPaused.exchange(false))
+      return;
+  }
+
+  if (!_chunk)
+    _chunk.reset(new BodyChunk{std::string(BodyChunkSize, '\0')});
+  auto &body = _stream->get().body();
+  body.data = _chunk->data.data();
+  body.size = _chunk->data.size();
+  http::async_read_some(_socket, _buffer, *_stream, [self = shared_from_this()](beast::error_code ec, std::size_t) {
+    // the buffer is full, not an error
+    if (ec == http::error::need_buffer)
+      ec = {};
+    if (ec)
+      return self->readFailed(ec);
+
+    auto &chunk = *self->_chunk;
+    auto filled = chunk.data.size() - self->_stream->get().body().size;
+    bool last = chunk.last = self->_stream->is_done();
+    if (filled > 0 || last) {
+      chunk.data.resize(filled);
+      // checked for room before reading
+      self->_body.push(self->_chunk.release());
+    }
+
+    if (!last)
+      return self->readBody();
+    self->_reading = false;
+    self->read();
+  });
+}
+
+void Connection::received() {
+  _idle.cancel();
+  _served++;
+  auto &request = _header->get();
+  bool keepAlive = request.keep_alive() && (_limits.maxRequests == 0 || _served < _limits.maxRequests);
+  _pending.push_back({request.version(), keepAlive});
+  if (!keepAlive)
+    _closing = true;
+}
+
+void Connection::readDone() {
+  _reading = false;
+  // bounded by maxPipelined, there is always room
+  _requests.push(new Request{_parser->release()});
+  read();
+}
+
+void Connection::readFailed(beast::error_code ec) {
+  _reading = false;
+  // a client closing its side after sending requests still gets its responses
+  if (ec == http::error::end_of_stream && !_pending.empty()) {
+    _closing = true;
+    return;
+  }
+  fail(ec, "Read");
+}
+
+void Connection::rejectBody(unsigned version) {
+  _reading = false;
+  _closing = true;
+  _pending.push_back({version, false});
+  http::response<http::string_body> response{http::status::payload_too_large, version};
+  response.prepare_payload();
+  _rejection.reset(new Outgoing{std::move(response)});
+  write();
+}
+
+void Connection::write() {
+  if (_writing || closed())
+    return;
+  if (!_responses.pop(_writing)) {
+    // only the rejected request is left to answer
+    if (!_rejection || _pending.size() != 1)
+      return;
+    _writing = _rejection.release();
+  }
+
+  auto handler = [self = shared_from_this()](beast::error_code ec, std::size_t) {
+    if (ec)
+      return self->fail(ec, "Response");
+
+    bool last = self->_writing->last;
+    delete self->_writing;
+    self->_writing = nullptr;
+    if (last && !self->_pending.empty()) {
+      auto answered = self->_pending.front();
+      self->_pending.pop_front();
+      if (!answered.keepAlive || (self->_closing && self->_pending.empty()))
+        return self->shutdown();
+      if (self->_pending.empty() && self->_reading)
+        self->armIdle();
+      // resumes reading if the pipelining limit paused it
+      self->read();
+    }
+    self->write();
+  };
+
+  // the response follows the version and connection reuse of its request
+  auto prepare = [&](auto &message) {
+    if (!_pending.empty()) {
+      message.version(_pending.front().version);
+      message.keep_alive(_pending.front().keepAlive);
+    }
+  };
+
+  std::visit(
+      [&](auto &message) {
+        using T = std::decay_t<decltype(message)>;
+        if constexpr (std::is_same_v<T, std::string>) {
+          net::async_write(_socket, net::buffer(message), std::move(handler));
+        } else if constexpr (std::is_same_v<T, Outgoing::Header>) {
+          prepare(message);
+          _writing->serializer.emplace(message);
+          http::async_write_header(_socket, *_writing->serializer, std::move(handler));
+#if SH_HTTP_SENDFILE
+        } else if constexpr (std::is_same_v<T, Outgoing::FileTransfer>) {
+          prepare(message.header);
+          _writing->serializer.emplace(message.header);
+          http::async_write_header(_socket, *_writing->serializer,
+                                   [self = shared_from_this(), handler = std::move(handler)](beast::error_code ec,
+                                                                                             std::size_t n) mutable {
+                                     if (ec)
+                                       return handler(ec, n);
+                                     auto &transfer = std::get<Outgoing::FileTransfer>(self->_writing->message);
+                                     asyncSendFile(self->_socket, transfer.file.fd, transfer.size, std::move(handler));
+                                   });
+#endif
+        } else {
+          prepare(message);
+          http::async_write(_socket, message, std::move(handler));
+        }
+      },
+      _writing->message);
+}
+
+void Connection::armIdle() {
+  if (_limits.idleTimeout <= 0.0)
+    return;
+  _idle.expires_after(std::chrono::duration_cast<net::steady_timer::duration>(std::chrono::duration<double>(_limits.idleTimeout)));
+  _idle.async_wait([self = shared_from_this()](beast::error_code ec) {
+    if (!ec)
+      self->shutdown();
+  });
+}
+
+void Connection::shutdown() {
+  if (_closed.exchange(true, std::memory_order_acq_rel))
+    return;
+  _idle.cancel();
+  beast::error_code ec;
+  _socket.shutdown(tcp::socket::shutdown_both, ec);
+  _socket.close(ec);
+}
+
+void Connection::fail(beast::error_code ec, std::string_view source) {
+  if (ec != http::error::end_of_stream && ec != net::error::operation_aborted)
+    SPDLOG_LOGGER_DEBUG(logger, "Http request error: {} from {} - closing connection.", ec.message(), source);
+  shutdown();
+}
+
+Workers::Workers(const std::string &address, uint16_t port, size_t threads, const ConnectionLimits &limits)
+    : _limits(limits) {
+  tcp::endpoint endpoint{net::ip::make_address(address), port};
+
+  for (size_t i = 0; i < threads; i++) {
+    auto &worker = *_workers.emplace_back(std::make_unique<Worker>());
+    if (!SH_HTTP_REUSE_PORT && i > 0)
+      continue;
+
+    auto &acceptor = worker.acceptor.emplace(worker.ioc);
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(net::socket_base::reuse_address(true));
+#if SH_HTTP_REUSE_PORT
+    acceptor.set_option(reuse_port(true));
+#endif
+    acceptor.bind(endpoint);
+    acceptor.listen(net::socket_base::max_listen_connections);
+  }
+
+  for (auto &worker : _workers) {
+    if (worker->acceptor)
+      accept(*worker);
+    worker->thread = std::thread([ioc = &worker->ioc]() {
+      auto guard = net::make_work_guard(*ioc);
+      ioc->run();
+    });
+  }
+}
+
+Workers::~Workers() {
+  for (auto &worker : _workers) {
+    worker->ioc.stop();
+  }
+  for (auto &worker : _workers) {
+    if (worker->thread.joinable())
+      worker->thread.join();
+  }
+  // sockets might belong to another worker's io_context, close them all before any is destroyed
+  for (auto &worker : _workers) {
+    worker->incoming.reset();
+    worker->acceptor.reset();
+  }
+
+  Connection *connection{};
+  while (_accepted.pop(connection))
+    delete connection;
+}
+
+std::shared_ptr<Connection> Workers::accepted() {
+  Connection *connection{};
+  if (!_accepted.pop(connection))
+    return nullptr;
+  return std::shared_ptr<Connection>(connection);
+}
+
+void Workers::accept(Worker &worker) {
+  // without a listener per worker, connections are spread over the workers in turn
+  auto &target = SH_HTTP_REUSE_PORT ? worker : *_workers[_next++ % _workers.size()];
+  worker.incoming.emplace(target.ioc);
+  worker.acceptor->async_accept(*worker.incoming, [this, &worker](beast::error_code ec) {
+    if (ec == net::error::operation_aborted)
+      return;
+
+    if (!ec) {
+      worker.incoming->set_option(tcp::no_delay(true), ec);
+      _accepted.push(new Connection(std::move(*worker.incoming), _limits));
+    } else {
+      SPDLOG_LOGGER_DEBUG(logger, "Http accept error: {}", ec.message());
+    }
+    accept(worker);
+  });
+}
+
+} // namespace shards::Http
@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2020 Fragcolor Pte. Ltd. */
+
+#ifndef C2E94B7A_6F13_4D8E_A5B0_3D71F8C6E250
+#define C2E94B7A_6F13_4D8E_A5B0_3D71F8C6E250
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <boost/lockfree/queue.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include "static_files.hpp"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+// Threaded mode of Http.Server
+//
+// Each worker thread runs its own io_context, accepting, parsing and writing on its own. Peer wires never touch
+// the sockets, they pop parsed requests and push responses through lock-free queues on the connection.
+
+namespace shards::Http {
+namespace beast = boost::beast;
+namespace http = beast::http;
+namespace net = boost::asio;
+using tcp = net::ip::tcp;
+
+// How long a connection is kept open and reused, shared by both modes of Http.Server
+struct ConnectionLimits {
+  // Seconds to wait for the next request before closing the connection, 0 waits forever
+  double idleTimeout{60.0};
+  // Requests served on a connection before closing it, 0 for no limit
+  uint64_t maxRequests{};
+  // Requests read ahead while earlier ones wait for their response, 1 disables pipelining
+  size_t maxPipelined{16};
+  // Largest request body accepted, 0 for no limit
+  uint64_t maxBodySize{1024 * 1024};
+
+  // Sets the body limit of a parser about to read a request
+  template <typename Parser> void apply(Parser &parser) const {
+    if (maxBodySize > 0)
+      parser.body_limit(maxBodySize);
+    else
+      parser.body_limit(boost::none);
+  }
+};
+
+// Parts of a streamed request body are read in buffers of this size
+static constexpr size_t BodyChunkSize = 64 * 1024;
+
+// A response, or a part of one, queued by a peer wire for its connection's worker
+struct Outgoing {
+  // A response without body, or the header of a chunked one
+  using Header = http::response<http::empty_body>;
+#if SH_HTTP_SENDFILE
+  // A header followed by a whole file sent with sendfile
+  struct FileTransfer {
+    http::response<http::empty_body> header;
+    FileHandle file;
+    uint64_t size;
+  };
+#endif
+  using Message = std::variant<http::response<http::string_body>, http::response<http::file_body>,
+                               http::response<SharedBody>, Header, std::string
+#if SH_HTTP_SENDFILE
+                               ,
+                               FileTransfer
+#endif
+                               >;
+
+  Message message;
+  // False for the header and chunks of a chunked response but its terminating chunk
+  bool last{true};
+  // Created by the worker when writing a header
+  std::optional<http::response_serializer<http::empty_body>> serializer;
+};
+
+struct Connection : std::enable_shared_from_this<Connection> {
+  // A parsed request, the body of a large one follows in chunks
+  struct Request {
+    http::request<http::string_body> message;
+    // The body was not read with the header, it comes through popBody
+    bool streamed{};
+  };
+  // A part of a streamed request body
+  struct BodyChunk {
+    std::string data;
+    bool last{};
+  };
+  static constexpr size_t QueueSize = 64;
+  // Bodies up to this size are read whole with their header
+  static constexpr uint64_t EagerBodySize = 64 * 1024;
+  // Chunks read ahead of the peer wire, bounds the memory a streamed body takes
+  static constexpr size_t BodyQueueSize = 16;
+
+  Connection(tcp::socket socket, const ConnectionLimits &limits)
+      : _socket(std::move(socket)), _idle(_socket.get_executor()), _limits(limits) {
+    _limits.maxPipelined = std::clamp(_limits.maxPipelined, size_t(1), QueueSize);
+  }
+  ~Connection();
+
+  // Peer wire side
+
+  // Next parsed request, ownership moves to the caller, nullptr if none
+  Request *popRequest();
+  // Next chunk of the streamed body of the last request, ownership moves to the caller, nullptr if none yet
+  BodyChunk *popBody();
+  // Queues a response for writing, false if the queue is full (ownership stays with the caller)
+  bool pushResponse(Outgoing *out);
+  // True once the connection is done, requests already parsed can still be popped
+  bool closed() const { return _closed.load(std::memory_order_acquire); }
+  // Closes the connection from any thread
+  void close();
+
+  // Worker side, starts reading requests
+  void start();
+
+private:
+  // A request read but not fully answered yet, responses go out in the same order
+  struct Pending {
+    unsigned version;
+    bool keepAlive;
+  };
+
+  tcp::socket _socket;
+  net::steady_timer _idle;
+  ConnectionLimits _limits;
+  // Both live as long as the connection, bytes of pipelined requests stay in the buffer
+  beast::flat_buffer _buffer;
+  // The header is parsed alone, the parser then moves to one for a whole or a streamed body
+  std::optional<http::request_parser<http::empty_body>> _header;
+  std::optional<http::request_parser<http::string_body>> _parser;
+  std::optional<http::request_parser<http::buffer_body>> _stream;
+  boost::lockfree::spsc_queue<Request *> _requests{QueueSize};
+  boost::lockfree::spsc_queue<Outgoing *> _responses{QueueSize};
+  boost::lockfree::spsc_queue<BodyChunk *> _body{BodyQueueSize};
+  std::atomic_bool _closed{};
+  // Reading a streamed body waits for the peer wire to pop a chunk
+  std::atomic_bool _bodyPaused{};
+
+  // Worker thread only
+  std::deque<Pending> _pending;
+  Outgoing *_writing{};
+  std::unique_ptr<BodyChunk> _chunk;
+  // 413 answer to a request over the body limit, written by the worker once the requests before it are answered
+  std::unique_ptr<Outgoing> _rejection;
+  uint64_t _served{};
+  bool _reading{};
+  // No more requests will be read, close once the pending ones are answered
+  bool _closing{};
+
+  void read();
+  void readBody();
+  void received();
+  void readDone();
+  void readFailed(beast::error_code ec);
+  void rejectBody(unsigned version);
+  void write();
+  void armIdle();
+  void shutdown();
+  void fail(beast::error_code ec, std::string_view source);
+};
+
+struct Workers {
+  static constexpr size_t QueueSize = 64;
+
+  // Binds one listener per thread with SO_REUSEPORT where the kernel balances connections across them,
+  // elsewhere a single listener hands connections to the workers in turn
+  Workers(const std::string &address, uint16_t port, size_t threads, const ConnectionLimits &limits);
+  ~Workers();
+
+  // Next accepted connection, null if none
+  std::shared_ptr<Connection> accepted();
+
+private:
+  struct Worker {
+    net::io_context ioc{1};
+    std::optional<tcp::acceptor> acceptor;
+    // The socket being accepted, it might belong to another worker
+    std::optional<tcp::socket> incoming;
+    std::thread thread;
+  };
+
+  ConnectionLimits _limits;
+  std::vector<std::unique_ptr<Worker>> _workers;
+  boost::lockfree::queue<Connection *> _accepted{QueueSize};
+  size_t _next{};
+
+  void accept(Worker &worker);
+};
+
+} // namespace shards::Http
+
+#endif /* C2E94B7A_6F13_4D8E_A5B0_3D71F8C6E250 */
@@ -0,0 +1,343 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+// Loopback benchmark and soak test for the network shards
+//
+// Runs Network.Server with many Network.Client peers (KCP), then Network.WS.Server with Network.WS.Client peers, all in
+// one mesh. Each peer sends timestamped messages at a fixed rate, the server echoes them back. Reports the echo
+// throughput, latency percentiles, the CPU time and C++ heap allocations per echoed message.
+//   network-bench [kcp|ws|all] [peers] [seconds] [rate per peer] [size] [coalesce]
+// Soak mode runs with fixed settings and fails if a message is lost, latency goes over budget or allocations pile up:
+//   network-bench soak [short|long] [kcp|ws|all]
+
+#include "../network.hpp"
+#include <shards/core/runtime.hpp>
+#include <shards/wire_dsl.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace shards;
+using Clock = std::chrono::steady_clock;
+
+// Every C++ heap allocation in the process, the runtime and the transports included
+static std::atomic<uint64_t> allocations{};
+static std::atomic<int64_t> liveAllocations{};
+
+void *operator new(size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  liveAllocations.fetch_add(1, std::memory_order_relaxed);
+  if (auto p = std::malloc(size ? size : 1))
+    return p;
+  throw std::bad_alloc();
+}
+void *operator new[](size_t size) { return operator new(size); }
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return operator new(size);
+  } catch (...) {
+    return nullptr;
+  }
+}
+void *operator new[](size_t size, const std::nothrow_t &tag) noexcept { return operator new(size, tag); }
+void operator delete(void *p) noexcept {
+  if (!p)
+    return;
+  liveAllocations.fetch_sub(1, std::memory_order_relaxed);
+  std::free(p);
+}
+void operator delete[](void *p) noexcept { operator delete(p); }
+void operator delete(void *p, size_t) noexcept { operator delete(p); }
+void operator delete[](void *p, size_t) noexcept { operator delete(p); }
+
+struct Settings {
+  size_t peers{64};
+  double seconds{10.0};
+  // Messages per second sent by each peer
+  double rate{100.0};
+  size_t size{256};
+  bool coalesce{};
+  double tickRate{1000.0};
+  int port{9391};
+
+  // Soak checks
+  bool soak{};
+  double maxP99Ms{};
+  int64_t maxLiveGrowth{};
+};
+
+// Message layout: u64 send time (ns) | u32 peer | u8 kind | filler
+enum class Kind : uint8_t { Probe, Measured };
+constexpr size_t HeaderSize = 8 + 4 + 1;
+
+struct PeerState {
+  bool connected{};
+  double credit{};
+  Clock::time_point lastProbe{};
+};
+
+struct Results {
+  std::vector<uint32_t> latencies; // microseconds
+  uint64_t sent{};
+  uint64_t received{};
+  uint64_t connected{};
+};
+
+struct Run {
+  using UnsafeActivateFunc = std::function<SHVar(SHContext *, const SHVar &)>;
+
+  Settings settings;
+  std::string transport;
+  std::vector<PeerState> peers;
+  Results results;
+  std::vector<uint8_t> payload;
+  bool measuring{};
+  bool sending{true};
+  Clock::time_point measureStart;
+
+  // Called by UnsafeActivate!, the input is the peer object output by the client
+  std::vector<std::unique_ptr<UnsafeActivateFunc>> senders;
+  UnsafeActivateFunc recorder;
+};
+
+static std::chrono::nanoseconds sinceEpoch(Clock::time_point t) { return t.time_since_epoch(); }
+
+static void sendStamped(Network::Peer &peer, std::vector<uint8_t> &payload, uint32_t index, Kind kind) {
+  uint64_t now = sinceEpoch(Clock::now()).count();
+  memcpy(payload.data(), &now, sizeof(uint64_t));
+  memcpy(payload.data() + 8, &index, sizeof(uint32_t));
+  payload[12] = uint8_t(kind);
+  peer.sendVar(Var(payload.data(), uint32_t(payload.size())));
+}
+
+static std::shared_ptr<SHWire> clientWire(Run &run, const std::string &transport, size_t index) {
+  auto sender = std::make_unique<Run::UnsafeActivateFunc>([&run, index](SHContext *, const SHVar &input) -> SHVar {
+    auto &peer = varAsObjectChecked<Network::Peer>(input, Network::Types::Peer);
+    auto &state = run.peers[index];
+    auto now = Clock::now();
+    if (!state.connected) {
+      // the first echo tells the connection is up, until then a probe goes out every 100ms
+      if (now - state.lastProbe > std::chrono::milliseconds(100)) {
+        state.lastProbe = now;
+        sendStamped(peer, run.payload, uint32_t(index), Kind::Probe);
+      }
+      return input;
+    }
+
+    if (!run.sending)
+      return input;
+    state.credit += run.settings.rate / run.settings.tickRate;
+    for (; state.credit >= 1.0; state.credit -= 1.0) {
+      sendStamped(peer, run.payload, uint32_t(index), Kind::Measured);
+      if (run.measuring)
+        run.results.sent++;
+    }
+    return input;
+  });
+
+  auto name = fmt::format("bench-{}-client-{}", transport, index);
+  Wire wire(name);
+  wire.looped(true);
+  auto handler = Weave().shard("UnsafeActivate!", Var(reinterpret_cast<int64_t>(&run.recorder)));
+  if (transport == "kcp") {
+    wire.shard("Network.Client", Var("127.0.0.1"), Var(run.settings.port), handler, Var(run.settings.coalesce));
+  } else {
+    auto address = fmt::format("ws://127.0.0.1:{}", run.settings.port);
+    wire.shard("Network.WS.Client", Var(address), handler, Var(false), Var(run.settings.coalesce));
+  }
+  wire.shard("UnsafeActivate!", Var(reinterpret_cast<int64_t>(sender.get())));
+  run.senders.emplace_back(std::move(sender));
+  return wire;
+}
+
+static std::shared_ptr<SHWire> serverWire(Run &run, const std::string &transport) {
+  // echo every message back to its peer
+  Wire handler(fmt::format("bench-{}-handler", transport));
+  handler.looped(true);
+  handler.shard("Network.Send");
+
+  Wire wire(fmt::format("bench-{}-server", transport));
+  wire.looped(true);
+  if (transport == "kcp") {
+    wire.shard("Network.Server", Var("127.0.0.1"), Var(run.settings.port), Var(handler), Var::Any, Var::Any, Var::Any,
+               Var::Any, Var(run.settings.coalesce));
+  } else {
+    wire.shard("Network.WS.Server", Var("127.0.0.1"), Var(run.settings.port), Var(handler), Var::Any, Var::Any,
+               Var(run.settings.coalesce));
+  }
+  return wire;
+}
+
+static double percentile(const std::vector<uint32_t> &sorted, double p) {
+  return sorted[std::min(sorted.size() - 1, size_t(p * sorted.size()))] / 1000.0;
+}
+
+// Returns false when a soak check fails
+static bool runTransport(const Settings &settings, const std::string &transport) {
+  Run run;
+  run.settings = settings;
+  run.transport = transport;
+  run.peers.resize(settings.peers);
+  run.payload.resize(std::max(settings.size, HeaderSize), 0x5a);
+  run.results.latencies.reserve(size_t(settings.peers * settings.rate * settings.seconds * 1.1));
+  run.recorder = [&run](SHContext *, const SHVar &input) -> SHVar {
+    if (input.valueType != SHType::Bytes || input.payload.bytesSize < HeaderSize)
+      return input;
+    uint64_t sentAt;
+    uint32_t index;
+    memcpy(&sentAt, input.payload.bytesValue, sizeof(uint64_t));
+    memcpy(&index, input.payload.bytesValue + 8, sizeof(uint32_t));
+    auto kind = Kind(input.payload.bytesValue[12]);
+    if (index >= run.peers.size())
+      return input;
+
+    auto &state = run.peers[index];
+    if (!state.connected) {
+      state.connected = true;
+      run.results.connected++;
+    }
+    // only messages sent while measuring count, the others were in flight when it started
+    if (kind == Kind::Measured && run.measuring && std::chrono::nanoseconds(sentAt) >= sinceEpoch(run.measureStart)) {
+      auto elapsed = sinceEpoch(Clock::now()).count() - int64_t(sentAt);
+      run.results.latencies.push_back(uint32_t(elapsed / 1000));
+      run.results.received++;
+    }
+    return input;
+  };
+
+  auto mesh = SHMesh::make();
+  mesh->schedule(serverWire(run, transport));
+  for (size_t i = 0; i < settings.peers; i++)
+    mesh->schedule(clientWire(run, transport, i));
+
+  auto tickPeriod = std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(1.0 / settings.tickRate));
+  auto next = Clock::now();
+  auto tickUntil = [&](auto done) {
+    while (!done()) {
+      if (!mesh->tick()) {
+        std::printf("%s: a wire failed\n", transport.c_str());
+        return false;
+      }
+      next += tickPeriod;
+      std::this_thread::sleep_until(next);
+    }
+    return true;
+  };
+
+  std::printf("%s: %zu peers, %.0f messages/s each, %zu bytes%s, %.0fs\n", transport.c_str(), settings.peers, settings.rate,
+              run.payload.size(), settings.coalesce ? ", coalesced" : "", settings.seconds);
+
+  // connect everyone, then warm up before measuring
+  auto connectDeadline = Clock::now() + std::chrono::seconds(10);
+  bool ok = tickUntil([&]() { return run.results.connected == settings.peers || Clock::now() > connectDeadline; });
+  if (ok && run.results.connected != settings.peers) {
+    std::printf("%s: only %llu of %zu peers connected\n", transport.c_str(), (unsigned long long)run.results.connected,
+                settings.peers);
+    ok = false;
+  }
+  auto warmup = Clock::now() + std::chrono::seconds(1);
+  ok = ok && tickUntil([&]() { return Clock::now() > warmup; });
+
+  int64_t liveBefore = liveAllocations.load();
+  uint64_t allocationsBefore = allocations.load();
+  auto cpuBefore = std::clock();
+  run.measureStart = Clock::now();
+  run.measuring = true;
+  auto start = run.measureStart;
+  auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(settings.seconds));
+  ok = ok && tickUntil([&]() { return Clock::now() > end; });
+  auto window = std::chrono::duration<double>(Clock::now() - start).count();
+
+  // stop sending and let what is in flight come back
+  run.sending = false;
+  auto drainDeadline = Clock::now() + std::chrono::seconds(5);
+  ok = ok && tickUntil([&]() { return run.results.received >= run.results.sent || Clock::now() > drainDeadline; });
+  auto cpu = double(std::clock() - cpuBefore) / CLOCKS_PER_SEC;
+  auto allocated = allocations.load() - allocationsBefore;
+  auto liveGrowth = liveAllocations.load() - liveBefore;
+
+  mesh->terminate();
+
+  auto &results = run.results;
+  if (results.latencies.empty()) {
+    std::printf("%s: no message echoed\n", transport.c_str());
+    return false;
+  }
+
+  auto lost = results.sent > results.received ? results.sent - results.received : 0;
+  std::sort(results.latencies.begin(), results.latencies.end());
+  auto &latencies = results.latencies;
+  auto p99 = percentile(latencies, 0.99);
+  std::printf("%s: echoed %llu of %llu, %.0f messages/s\n", transport.c_str(), (unsigned long long)results.received,
+              (unsigned long long)results.sent, results.received / window);
+  std::printf("%s: latency ms: p50 %.3f, p99 %.3f, p999 %.3f, max %.3f\n", transport.c_str(), percentile(latencies, 0.5),
+              p99, percentile(latencies, 0.999), latencies.back() / 1000.0);
+  std::printf("%s: per message: %.2f us cpu, %.2f allocations, %lld live allocations more than before\n", transport.c_str(),
+              cpu * 1e6 / results.received, double(allocated) / results.received, (long long)liveGrowth);
+
+  if (settings.soak) {
+    // both transports are reliable, nothing can go missing
+    if (lost > 0) {
+      std::printf("%s: FAILED, %llu messages lost\n", transport.c_str(), (unsigned long long)lost);
+      ok = false;
+    }
+    if (p99 > settings.maxP99Ms) {
+      std::printf("%s: FAILED, p99 latency over %.1fms\n", transport.c_str(), settings.maxP99Ms);
+      ok = false;
+    }
+    if (liveGrowth > settings.maxLiveGrowth) {
+      std::printf("%s: FAILED, %lld allocations still live, at most %lld expected\n", transport.c_str(), (long long)liveGrowth,
+                  (long long)settings.maxLiveGrowth);
+      ok = false;
+    }
+  }
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  (void)shardsInterface(SHARDS_CURRENT_ABI);
+
+  Settings settings;
+  std::string transport = "all";
+  if (argc > 1 && std::string(argv[1]) == "soak") {
+    // short runs on every CI build, long runs catch slow leaks and drifts
+    bool isLong = argc > 2 && std::string(argv[2]) == "long";
+    transport = argc > 3 ? argv[3] : "all";
+    settings.soak = true;
+    settings.peers = isLong ? 256 : 32;
+    settings.seconds = isLong ? 600.0 : 10.0;
+    settings.rate = isLong ? 50.0 : 100.0;
+    settings.maxP99Ms = 250.0;
+    settings.maxLiveGrowth = 10000;
+  } else {
+    transport = argc > 1 ? argv[1] : "all";
+    settings.peers = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : settings.peers;
+    settings.seconds = argc > 3 ? std::atof(argv[3]) : settings.seconds;
+    settings.rate = argc > 4 ? std::atof(argv[4]) : settings.rate;
+    settings.size = argc > 5 ? std::strtoul(argv[5], nullptr, 10) : settings.size;
+    settings.coalesce = argc > 6 && std::atoi(argv[6]) != 0;
+  }
+
+  if (transport != "kcp" && transport != "ws" && transport != "all") {
+    std::printf("unknown transport %s, expected kcp, ws or all\n", transport.c_str());
+    return 1;
+  }
+
+  bool ok = true;
+  if (transport == "kcp" || transport == "all")
+    ok = runTransport(settings, "kcp") && ok;
+  if (transport == "ws" || transport == "all") {
+    settings.port++;
+    ok = runTransport(settings, "ws") && ok;
+  }
+  return ok ? 0 : 2;
+}
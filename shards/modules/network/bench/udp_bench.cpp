@@ -0,0 +1,160 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+// Loopback load generator for the UDP sockets under Network.Server
+//
+// Starts an echo server on one or more sockets sharing a port, then many client sockets, each one a peer, keeping
+// a window of datagrams in flight. Reports the packets per second the server moved and how many datagrams each
+// system call carried. Compare batching against one datagram per call with a batch of 1:
+//   udp-bench [peers] [seconds] [server threads] [client threads] [batch] [window] [size] [gso]
+
+#include "../udp_socket.hpp"
+#include <boost/asio/executor_work_guard.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace shards::Network;
+namespace net = boost::asio;
+using Clock = std::chrono::steady_clock;
+
+struct IoThreads {
+  std::vector<std::unique_ptr<net::io_context>> contexts;
+  std::vector<std::thread> threads;
+
+  explicit IoThreads(size_t count) {
+    for (size_t i = 0; i < count; i++)
+      contexts.emplace_back(std::make_unique<net::io_context>(1));
+    for (auto &ioc : contexts) {
+      threads.emplace_back([ioc = ioc.get()]() {
+        auto guard = net::make_work_guard(*ioc);
+        ioc->run();
+      });
+    }
+  }
+
+  ~IoThreads() {
+    for (auto &ioc : contexts)
+      ioc->stop();
+    for (auto &thread : threads)
+      thread.join();
+  }
+
+  net::io_context &operator[](size_t i) { return *contexts[i % contexts.size()]; }
+};
+
+struct Totals {
+  uint64_t received{}, sent{}, dropped{}, receiveCalls{}, sendCalls{};
+
+  static Totals of(const std::vector<std::shared_ptr<UdpSocket>> &sockets) {
+    Totals t;
+    for (auto &s : sockets) {
+      auto &stats = s->stats();
+      t.received += stats.received;
+      t.sent += stats.sent;
+      t.dropped += stats.dropped;
+      t.receiveCalls += stats.receiveCalls;
+      t.sendCalls += stats.sendCalls;
+    }
+    return t;
+  }
+};
+
+int main(int argc, char **argv) {
+  size_t peers = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+  double seconds = argc > 2 ? std::atof(argv[2]) : 5.0;
+  size_t serverThreads = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1;
+  size_t clientThreads = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 4;
+  size_t batch = argc > 5 ? std::strtoul(argv[5], nullptr, 10) : 64;
+  size_t window = argc > 6 ? std::strtoul(argv[6], nullptr, 10) : 4;
+  size_t size = argc > 7 ? std::strtoul(argv[7], nullptr, 10) : 256;
+  bool gso = argc > 8 && std::atoi(argv[8]) != 0;
+
+  UdpSocket::Options serverOptions;
+  serverOptions.batch = batch;
+  serverOptions.gso = gso;
+  serverOptions.reuseAddress = true;
+  serverOptions.reusePort = serverThreads > 1;
+  serverOptions.bufferSize = 4 * 1024 * 1024;
+
+  auto echo = [](UdpSocket &socket, const udp::endpoint &from, const uint8_t *data, size_t size) {
+    socket.send(from, data, size);
+  };
+
+  IoThreads serverIo(serverThreads);
+  std::vector<std::shared_ptr<UdpSocket>> servers;
+  udp::endpoint serverEndpoint{net::ip::make_address("127.0.0.1"), 0};
+  for (size_t i = 0; i < serverThreads; i++) {
+    servers.push_back(UdpSocket::open(serverIo[i], serverEndpoint, serverOptions, echo));
+    serverEndpoint = servers.front()->localEndpoint();
+  }
+
+  // clients echo back too, each peer keeps its window going
+  UdpSocket::Options clientOptions;
+  clientOptions.batch = 64;
+  clientOptions.bufferSize = 256 * 1024;
+  std::vector<std::atomic<uint64_t>> echoes(peers);
+  IoThreads clientIo(clientThreads);
+  std::vector<std::shared_ptr<UdpSocket>> clients;
+  for (size_t i = 0; i < peers; i++) {
+    clients.push_back(UdpSocket::open(
+        clientIo[i], udp::endpoint{net::ip::make_address("127.0.0.1"), 0}, clientOptions,
+        [&, i](UdpSocket &socket, const udp::endpoint &, const uint8_t *data, size_t size) {
+          echoes[i].fetch_add(1, std::memory_order_relaxed);
+          socket.send(serverEndpoint, data, size);
+        }));
+  }
+
+  std::vector<uint8_t> payload(size, 0x5a);
+  std::vector<uint64_t> seen(peers, ~uint64_t(0));
+  auto refill = [&]() {
+    // a window lost to full buffers is started again
+    for (size_t i = 0; i < peers; i++) {
+      auto now = echoes[i].load(std::memory_order_relaxed);
+      if (now != seen[i]) {
+        seen[i] = now;
+        continue;
+      }
+      for (size_t w = 0; w < window; w++)
+        clients[i]->send(serverEndpoint, payload.data(), payload.size());
+    }
+  };
+
+  std::printf("%zu peers, %zu server threads, %zu client threads, batch %zu, window %zu, %zu bytes%s\n", peers,
+              serverThreads, clientThreads, batch, window, size, gso ? ", gso" : "");
+
+  // warm up before measuring
+  auto warmup = Clock::now() + std::chrono::seconds(1);
+  while (Clock::now() < warmup) {
+    refill();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+
+  auto before = Totals::of(servers);
+  auto start = Clock::now();
+  auto end = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(seconds));
+  while (Clock::now() < end) {
+    refill();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  }
+  auto after = Totals::of(servers);
+  auto elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+  auto received = after.received - before.received;
+  auto sent = after.sent - before.sent;
+  auto receiveCalls = after.receiveCalls - before.receiveCalls;
+  auto sendCalls = after.sendCalls - before.sendCalls;
+  std::printf("server received: %.0f packets/s, %.1f per call\n", double(received) / elapsed,
+              receiveCalls ? double(received) / double(receiveCalls) : 0.0);
+  std::printf("server sent:     %.0f packets/s, %.1f per call\n", double(sent) / elapsed,
+              sendCalls ? double(sent) / double(sendCalls) : 0.0);
+  std::printf("dropped:         %llu\n", (unsigned long long)(after.dropped - before.dropped));
+
+  for (auto &socket : clients)
+    socket->close();
+  for (auto &socket : servers)
+    socket->close();
+  return 0;
+}
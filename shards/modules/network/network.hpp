@@ -7,10 +7,19 @@
 #include <shards/shards.h>
 #include <shards/shards.hpp>
 #include <vector>
+#include <functional>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
+#include <limits>
+#include <linalg.h>
 #include "log.hpp"
 
 namespace shards {
+struct Serialization;
+struct CompactSchema;
+struct CompactSchemaScope;
+
 namespace Network {
 
 constexpr uint32_t PeerCC = 'netP';
@@ -42,7 +51,20 @@ struct Reader {
     offset = newOffset;
   }
 
-  void deserializeInto(OwnedVar &output);
+  const uint8_t *peek(size_t size) const { return offset + size <= max ? (const uint8_t *)buffer + offset : nullptr; }
+  void skip(size_t size) {
+    if (offset + size > max) {
+      throw std::runtime_error("Overflow requested");
+    }
+    offset += size;
+  }
+
+  // Compact schemas embedded by the sender are kept in schemas, the scope of the connection
+  void deserializeInto(OwnedVar &output, CompactSchemaScope &schemas);
+  // Also accepts compact (schema driven) messages, regular ones are read with serializer
+  void deserializeInto(Serialization &serializer, SHVar &output, CompactSchemaScope &schemas);
+  // Strings and bytes in output point into the buffer, which must outlive any use of output
+  void deserializeViewInto(OwnedVar &output, CompactSchemaScope &schemas);
 };
 
 struct Writer {
@@ -77,27 +99,191 @@ struct Writer {
   size_t size() { return offset; }
 
   boost::span<const uint8_t> varToSendBuffer(const SHVar &input);
+  boost::span<const uint8_t> varToCompactSendBuffer(const SHVar &input, const CompactSchema &schema, bool embedSchema);
 };
 
 Writer &getSendWriter();
 
+// Messages coalesced by a peer travel as a single one:
+//   u32 size | u8 BatchMarker | u32 count | count framed messages, each starting with its own u32 size
+// The marker is neither a valid SHType nor the compact serialization marker.
+constexpr uint8_t BatchMarker = 0xB7;
+constexpr size_t BatchHeaderSize = 9;
+
+inline bool isBatch(const uint8_t *data, size_t size) { return size > 4 && data[4] == BatchMarker; }
+
+// Calls fn with a Reader over each message in a received payload (starting with its u32 size), a regular message or a
+// batch of them. fn returns false to skip the rest of the batch.
+template <typename F> void forEachMessage(const uint8_t *data, size_t size, F &&fn) {
+  if (!isBatch(data, size)) {
+    Reader r((char *)data + 4, size - 4);
+    fn(r);
+    return;
+  }
+
+  if (size < BatchHeaderSize)
+    throw std::runtime_error("Truncated message batch");
+  uint32_t count;
+  memcpy(&count, data + 5, sizeof(uint32_t));
+  size_t offset = BatchHeaderSize;
+  for (uint32_t i = 0; i < count; i++) {
+    uint32_t len;
+    if (offset + sizeof(uint32_t) > size)
+      throw std::runtime_error("Truncated message batch");
+    memcpy(&len, data + offset, sizeof(uint32_t));
+    if (len < sizeof(uint32_t) || offset + len > size)
+      throw std::runtime_error("Invalid message in batch");
+    Reader r((char *)data + offset + 4, len - 4);
+    if (!fn(r))
+      return;
+    offset += len;
+  }
+}
+
 struct Peer {
-  Peer() { id = nextId.fetch_add(1, std::memory_order_relaxed); }
-  virtual ~Peer() = default;
+  Peer();
+  virtual ~Peer();
+
+  // Batches larger than this are flushed early
+  static constexpr size_t MaxCoalescedSize = 16 * 1024;
 
   virtual void send(boost::span<const uint8_t> data) = 0;
   virtual bool disconnected() const = 0;
   int64_t getId() { return id; }
-  void sendVar(const SHVar &input) { send(getSendWriter().varToSendBuffer(input)); }
+  void sendVar(const SHVar &input) { post(getSendWriter().varToSendBuffer(input)); }
+  // The schema is embedded only in the first message that uses it
+  void sendVar(const SHVar &input, const CompactSchema &schema);
+
+  // Sends a framed message (u32 size | payload), or queues it until flush when coalescing
+  void post(boost::span<const uint8_t> message);
+  // Sends the messages queued since the last flush together, as a single batch
+  void flush();
+
+  // Set by the server or client shard owning this peer, which flushes it once per activation
+  bool coalesce{};
+
+  // Compact schemas the other side embedded in its messages, for this connection only
+  CompactSchemaScope &receivedSchemas() { return *_receivedSchemas; }
+
+  // A new connection reuses this peer, anything tied to the previous one is dropped
+  void newSession();
+  // Changes with every connection using this peer
+  uint64_t session() const { return _session; }
 
 private:
   static inline std::atomic_int64_t nextId{1};
+  static inline std::atomic_uint64_t nextSession{1};
   int64_t id;
+  uint64_t _session{nextSession.fetch_add(1, std::memory_order_relaxed)};
+  // Compact schemas already embedded for this connection, cleared by newSession so a reused peer embeds them again
+  std::unordered_set<uint64_t> sentSchemas;
+  std::unique_ptr<CompactSchemaScope> _receivedSchemas;
+  // Queued messages after room for the batch header
+  std::vector<uint8_t> pending;
+  uint32_t pendingCount{};
+};
+
+// Peers bucketed by the cell of a uniform grid holding their last known position, so updates can go to the peers
+// they are relevant to instead of all of them. Only used from the mesh thread.
+struct InterestGrid {
+  using float3 = linalg::aliases::float3;
+
+  // Moves the peer, cells are only touched when it crosses into another one
+  void update(Peer &peer, const float3 &position);
+  void remove(int64_t peerId);
+  void clear();
+
+  float cellSize() const { return _cellSize; }
+  // Every peer is bucketed again when the size changes
+  void setCellSize(float size);
+
+  size_t size() const { return _entries.size(); }
+
+  // Calls fn for each peer within radius of center, a radius of 0 selects the cell of center and its neighbors
+  template <typename F> void query(const float3 &center, float radius, F &&fn) const {
+    if (_cells.empty())
+      return;
+    auto reach = radius > 0.0f ? radius : _cellSize;
+    auto lo = cellOf(center - reach), hi = cellOf(center + reach);
+    auto radius2 = radius * radius;
+    auto visit = [&](const std::vector<Entry *> &cell) {
+      for (auto entry : cell) {
+        if (radius > 0.0f ? linalg::length2(entry->position - center) > radius2 : !within(entry->position, lo, hi))
+          continue;
+        fn(*entry->peer);
+      }
+    };
+
+    // Nothing lies outside of the occupied cells, this also collapses z when all positions are 2D
+    auto from = linalg::max(lo, _lo), to = linalg::min(hi, _hi);
+    if (from.x > to.x || from.y > to.y || from.z > to.z)
+      return;
+    // In double, the extent of each axis can be up to 2^31 cells
+    auto volume = double(to.x - from.x + 1) * double(to.y - from.y + 1) * double(to.z - from.z + 1);
+    if (volume > double(_cells.size())) {
+      // Large reach over a sparse grid, cheaper to go through the occupied cells
+      for (auto &[key, cell] : _cells)
+        visit(cell);
+      return;
+    }
+
+    for (auto x = from.x; x <= to.x; x++) {
+      for (auto y = from.y; y <= to.y; y++) {
+        for (auto z = from.z; z <= to.z; z++) {
+          auto it = _cells.find(cellKey({x, y, z}));
+          if (it != _cells.end())
+            visit(it->second);
+        }
+      }
+    }
+  }
+
+private:
+  using int3 = linalg::aliases::int3;
+
+  struct Entry {
+    Peer *peer;
+    float3 position;
+    uint64_t cell;
+    // In the cell's list, for constant time removal
+    size_t index;
+  };
+
+  float _cellSize{32.0f};
+  // Entries never move in memory, cells point to them
+  std::unordered_map<int64_t, Entry> _entries;
+  std::unordered_map<uint64_t, std::vector<Entry *>> _cells;
+  // Bounds of the cells ever occupied since the last clear, only grow
+  int3 _lo{std::numeric_limits<int>::max()}, _hi{std::numeric_limits<int>::min()};
+
+  // Far away, infinite or NaN coordinates saturate instead of overflowing the conversion to int
+  static constexpr float MaxCell = float(1 << 30);
+  static int clampCell(float cell) { return cell < MaxCell ? (cell > -MaxCell ? int(cell) : int(-MaxCell)) : int(MaxCell); }
+  int3 cellOf(const float3 &position) const {
+    auto cell = linalg::floor(position / _cellSize);
+    return {clampCell(cell.x), clampCell(cell.y), clampCell(cell.z)};
+  }
+  bool within(const float3 &position, const int3 &lo, const int3 &hi) const {
+    auto cell = cellOf(position);
+    return cell.x >= lo.x && cell.x <= hi.x && cell.y >= lo.y && cell.y <= hi.y && cell.z >= lo.z && cell.z <= hi.z;
+  }
+  // 21 bits per axis, far away cells wrapping onto each other only cost extra checks
+  static uint64_t cellKey(const int3 &cell) {
+    return (uint64_t(uint32_t(cell.x) & 0x1FFFFF) << 42) | (uint64_t(uint32_t(cell.y) & 0x1FFFFF) << 21) |
+           uint64_t(uint32_t(cell.z) & 0x1FFFFF);
+  }
+  void link(Entry &entry);
+  void unlink(Entry &entry);
 };
 
 struct Server {
+  // Positions set with Network.SetPosition, used by Network.BroadcastNear
+  InterestGrid interest;
+
   virtual void broadcast(boost::span<const uint8_t> data, const SHVar &exclude) = 0;
   void broadcastVar(const SHVar &input, const SHVar &exclude) { broadcast(getSendWriter().varToSendBuffer(input), exclude); }
+  // Every connected peer, on the mesh thread
+  virtual void forEachPeer(const std::function<void(Peer &)> &fn) = 0;
 };
 
 struct OnPeerConnected {
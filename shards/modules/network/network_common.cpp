@@ -8,7 +8,9 @@
 #include <shards/common_types.hpp>
 #include <shards/core/wire_doppelganger_pool.hpp>
 #include <shards/core/serialization.hpp>
+#include <shards/core/serialization_compact.hpp>
 #include <shards/utility.hpp>
+#include <cmath>
 #include <optional>
 #include <boost/lockfree/queue.hpp>
 #include <functional>
@@ -27,10 +29,29 @@ Writer &getSendWriter() {
   return inst;
 }
 
-void Reader::deserializeInto(OwnedVar &output) {
+void Reader::deserializeInto(Serialization &serializer, SHVar &output, CompactSchemaScope &schemas) {
+  const uint8_t *head = peek(1);
+  if (head && CompactSerialization::isCompact(*head)) {
+    static thread_local CompactSerialization compact;
+    compact.reset();
+    skip(1);
+    compact.deserializeFrame(*this, output, schemas);
+  } else {
+    serializer.deserialize(*this, output);
+  }
+}
+
+void Reader::deserializeInto(OwnedVar &output, CompactSchemaScope &schemas) {
+  static thread_local Serialization serializer;
+  serializer.reset();
+  deserializeInto(serializer, output, schemas);
+}
+
+void Reader::deserializeViewInto(OwnedVar &output, CompactSchemaScope &schemas) {
   static thread_local Serialization serializer;
   serializer.reset();
-  serializer.deserialize(*this, output);
+  serializer.views = true;
+  deserializeInto(serializer, output, schemas);
 }
 
 boost::span<const uint8_t> Writer::varToSendBuffer(const SHVar &input) {
@@ -38,12 +59,148 @@ boost::span<const uint8_t> Writer::varToSendBuffer(const SHVar &input) {
 
   reset();
   serializer.reset();
-  serializer.serialize(input, *this);
+  // size first so the buffer is grown once and the payload written in place
+  offset += serializer.serializeInto(input, buffer, offset);
+  finalize();
+
+  return boost::span(data(), size());
+}
+
+boost::span<const uint8_t> Writer::varToCompactSendBuffer(const SHVar &input, const CompactSchema &schema, bool embedSchema) {
+  static thread_local CompactSerialization serializer;
+
+  reset();
+  serializer.reset();
+  serializer.serialize(input, schema, *this, embedSchema);
   finalize();
 
   return boost::span(data(), size());
 }
 
+void Peer::sendVar(const SHVar &input, const CompactSchema &schema) {
+  bool embedSchema = sentSchemas.insert(schema.hash).second;
+  post(getSendWriter().varToCompactSendBuffer(input, schema, embedSchema));
+}
+
+void Peer::post(boost::span<const uint8_t> message) {
+  if (!coalesce)
+    return send(message);
+
+  if (pendingCount > 0 && pending.size() + message.size() > MaxCoalescedSize)
+    flush();
+  if (pendingCount == 0)
+    pending.resize(BatchHeaderSize);
+  pending.insert(pending.end(), message.begin(), message.end());
+  pendingCount++;
+}
+
+void Peer::flush() {
+  if (pendingCount == 0)
+    return;
+  DEFER({
+    pending.clear();
+    pendingCount = 0;
+  });
+
+  if (disconnected())
+    return;
+
+  if (pendingCount == 1) {
+    // no need for a batch
+    send(boost::span<const uint8_t>(pending.data() + BatchHeaderSize, pending.size() - BatchHeaderSize));
+    return;
+  }
+
+  uint32_t size = uint32_t(pending.size());
+  memcpy(pending.data(), &size, sizeof(uint32_t));
+  pending[4] = BatchMarker;
+  memcpy(pending.data() + 5, &pendingCount, sizeof(uint32_t));
+  send(boost::span<const uint8_t>(pending.data(), pending.size()));
+}
+
+Peer::Peer() : _receivedSchemas(std::make_unique<CompactSchemaScope>()) {
+  id = nextId.fetch_add(1, std::memory_order_relaxed);
+}
+
+Peer::~Peer() = default;
+
+void Peer::newSession() {
+  _session = nextSession.fetch_add(1, std::memory_order_relaxed);
+  sentSchemas.clear();
+  _receivedSchemas->clear();
+  pending.clear();
+  pendingCount = 0;
+}
+
+void InterestGrid::link(Entry &entry) {
+  auto at = cellOf(entry.position);
+  _lo = linalg::min(_lo, at);
+  _hi = linalg::max(_hi, at);
+  auto &cell = _cells[entry.cell];
+  entry.index = cell.size();
+  cell.push_back(&entry);
+}
+
+void InterestGrid::unlink(Entry &entry) {
+  auto it = _cells.find(entry.cell);
+  auto &cell = it->second;
+  // swap with the last one, order does not matter
+  auto last = cell.back();
+  cell[entry.index] = last;
+  last->index = entry.index;
+  cell.pop_back();
+  if (cell.empty())
+    _cells.erase(it);
+}
+
+void InterestGrid::update(Peer &peer, const float3 &position) {
+  auto cell = cellKey(cellOf(position));
+  auto [it, inserted] = _entries.try_emplace(peer.getId(), Entry{&peer, position, cell, 0});
+  auto &entry = it->second;
+  if (inserted) {
+    link(entry);
+    return;
+  }
+
+  entry.position = position;
+  if (entry.cell != cell) {
+    unlink(entry);
+    entry.cell = cell;
+    link(entry);
+  }
+}
+
+void InterestGrid::remove(int64_t peerId) {
+  auto it = _entries.find(peerId);
+  if (it == _entries.end())
+    return;
+  unlink(it->second);
+  _entries.erase(it);
+}
+
+void InterestGrid::clear() {
+  _entries.clear();
+  _cells.clear();
+  _lo = int3{std::numeric_limits<int>::max()};
+  _hi = int3{std::numeric_limits<int>::min()};
+}
+
+void InterestGrid::setCellSize(float size) {
+  if (!(size > 0.0f) || !std::isfinite(size))
+    throw std::invalid_argument("Interest grid cell size must be positive");
+  if (size == _cellSize)
+    return;
+
+  _cellSize = size;
+  _cells.clear();
+  _lo = int3{std::numeric_limits<int>::max()};
+  _hi = int3{std::numeric_limits<int>::min()};
+  for (auto &[id, entry] : _entries) {
+    entry.cell = cellKey(cellOf(entry.position));
+    link(entry);
+  }
+}
+
 Peer &getConnectedPeer(ParamVar &peerParam) {
   Peer &peer = varAsObjectChecked<Peer>(peerParam.get(), Types::Peer);
   if (peer.disconnected()) {
@@ -111,6 +268,123 @@ struct Broadcast {
   }
 };
 
+static InterestGrid::float3 toPosition(const SHVar &var) {
+  InterestGrid::float3 position =
+      var.valueType == SHType::Float2
+          ? InterestGrid::float3{float(var.payload.float2Value[0]), float(var.payload.float2Value[1]), 0.0f}
+          : InterestGrid::float3{var.payload.float3Value[0], var.payload.float3Value[1], var.payload.float3Value[2]};
+  if (!std::isfinite(position.x) || !std::isfinite(position.y) || !std::isfinite(position.z))
+    throw ActivationError("Network: position must be finite");
+  return position;
+}
+
+struct SetPosition {
+  static SHOptionalString help() {
+    return SHCCSTR("This shard records the position of a peer in the server (created by Network.Server) specified in the "
+                   "Server parameter, so that Network.BroadcastNear only sends it what happens around it. Peers without a "
+                   "position receive nothing from Network.BroadcastNear.");
+  }
+
+  static SHOptionalString inputHelp() { return SHCCSTR("The position of the peer, 2D positions lie on the XY plane."); }
+
+  static SHOptionalString outputHelp() { return DefaultHelpText::OutputHelpPass; }
+
+  static SHTypesInfo inputTypes() {
+    static shards::Types types{{CoreInfo::Float2Type, CoreInfo::Float3Type}};
+    return types;
+  }
+  static SHTypesInfo outputTypes() { return inputTypes(); }
+
+  PARAM_EXT(ParamVar, _peer, Types::PeerParameterInfo);
+  PARAM_PARAMVAR(_server, "Server", "The server the peer is connected to.", {Types::ServerVar});
+  PARAM_IMPL(PARAM_IMPL_FOR(_peer), PARAM_IMPL_FOR(_server));
+
+  SetPosition() {
+    setDefaultPeerParam(_peer);
+    setDefaultServerParam(_server);
+  }
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) { PARAM_CLEANUP(context); }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    return data.inputType;
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    auto &server = varAsObjectChecked<Server>(_server.get(), Types::Server);
+    auto &peer = getConnectedPeer(_peer);
+    server.interest.update(peer, toPosition(input));
+    return input;
+  }
+};
+
+struct BroadcastNear {
+  static SHOptionalString help() {
+    return SHCCSTR("This shard sends the input only to the peers of the server (created by Network.Server) close to the "
+                   "given position, as recorded with Network.SetPosition. Without a radius, peers in the cell of the "
+                   "position and the cells around it receive the input.");
+  }
+
+  static SHOptionalString inputHelp() { return SHCCSTR("The input to send to the nearby peers."); }
+
+  static SHOptionalString outputHelp() { return DefaultHelpText::OutputHelpPass; }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
+
+  PARAM_PARAMVAR(_server, "Server", "The server to send the input to.", {Types::ServerVar});
+  PARAM_PARAMVAR(_position, "Position", "Where the update happens.",
+                 {CoreInfo::Float2Type, CoreInfo::Float2VarType, CoreInfo::Float3Type, CoreInfo::Float3VarType});
+  PARAM_PARAMVAR(_radius, "Radius", "Only peers within this distance of the position receive the input.",
+                 {CoreInfo::NoneType, CoreInfo::FloatType, CoreInfo::FloatVarType});
+  PARAM_PARAMVAR(_exclude, "Exclude", "The list of Peer IDs to exclude from the broadcast.",
+                 {CoreInfo::IntVarSeqType, CoreInfo::IntSeqType, CoreInfo::NoneType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_server), PARAM_IMPL_FOR(_position), PARAM_IMPL_FOR(_radius), PARAM_IMPL_FOR(_exclude));
+
+  BroadcastNear() { setDefaultServerParam(_server); }
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) { PARAM_CLEANUP(context); }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    if (_position.isNone())
+      throw ComposeError("Network.BroadcastNear: Position is required");
+    return outputTypes().elements[0];
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    auto &server = varAsObjectChecked<Server>(_server.get(), Types::Server);
+    auto &radius = _radius.get();
+    auto &exclude = _exclude.get();
+
+    auto reach = radius.valueType == SHType::Float ? float(radius.payload.floatValue) : 0.0f;
+    if (!(reach >= 0.0f) || !std::isfinite(reach))
+      throw ActivationError("Network.BroadcastNear: Radius must be a finite, non-negative distance");
+
+    std::optional<boost::span<const uint8_t>> data;
+    server.interest.query(toPosition(_position.get()), reach, [&](Peer &peer) {
+      if (peer.disconnected())
+        return;
+      if (exclude.valueType == SHType::Seq) {
+        for (auto &excluded : exclude) {
+          if (excluded.payload.intValue == peer.getId())
+            return;
+        }
+      }
+      // serialized once, only if someone is around
+      if (!data)
+        data = getSendWriter().varToSendBuffer(input);
+      peer.post(*data);
+    });
+    return input;
+  }
+};
+
 struct Send {
   static SHOptionalString help() {
     return SHCCSTR("This shard sends the input to the peer specified in the Peer parameter.");
@@ -128,9 +402,18 @@ struct Send {
   static SHTypesInfo outputTypes() { return shards::CoreInfo::AnyType; }
 
   PARAM_EXT(ParamVar, _peer, Types::PeerParameterInfo);
-  PARAM_IMPL(PARAM_IMPL_FOR(_peer));
+  PARAM_VAR(_compact, "Compact",
+            "If the input should be sent using the compact encoding derived from its type, the type itself is only sent once "
+            "per peer. Much smaller messages for values with a known shape (tables with fixed keys, sequences of numbers).",
+            {CoreInfo::BoolType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_peer), PARAM_IMPL_FOR(_compact));
+
+  std::shared_ptr<const CompactSchema> _schema;
 
-  Send() { setDefaultPeerParam(_peer); }
+  Send() {
+    setDefaultPeerParam(_peer);
+    _compact = Var(false);
+  }
 
   void warmup(SHContext *context) { PARAM_WARMUP(context); }
   void cleanup(SHContext *context) { PARAM_CLEANUP(context); }
@@ -138,12 +421,16 @@ struct Send {
   PARAM_REQUIRED_VARIABLES();
   SHTypeInfo compose(SHInstanceData &data) {
     PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    _schema = _compact->payload.boolValue ? CompactSchemaRegistry::instance().get(data.inputType) : nullptr;
     return outputTypes().elements[0];
   }
 
   SHVar activate(SHContext *shContext, const SHVar &input) {
     auto &peer = getConnectedPeer(_peer);
-    peer.sendVar(input);
+    if (_schema)
+      peer.sendVar(input, *_schema);
+    else
+      peer.sendVar(input);
     return input;
   }
 };
@@ -180,6 +467,8 @@ struct SendRaw {
 
   SHVar activate(SHContext *shContext, const SHVar &input) {
     auto &peer = getConnectedPeer(_peer);
+    // keep the order with coalesced messages
+    peer.flush();
     // if (input.valueType == SHType::String) {
     //   peer.send(boost::span(input.payload.stringValue, input.payload.stringLen));
     // } else {
@@ -261,6 +550,8 @@ struct PeerShard {
 SHARDS_REGISTER_FN(network_common) {
   using namespace shards::Network;
   REGISTER_SHARD("Network.Broadcast", Broadcast);
+  REGISTER_SHARD("Network.BroadcastNear", BroadcastNear);
+  REGISTER_SHARD("Network.SetPosition", SetPosition);
   REGISTER_SHARD("Network.SendRaw", SendRaw);
   REGISTER_SHARD("Network.Send", Send);
   REGISTER_SHARD("Network.PeerID", PeerID);
@@ -16,6 +16,7 @@
 
 #include <tracy/Wrapper.hpp>
 #include "network.hpp"
+#include "udp_socket.hpp"
 #include <shards/core/shared.hpp>
 #include <shards/core/foundation.hpp>
 #include <shards/shards.hpp>
@@ -26,6 +27,7 @@
 #include <shards/utility.hpp>
 #include <optional>
 #include <boost/lockfree/queue.hpp>
+#include <atomic>
 #include <functional>
 #include <memory>
 #include <shared_mutex>
@@ -46,29 +48,44 @@ static inline auto logger = getLogger();
 
 using boost::asio::ip::udp;
 
+// I/O threads shared by the network shards of a mesh, each runs its own io_context
 struct NetworkContext {
-  boost::asio::io_context _io_context;
-  std::thread _io_context_thread;
-
-  NetworkContext() {
-    _io_context_thread = std::thread([this] {
-      // Force run to run even without work
-      boost::asio::executor_work_guard<boost::asio::io_context::executor_type> _guard = boost::asio::make_work_guard(_io_context);
-      try {
-        SPDLOG_LOGGER_DEBUG(logger, "Boost asio context running...");
-        _io_context.run();
-      } catch (...) {
-        SPDLOG_LOGGER_ERROR(logger, "Boost asio context run failed.");
-      }
-      SPDLOG_LOGGER_DEBUG(logger, "Boost asio context exiting...");
-    });
+  struct IoThread {
+    boost::asio::io_context _io_context{1};
+    std::thread _thread;
+  };
+
+  std::mutex _lock;
+  std::vector<std::unique_ptr<IoThread>> _threads;
+
+  // Starts threads up to index as needed
+  boost::asio::io_context &ioContext(size_t index) {
+    std::scoped_lock<std::mutex> l(_lock);
+    while (_threads.size() <= index) {
+      auto &io = *_threads.emplace_back(std::make_unique<IoThread>());
+      io._thread = std::thread([ioc = &io._io_context] {
+        // Force run to run even without work
+        boost::asio::executor_work_guard<boost::asio::io_context::executor_type> _guard = boost::asio::make_work_guard(*ioc);
+        try {
+          SPDLOG_LOGGER_DEBUG(logger, "Boost asio context running...");
+          ioc->run();
+        } catch (...) {
+          SPDLOG_LOGGER_ERROR(logger, "Boost asio context run failed.");
+        }
+        SPDLOG_LOGGER_DEBUG(logger, "Boost asio context exiting...");
+      });
+    }
+    return _threads[index]->_io_context;
   }
 
   ~NetworkContext() {
     SPDLOG_LOGGER_TRACE(logger, "NetworkContext dtor");
-    _io_context.stop(); // internally it will lock and send stop to all threads
-    if (_io_context_thread.joinable())
-      _io_context_thread.join();
+    for (auto &io : _threads)
+      io->_io_context.stop(); // internally it will lock and send stop to all threads
+    for (auto &io : _threads) {
+      if (io->_thread.joinable())
+        io->_thread.join();
+    }
   }
 };
 
@@ -82,8 +99,8 @@ struct NetworkBase {
 
   AnyStorage<NetworkContext> _sharedNetworkContext;
 
-  std::optional<udp::socket> _socket;
-  std::mutex _socketMutex;
+  // A server can spread its peers over several sockets sharing its port, each served by its own I/O thread
+  std::vector<std::shared_ptr<UdpSocket>> _sockets;
 
   ExposedInfo _required;
   SHTypeInfo compose(const SHInstanceData &data) {
@@ -95,27 +112,17 @@ struct NetworkBase {
 
   SHExposedTypesInfo requiredVariables() { return SHExposedTypesInfo(_required); }
 
-  void cleanup(SHContext *context) {
-    if (_sharedNetworkContext) {
-      auto &io_context = _sharedNetworkContext->_io_context;
-
-      // defer all in the context or we will crash!
-      if (_socket) {
-        std::scoped_lock<std::mutex> l(_socketMutex);
-
-        struct Container {
-          udp::socket socket;
-          Container(udp::socket &&s) : socket(std::move(s)) {}
-        };
-
-        boost::asio::post(io_context, [socket_ = std::make_unique<Container>(std::move(_socket.value()))]() {
-          SPDLOG_LOGGER_TRACE(logger, "Closing socket");
-          socket_->socket.close();
-        });
-
-        _socket.reset();
-      }
+  // Once this returns no more datagrams are received
+  void closeSockets() {
+    for (auto &socket : _sockets) {
+      SPDLOG_LOGGER_TRACE(logger, "Closing socket");
+      socket->close();
     }
+    _sockets.clear();
+  }
+
+  void cleanup(SHContext *context) {
+    closeSockets();
 
     // clean context vars
     if (_peerVar) {
@@ -266,6 +273,7 @@ struct KCPPeer final : public Peer {
     // set "turbo" mode
     ikcp_nodelay(kcp, 1, 10, 2, 1);
 
+    newSession();
     _start = SHClock::now();
     _lastContact = SHClock::now();
     disconnected_ = false;
@@ -275,6 +283,8 @@ struct KCPPeer final : public Peer {
   }
 
   std::optional<udp::endpoint> endpoint{};
+  // The socket this peer's datagrams arrive on, replies go out through it too
+  std::shared_ptr<UdpSocket> socket;
   ikcpcb *kcp = nullptr;
   Serialization des{};
   OwnedVar payload{};
@@ -299,30 +309,54 @@ struct KCPPeer final : public Peer {
 };
 
 struct KCPServer : public Server {
+  // Guards the peer maps, the I/O threads add peers as they connect
+  std::shared_mutex peersMutex;
   std::unordered_map<udp::endpoint, KCPPeer *> _end2Peer;
+  // Set while the server activation holds a shared lock, the peer wires it runs read the peers without locking again
+  std::atomic<std::thread::id> _readingThread{};
+
+  template <typename F> void readPeers(F &&fn) {
+    if (_readingThread.load(std::memory_order_relaxed) == std::this_thread::get_id()) {
+      fn();
+      return;
+    }
+    std::shared_lock<std::shared_mutex> lock(peersMutex);
+    fn();
+  }
+
+  void forEachPeer(const std::function<void(Peer &)> &fn) override {
+    readPeers([&]() {
+      for (auto &[end, peer] : _end2Peer) {
+        fn(*peer);
+      }
+    });
+  }
+
   std::unordered_map<const SHWire *, KCPPeer *> _wire2Peer;
 
   std::unordered_set<int64_t> _blacklist;
 
   void broadcast(boost::span<const uint8_t> data, const SHVar &exclude) {
-    if (exclude.valueType == SHType::Seq) {
-      _blacklist.clear();
+    readPeers([&]() {
+      if (exclude.valueType == SHType::Seq) {
+        _blacklist.clear();
 
-      for (auto &excluded : exclude) {
-        _blacklist.insert(excluded.payload.intValue);
-      }
+        for (auto &excluded : exclude) {
+          _blacklist.insert(excluded.payload.intValue);
+        }
 
-      for (auto &[end, peer] : _end2Peer) {
-        if (_blacklist.find(peer->getId()) == _blacklist.end()) {
-          peer->send(data);
+        for (auto &[end, peer] : _end2Peer) {
+          if (_blacklist.find(peer->getId()) == _blacklist.end()) {
+            peer->post(data);
+          }
+        }
+      } else {
+        // fast path
+        for (auto &[end, peer] : _end2Peer) {
+          peer->post(data);
         }
       }
-    } else {
-      // fast path
-      for (auto &[end, peer] : _end2Peer) {
-        peer->send(data);
-      }
-    }
+    });
   }
 };
 
@@ -360,9 +394,6 @@ struct ServerShard : public NetworkBase {
     }
   } _composer{*this};
 
-  std::shared_mutex peersMutex;
-  udp::endpoint _sender;
-
   KCPServer _server;
   SHVar *_serverVar{nullptr};
 
@@ -372,6 +403,11 @@ struct ServerShard : public NetworkBase {
   std::atomic<bool> _running{false};
 
   float _timeoutSecs = 30.0f;
+  int64_t _threads = 1;
+  bool _gso = false;
+  bool _coalesce = false;
+  bool _view = false;
+  float _cellSize = 32.0f;
 
   ShardsVar _disconnectionHandler{};
 
@@ -392,7 +428,28 @@ struct ServerShard : public NetworkBase {
        {CoreInfo::FloatType}},
       {"OnDisconnect",
        SHCCSTR("The shards to execute when a peer disconnects, The Peer ID will be the input."),
-       {CoreInfo::ShardsOrNone}}};
+       {CoreInfo::ShardsOrNone}},
+      {"Threads",
+       SHCCSTR("The number of sockets sharing the port, each with its own I/O thread. The kernel spreads peers over them by "
+               "hashing their address (Linux only, a single socket is used elsewhere)."),
+       {CoreInfo::IntType}},
+      {"GSO",
+       SHCCSTR("Send runs of equally sized datagrams to the same peer as a single buffer segmented by the kernel (UDP GSO, "
+               "Linux only)."),
+       {CoreInfo::BoolType}},
+      {"Coalesce",
+       SHCCSTR("Queue the messages sent to each peer and send them together once per activation of the server, fewer and "
+               "larger packets at the cost of up to a tick of latency."),
+       {CoreInfo::BoolType}},
+      {"View",
+       SHCCSTR("Deserialize the strings and byte arrays of received messages as views into the receive buffer instead of "
+               "copies. They are only valid while the peer wire processes the message, copies made with Set and the like "
+               "stay valid."),
+       {CoreInfo::BoolType}},
+      {"CellSize",
+       SHCCSTR("The size of the cells peers are bucketed in by Network.SetPosition, about the distance at which updates "
+               "stop being relevant to them."),
+       {CoreInfo::FloatType}}};
 
   static SHParametersInfo parameters() { return SHParametersInfo(params); }
 
@@ -412,6 +469,22 @@ struct ServerShard : public NetworkBase {
       break;
     case 4:
       _disconnectionHandler = value;
+      break;
+    case 5:
+      _threads = value.payload.intValue;
+      break;
+    case 6:
+      _gso = value.payload.boolValue;
+      break;
+    case 7:
+      _coalesce = value.payload.boolValue;
+      break;
+    case 8:
+      _view = value.payload.boolValue;
+      break;
+    case 9:
+      _cellSize = float(value.payload.floatValue);
+      break;
     default:
       break;
     }
@@ -429,12 +502,27 @@ struct ServerShard : public NetworkBase {
       return Var(_timeoutSecs);
     case 4:
       return _disconnectionHandler;
+    case 5:
+      return Var(_threads);
+    case 6:
+      return Var(_gso);
+    case 7:
+      return Var(_coalesce);
+    case 8:
+      return Var(_view);
+    case 9:
+      return Var(_cellSize);
     default:
       return Var::Empty;
     }
   }
 
   SHTypeInfo compose(const SHInstanceData &data) {
+    if (_threads < 1)
+      throw ComposeError("Network.Server: Threads must be at least 1");
+    if (_cellSize <= 0.0f)
+      throw ComposeError("Network.Server: CellSize must be positive");
+
     if (_handlerMaster.valueType == SHType::Wire)
       _pool.reset(new WireDoppelgangerPool<KCPPeer>(_handlerMaster.payload.wireValue));
 
@@ -449,6 +537,8 @@ struct ServerShard : public NetworkBase {
     _sharedCopy = ExposedInfo(data.shared);
     auto endpointInfo = ExposedInfo::Variable("Network.Peer", SHCCSTR("The active peer."), Types::Peer);
     _sharedCopy.push_back(endpointInfo);
+    // peer wires can reach their server, for Network.Broadcast and Network.SetPosition
+    _sharedCopy.push_back(ExposedInfo::Variable("Network.Server", SHCCSTR("The server of the active peer."), Types::Server));
 
     NetworkBase::compose(data);
 
@@ -460,7 +550,7 @@ struct ServerShard : public NetworkBase {
       SHWire *toStop{};
       while (_stopWireQueue.pop(toStop)) {
         // read lock this
-        std::shared_lock<std::shared_mutex> lock(peersMutex);
+        std::shared_lock<std::shared_mutex> lock(_server.peersMutex);
         auto it = _server._wire2Peer.find(toStop);
         if (it == _server._wire2Peer.end())
           continue; // Wire is not managed by this server
@@ -500,8 +590,9 @@ struct ServerShard : public NetworkBase {
         }
 
         // write lock it now
-        std::scoped_lock<std::shared_mutex> lock2(peersMutex);
+        std::scoped_lock<std::shared_mutex> lock2(_server.peersMutex);
         _server._end2Peer.erase(*container->endpoint);
+        _server.interest.remove(container->getId());
         _pool->release(container);
       }
     }
@@ -520,6 +611,7 @@ struct ServerShard : public NetworkBase {
     NetworkBase::warmup(context);
 
     setServer(context, &_server);
+    _server.interest.setCellSize(_cellSize);
 
     _running.store(true, std::memory_order_release);
   }
@@ -527,13 +619,17 @@ struct ServerShard : public NetworkBase {
   void cleanup(SHContext *context) {
     _running.store(false, std::memory_order_release);
 
+    // Stop receiving before the pool goes away
+    closeSockets();
+
     // Stop handlers
     if (_pool) {
-      std::scoped_lock<std::shared_mutex> lock(peersMutex);
+      std::scoped_lock<std::shared_mutex> lock(_server.peersMutex);
       SPDLOG_LOGGER_TRACE(logger, "Stopping all wires");
       _pool->stopAll();
       _server._end2Peer.clear();
       _server._wire2Peer.clear();
+      _server.interest.clear();
       _pool.reset();
     } else {
       SPDLOG_LOGGER_TRACE(logger, "No pool to stop");
@@ -567,23 +663,8 @@ struct ServerShard : public NetworkBase {
     ZoneScopedN("Network::UDPOutput");
 
     KCPPeer *p = (KCPPeer *)user;
-    ServerShard *s = (ServerShard *)p->user;
-
-    std::scoped_lock<std::mutex> l(s->_socketMutex); // not ideal but for now we gotta do it
-
-    s->_socket->async_send_to(boost::asio::buffer(buf, len), *p->endpoint,
-                              [](boost::system::error_code ec, std::size_t bytes_sent) {
-                                TracyMessageL("Network::async_send_to (udp)");
-                                if (ec) {
-                                  // ignore flow-control No buffer space available
-                                  if (ec != boost::asio::error::no_buffer_space && ec != boost::asio::error::would_block &&
-                                      ec != boost::asio::error::try_again) {
-                                    SPDLOG_LOGGER_ERROR(logger, "Error sending: {}", ec.message());
-                                  } else {
-                                    SPDLOG_LOGGER_DEBUG(logger, "Error sending (ignored): {}", ec.message());
-                                  }
-                                }
-                              });
+    // copied and flushed in batches by the socket's I/O thread
+    p->socket->send(*p->endpoint, (const uint8_t *)buf, size_t(len));
     return 0;
   }
 
@@ -593,117 +674,75 @@ struct ServerShard : public NetworkBase {
     _stopWireQueue.push(e.wire);
   }
 
-  void do_receive() {
-    thread_local std::vector<uint8_t> recv_buffer(0xFFFF);
-
-    std::scoped_lock<std::mutex> l(_socketMutex); // not ideal but for now we gotta do it
-
-    _socket->async_receive_from(boost::asio::buffer(recv_buffer.data(), recv_buffer.size()), _sender,
-                                [this](boost::system::error_code ec, std::size_t bytes_recvd) {
-                                  TracyMessageL("Network::async_receive_from (udp)");
-                                  if (!ec && bytes_recvd > 0) {
-                                    KCPPeer *currentPeer = nullptr;
-                                    std::shared_lock<std::shared_mutex> lock(peersMutex);
-                                    auto it = _server._end2Peer.find(_sender);
-                                    if (it == _server._end2Peer.end()) {
-                                      SPDLOG_LOGGER_TRACE(logger, "Received packet from unknown peer: {} port: {}",
-                                                          _sender.address().to_string(), _sender.port());
-
-                                      // new peer
-                                      lock.unlock();
-
-                                      // we write so hard lock this
-                                      std::scoped_lock<std::shared_mutex> lock(peersMutex);
-
-                                      // new peer
-                                      try {
-                                        auto peer = _pool->acquire(_composer, (void *)0);
-                                        peer->reset();
-                                        _server._end2Peer[_sender] = peer;
-                                        peer->endpoint = _sender;
-                                        peer->user = this;
-                                        peer->kcp->user = peer;
-                                        peer->kcp->output = &ServerShard::udp_output;
-                                        SPDLOG_LOGGER_DEBUG(logger, "Added new peer: {} port: {}",
-                                                            peer->endpoint->address().to_string(), peer->endpoint->port());
-
-                                        // Assume that we recycle containers so the connection might already exist!
-                                        _server._wire2Peer[peer->wire.get()] = peer;
-
-                                        // set wire ID, in order for Events to be properly routed
-                                        // for now we just use ptr as ID, until it causes problems
-                                        peer->wire->id = static_cast<entt::id_type>(peer->getId());
-
-                                        currentPeer = peer;
-                                      } catch (std::exception &e) {
-                                        SPDLOG_LOGGER_ERROR(logger, "Error acquiring peer: {}", e.what());
-
-                                        // keep receiving
-                                        if (_socket && _running.load(std::memory_order_acquire))
-                                          return do_receive();
-                                      }
-                                    } else {
-                                      // SPDLOG_LOGGER_TRACE(logger, "Received packet from known peer: {} port: {}",
-                                      // _sender.address().to_string(), _sender.port());
-
-                                      // existing peer
-                                      currentPeer = it->second;
-
-                                      lock.unlock();
-                                    }
-
-                                    {
-                                      std::scoped_lock pLock(currentPeer->mutex);
-
-                                      auto err = ikcp_input(currentPeer->kcp, (char *)recv_buffer.data(), bytes_recvd);
-                                      // SPDLOG_LOGGER_TRACE(logger, "ikcp_input: {}, peer: {} port: {}, size: {}", err,
-                                      // _sender.address().to_string(), _sender.port(),
-                                      //             bytes_recvd);
-                                      if (err < 0) {
-                                        SPDLOG_LOGGER_ERROR(logger, "Error ikcp_input: {}, peer: {} port: {}", err,
-                                                            _sender.address().to_string(), _sender.port());
-                                        _stopWireQueue.push(currentPeer->wire.get());
-                                      }
-
-                                      currentPeer->_lastContact = SHClock::now();
-                                    }
-
-                                    // keep receiving
-                                    if (_socket && _running.load(std::memory_order_acquire)) {
-                                      return do_receive();
-                                    } else {
-                                      SPDLOG_LOGGER_DEBUG(logger, "Socket closed, stopping receive loop");
-                                    }
-                                  } else {
-                                    if (ec == boost::asio::error::operation_aborted) {
-                                      // we likely have invalid data under the hood, let's just ignore it
-                                      SPDLOG_LOGGER_DEBUG(logger, "Operation aborted");
-                                      return;
-                                    } else if (ec == boost::asio::error::no_buffer_space ||
-                                               ec == boost::asio::error::would_block || ec == boost::asio::error::try_again) {
-                                      SPDLOG_LOGGER_DEBUG(logger, "Ignored error while receiving: {}", ec.message());
-                                      return do_receive();
-                                    }
-
-                                    SPDLOG_LOGGER_DEBUG(logger, "Error receiving: {}, peer: {} port: {}", ec.message(),
-                                                        _sender.address().to_string(), _sender.port());
-
-                                    std::shared_lock<std::shared_mutex> lock(peersMutex);
-                                    auto it = _server._end2Peer.find(_sender);
-                                    if (it != _server._end2Peer.end()) {
-                                      SPDLOG_LOGGER_TRACE(logger, "Removing peer: {} port: {}", _sender.address().to_string(),
-                                                          _sender.port());
-                                      _stopWireQueue.push(it->second->wire.get());
-                                    }
-
-                                    // keep receiving
-                                    if (_socket && _running.load(std::memory_order_acquire)) {
-                                      return do_receive();
-                                    } else {
-                                      SPDLOG_LOGGER_DEBUG(logger, "Socket closed, stopping receive loop");
-                                    }
-                                  }
-                                });
+  // Called on the I/O thread of the socket for every datagram
+  void received(UdpSocket &socket, const udp::endpoint &sender, const uint8_t *data, size_t size) {
+    TracyMessageL("Network::received (udp)");
+    if (size == 0 || !_running.load(std::memory_order_acquire))
+      return;
+
+    KCPPeer *currentPeer = nullptr;
+    std::shared_lock<std::shared_mutex> lock(_server.peersMutex);
+    auto it = _server._end2Peer.find(sender);
+    if (it == _server._end2Peer.end()) {
+      SPDLOG_LOGGER_TRACE(logger, "Received packet from unknown peer: {} port: {}", sender.address().to_string(),
+                          sender.port());
+
+      // new peer
+      lock.unlock();
+
+      // we write so hard lock this
+      std::scoped_lock<std::shared_mutex> lock(_server.peersMutex);
+
+      // another socket's thread might have added it meanwhile
+      auto existing = _server._end2Peer.find(sender);
+      if (existing != _server._end2Peer.end()) {
+        currentPeer = existing->second;
+      } else {
+        // new peer
+        try {
+          auto peer = _pool->acquire(_composer, (void *)0);
+          peer->reset();
+          _server._end2Peer[sender] = peer;
+          peer->endpoint = sender;
+          peer->socket = socket.shared_from_this();
+          peer->coalesce = _coalesce;
+          peer->des.views = _view;
+          peer->user = this;
+          peer->kcp->user = peer;
+          peer->kcp->output = &ServerShard::udp_output;
+          SPDLOG_LOGGER_DEBUG(logger, "Added new peer: {} port: {}", peer->endpoint->address().to_string(),
+                              peer->endpoint->port());
+
+          // Assume that we recycle containers so the connection might already exist!
+          _server._wire2Peer[peer->wire.get()] = peer;
+
+          // set wire ID, in order for Events to be properly routed
+          // for now we just use ptr as ID, until it causes problems
+          peer->wire->id = static_cast<entt::id_type>(peer->getId());
+
+          currentPeer = peer;
+        } catch (std::exception &e) {
+          SPDLOG_LOGGER_ERROR(logger, "Error acquiring peer: {}", e.what());
+          return;
+        }
+      }
+    } else {
+      // existing peer
+      currentPeer = it->second;
+
+      lock.unlock();
+    }
+
+    std::scoped_lock pLock(currentPeer->mutex);
+
+    auto err = ikcp_input(currentPeer->kcp, (const char *)data, long(size));
+    if (err < 0) {
+      SPDLOG_LOGGER_ERROR(logger, "Error ikcp_input: {}, peer: {} port: {}", err, sender.address().to_string(),
+                          sender.port());
+      _stopWireQueue.push(currentPeer->wire.get());
+    }
+
+    currentPeer->_lastContact = SHClock::now();
   }
 
   void setServer(SHContext *context, KCPServer *server) {
@@ -724,27 +763,36 @@ struct ServerShard : public NetworkBase {
 
   SHVar activate(SHContext *context, const SHVar &input) {
     assert(_sharedNetworkContext);
-    auto &io_context = _sharedNetworkContext->_io_context;
 
-    if (!_socket) {
+    if (_sockets.empty()) {
       // first activation, let's init
-      _socket.emplace(io_context);
-      _socket->open(udp::v4());
-      _socket->set_option(boost::asio::ip::udp::socket::reuse_address(true));
-      _socket->set_option(boost::asio::socket_base::send_buffer_size(65536));
-      _socket->set_option(boost::asio::socket_base::receive_buffer_size(65536));
-      _socket->bind(udp::endpoint(udp::v4(), _port.get().payload.intValue));
-
-      // start receiving
-      boost::asio::post(io_context, [this]() { do_receive(); });
+      // without SO_REUSEPORT a second socket would not get any datagram
+      size_t count = SH_NETWORK_MMSG ? size_t(_threads) : 1;
+      UdpSocket::Options options;
+      options.gso = _gso;
+      options.reuseAddress = true;
+      options.reusePort = count > 1;
+      udp::endpoint local(udp::v4(), _port.get().payload.intValue);
+      for (size_t i = 0; i < count; i++) {
+        _sockets.push_back(UdpSocket::open(
+            _sharedNetworkContext->ioContext(i), local, options,
+            [this](UdpSocket &socket, const udp::endpoint &sender, const uint8_t *data, size_t size) {
+              received(socket, sender, data, size);
+            },
+            [](const boost::system::error_code &ec) {
+              SPDLOG_LOGGER_DEBUG(logger, "Error on server socket: {}", ec.message());
+            }));
+      }
 
-      SPDLOG_LOGGER_TRACE(logger, "Network.Server listening on port {}", _port.get().payload.intValue);
+      SPDLOG_LOGGER_TRACE(logger, "Network.Server listening on port {} with {} sockets", _port.get().payload.intValue, count);
     }
 
     gcWires(context);
 
     {
-      std::shared_lock<std::shared_mutex> lock(peersMutex);
+      std::shared_lock<std::shared_mutex> lock(_server.peersMutex);
+      _server._readingThread = std::this_thread::get_id();
+      DEFER({ _server._readingThread = std::thread::id(); });
 
       auto now = SHClock::now();
 
@@ -786,29 +834,44 @@ struct ServerShard : public NetworkBase {
             return input;
 
           try {
-            if (peer_->recvBuffer.size() > IKCP_MAX_PKT_SIZE) {
-              // do this async as it's a big buffer
-              await(
-                  context,
-                  [peer_]() {
-                    // deserialize from buffer on top of the vector of payloads, wires might consume them out of band
-                    Reader r((char *)peer_->recvBuffer.data() + 4, peer_->recvBuffer.size() - 4);
-                    peer_->des.reset();
-                    peer_->des.deserialize(r, peer_->payload);
-                  },
-                  [] {});
+            // Run within the root flow, false once the peer wire is done
+            auto run = [&]() {
+              auto runRes = runSubWire(peer_->wire.get(), context, peer_->payload);
+              if (unlikely(runRes.state == SHRunWireOutputState::Failed || runRes.state == SHRunWireOutputState::Stopped ||
+                           runRes.state == SHRunWireOutputState::Returned)) {
+                stop(peer_->wire.get());
+                return false;
+              }
+              return true;
+            };
+
+            if (isBatch(peer_->recvBuffer.data(), peer_->recvBuffer.size())) {
+              // coalesced messages, the wire runs once for each
+              forEachMessage(peer_->recvBuffer.data(), peer_->recvBuffer.size(), [&](Reader &r) {
+                peer_->des.reset();
+                r.deserializeInto(peer_->des, peer_->payload, peer_->receivedSchemas());
+                return run();
+              });
             } else {
-              // deserialize from buffer on top of the vector of payloads, wires might consume them out of band
-              Reader r((char *)peer_->recvBuffer.data() + 4, peer_->recvBuffer.size() - 4);
-              peer_->des.reset();
-              peer_->des.deserialize(r, peer_->payload);
-            }
-
-            // Run within the root flow
-            auto runRes = runSubWire(peer->wire.get(), context, peer->payload);
-            if (unlikely(runRes.state == SHRunWireOutputState::Failed || runRes.state == SHRunWireOutputState::Stopped ||
-                         runRes.state == SHRunWireOutputState::Returned)) {
-              stop(peer->wire.get());
+              if (peer_->recvBuffer.size() > IKCP_MAX_PKT_SIZE) {
+                // do this async as it's a big buffer
+                await(
+                    context,
+                    [peer_]() {
+                      // deserialize from buffer on top of the vector of payloads, wires might consume them out of band
+                      Reader r((char *)peer_->recvBuffer.data() + 4, peer_->recvBuffer.size() - 4);
+                      peer_->des.reset();
+                      r.deserializeInto(peer_->des, peer_->payload, peer_->receivedSchemas());
+                    },
+                    [] {});
+              } else {
+                // deserialize from buffer on top of the vector of payloads, wires might consume them out of band
+                Reader r((char *)peer_->recvBuffer.data() + 4, peer_->recvBuffer.size() - 4);
+                peer_->des.reset();
+                r.deserializeInto(peer_->des, peer_->payload, peer_->receivedSchemas());
+              }
+
+              run();
             }
           } catch (std::exception &e) {
             SPDLOG_LOGGER_ERROR(logger, "Critical errors processing peer {}: {}, disconnecting it",
@@ -820,6 +883,13 @@ struct ServerShard : public NetworkBase {
           context->continueFlow();
         }
       }
+
+      // what peer wires and others sent since the last activation goes out together
+      if (_coalesce) {
+        for (auto &[end, peer] : _server._end2Peer) {
+          peer->flush();
+        }
+      }
     }
 
     return *_serverVar;
@@ -853,6 +923,8 @@ struct ClientShard : public NetworkBase {
 
   KCPPeer _peer;
   ShardsVar _blks{};
+  bool _coalesce = false;
+  bool _view = false;
   udp::endpoint _server;
 
   SHVar *_peerVarRef{};
@@ -860,7 +932,16 @@ struct ClientShard : public NetworkBase {
   static inline Parameters params{
       {"Address", SHCCSTR("The local bind address or the remote address."), {CoreInfo::StringOrStringVar}},
       {"Port", SHCCSTR("The port to bind if server or to connect to if client."), {CoreInfo::IntOrIntVar}},
-      {"Handler", SHCCSTR("The shards to execute when a packet is received."), {CoreInfo::ShardsOrNone}}};
+      {"Handler", SHCCSTR("The shards to execute when a packet is received."), {CoreInfo::ShardsOrNone}},
+      {"Coalesce",
+       SHCCSTR("Queue the messages sent to the server and send them together once per activation of the client, fewer and "
+               "larger packets at the cost of up to a tick of latency."),
+       {CoreInfo::BoolType}},
+      {"View",
+       SHCCSTR("Deserialize the strings and byte arrays of received messages as views into the receive buffer instead of "
+               "copies. They are only valid while the handler processes the message, copies made with Set and the like stay "
+               "valid."),
+       {CoreInfo::BoolType}}};
 
   static SHParametersInfo parameters() { return SHParametersInfo(params); }
 
@@ -875,6 +956,12 @@ struct ClientShard : public NetworkBase {
     case 2:
       _blks = value;
       break;
+    case 3:
+      _coalesce = value.payload.boolValue;
+      break;
+    case 4:
+      _view = value.payload.boolValue;
+      break;
     default:
       break;
     }
@@ -888,6 +975,10 @@ struct ClientShard : public NetworkBase {
       return _port;
     case 2:
       return _blks;
+    case 3:
+      return Var(_coalesce);
+    case 4:
+      return Var(_view);
     default:
       return Var::Empty;
     }
@@ -896,68 +987,36 @@ struct ClientShard : public NetworkBase {
   static int udp_output(const char *buf, int len, ikcpcb *kcp, void *user) {
     ClientShard *c = (ClientShard *)user;
 
-    std::scoped_lock<std::mutex> l(c->_socketMutex); // not ideal but for now we gotta do it
-
     SPDLOG_LOGGER_TRACE(logger, "asio> queueing sending {} bytes", len);
-    c->_socket->async_send_to(boost::asio::buffer(buf, len), c->_server,
-                              [c](boost::system::error_code ec, std::size_t bytes_sent) {
-                                if (ec) {
-                                  // ignore flow-control No buffer space available
-                                  if (ec != boost::asio::error::no_buffer_space && ec != boost::asio::error::would_block &&
-                                      ec != boost::asio::error::try_again) {
-                                    SPDLOG_LOGGER_ERROR(logger, "Error sending: {}", ec.message());
-                                    c->_peer.networkError = ec;
-                                  } else {
-                                    SPDLOG_LOGGER_DEBUG(logger, "Error sending (ignored): {}", ec.message());
-                                  }
-                                } else {
-                                  SPDLOG_LOGGER_TRACE(logger, "asio> sent {} bytes", bytes_sent);
-                                }
-                              });
-
+    c->_peer.socket->send(c->_server, (const uint8_t *)buf, size_t(len));
     return 0;
   }
 
   void setup() {
     // new peer
     _peer.reset();
+    _peer.coalesce = _coalesce;
+    _peer.des.views = _view;
     _peer.kcp->user = this;
     _peer.kcp->output = &ClientShard::udp_output;
   }
 
-  void do_receive() {
-    thread_local std::vector<uint8_t> recv_buffer(0xFFFF);
-
-    std::scoped_lock<std::mutex> l(_socketMutex); // not ideal but for now we gotta do it
-
-    _socket->async_receive_from(boost::asio::buffer(recv_buffer.data(), recv_buffer.size()), _server,
-                                [this](boost::system::error_code ec, std::size_t bytes_recvd) {
-                                  if (ec) {
-                                    // certain errors are expected, ignore them
-                                    if (ec == boost::asio::error::no_buffer_space || ec == boost::asio::error::would_block ||
-                                        ec == boost::asio::error::try_again) {
-                                      SPDLOG_LOGGER_DEBUG(logger, "Ignored error while receiving: {}", ec.message());
-                                      return do_receive(); // continue receiving
-                                    } else if (ec == boost::asio::error::operation_aborted) {
-                                      SPDLOG_LOGGER_ERROR(logger, "Socket aborted receiving: {}", ec.message());
-                                      // _peer might be invalid at this point!
-                                    } else {
-                                      SPDLOG_LOGGER_ERROR(logger, "Error receiving: {}", ec.message());
-                                      _peer.networkError = ec;
-                                    }
-                                  } else {
-                                    if (bytes_recvd > 0) {
-                                      std::scoped_lock lock(_peer.mutex);
-
-                                      auto err = ikcp_input(_peer.kcp, (char *)recv_buffer.data(), bytes_recvd);
-                                      if (err < 0) {
-                                        SPDLOG_LOGGER_ERROR(logger, "Error ikcp_input: {}");
-                                      }
-                                    }
-                                    // keep receiving
-                                    do_receive();
-                                  }
-                                });
+  // Called on the I/O thread of the socket for every datagram
+  void received(const uint8_t *data, size_t size) {
+    if (size == 0)
+      return;
+
+    std::scoped_lock lock(_peer.mutex);
+    auto err = ikcp_input(_peer.kcp, (const char *)data, long(size));
+    if (err < 0) {
+      SPDLOG_LOGGER_ERROR(logger, "Error ikcp_input: {}", err);
+    }
+  }
+
+  void failed(const boost::system::error_code &ec) {
+    SPDLOG_LOGGER_ERROR(logger, "Network error: {}", ec.message());
+    std::scoped_lock lock(_peer.mutex);
+    _peer.networkError = ec;
   }
 
   SHTypeInfo compose(SHInstanceData &data) {
@@ -990,18 +1049,11 @@ struct ClientShard : public NetworkBase {
 
   SHVar activate(SHContext *context, const SHVar &input) {
     assert(_sharedNetworkContext);
-    auto &io_context = _sharedNetworkContext->_io_context;
 
-    if (!_socket) {
+    if (_sockets.empty()) {
       setup(); // reset the peer
 
       // first activation, let's init
-      _socket.emplace(io_context, udp::endpoint(udp::v4(), 0));
-      boost::asio::socket_base::send_buffer_size option_send(65536);
-      boost::asio::socket_base::receive_buffer_size option_recv(65536);
-      _socket->set_option(option_send);
-      _socket->set_option(option_recv);
-
       boost::asio::io_service io_service;
       udp::resolver resolver(io_service);
       auto sport = std::to_string(_port.get().payload.intValue);
@@ -1009,8 +1061,11 @@ struct ClientShard : public NetworkBase {
       _server = *resolver.resolve(query);
       _peer.endpoint = _server;
 
-      // start receiving
-      boost::asio::post(io_context, [this]() { do_receive(); });
+      // starts receiving
+      _peer.socket = _sockets.emplace_back(UdpSocket::open(
+          _sharedNetworkContext->ioContext(0), udp::endpoint(udp::v4(), 0), UdpSocket::Options{},
+          [this](UdpSocket &, const udp::endpoint &, const uint8_t *data, size_t size) { received(data, size); },
+          [this](const boost::system::error_code &ec) { failed(ec); }));
     }
 
     assignVariableValue(*_peerVarRef, Var::Object(&_peer, CoreCC, PeerCC));
@@ -1019,6 +1074,19 @@ struct ClientShard : public NetworkBase {
       if (!context->shouldContinue())
         return Var::Empty;
 
+      if (isBatch(_peer.recvBuffer.data(), _peer.recvBuffer.size())) {
+        DEFER({ _peer.endReceive(); });
+        // coalesced messages, the handler runs once for each
+        forEachMessage(_peer.recvBuffer.data(), _peer.recvBuffer.size(), [&](Reader &r) {
+          _peer.des.reset();
+          r.deserializeInto(_peer.des, _peer.payload, _peer.receivedSchemas());
+          SHVar output{};
+          activateShards(SHVar(_blks).payload.seqValue, context, _peer.payload, output);
+          return context->shouldContinue();
+        });
+        return flushed();
+      }
+
       if (_peer.recvBuffer.size() > IKCP_MAX_PKT_SIZE) {
         // do this async as it's a big buffer
         await(
@@ -1027,24 +1095,30 @@ struct ClientShard : public NetworkBase {
               // deserialize from buffer on top of the vector of payloads, wires might consume them out of band
               Reader r((char *)_peer.recvBuffer.data() + 4, _peer.recvBuffer.size() - 4);
               _peer.des.reset();
-              _peer.des.deserialize(r, _peer.payload);
+              r.deserializeInto(_peer.des, _peer.payload, _peer.receivedSchemas());
             },
             [] {});
       } else {
         // deserialize from buffer on top of the vector of payloads, wires might consume them out of band
         Reader r((char *)_peer.recvBuffer.data() + 4, _peer.recvBuffer.size() - 4);
         _peer.des.reset();
-        _peer.des.deserialize(r, _peer.payload);
+        r.deserializeInto(_peer.des, _peer.payload, _peer.receivedSchemas());
       }
 
-      // at this point we can already cleanup the buffer
-      _peer.endReceive();
+      // views point into the buffer, it is cleaned up once the handler is done
+      DEFER({ _peer.endReceive(); });
 
       SHVar output{};
       activateShards(SHVar(_blks).payload.seqValue, context, _peer.payload, output);
       // no need to handle errors as context will eventually deal with it after activation
     }
 
+    return flushed();
+  }
+
+  SHVar flushed() {
+    // what was sent since the last activation goes out together
+    _peer.flush();
     return Var::Object(&_peer, CoreCC, PeerCC);
   }
 };
@@ -0,0 +1,373 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2024 Fragcolor Pte. Ltd. */
+
+#include "network.hpp"
+
+#include <shards/core/shared.hpp>
+#include <shards/core/params.hpp>
+#include <shards/common_types.hpp>
+#include <shards/core/serialization.hpp>
+#include <shards/utility.hpp>
+#include <string_view>
+#include <unordered_map>
+
+namespace shards {
+namespace Network {
+
+// Binary difference between two values, tables and sequences are descended into, anything else is replaced whole
+//   Replace: u8 op | value
+//   Table:   u8 op | u32 changed | (key | delta) * changed | u32 removed | key * removed
+//   Seq:     u8 op | u32 length | u32 changed | (u32 index | delta) * changed
+struct DeltaCodec {
+  enum class Op : uint8_t { Replace, Table, Seq };
+
+  Serialization serializer;
+  OwnedVar key;
+
+  // Appends the delta turning prev into curr
+  void encode(const SHVar &prev, const SHVar &curr, BufferRefWriter &w) {
+    if (prev.valueType != curr.valueType || (curr.valueType != SHType::Table && curr.valueType != SHType::Seq)) {
+      writeOp(w, Op::Replace);
+      serializer.serialize(curr, w);
+      return;
+    }
+
+    if (curr.valueType == SHType::Table) {
+      auto &prevTable = asTable(prev);
+      writeOp(w, Op::Table);
+      auto changedAt = claimCount(w);
+      uint32_t changed = 0;
+      ForEach(curr.payload.tableValue, [&](const SHVar &k, const SHVar &v) {
+        auto before = prevTable.find(k);
+        if (before && *before == v)
+          return;
+        serializer.serialize(k, w);
+        encode(before ? (const SHVar &)*before : Var::Empty, v, w);
+        changed++;
+      });
+      writeCount(w, changedAt, changed);
+
+      auto &currTable = asTable(curr);
+      auto removedAt = claimCount(w);
+      uint32_t removed = 0;
+      ForEach(prev.payload.tableValue, [&](const SHVar &k, const SHVar &) {
+        if (currTable.hasKey(k))
+          return;
+        serializer.serialize(k, w);
+        removed++;
+      });
+      writeCount(w, removedAt, removed);
+    } else {
+      auto &prevSeq = prev.payload.seqValue;
+      auto &currSeq = curr.payload.seqValue;
+      writeOp(w, Op::Seq);
+      writeCount(w, claimCount(w), currSeq.len);
+      auto changedAt = claimCount(w);
+      uint32_t changed = 0;
+      for (uint32_t i = 0; i < currSeq.len; i++) {
+        auto grown = i >= prevSeq.len;
+        if (!grown && prevSeq.elements[i] == currSeq.elements[i])
+          continue;
+        w((const uint8_t *)&i, sizeof(uint32_t));
+        encode(grown ? Var::Empty : prevSeq.elements[i], currSeq.elements[i], w);
+        changed++;
+      }
+      writeCount(w, changedAt, changed);
+    }
+  }
+
+  // Applies a delta produced by encode to the value it was computed from
+  void apply(BytesReader &r, SHVar &target) {
+    uint8_t op;
+    r(&op, sizeof(uint8_t));
+    switch (Op(op)) {
+    case Op::Replace:
+      serializer.deserialize(r, target);
+      break;
+    case Op::Table: {
+      if (target.valueType != SHType::Table)
+        throw ActivationError("Replica delta does not match the replicated state");
+      auto &table = asTable(target);
+      auto changed = readCount(r, MinTableEntrySize);
+      for (uint32_t i = 0; i < changed; i++) {
+        serializer.deserialize(r, key);
+        apply(r, table[key]);
+      }
+      auto removed = readCount(r, MinKeySize);
+      for (uint32_t i = 0; i < removed; i++) {
+        serializer.deserialize(r, key);
+        table.remove(key);
+      }
+    } break;
+    case Op::Seq: {
+      if (target.valueType != SHType::Seq)
+        throw ActivationError("Replica delta does not match the replicated state");
+      auto &seq = asSeq(target);
+      auto len = readCount(r, 0);
+      auto changed = readCount(r, MinSeqEntrySize);
+      // every element a sequence grows by comes with the delta, a bogus length can't allocate more than was received
+      if (len > seq.size() && len - seq.size() > changed)
+        throw ActivationError("Replica delta length out of range");
+      seq.resize(len);
+      for (uint32_t i = 0; i < changed; i++) {
+        auto index = readCount(r, 0);
+        if (index >= len)
+          throw ActivationError("Replica delta index out of range");
+        apply(r, seq[index]);
+      }
+    } break;
+    default:
+      throw ActivationError("Invalid replica delta");
+    }
+  }
+
+private:
+  static void writeOp(BufferRefWriter &w, Op op) { w((const uint8_t *)&op, sizeof(Op)); }
+
+  static size_t claimCount(BufferRefWriter &w) {
+    auto offset = w.size();
+    w.claim(sizeof(uint32_t));
+    return offset;
+  }
+
+  static void writeCount(BufferRefWriter &w, size_t offset, uint32_t count) {
+    memcpy(w._buffer.data() + offset, &count, sizeof(uint32_t));
+  }
+
+  // Smallest encodings of the entries counted, used to reject counts larger than what is left to read
+  static constexpr size_t MinKeySize = 1;
+  static constexpr size_t MinTableEntrySize = MinKeySize + sizeof(Op);
+  static constexpr size_t MinSeqEntrySize = sizeof(uint32_t) + sizeof(Op);
+
+  static uint32_t readCount(BytesReader &r, size_t entrySize) {
+    uint32_t count;
+    r((uint8_t *)&count, sizeof(uint32_t));
+    if (entrySize > 0 && count > (r.max - r.offset) / entrySize)
+      throw ActivationError("Replica delta is truncated");
+    return count;
+  }
+};
+
+// Replication frames travel as Bytes messages:
+//   u8 kind | u64 stream | u32 seq | (Full) value | (Delta) u32 base seq, delta from the state at base seq
+enum class FrameKind : uint8_t { Full, Delta };
+constexpr size_t FrameHeaderSize = 1 + 8 + 4;
+
+// FNV-1a, stable across platforms unlike std::hash
+inline uint64_t streamId(std::string_view name) {
+  uint64_t h = 0xcbf29ce484222325ull;
+  for (auto c : name) {
+    h ^= uint8_t(c);
+    h *= 0x100000001b3ull;
+  }
+  return h;
+}
+
+struct Replicate {
+  static SHOptionalString help() {
+    return SHCCSTR("Replicates the input to a peer, or to every peer of a server, sending only what changed since the "
+                   "state each peer already has. Tables and sequences are compared element by element and only the "
+                   "differences are sent, other values are sent whole when they change. Peers that just connected receive "
+                   "the full state first. The receiving side rebuilds the state with Network.Replica.");
+  }
+  static SHOptionalString inputHelp() { return SHCCSTR("The state to replicate, usually a table."); }
+  static SHOptionalString outputHelp() { return DefaultHelpText::OutputHelpPass; }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
+
+  PARAM_VAR(_name, "Name", "The name of the replicated stream, must match the one of the receiving Network.Replica.",
+            {CoreInfo::StringType});
+  PARAM_EXT(ParamVar, _peer, Types::PeerParameterInfo);
+  PARAM_PARAMVAR(_server, "Server", "Replicate to every peer connected to this server instead of a single peer.",
+                 {CoreInfo::NoneType, Types::ServerVar});
+  PARAM_IMPL(PARAM_IMPL_FOR(_name), PARAM_IMPL_FOR(_peer), PARAM_IMPL_FOR(_server));
+
+  Replicate() {
+    _name = Var("state");
+    setDefaultPeerParam(_peer);
+  }
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) {
+    PARAM_CLEANUP(context);
+    _last = Var::Empty;
+    _seq = 0;
+    _peers.clear();
+  }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(SHInstanceData &data) {
+    // fanning out through a server, there is no single peer to look for
+    if (!_server.isNone())
+      _peer = Var::Empty;
+    else if (_peer.isNone())
+      setDefaultPeerParam(_peer);
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    _stream = streamId(SHSTRVIEW(_name));
+    return outputTypes().elements[0];
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    if (_seq == 0 || !(input == _last)) {
+      if (_seq != 0) {
+        // computed once, shared by every peer holding the previous state
+        BufferRefWriter w(_delta);
+        writeHeader(w, FrameKind::Delta, _seq + 1);
+        w((const uint8_t *)&_seq, sizeof(uint32_t));
+        _codec.encode(_last, input, w);
+      }
+      _last = input;
+      _seq++;
+      _full.clear();
+    }
+
+    _tick++;
+    if (!_server.isNone()) {
+      auto &server = varAsObjectChecked<Server>(_server.get(), Types::Server);
+      size_t count = 0;
+      server.forEachPeer([&](Peer &peer) {
+        if (!peer.disconnected())
+          replicateTo(peer);
+        count++;
+      });
+      // forget peers that are gone
+      if (_peers.size() > count) {
+        for (auto it = _peers.begin(); it != _peers.end();) {
+          if (it->second.tick != _tick)
+            it = _peers.erase(it);
+          else
+            ++it;
+        }
+      }
+    } else {
+      replicateTo(getConnectedPeer(_peer));
+    }
+
+    return input;
+  }
+
+private:
+  struct PeerState {
+    uint64_t session{};
+    uint32_t seq{};
+    uint64_t tick{};
+  };
+
+  uint64_t _stream{};
+  OwnedVar _last;
+  uint32_t _seq{};
+  uint64_t _tick{};
+  DeltaCodec _codec;
+  // Frames from the previous state to the current one and of the whole current state, the latter built on demand
+  std::vector<uint8_t> _delta;
+  std::vector<uint8_t> _full;
+  std::unordered_map<int64_t, PeerState> _peers;
+
+  void writeHeader(BufferRefWriter &w, FrameKind kind, uint32_t seq) {
+    w((const uint8_t *)&kind, sizeof(FrameKind));
+    w((const uint8_t *)&_stream, sizeof(uint64_t));
+    w((const uint8_t *)&seq, sizeof(uint32_t));
+  }
+
+  void replicateTo(Peer &peer) {
+    auto &state = _peers[peer.getId()];
+    state.tick = _tick;
+    // a new session is a new connection, whatever it was sent is gone with it
+    auto synced = state.session == peer.session();
+    if (synced && state.seq == _seq)
+      return;
+
+    // the transports are reliable and ordered, what was sent is what the peer holds
+    if (synced && state.seq + 1 == _seq) {
+      peer.sendVar(Var(_delta.data(), uint32_t(_delta.size())));
+    } else {
+      if (_full.empty()) {
+        BufferRefWriter w(_full);
+        writeHeader(w, FrameKind::Full, _seq);
+        _codec.serializer.serialize(_last, w);
+      }
+      peer.sendVar(Var(_full.data(), uint32_t(_full.size())));
+    }
+    state.session = peer.session();
+    state.seq = _seq;
+  }
+};
+
+struct Replica {
+  static SHOptionalString help() {
+    return SHCCSTR("Rebuilds the state replicated by Network.Replicate from the frames it sends. Frames of other streams "
+                   "are ignored, so several replicas can share the same handler.");
+  }
+  static SHOptionalString inputHelp() { return SHCCSTR("A frame received from Network.Replicate."); }
+  static SHOptionalString outputHelp() {
+    return SHCCSTR("The replicated state, none until the first full frame is received.");
+  }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::BytesType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
+
+  PARAM_VAR(_name, "Name", "The name of the replicated stream, must match the one of Network.Replicate.",
+            {CoreInfo::StringType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_name));
+
+  Replica() { _name = Var("state"); }
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) {
+    PARAM_CLEANUP(context);
+    _state = Var::Empty;
+    _seq = 0;
+  }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    _stream = streamId(SHSTRVIEW(_name));
+    return outputTypes().elements[0];
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    if (input.payload.bytesSize < FrameHeaderSize)
+      throw ActivationError("Invalid replication frame");
+
+    BytesReader r(input.payload.bytesValue, input.payload.bytesSize);
+    FrameKind kind;
+    uint64_t stream;
+    uint32_t seq;
+    r((uint8_t *)&kind, sizeof(FrameKind));
+    r((uint8_t *)&stream, sizeof(uint64_t));
+    r((uint8_t *)&seq, sizeof(uint32_t));
+    if (stream != _stream)
+      return _state;
+
+    if (kind == FrameKind::Full) {
+      _codec.serializer.deserialize(r, _state);
+    } else if (kind == FrameKind::Delta) {
+      uint32_t base;
+      r((uint8_t *)&base, sizeof(uint32_t));
+      if (_seq == 0 || base != _seq)
+        throw ActivationError("Replication delta does not follow the current state");
+      _codec.apply(r, _state);
+    } else {
+      throw ActivationError("Invalid replication frame");
+    }
+    _seq = seq;
+    return _state;
+  }
+
+private:
+  uint64_t _stream{};
+  OwnedVar _state;
+  uint32_t _seq{};
+  DeltaCodec _codec;
+};
+
+} // namespace Network
+} // namespace shards
+
+SHARDS_REGISTER_FN(network_replicate) {
+  using namespace shards::Network;
+  REGISTER_SHARD("Network.Replicate", Replicate);
+  REGISTER_SHARD("Network.Replica", Replica);
+}
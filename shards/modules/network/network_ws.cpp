@@ -33,8 +33,10 @@ struct WSServer final : public Server {
   sockethandle_t socket{};
   std::unordered_map<sockethandle_t, struct WSHandler *> handle2Peer;
   std::unordered_set<int64_t> _blacklist;
+  // Peers a broadcast goes to directly, sharing a single copy of the data
+  std::vector<sockethandle_t> _targets;
 
-  WSServer() { ctx = pollnet_init(); }
+  WSServer(uint32_t threads) { ctx = pollnet_init_threads(threads); }
   ~WSServer() { pollnet_shutdown(ctx); }
 
   void bind(std::string_view addr, int port) {
@@ -49,6 +51,7 @@ struct WSServer final : public Server {
   }
 
   void broadcast(boost::span<const uint8_t> data, const SHVar &exclude) override;
+  void forEachPeer(const std::function<void(Peer &)> &fn) override;
 };
 
 struct WSPeer : public Peer {
@@ -58,6 +61,7 @@ struct WSPeer : public Peer {
   bool disconnected_{};
 
   void init(pollnet_ctx *ctx_, sockethandle_t handle, bool isServerSide) {
+    newSession();
     ctx = ctx_;
     disconnected_ = false;
     socket = handle;
@@ -80,22 +84,33 @@ struct WSHandler : public WSPeer {
 };
 
 void WSServer::broadcast(boost::span<const uint8_t> data, const SHVar &exclude) {
-  if (exclude.valueType == SHType::Seq) {
+  bool excluding = exclude.valueType == SHType::Seq;
+  if (excluding) {
     _blacklist.clear();
 
     for (auto &excluded : exclude) {
       _blacklist.insert(excluded.payload.intValue);
     }
+  }
 
-    for (auto &[handle, peer] : handle2Peer) {
-      if (_blacklist.find(peer->getId()) == _blacklist.end()) {
-        peer->send(data);
-      }
-    }
-  } else {
-    for (auto &[handle, peer] : handle2Peer) {
-      peer->send(data);
-    }
+  _targets.clear();
+  for (auto &[handle, peer] : handle2Peer) {
+    if (excluding && _blacklist.find(peer->getId()) != _blacklist.end())
+      continue;
+    // coalescing peers batch it with the rest of their messages
+    if (peer->coalesce)
+      peer->post(data);
+    else
+      _targets.push_back(handle);
+  }
+
+  if (!_targets.empty())
+    pollnet_send_binary_many(ctx, _targets.data(), uint32_t(_targets.size()), data.data(), uint32_t(data.size()));
+}
+
+void WSServer::forEachPeer(const std::function<void(Peer &)> &fn) {
+  for (auto &[handle, peer] : handle2Peer) {
+    fn(*peer);
   }
 }
 
@@ -148,8 +163,33 @@ struct WSServerShard {
             {CoreInfo::FloatType});
   PARAM(ShardsVar, _onDisconnect, "OnDisconnect", ("The shards to execute when a peer disconnects, The Peer ID will be the input."),
         {CoreInfo::ShardsOrNone});
+  PARAM_VAR(_coalesce, "Coalesce",
+            ("Queue the messages sent to each peer and send them together once per activation of the server, fewer and "
+             "larger frames at the cost of up to a tick of latency."),
+            {CoreInfo::NoneType, CoreInfo::BoolType});
+  PARAM_VAR(_threads, "Threads",
+            ("The number of I/O threads serving the connections, messages are still delivered to the peer wires on the "
+             "wire running the server."),
+            {CoreInfo::IntType});
+  PARAM_VAR(_maxMessages, "MaxMessages",
+            ("The most messages delivered to each peer wire per activation of the server, the others wait for the next "
+             "one."),
+            {CoreInfo::IntType});
+  PARAM_VAR(_view, "View",
+            ("Deserialize the strings and byte arrays of received messages as views into the receive buffer instead of "
+             "copies. They are only valid while the peer wire processes the message, copies made with Set and the like stay "
+             "valid."),
+            {CoreInfo::NoneType, CoreInfo::BoolType});
+  PARAM_VAR(_cellSize, "CellSize",
+            ("The size of the cells peers are bucketed in by Network.SetPosition, about the distance at which updates stop "
+             "being relevant to them."),
+            {CoreInfo::FloatType});
   PARAM_IMPL(PARAM_IMPL_FOR(_address), PARAM_IMPL_FOR(_port), PARAM_IMPL_FOR(_handler), PARAM_IMPL_FOR(_timeout),
-             PARAM_IMPL_FOR(_onDisconnect));
+             PARAM_IMPL_FOR(_onDisconnect), PARAM_IMPL_FOR(_coalesce), PARAM_IMPL_FOR(_threads),
+             PARAM_IMPL_FOR(_maxMessages), PARAM_IMPL_FOR(_view), PARAM_IMPL_FOR(_cellSize));
+
+  // Connections accepted per activation at most, more wait for the next one
+  static constexpr size_t MaxAccepts = 256;
 
   std::unique_ptr<WireDoppelgangerPool<WSHandler>> _pool;
   ExposedInfo _sharedCopy;
@@ -182,7 +222,11 @@ struct WSServerShard {
     }
   } _composer;
 
-  WSServerShard() : _composer(*this) {}
+  WSServerShard() : _composer(*this) {
+    _threads = Var(1);
+    _maxMessages = Var(64);
+    _cellSize = Var(32.0);
+  }
 
   std::string _serverDebugName;
   void warmup(SHContext *context) {
@@ -226,6 +270,13 @@ struct WSServerShard {
   SHTypeInfo compose(SHInstanceData &data) {
     PARAM_COMPOSE_REQUIRED_VARIABLES(data);
 
+    if (_threads.payload.intValue < 1)
+      throw ComposeError("Network.WS.Server: Threads must be at least 1");
+    if (_maxMessages.payload.intValue < 1)
+      throw ComposeError("Network.WS.Server: MaxMessages must be at least 1");
+    if (_cellSize.payload.floatValue <= 0.0)
+      throw ComposeError("Network.WS.Server: CellSize must be positive");
+
     if (!_handler->isNone()) {
       std::shared_ptr<SHWire> wire = IntoWire{}.defaultWireName("network-wire").var(_handler);
       _pool.reset(new WireDoppelgangerPool<WSHandler>(SHWire::weakRef(wire)));
@@ -242,6 +293,8 @@ struct WSServerShard {
     _sharedCopy = ExposedInfo(data.shared);
     auto endpointInfo = ExposedInfo::Variable("Network.Peer", SHCCSTR("The active peer."), Types::Peer);
     _sharedCopy.push_back(endpointInfo);
+    // peer wires can reach their server, for Network.Broadcast and Network.SetPosition
+    _sharedCopy.push_back(ExposedInfo::Variable("Network.Server", SHCCSTR("The server of the active peer."), Types::Server));
 
     return outputTypes().elements[0];
   }
@@ -259,6 +312,7 @@ struct WSServerShard {
   void newClient(WSServer &server, SHContext *context) {
     auto peer = _pool->acquire(_composer);
     peer->init(server.ctx, pollnet_get_connected_client_handle(server.ctx, server.socket), true);
+    peer->coalesce = !_coalesce->isNone() && _coalesce.payload.boolValue;
     server.handle2Peer[peer->socket] = peer;
 
     if (!peer->onStopConnection) {
@@ -303,6 +357,8 @@ struct WSServerShard {
     }
 
     handler.close();
+    if (_server)
+      _server->interest.remove(handler.getId());
 
     _pool->release(&handler);
   }
@@ -314,16 +370,23 @@ struct WSServerShard {
       // cloneVar(handler.recvBuffer, tmp);
 
       try {
-        // deserialize from buffer on top of the vector of payloads, wires might consume them out of band
-        Reader r((char *)dataSpan.data() + 4, dataSpan.size() - 4);
-        r.deserializeInto(handler.recvBuffer);
-
-        auto runRes = shards::runSubWire(handler.wire.get(), context, handler.recvBuffer);
-        if (unlikely(runRes.state == SHRunWireOutputState::Failed || runRes.state == SHRunWireOutputState::Stopped ||
-                     runRes.state == SHRunWireOutputState::Returned)) {
-          handler.disconnected_ = true;
-          shards::stop(handler.wire.get());
-        }
+        // a single message or a batch of coalesced ones, the wire runs once for each
+        forEachMessage(dataSpan.data(), dataSpan.size(), [&](Reader &r) {
+          // deserialize from buffer on top of the vector of payloads, wires might consume them out of band
+          if (!_view->isNone() && _view.payload.boolValue)
+            r.deserializeViewInto(handler.recvBuffer, handler.receivedSchemas());
+          else
+            r.deserializeInto(handler.recvBuffer, handler.receivedSchemas());
+
+          auto runRes = shards::runSubWire(handler.wire.get(), context, handler.recvBuffer);
+          if (unlikely(runRes.state == SHRunWireOutputState::Failed || runRes.state == SHRunWireOutputState::Stopped ||
+                       runRes.state == SHRunWireOutputState::Returned)) {
+            handler.disconnected_ = true;
+            shards::stop(handler.wire.get());
+            return false;
+          }
+          return true;
+        });
       } catch (std::exception &e) {
         SPDLOG_LOGGER_ERROR(getLogger(), "Error while processing data from peer {}: {}", handler.getId(), e.what());
         shards::stop(handler.wire.get());
@@ -337,46 +400,52 @@ struct WSServerShard {
 
   SHVar activate(SHContext *shContext, const SHVar &input) {
     if (!_server) {
-      _server = std::make_shared<WSServer>();
+      _server = std::make_shared<WSServer>(uint32_t(_threads.payload.intValue));
       _server->bind(SHSTRVIEW(_address.get()), _port.get().payload.intValue);
+      _server->interest.setCellSize(float(_cellSize.payload.floatValue));
       _serverDebugName = fmt::format("WSServer({})", _server->socket);
       _serverVar = Var::Object(_server.get(), Types::Server);
       assignVariableValue(*_serverVarRef, _serverVar);
     }
 
-    socketstatus_t status = pollnet_update(_server->ctx, _server->socket);
-    pollnetLog(_server->ctx, status, _server->socket, _serverDebugName);
+    // take all the connections waiting, not just one
+    for (size_t i = 0; i < MaxAccepts; i++) {
+      socketstatus_t status = pollnet_update(_server->ctx, _server->socket);
+      pollnetLog(_server->ctx, status, _server->socket, _serverDebugName);
 
-    switch (status) {
-    case POLLNET_ERROR:
-      throw ActivationError("Error in socket");
-      break;
-    case POLLNET_INVALID:
-      throw ActivationError("Invalid socket");
-      break;
-    case POLLNET_CLOSED:
-      throw ActivationError("Closed socket");
-    case POLLNET_OPEN_NEWCLIENT:
-      newClient(*_server.get(), shContext);
+      switch (status) {
+      case POLLNET_ERROR:
+        throw ActivationError("Error in socket");
+        break;
+      case POLLNET_INVALID:
+        throw ActivationError("Invalid socket");
+        break;
+      case POLLNET_CLOSED:
+        throw ActivationError("Closed socket");
+      case POLLNET_OPEN_NEWCLIENT:
+        newClient(*_server.get(), shContext);
+        continue;
+      }
       break;
     }
 
+    auto maxMessages = _maxMessages.payload.intValue;
     auto &map = _server->handle2Peer;
     for (auto it = map.begin(); it != map.end();) {
       auto handle = it->first;
       auto peer = it->second;
 
-      socketstatus_t status = pollnet_update(_server->ctx, handle);
-      pollnetLog(_server->ctx, status, handle, peer->getId());
-      switch (status) {
-      case POLLNET_ERROR:
-      case POLLNET_INVALID:
-      case POLLNET_CLOSED:
-        peer->disconnected_ = true;
+      // deliver what arrived since the last activation in one go, up to a limit so a busy peer can't stall the others
+      for (SHInt i = 0; i < maxMessages && !peer->disconnected_; i++) {
+        socketstatus_t status = pollnet_update(_server->ctx, handle);
+        pollnetLog(_server->ctx, status, handle, peer->getId());
+        if (status == POLLNET_ERROR || status == POLLNET_INVALID || status == POLLNET_CLOSED) {
+          peer->disconnected_ = true;
+        } else if (status == POLLNET_OPEN_HASDATA) {
+          recvClientData(*peer, shContext);
+          continue;
+        }
         break;
-      case POLLNET_OPEN_HASDATA: {
-        recvClientData(*peer, shContext);
-      } break;
       }
 
       if (peer->disconnected_) {
@@ -388,6 +457,11 @@ struct WSServerShard {
       }
     }
 
+    // what peer wires and others sent since the last activation goes out together
+    for (auto &[handle, peer] : map) {
+      peer->flush();
+    }
+
     return _serverVar;
   }
 };
@@ -415,7 +489,17 @@ struct WSClientShard {
   PARAM_PARAMVAR(_address, "Address", ("The local bind address or the remote address."), {CoreInfo::StringOrStringVar});
   PARAM(ShardsVar, _handler, "Handler", ("The shards to execute when a packet is received."), {CoreInfo::ShardsOrNone});
   PARAM_VAR(_raw, "Raw", ("If set to true, the client will receive raw byte packets instead of serialized objects."), {CoreInfo::NoneType, CoreInfo::BoolType});
-  PARAM_IMPL(PARAM_IMPL_FOR(_address), PARAM_IMPL_FOR(_handler), PARAM_IMPL_FOR(_raw));
+  PARAM_VAR(_coalesce, "Coalesce",
+            ("Queue the messages sent to the server and send them together once per activation of the client, fewer and "
+             "larger frames at the cost of up to a tick of latency."),
+            {CoreInfo::NoneType, CoreInfo::BoolType});
+  PARAM_VAR(_view, "View",
+            ("Deserialize the strings and byte arrays of received messages as views into the receive buffer instead of "
+             "copies. They are only valid while the handler processes the message, copies made with Set and the like stay "
+             "valid."),
+            {CoreInfo::NoneType, CoreInfo::BoolType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_address), PARAM_IMPL_FOR(_handler), PARAM_IMPL_FOR(_raw), PARAM_IMPL_FOR(_coalesce),
+             PARAM_IMPL_FOR(_view));
 
   std::shared_ptr<WSClient> _client;
   SHVar _peerVar;
@@ -478,19 +562,26 @@ struct WSClientShard {
     Var tmp(dataSpan.data(), dataSpan.size());
 
     withObjectVariable(*_peerVarRef, &peer, Types::Peer, [&]() {
-      Var input{};
+      SHVar output{};
       if (useRawData()) {
-        input = Var((uint8_t *)dataSpan.data(), dataSpan.size());
-      } else {
-        Reader r((char *)dataSpan.data() + 4, dataSpan.size() - 4);
-        r.deserializeInto(client.recvBuffer);
-        input = client.recvBuffer;
+        Var input((uint8_t *)dataSpan.data(), dataSpan.size());
+        if (_handler) {
+          _handler.activate(context, input, output);
+        }
+        return;
       }
 
-      SHVar output{};
-      if (_handler) {
-        _handler.activate(context, input, output);
-      }
+      // a single message or a batch of coalesced ones, the handler runs once for each
+      forEachMessage(dataSpan.data(), dataSpan.size(), [&](Reader &r) {
+        if (!_view->isNone() && _view.payload.boolValue)
+          r.deserializeViewInto(client.recvBuffer, peer.receivedSchemas());
+        else
+          r.deserializeInto(client.recvBuffer, peer.receivedSchemas());
+        if (_handler) {
+          _handler.activate(context, client.recvBuffer, output);
+        }
+        return context->shouldContinue();
+      });
     });
   }
 
@@ -498,6 +589,7 @@ struct WSClientShard {
     if (!_client) {
       _client = std::make_shared<WSClient>();
       _client->peer.init(_client->ctx, pollnet_open_ws(_client->ctx, toSWL(SHSTRVIEW(_address.get()))), false);
+      _client->peer.coalesce = !_coalesce->isNone() && _coalesce.payload.boolValue;
       _peerVar = Var::Object(&_client->peer, Types::Peer);
       assignVariableValue(*_peerVarRef, _peerVar);
     }
@@ -520,6 +612,9 @@ struct WSClientShard {
     } break;
     }
 
+    // what was sent since the last activation goes out together
+    peer.flush();
+
     return _peerVar;
   }
 };
@@ -541,6 +636,7 @@ struct WSPeer : public Peer {
   boost::lockfree::queue<Message *> sendQueue{16};
 
   void init(std::string_view addr) {
+    newSession();
     debugName = "WSPeer";
 
     std::string fullAddr{addr};
@@ -638,7 +734,16 @@ struct WSClientShard {
 
   PARAM_PARAMVAR(_address, "Address", ("The local bind address or the remote address."), {CoreInfo::StringOrStringVar});
   PARAM(ShardsVar, _handler, "Handler", ("The flow to execute when a packet is received."), {CoreInfo::ShardsOrNone});
-  PARAM_IMPL(PARAM_IMPL_FOR(_address), PARAM_IMPL_FOR(_handler));
+  PARAM_VAR(_coalesce, "Coalesce",
+            ("Queue the messages sent to the server and send them together once per activation of the client, fewer and "
+             "larger frames at the cost of up to a tick of latency."),
+            {CoreInfo::NoneType, CoreInfo::BoolType});
+  PARAM_VAR(_view, "View",
+            ("Deserialize the strings and byte arrays of received messages as views into the receive buffer instead of "
+             "copies. They are only valid while the handler processes the message, copies made with Set and the like stay "
+             "valid."),
+            {CoreInfo::NoneType, CoreInfo::BoolType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_address), PARAM_IMPL_FOR(_handler), PARAM_IMPL_FOR(_coalesce), PARAM_IMPL_FOR(_view));
 
   std::shared_ptr<WSClient> _client;
   SHVar _peerVar;
@@ -693,13 +798,19 @@ struct WSClientShard {
     auto &peer = client.peer;
 
     withObjectVariable(*_peerVarRef, &peer, Types::Peer, [&]() {
-      Reader r((char *)msg.data.data() + 4, msg.data.size() - 4);
-      r.deserializeInto(client.peer.recvBuffer);
-
-      SHVar output{};
-      if (_handler) {
-        _handler.activate(context, client.peer.recvBuffer, output);
-      }
+      // a single message or a batch of coalesced ones, the handler runs once for each
+      forEachMessage(msg.data.data(), msg.data.size(), [&](Reader &r) {
+        if (!_view->isNone() && _view.payload.boolValue)
+          r.deserializeViewInto(client.peer.recvBuffer, client.peer.receivedSchemas());
+        else
+          r.deserializeInto(client.peer.recvBuffer, client.peer.receivedSchemas());
+
+        SHVar output{};
+        if (_handler) {
+          _handler.activate(context, client.peer.recvBuffer, output);
+        }
+        return context->shouldContinue();
+      });
     });
   }
 
@@ -707,6 +818,7 @@ struct WSClientShard {
     if (!_client) {
       _client = std::make_shared<WSClient>();
       _client->peer.init(SHSTRVIEW(_address.get()));
+      _client->peer.coalesce = !_coalesce->isNone() && _coalesce.payload.boolValue;
       _peerVar = Var::Object(&_client->peer, Types::Peer);
       assignVariableValue(*_peerVarRef, _peerVar);
     }
@@ -723,6 +835,9 @@ struct WSClientShard {
       }
     }
 
+    // what was sent since the last activation goes out together
+    peer.flush();
+
     return _peerVar;
   }
 };
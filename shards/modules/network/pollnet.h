@@ -53,6 +53,12 @@ sockethandle_t pollnet_invalid_handle();
  */
 pollnet_ctx *pollnet_init();
 
+/*
+ * Creates a new pollnet context whose sockets are served by a pool of
+ * `threads` I/O threads. 1 is the same as `pollnet_init`.
+ */
+pollnet_ctx *pollnet_init_threads(uint32_t threads);
+
 /*
  * Shuts down a context: all open sockets and servers are closed.
  */
@@ -86,6 +92,13 @@ void pollnet_send(pollnet_ctx *ctx, sockethandle_t handle, SHStringWithLen msg);
  */
 void pollnet_send_binary(pollnet_ctx *ctx, sockethandle_t handle, const unsigned char *msg, uint32_t msgsize);
 
+/*
+ * Send the same binary data to many sockets.
+ * The data is copied once and shared by all the sockets.
+ */
+void pollnet_send_binary_many(pollnet_ctx *ctx, const sockethandle_t *handles, uint32_t count, const unsigned char *msg,
+                              uint32_t msgsize);
+
 /*
  * Poll a socket for updates. Some status codes indicate that additional
  * data can be queried:
@@ -4,6 +4,7 @@ use futures_util::{SinkExt, StreamExt};
 use log::{debug, error, info, warn};
 use slotmap::{HopSlotMap, Key};
 use std::net::SocketAddr;
+use std::sync::Arc;
 use std::thread;
 use tokio::io::AsyncWriteExt;
 use tokio::net::{TcpListener, TcpStream};
@@ -105,6 +106,9 @@ enum PollnetMessage {
   Disconnect,
   Text(String),
   Binary(Vec<u8>),
+  // The same payload queued to many sockets with a single copy from the caller, the I/O threads copy it again into
+  // each frame but the last one, which takes the buffer
+  SharedBinary(Arc<Vec<u8>>),
   Error(String),
   NewClient(ClientConn),
 }
@@ -125,15 +129,26 @@ pub struct PollnetContext {
 
 impl PollnetContext {
   pub fn new() -> PollnetContext {
+    Self::with_threads(1)
+  }
+
+  // Sockets are served by `threads` I/O threads, a single one runs everything on the context's own thread
+  pub fn with_threads(threads: usize) -> PollnetContext {
     let (handle_tx, handle_rx) = std::sync::mpsc::channel();
     let (shutdown_tx, shutdown_rx) = tokio::sync::oneshot::channel();
     let shutdown_tx = Some(shutdown_tx);
 
     let thread = Some(thread::spawn(move || {
-      let rt = runtime::Builder::new_current_thread()
-        .enable_all()
-        .build()
-        .expect("Unable to create the runtime");
+      let rt = if threads > 1 {
+        runtime::Builder::new_multi_thread()
+          .worker_threads(threads)
+          .thread_name("pollnet-io")
+          .enable_all()
+          .build()
+      } else {
+        runtime::Builder::new_current_thread().enable_all().build()
+      }
+      .expect("Unable to create the runtime");
 
       // Send handle back out so we can store it?
       handle_tx
@@ -207,6 +222,21 @@ impl PollnetContext {
     }
   }
 
+  // Serialized once by the caller, the payload is shared by every target
+  pub fn send_binary_many(&mut self, handles: &[SocketHandle], msg: &[u8]) {
+    let shared = Arc::new(msg.to_vec());
+    for handle in handles {
+      if let Some(sock) = self.sockets.get_mut(*handle) {
+        if let Some(chans) = &sock.io {
+          chans
+            .tx
+            .try_send(PollnetMessage::SharedBinary(shared.clone()))
+            .unwrap_or_default();
+        }
+      }
+    }
+  }
+
   pub fn update(&mut self, handle: SocketHandle, blocking: bool) -> SocketStatus {
     let sock = match self.sockets.get_mut(handle) {
       Some(sock) => sock,
@@ -5,6 +5,52 @@ use tungstenite::protocol::Message;
 
 use super::*;
 
+// Outgoing messages queued at once are written together, with a single flush
+const MAX_WRITE_BATCH: usize = 64;
+
+enum Outgoing {
+  Queued,
+  Disconnect,
+}
+
+// Queues a message without flushing it
+async fn feed_outgoing<S>(
+  ws_stream: &mut WebSocketStream<S>,
+  message: Option<PollnetMessage>,
+) -> tungstenite::Result<Outgoing>
+where
+  S: AsyncRead + AsyncWrite + Unpin,
+{
+  match message {
+    Some(PollnetMessage::Text(msg)) => {
+      debug!("WS outgoing text: {:}", msg.len());
+      ws_stream.feed(Message::Text(msg)).await?;
+    }
+    Some(PollnetMessage::Binary(msg)) => {
+      debug!("WS outgoing binary: {:}", msg.len());
+      ws_stream.feed(Message::Binary(msg)).await?;
+    }
+    Some(PollnetMessage::SharedBinary(msg)) => {
+      debug!("WS outgoing shared binary: {:}", msg.len());
+      // tungstenite 0.20 frames own their payload, every target but the last one to get here needs its copy
+      let payload = Arc::try_unwrap(msg).unwrap_or_else(|shared| shared.as_ref().clone());
+      ws_stream.feed(Message::Binary(payload)).await?;
+    }
+    Some(PollnetMessage::Disconnect) => {
+      debug!("Client-side disconnect.");
+      return Ok(Outgoing::Disconnect);
+    }
+    None => {
+      warn!("Channel closed w/o disconnect message.");
+      return Ok(Outgoing::Disconnect);
+    }
+    _ => {
+      error!("Invalid message to WS!");
+    }
+  }
+  Ok(Outgoing::Queued)
+}
+
 async fn websocket_poll_loop_inner<S>(
   ws_stream: &mut WebSocketStream<S>,
   mut io: ReactorChannels,
@@ -16,33 +62,29 @@ where
   loop {
     tokio::select! {
         from_c_message = io.rx.recv() => {
-            match from_c_message {
-                Some(PollnetMessage::Text(msg)) => {
-                    debug!("WS outgoing text: {:}", msg.len());
-                    if let Err(e) = ws_stream.send(Message::Text(msg)).await {
-                        debug!("WS send error.");
-                        send_error(io.tx, e);
-                        return Ok(());
-                    };
-                },
-                Some(PollnetMessage::Binary(msg)) => {
-                    debug!("WS outgoing binary: {:}", msg.len());
-                    if let Err(e) = ws_stream.send(Message::Binary(msg)).await {
-                        debug!("WS send error.");
-                        send_error(io.tx, e);
-                        return Ok(());
-                    };
-                },
-                Some(PollnetMessage::Disconnect) => {
-                    debug!("Client-side disconnect.");
-                    return Ok(());
-                },
-                None => {
-                    warn!("Channel closed w/o disconnect message.");
+            let mut result = feed_outgoing(ws_stream, from_c_message).await;
+            // take whatever else is already queued, then write it all at once
+            for _ in 1..MAX_WRITE_BATCH {
+                match result {
+                    Ok(Outgoing::Queued) => {},
+                    _ => break,
+                }
+                match io.rx.try_recv() {
+                    Ok(msg) => result = feed_outgoing(ws_stream, Some(msg)).await,
+                    Err(_) => break,
+                }
+            }
+            let result = match result {
+                Ok(outgoing) => ws_stream.flush().await.map(|_| outgoing),
+                Err(e) => Err(e),
+            };
+            match result {
+                Ok(Outgoing::Queued) => {},
+                Ok(Outgoing::Disconnect) => return Ok(()),
+                Err(e) => {
+                    debug!("WS send error.");
+                    send_error(io.tx, e);
                     return Ok(());
-                },
-                _ => {
-                    error!("Invalid message to WS!");
                 }
             }
         },
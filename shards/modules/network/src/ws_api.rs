@@ -28,6 +28,13 @@ pub extern "C" fn pollnet_invalid_handle() -> u64 {
   SocketHandle::null().into()
 }
 
+#[no_mangle]
+pub extern "C" fn pollnet_init_threads(threads: u32) -> *mut PollnetContext {
+  Box::into_raw(Box::new(PollnetContext::with_threads(
+    threads.max(1) as usize
+  )))
+}
+
 /// # Safety
 ///
 /// ctx must be valid
@@ -110,6 +117,26 @@ pub unsafe extern "C" fn pollnet_send_binary(
   ctx.send_binary(handle.into(), slice)
 }
 
+/// # Safety
+///
+/// ctx must be valid, handles must point to count handles
+#[no_mangle]
+pub unsafe extern "C" fn pollnet_send_binary_many(
+  ctx: *mut PollnetContext,
+  handles: *const u64,
+  count: u32,
+  msg: *const u8,
+  msgsize: u32,
+) {
+  let ctx = unsafe { &mut *ctx };
+  let handles: Vec<SocketHandle> = unsafe { std::slice::from_raw_parts(handles, count as usize) }
+    .iter()
+    .map(|handle| (*handle).into())
+    .collect();
+  let slice = unsafe { std::slice::from_raw_parts(msg, msgsize as usize) };
+  ctx.send_binary_many(&handles, slice)
+}
+
 /// # Safety
 ///
 /// ctx must be valid
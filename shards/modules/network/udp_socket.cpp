@@ -0,0 +1,343 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#include "udp_socket.hpp"
+#include "log.hpp"
+#include <boost/asio/post.hpp>
+#include <cstring>
+#include <future>
+
+#if SH_NETWORK_MMSG
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <cerrno>
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#endif
+
+namespace shards::Network {
+
+static auto logger = getLogger();
+
+#if SH_NETWORK_MMSG && defined(SO_REUSEPORT)
+using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
+#endif
+
+// Rounds of batched reads before letting queued sends through
+static constexpr size_t MaxReadRounds = 16;
+#if SH_NETWORK_MMSG
+// Kernel limits of a single GSO buffer
+static constexpr size_t MaxSegments = 64;
+static constexpr size_t MaxSegmentedBytes = 60000;
+#endif
+
+static bool isFlowControl(const boost::system::error_code &ec) {
+  return ec == boost::asio::error::no_buffer_space || ec == boost::asio::error::would_block ||
+         ec == boost::asio::error::try_again;
+}
+
+std::shared_ptr<UdpSocket> UdpSocket::open(boost::asio::io_context &ioc, const udp::endpoint &local, const Options &options,
+                                           Receiver receiver, ErrorHandler onError) {
+  auto socket = std::make_shared<UdpSocket>(ioc, options, std::move(receiver), std::move(onError));
+  auto &s = socket->_socket;
+  s.open(local.protocol());
+  if (options.reuseAddress)
+    s.set_option(udp::socket::reuse_address(true));
+#if SH_NETWORK_MMSG && defined(SO_REUSEPORT)
+  if (options.reusePort)
+    s.set_option(reuse_port(true));
+#endif
+  s.set_option(boost::asio::socket_base::send_buffer_size(options.bufferSize));
+  s.set_option(boost::asio::socket_base::receive_buffer_size(options.bufferSize));
+  s.bind(local);
+  s.non_blocking(true);
+
+  boost::asio::post(ioc, [socket]() { socket->receive(); });
+  return socket;
+}
+
+UdpSocket::UdpSocket(boost::asio::io_context &ioc, const Options &options, Receiver receiver, ErrorHandler onError)
+    : _ioc(ioc), _socket(ioc), _options(options), _receiver(std::move(receiver)), _onError(std::move(onError)) {
+  if (_options.batch == 0)
+    _options.batch = 1;
+#if SH_NETWORK_MMSG
+  _recvData.resize(_options.batch * MaxDatagramSize);
+  _msgs.resize(_options.batch);
+  _iovs.resize(_options.batch);
+  _names.resize(_options.batch);
+  _control.resize(_options.batch * CMSG_SPACE(sizeof(uint16_t)));
+  _msgStart.resize(_options.batch + 1);
+#else
+  _options.gso = false;
+  _recvData.resize(0xFFFF);
+#endif
+}
+
+void UdpSocket::close() {
+  auto closeNow = [](UdpSocket &self) {
+    if (self._closed.exchange(true))
+      return;
+    boost::system::error_code ec;
+    self._socket.close(ec);
+  };
+
+  // nothing else can be touching the socket, posting would never run or deadlock
+  if (_ioc.stopped() || _ioc.get_executor().running_in_this_thread()) {
+    closeNow(*this);
+    return;
+  }
+
+  auto closed = std::make_shared<std::promise<void>>();
+  auto done = closed->get_future();
+  boost::asio::post(_ioc, [self = shared_from_this(), closed, closeNow]() {
+    closeNow(*self);
+    closed->set_value();
+  });
+  if (done.wait_for(CloseTimeout) == std::future_status::timeout) {
+    SPDLOG_LOGGER_WARN(logger, "UDP socket not closed by its I/O thread in time, closing it anyway");
+    closeNow(*this);
+  }
+}
+
+udp::endpoint UdpSocket::localEndpoint() const {
+  boost::system::error_code ec;
+  return _socket.local_endpoint(ec);
+}
+
+void UdpSocket::failed(const boost::system::error_code &ec) {
+  if (_onError)
+    _onError(ec);
+  else
+    SPDLOG_LOGGER_DEBUG(logger, "UDP socket error: {}", ec.message());
+}
+
+void UdpSocket::receive() {
+  if (_closed)
+    return;
+
+  _socket.async_wait(udp::socket::wait_read, [self = shared_from_this()](boost::system::error_code ec) {
+    if (self->_closed || ec == boost::asio::error::operation_aborted)
+      return;
+    if (ec)
+      self->failed(ec);
+    else
+      self->drain();
+    self->receive();
+  });
+}
+
+void UdpSocket::drain() {
+  auto batch = _options.batch;
+  for (size_t round = 0; round < MaxReadRounds && !_closed; round++) {
+#if SH_NETWORK_MMSG
+    for (size_t i = 0; i < batch; i++) {
+      auto &iov = _iovs[i];
+      iov.iov_base = _recvData.data() + i * MaxDatagramSize;
+      iov.iov_len = MaxDatagramSize;
+      auto &hdr = _msgs[i].msg_hdr;
+      std::memset(&hdr, 0, sizeof(hdr));
+      hdr.msg_name = &_names[i];
+      hdr.msg_namelen = sizeof(sockaddr_storage);
+      hdr.msg_iov = &iov;
+      hdr.msg_iovlen = 1;
+    }
+
+    auto n = ::recvmmsg(_socket.native_handle(), _msgs.data(), unsigned(batch), MSG_DONTWAIT, nullptr);
+    _stats.receiveCalls.fetch_add(1, std::memory_order_relaxed);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      boost::system::error_code ec(errno, boost::asio::error::get_system_category());
+      if (!isFlowControl(ec))
+        failed(ec);
+      return;
+    }
+
+    udp::endpoint from;
+    for (int i = 0; i < n && !_closed; i++) {
+      auto &hdr = _msgs[i].msg_hdr;
+      if (hdr.msg_flags & MSG_TRUNC) {
+        _stats.dropped.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      if (hdr.msg_namelen > from.capacity())
+        continue;
+      std::memcpy(from.data(), &_names[i], hdr.msg_namelen);
+      from.resize(hdr.msg_namelen);
+      _receiver(*this, from, (const uint8_t *)_iovs[i].iov_base, _msgs[i].msg_len);
+    }
+    _stats.received.fetch_add(uint64_t(n), std::memory_order_relaxed);
+
+    if (size_t(n) < batch)
+      return;
+#else
+    for (size_t i = 0; i < batch && !_closed; i++) {
+      udp::endpoint from;
+      boost::system::error_code ec;
+      auto n = _socket.receive_from(boost::asio::buffer(_recvData), from, 0, ec);
+      _stats.receiveCalls.fetch_add(1, std::memory_order_relaxed);
+      if (ec) {
+        if (!isFlowControl(ec))
+          failed(ec);
+        return;
+      }
+      _stats.received.fetch_add(1, std::memory_order_relaxed);
+      _receiver(*this, from, _recvData.data(), n);
+    }
+#endif
+  }
+}
+
+void UdpSocket::send(const udp::endpoint &to, const uint8_t *data, size_t size) {
+  bool wake;
+  {
+    std::scoped_lock<std::mutex> l(_sendLock);
+    if (_queuedData.size() + size > MaxQueuedBytes) {
+      _stats.dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    // a flush is already on its way otherwise
+    wake = _queued.empty();
+    _queued.push_back({to, _queuedData.size(), size});
+    _queuedData.insert(_queuedData.end(), data, data + size);
+  }
+  if (wake)
+    boost::asio::post(_socket.get_executor(), [self = shared_from_this()]() { self->flush(); });
+}
+
+void UdpSocket::flush() {
+  // resumed by the write wait
+  if (_waitingWrite || _closed)
+    return;
+
+  bool resumed = _flushPos < _flushing.size();
+  if (!resumed) {
+    _flushing.clear();
+    _flushingData.clear();
+    _flushPos = 0;
+    std::scoped_lock<std::mutex> l(_sendLock);
+    std::swap(_queued, _flushing);
+    std::swap(_queuedData, _flushingData);
+  }
+
+  if (!sendFlushing()) {
+    // the socket is full, keep the rest and go on once it drained
+    _waitingWrite = true;
+    _socket.async_wait(udp::socket::wait_write, [self = shared_from_this()](boost::system::error_code ec) {
+      self->_waitingWrite = false;
+      if (self->_closed || ec == boost::asio::error::operation_aborted)
+        return;
+      if (ec)
+        self->failed(ec);
+      self->flush();
+    });
+    return;
+  }
+
+  if (resumed) {
+    // the wake ups of sends queued while waiting were ignored
+    std::scoped_lock<std::mutex> l(_sendLock);
+    if (!_queued.empty())
+      boost::asio::post(_socket.get_executor(), [self = shared_from_this()]() { self->flush(); });
+  }
+}
+
+bool UdpSocket::sendFlushing() {
+  auto &pos = _flushPos;
+  auto total = _flushing.size();
+  while (pos < total && !_closed) {
+#if SH_NETWORK_MMSG
+    size_t count = 0;
+    while (count < _options.batch && pos < total) {
+      auto &first = _flushing[pos];
+      // queued back to back, a run of datagrams is contiguous in the data
+      size_t run = 1;
+      size_t bytes = first.size;
+      if (_options.gso) {
+        while (pos + run < total && run < MaxSegments) {
+          auto &next = _flushing[pos + run];
+          // segments all have the size of the first but the last one, which can be smaller
+          if (next.to != first.to || next.size > first.size || bytes + next.size > MaxSegmentedBytes ||
+              _flushing[pos + run - 1].size != first.size)
+            break;
+          bytes += next.size;
+          run++;
+        }
+      }
+
+      auto &iov = _iovs[count];
+      iov.iov_base = _flushingData.data() + first.offset;
+      iov.iov_len = bytes;
+      auto &hdr = _msgs[count].msg_hdr;
+      std::memset(&hdr, 0, sizeof(hdr));
+      hdr.msg_name = (void *)first.to.data();
+      hdr.msg_namelen = socklen_t(first.to.size());
+      hdr.msg_iov = &iov;
+      hdr.msg_iovlen = 1;
+      if (run > 1) {
+        auto space = CMSG_SPACE(sizeof(uint16_t));
+        hdr.msg_control = _control.data() + count * space;
+        hdr.msg_controllen = space;
+        auto cmsg = CMSG_FIRSTHDR(&hdr);
+        cmsg->cmsg_level = SOL_UDP;
+        cmsg->cmsg_type = UDP_SEGMENT;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        uint16_t segment = uint16_t(first.size);
+        std::memcpy(CMSG_DATA(cmsg), &segment, sizeof(segment));
+      }
+
+      _msgStart[count] = pos;
+      pos += run;
+      count++;
+    }
+    _msgStart[count] = pos;
+
+    auto n = ::sendmmsg(_socket.native_handle(), _msgs.data(), unsigned(count), MSG_DONTWAIT);
+    _stats.sendCalls.fetch_add(1, std::memory_order_relaxed);
+    if (n < 0) {
+      auto err = errno;
+      pos = _msgStart[0];
+      if (err == EINTR)
+        continue;
+      if (_options.gso && (err == EIO || err == EINVAL)) {
+        // no GSO on this route or kernel, send segments one by one from now on
+        SPDLOG_LOGGER_DEBUG(logger, "UDP GSO not available, disabling it");
+        _options.gso = false;
+        continue;
+      }
+      boost::system::error_code ec(err, boost::asio::error::get_system_category());
+      if (!isFlowControl(ec)) {
+        // skip the datagrams that failed and go on with the others
+        failed(ec);
+        pos = _msgStart[1];
+        _stats.dropped.fetch_add(pos - _msgStart[0], std::memory_order_relaxed);
+        continue;
+      }
+      return false;
+    }
+    // a short count means the next message failed, the next call reports why
+    pos = _msgStart[size_t(n)];
+    _stats.sent.fetch_add(pos - _msgStart[0], std::memory_order_relaxed);
+#else
+    auto &datagram = _flushing[pos];
+    boost::system::error_code ec;
+    _socket.send_to(boost::asio::buffer(_flushingData.data() + datagram.offset, datagram.size), datagram.to, 0, ec);
+    _stats.sendCalls.fetch_add(1, std::memory_order_relaxed);
+    if (ec && isFlowControl(ec))
+      return false;
+    if (ec) {
+      failed(ec);
+      _stats.dropped.fetch_add(1, std::memory_order_relaxed);
+      pos++;
+      continue;
+    }
+    _stats.sent.fetch_add(1, std::memory_order_relaxed);
+    pos++;
+#endif
+  }
+
+  return true;
+}
+
+} // namespace shards::Network
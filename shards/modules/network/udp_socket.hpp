@@ -0,0 +1,133 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#ifndef A7D3F0C2_58E1_4B9A_9F26_C41E7B0D3A85
+#define A7D3F0C2_58E1_4B9A_9F26_C41E7B0D3A85
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/udp.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux__)
+#define SH_NETWORK_MMSG 1
+#include <sys/socket.h>
+#else
+#define SH_NETWORK_MMSG 0
+#endif
+
+namespace shards::Network {
+using boost::asio::ip::udp;
+
+// A UDP socket served by a single I/O thread, datagrams move in and out in batches
+//
+// Readiness is waited for once, then the socket is drained. On Linux up to Options::batch datagrams go through each
+// recvmmsg/sendmmsg call, elsewhere the same loop does one non-blocking call per datagram. Sending never touches the
+// socket from the caller's thread: datagrams are copied into a queue the I/O thread flushes, so all the segments KCP
+// outputs during a tick cost a single wake up. When the socket buffer is full the rest of the queue waits for it to be
+// writable again, only sends beyond MaxQueuedBytes are dropped.
+struct UdpSocket : std::enable_shared_from_this<UdpSocket> {
+  // Called on the I/O thread for each datagram received, data is only valid during the call
+  using Receiver = std::function<void(UdpSocket &socket, const udp::endpoint &from, const uint8_t *data, size_t size)>;
+  // Called on the I/O thread when receiving or sending fails, flow control errors are not reported
+  using ErrorHandler = std::function<void(const boost::system::error_code &ec)>;
+
+  struct Options {
+    // Datagrams moved per system call, 1 disables batching
+    size_t batch{64};
+    // Sends runs of equally sized datagrams to the same peer as a single UDP GSO buffer (Linux)
+    bool gso{false};
+    // Lets a server rebind its port right after a restart, clients must not set it: Linux can then hand them an ephemeral
+    // port a server is bound to, along with the server's datagrams
+    bool reuseAddress{false};
+    // Several sockets can bind the same port, the kernel spreads peers over them by hashing their address (Linux)
+    bool reusePort{false};
+    int bufferSize{65536};
+  };
+
+  struct Stats {
+    std::atomic<uint64_t> received{};
+    std::atomic<uint64_t> sent{};
+    // Truncated on receive, not queued because the queue was full, or failed to send
+    std::atomic<uint64_t> dropped{};
+    std::atomic<uint64_t> receiveCalls{};
+    std::atomic<uint64_t> sendCalls{};
+  };
+
+  // Larger datagrams are dropped, KCP segments are bound by its MTU
+  static constexpr size_t MaxDatagramSize = 4096;
+  // Datagrams queued but not flushed yet, further sends are dropped and left to KCP to retransmit
+  static constexpr size_t MaxQueuedBytes = 4 * 1024 * 1024;
+
+  // Binds a socket and starts receiving, throws if binding fails
+  static std::shared_ptr<UdpSocket> open(boost::asio::io_context &ioc, const udp::endpoint &local, const Options &options,
+                                         Receiver receiver, ErrorHandler onError = {});
+
+  UdpSocket(boost::asio::io_context &ioc, const Options &options, Receiver receiver, ErrorHandler onError);
+
+  // Thread safe, the data is copied
+  void send(const udp::endpoint &to, const uint8_t *data, size_t size);
+
+  // Closes the socket, once this returns the handlers are not called anymore
+  // Closed on the I/O thread when it runs, directly when called from it or when the context is stopped. Waits up to
+  // CloseTimeout for a busy or dead I/O thread before closing it from the calling thread anyway
+  void close();
+
+  udp::endpoint localEndpoint() const;
+  const Stats &stats() const { return _stats; }
+
+private:
+  struct Queued {
+    udp::endpoint to;
+    size_t offset;
+    size_t size;
+  };
+
+  static constexpr auto CloseTimeout = std::chrono::seconds(5);
+
+  boost::asio::io_context &_ioc;
+  udp::socket _socket;
+  Options _options;
+  Receiver _receiver;
+  ErrorHandler _onError;
+  Stats _stats;
+
+  std::mutex _sendLock;
+  std::vector<Queued> _queued;
+  std::vector<uint8_t> _queuedData;
+
+  // Set once, by whichever thread closes the socket
+  std::atomic_bool _closed{};
+
+  // I/O thread only
+  std::vector<Queued> _flushing;
+  std::vector<uint8_t> _flushingData;
+  // First datagram of _flushing not sent yet, the rest waits for the socket to be writable again
+  size_t _flushPos{};
+  bool _waitingWrite{};
+  std::vector<uint8_t> _recvData;
+#if SH_NETWORK_MMSG
+  std::vector<mmsghdr> _msgs;
+  std::vector<iovec> _iovs;
+  std::vector<sockaddr_storage> _names;
+  std::vector<char> _control;
+  // Index in _flushing of the first datagram of each message being sent
+  std::vector<size_t> _msgStart;
+#endif
+
+  void receive();
+  void drain();
+  void flush();
+  // Sends from _flushPos, returns false if the socket is full
+  bool sendFlushing();
+  void failed(const boost::system::error_code &ec);
+};
+
+} // namespace shards::Network
+
+#endif /* A7D3F0C2_58E1_4B9A_9F26_C41E7B0D3A85 */
@@ -0,0 +1,454 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#include "recordlog.hpp"
+#include <shards/core/shared.hpp>
+#include <shards/core/params.hpp>
+#include <shards/core/serialization.hpp>
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+namespace fs = boost::filesystem;
+
+namespace shards::RecordLog {
+
+uint64_t Log::checksum(int64_t timestamp, const uint8_t *payload, size_t size) {
+  return XXH3_64bits_withSeed(payload, size, uint64_t(timestamp));
+}
+
+bool Log::open(const std::string &path) {
+  close();
+  _path = path;
+  if (!_file.open(path) || _file.size() < FileHeaderSize) {
+    close();
+    return false;
+  }
+
+  uint32_t magic, version;
+  memcpy(&magic, _file.data(), sizeof(uint32_t));
+  memcpy(&version, _file.data() + sizeof(uint32_t), sizeof(uint32_t));
+  if (magic != Magic || version != Version) {
+    close();
+    return false;
+  }
+
+  loadIndex();
+  scan();
+  return true;
+}
+
+void Log::close() {
+  _file.close();
+  _path.clear();
+  _index.clear();
+  _count = 0;
+  _end = FileHeaderSize;
+  _lastTimestamp = INT64_MIN;
+}
+
+void Log::loadIndex() {
+  std::ifstream stream(indexPath(_path), std::ios::binary);
+  IndexEntry entry;
+  while (stream.read((char *)&entry, sizeof(IndexEntry))) {
+    // keep the consistent prefix only
+    if (entry.record != _index.size() * IndexInterval || (!_index.empty() && entry.offset <= _index.back().offset))
+      break;
+    _index.push_back(entry);
+  }
+
+  // entries can be ahead of what actually made it to the log
+  while (!_index.empty() && !valid(_index.back().offset)) {
+    _index.pop_back();
+  }
+
+  // resume scanning from the last indexed block, scanning indexes it again
+  if (_index.empty())
+    return;
+  auto resume = _index.back();
+  _index.pop_back();
+  if (_index.empty()) {
+    _count = resume.record;
+    _end = resume.offset;
+    return;
+  }
+
+  // scanning checks the order against the record right before the resumed block, the last one of the block before
+  uint64_t offset = _index.back().offset;
+  int64_t last = INT64_MIN;
+  while (offset < resume.offset && valid(offset)) {
+    auto h = header(offset);
+    last = h.timestamp;
+    offset += RecordHeaderSize + h.size;
+  }
+  if (offset != resume.offset) {
+    // the blocks do not chain up, trust nothing and scan everything
+    _index.clear();
+    return;
+  }
+  _count = resume.record;
+  _end = resume.offset;
+  _lastTimestamp = last;
+}
+
+void Log::refresh() {
+  boost::system::error_code ec;
+  auto size = fs::file_size(_path, ec);
+  if (ec || size == _file.size())
+    return;
+
+  _file.open(_path);
+  if (_file.size() < _end) {
+    // the tail was cut by a writer recovering it, start over
+    std::string path = _path;
+    open(path);
+  }
+}
+
+RecordHeader Log::header(uint64_t offset) const {
+  RecordHeader h;
+  const uint8_t *ptr = _file.data() + offset;
+  memcpy(&h.size, ptr, sizeof(uint32_t));
+  memcpy(&h.checksum, ptr + sizeof(uint32_t), sizeof(uint64_t));
+  memcpy(&h.timestamp, ptr + sizeof(uint32_t) + sizeof(uint64_t), sizeof(int64_t));
+  return h;
+}
+
+bool Log::valid(uint64_t offset) const {
+  if (offset < FileHeaderSize || offset + RecordHeaderSize > _file.size())
+    return false;
+  auto h = header(offset);
+  if (offset + RecordHeaderSize + h.size > _file.size())
+    return false;
+  return h.checksum == checksum(h.timestamp, payload(offset), h.size);
+}
+
+bool Log::scan() {
+  refresh();
+  while (_end < _file.size()) {
+    if (!valid(_end))
+      return false;
+    auto h = header(_end);
+    if (h.timestamp < _lastTimestamp)
+      return false;
+    if (_count % IndexInterval == 0)
+      _index.push_back(IndexEntry{_count, h.timestamp, _end});
+    _lastTimestamp = h.timestamp;
+    _end += RecordHeaderSize + h.size;
+    _count++;
+  }
+  return true;
+}
+
+bool Log::locate(uint64_t record, uint64_t &offset) {
+  if (record >= _count)
+    scan();
+  if (record >= _count)
+    return false;
+
+  auto &entry = _index[record / IndexInterval];
+  uint64_t current = entry.offset;
+  for (uint64_t i = entry.record; i < record; i++) {
+    current += RecordHeaderSize + header(current).size;
+  }
+  offset = current;
+  return true;
+}
+
+uint64_t Log::seek(int64_t timestamp) {
+  scan();
+  if (_index.empty())
+    return 0;
+
+  // the first match is either in the block before the first one starting at or after timestamp, or starts it
+  auto it = std::lower_bound(_index.begin(), _index.end(), timestamp,
+                             [](const IndexEntry &entry, int64_t timestamp) { return entry.timestamp < timestamp; });
+  if (it != _index.begin())
+    --it;
+
+  uint64_t offset = it->offset;
+  for (uint64_t record = it->record; record < _count; record++) {
+    auto h = header(offset);
+    if (h.timestamp >= timestamp)
+      return record;
+    offset += RecordHeaderSize + h.size;
+  }
+  return _count;
+}
+
+bool Writer::open(const std::string &path) {
+  close();
+
+  boost::system::error_code ec;
+  auto size = fs::file_size(path, ec);
+  if (ec || size < FileHeaderSize) {
+    // make sure to create directories
+    fs::path p(path);
+    auto parent_path = p.parent_path();
+    if (!parent_path.empty() && !fs::exists(parent_path))
+      fs::create_directories(parent_path);
+
+    std::ofstream stream(path, std::ios::trunc | std::ios::binary);
+    stream.write((const char *)&Magic, sizeof(uint32_t));
+    stream.write((const char *)&Version, sizeof(uint32_t));
+    if (!stream.good())
+      return false;
+    _path = path;
+  } else {
+    if (!Log::open(path))
+      return false;
+    // nothing reads through the mapping while writing
+    _file.close();
+    if (_end < size) {
+      SHLOG_WARNING("RecordLog: {} has an incomplete or corrupted tail, truncating {} bytes after record {}", path,
+                    size - _end, _count);
+      fs::resize_file(path, _end);
+    }
+  }
+
+  // the index is rewritten to match the recovered log
+  _indexStream = std::ofstream(indexPath(path), std::ios::trunc | std::ios::binary);
+  _indexStream.write((const char *)_index.data(), _index.size() * sizeof(IndexEntry));
+  _stream = std::ofstream(path, std::ios::app | std::ios::binary);
+  return _stream.good() && _indexStream.good();
+}
+
+void Writer::close() {
+  flush();
+  _stream = {};
+  _indexStream = {};
+  Log::close();
+}
+
+uint64_t Writer::append(const uint8_t *payload, size_t size, int64_t timestamp) {
+  uint32_t size32 = uint32_t(size);
+  uint64_t sum = checksum(timestamp, payload, size);
+  _stream.write((const char *)&size32, sizeof(uint32_t));
+  _stream.write((const char *)&sum, sizeof(uint64_t));
+  _stream.write((const char *)&timestamp, sizeof(int64_t));
+  _stream.write((const char *)payload, size);
+
+  if (_count % IndexInterval == 0) {
+    IndexEntry entry{_count, timestamp, _end};
+    _index.push_back(entry);
+    _indexStream.write((const char *)&entry, sizeof(IndexEntry));
+  }
+
+  _end += RecordHeaderSize + size;
+  _lastTimestamp = timestamp;
+  return _count++;
+}
+
+void Writer::flush() {
+  if (_stream.is_open())
+    _stream.flush();
+  if (_indexStream.is_open())
+    _indexStream.flush();
+}
+
+struct Append {
+  static SHOptionalString help() {
+    return SHCCSTR("Appends the input value as a new record at the end of a record log, creating the log if needed. An existing "
+                   "log is recovered first, an incomplete or corrupted record left by a crash is removed along with anything "
+                   "after it. Only one writer should append to a log at a time.");
+  }
+  static SHOptionalString inputHelp() { return SHCCSTR("The value to append."); }
+  static SHOptionalString outputHelp() { return SHCCSTR("The number of the new record, starting from 0."); }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::IntType; }
+
+  PARAM_PARAMVAR(_path, "Path", "The record log file.", {CoreInfo::StringType, CoreInfo::StringVarType});
+  PARAM_PARAMVAR(_timestamp, "Timestamp",
+                 "The timestamp of the record, by default the time in milliseconds since the epoch. Must not be lower than "
+                 "the timestamp of the previous record.",
+                 {CoreInfo::NoneType, CoreInfo::IntType, CoreInfo::IntVarType});
+  PARAM_VAR(_flush, "Flush", "If the log should be flushed after every record.", {CoreInfo::BoolType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_path), PARAM_IMPL_FOR(_timestamp), PARAM_IMPL_FOR(_flush));
+
+  Append() { _flush = Var(false); }
+
+  Writer _log;
+  Serialization _serial;
+  std::vector<uint8_t> _buffer;
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) {
+    _log.close();
+    PARAM_CLEANUP(context);
+  }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(const SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    return outputTypes().elements[0];
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    std::string path(SHSTRVIEW(_path.get()));
+    if (_log.path() != path) {
+      if (!_log.open(path))
+        throw ActivationError(fmt::format("RecordLog.Append, {} could not be opened as a record log", path));
+    }
+
+    auto &timestampVar = _timestamp.get();
+    int64_t timestamp = timestampVar.valueType == SHType::Int
+                            ? timestampVar.payload.intValue
+                            : std::chrono::duration_cast<std::chrono::milliseconds>(
+                                  std::chrono::system_clock::now().time_since_epoch())
+                                  .count();
+    if (timestamp < _log.lastTimestamp()) {
+      throw ActivationError(fmt::format("RecordLog.Append, timestamp {} is lower than the previous record's {}", timestamp,
+                                        _log.lastTimestamp()));
+    }
+
+    _serial.reset();
+    _serial.serializeInto(input, _buffer);
+    if (_buffer.size() > UINT32_MAX)
+      throw ActivationError("RecordLog.Append, records are limited to 4GB");
+
+    auto record = _log.append(_buffer.data(), _buffer.size(), timestamp);
+    if (_flush->payload.boolValue)
+      _log.flush();
+    return Var(int64_t(record));
+  }
+};
+
+struct ReaderBase {
+  PARAM_PARAMVAR(_path, "Path", "The record log file.", {CoreInfo::StringType, CoreInfo::StringVarType});
+
+  Log _log;
+
+  Log &log(std::string_view shardName) {
+    std::string path(SHSTRVIEW(_path.get()));
+    if (_log.path() != path) {
+      if (!_log.open(path))
+        throw ActivationError(fmt::format("{}, {} is not a record log", shardName, path));
+    }
+    return _log;
+  }
+};
+
+struct Get : ReaderBase {
+  static SHOptionalString help() {
+    return SHCCSTR("Reads a record of a record log by number. The log is memory mapped and located through its sparse index, "
+                   "records appended since the last read are picked up.");
+  }
+  static SHOptionalString inputHelp() { return SHCCSTR("The number of the record to read, starting from 0."); }
+  static SHOptionalString outputHelp() { return SHCCSTR("The value stored in the record."); }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::IntType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::AnyType; }
+
+  PARAM_PARAMVAR(_timestampVar, "Timestamp", "A variable receiving the timestamp of the record.",
+                 {CoreInfo::NoneType, CoreInfo::IntVarType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_path), PARAM_IMPL_FOR(_timestampVar));
+
+  Serialization _serial;
+  SHVar _output{};
+
+  void destroy() { destroyVar(_output); }
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) {
+    _log.close();
+    PARAM_CLEANUP(context);
+  }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(const SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    return outputTypes().elements[0];
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    auto &log = this->log("RecordLog.Get");
+    uint64_t offset;
+    if (input.payload.intValue < 0 || !log.locate(uint64_t(input.payload.intValue), offset)) {
+      throw ActivationError(
+          fmt::format("RecordLog.Get, record {} does not exist, the log has {} records", input.payload.intValue, log.count()));
+    }
+
+    auto header = log.header(offset);
+    BytesReader r(log.payload(offset), header.size);
+    _serial.reset();
+    _serial.deserialize(r, _output);
+
+    auto &timestamp = _timestampVar.get();
+    if (timestamp.valueType == SHType::Int)
+      timestamp.payload.intValue = header.timestamp;
+    return _output;
+  }
+};
+
+struct Seek : ReaderBase {
+  static SHOptionalString help() {
+    return SHCCSTR("Finds the first record of a record log with a timestamp at or after the input timestamp, using the sparse "
+                   "index to skip most of the log.");
+  }
+  static SHOptionalString inputHelp() { return SHCCSTR("The timestamp to look for."); }
+  static SHOptionalString outputHelp() {
+    return SHCCSTR("The number of the first matching record, or the number of records if every record is older.");
+  }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::IntType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::IntType; }
+
+  PARAM_IMPL(PARAM_IMPL_FOR(_path));
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) {
+    _log.close();
+    PARAM_CLEANUP(context);
+  }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(const SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    return outputTypes().elements[0];
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    return Var(int64_t(log("RecordLog.Seek").seek(input.payload.intValue)));
+  }
+};
+
+struct Count : ReaderBase {
+  static SHOptionalString help() { return SHCCSTR("Outputs the number of valid records in a record log."); }
+  static SHOptionalString outputHelp() { return SHCCSTR("The number of records."); }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::AnyType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::IntType; }
+
+  PARAM_IMPL(PARAM_IMPL_FOR(_path));
+
+  void warmup(SHContext *context) { PARAM_WARMUP(context); }
+  void cleanup(SHContext *context) {
+    _log.close();
+    PARAM_CLEANUP(context);
+  }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(const SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    return outputTypes().elements[0];
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    auto &log = this->log("RecordLog.Count");
+    log.scan();
+    return Var(int64_t(log.count()));
+  }
+};
+
+} // namespace shards::RecordLog
+
+namespace shards {
+SHARDS_REGISTER_FN(recordlog) {
+  REGISTER_SHARD("RecordLog.Append", RecordLog::Append);
+  REGISTER_SHARD("RecordLog.Get", RecordLog::Get);
+  REGISTER_SHARD("RecordLog.Seek", RecordLog::Seek);
+  REGISTER_SHARD("RecordLog.Count", RecordLog::Count);
+}
+} // namespace shards
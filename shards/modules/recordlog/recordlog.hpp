@@ -0,0 +1,108 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+/* Copyright © 2019 Fragcolor Pte. Ltd. */
+
+#ifndef F3A86D12_5C4B_4B0E_8E7D_2A9C61B4E0F5
+#define F3A86D12_5C4B_4B0E_8E7D_2A9C61B4E0F5
+
+#include <shards/core/mapped_file.hpp>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// Append only record log
+//
+// File layout:
+//   u32 Magic | u32 Version | records...
+// Record layout:
+//   u32 payload size | u64 checksum | i64 timestamp | payload (a serialized value)
+// The checksum is XXH3 over the timestamp and the payload, a record that is truncated or does not match its
+// checksum ends the log; writers cut such a tail away when opening the log.
+//
+// A sparse index is kept next to the log (<path>.idx), one entry every IndexInterval records, so any record can
+// be located by number or timestamp hopping over at most IndexInterval - 1 record headers. The index is only a
+// hint, it is rebuilt from the log for the records it is missing.
+// Timestamps never decrease along the log.
+
+namespace shards::RecordLog {
+
+struct IndexEntry {
+  uint64_t record;
+  int64_t timestamp;
+  uint64_t offset;
+};
+
+struct RecordHeader {
+  uint32_t size;
+  uint64_t checksum;
+  int64_t timestamp;
+};
+
+struct Log {
+  static constexpr uint32_t Magic = 0x4C524853; // "SHRL"
+  static constexpr uint32_t Version = 1;
+  static constexpr size_t FileHeaderSize = sizeof(uint32_t) * 2;
+  static constexpr size_t RecordHeaderSize = sizeof(uint32_t) + sizeof(uint64_t) + sizeof(int64_t);
+  static constexpr uint64_t IndexInterval = 64;
+
+  static std::string indexPath(const std::string &path) { return path + ".idx"; }
+
+  const std::string &path() const { return _path; }
+  // Number of valid records found so far
+  uint64_t count() const { return _count; }
+  // Offset past the last valid record
+  uint64_t end() const { return _end; }
+  int64_t lastTimestamp() const { return _lastTimestamp; }
+  const std::vector<IndexEntry> &index() const { return _index; }
+
+  // Maps the log and finds its valid records, returns false if the file does not exist or is not a log
+  bool open(const std::string &path);
+  void close();
+
+  // Picks up records appended since the last scan, returns false if the tail holds an incomplete or corrupted record
+  bool scan();
+
+  // Offset of a record, false if the record does not exist (yet)
+  bool locate(uint64_t record, uint64_t &offset);
+  // Number of the first record with a timestamp at or after the given one, count() if none
+  uint64_t seek(int64_t timestamp);
+
+  // Reads the record at offset, payload points into the mapping and stays valid until the next scan
+  RecordHeader header(uint64_t offset) const;
+  const uint8_t *payload(uint64_t offset) const { return _file.data() + offset + RecordHeaderSize; }
+
+  static uint64_t checksum(int64_t timestamp, const uint8_t *payload, size_t size);
+
+protected:
+  std::string _path;
+  MappedFile _file;
+  std::vector<IndexEntry> _index;
+  uint64_t _count{};
+  uint64_t _end{FileHeaderSize};
+  int64_t _lastTimestamp{INT64_MIN};
+
+  void loadIndex();
+  // Remaps the file if it grew past the current mapping
+  void refresh();
+  // True if a complete record with a matching checksum is at offset
+  bool valid(uint64_t offset) const;
+};
+
+// Appends records, recovering the tail of an existing log first
+struct Writer : Log {
+  // Creates the log if needed, returns false if the file exists but is not a log
+  bool open(const std::string &path);
+  void close();
+
+  // Returns the number of the new record, timestamps must not go backwards
+  uint64_t append(const uint8_t *payload, size_t size, int64_t timestamp);
+  void flush();
+
+private:
+  std::ofstream _stream;
+  std::ofstream _indexStream;
+};
+
+} // namespace shards::RecordLog
+
+#endif /* F3A86D12_5C4B_4B0E_8E7D_2A9C61B4E0F5 */
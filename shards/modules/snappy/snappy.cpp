@@ -3,7 +3,9 @@
 
 #include <shards/core/shared.hpp>
 #include <shards/core/runtime.hpp>
+#include <shards/core/params.hpp>
 #include <snappy.h>
+#include <array>
 
 namespace shards {
 namespace Snappy {
@@ -48,9 +50,227 @@ struct Decompress {
   }
 };
 
+// Streaming variants use the snappy framing format, the output can be written to a file chunk by chunk and read back
+// by any tool supporting it. Snappy keeps no state between blocks, the buffers are what gets reused
+namespace Framing {
+constexpr uint8_t StreamIdentifier = 0xff;
+constexpr uint8_t CompressedData = 0x00;
+constexpr uint8_t UncompressedData = 0x01;
+constexpr char Magic[] = "sNaPpY";
+constexpr size_t MagicSize = 6;
+constexpr size_t HeaderSize = 4;
+constexpr size_t ChecksumSize = 4;
+constexpr size_t MaxBlockSize = 65536;
+
+inline uint32_t crc32c(const uint8_t *data, size_t size) {
+  static const auto table = [] {
+    std::array<uint32_t, 256> t{};
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t c = i;
+      for (int k = 0; k < 8; k++)
+        c = c & 1 ? (c >> 1) ^ 0x82F63B78 : c >> 1;
+      t[i] = c;
+    }
+    return t;
+  }();
+  uint32_t crc = 0xFFFFFFFF;
+  for (size_t i = 0; i < size; i++)
+    crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+  return crc ^ 0xFFFFFFFF;
+}
+
+inline uint32_t maskedChecksum(const uint8_t *data, size_t size) {
+  auto crc = crc32c(data, size);
+  return ((crc >> 15) | (crc << 17)) + 0xa282ead8;
+}
+
+inline void writeHeader(std::vector<uint8_t> &out, uint8_t type, size_t size) {
+  out.push_back(type);
+  out.push_back(uint8_t(size));
+  out.push_back(uint8_t(size >> 8));
+  out.push_back(uint8_t(size >> 16));
+}
+
+inline void writeU32(std::vector<uint8_t> &out, uint32_t value) {
+  for (int i = 0; i < 4; i++)
+    out.push_back(uint8_t(value >> (i * 8)));
+}
+
+inline uint32_t readU32(const uint8_t *data) {
+  return uint32_t(data[0]) | uint32_t(data[1]) << 8 | uint32_t(data[2]) << 16 | uint32_t(data[3]) << 24;
+}
+} // namespace Framing
+
+struct CompressStream {
+  static SHOptionalString help() {
+    return SHCCSTR("Compresses a stream of byte arrays chunk by chunk using the Snappy framing format. The first output of a "
+                   "stream starts with the stream identifier, the outputs can be concatenated or sent in order to "
+                   "Snappy.DecompressStream.");
+  }
+  static SHOptionalString inputHelp() { return SHCCSTR("The next chunk of the stream."); }
+  static SHOptionalString outputHelp() { return SHCCSTR("The framed compressed bytes for the chunk."); }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::BytesType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::BytesType; }
+
+  PARAM_PARAMVAR(_finish, "Finish", "If this chunk ends the stream, the next chunk starts a new one.",
+                 {CoreInfo::BoolType, CoreInfo::BoolVarType});
+  PARAM_IMPL(PARAM_IMPL_FOR(_finish));
+
+  CompressStream() { _finish = Var(false); }
+
+  std::vector<uint8_t> _buffer;
+  std::vector<char> _block;
+  bool _started{};
+
+  void warmup(SHContext *context) {
+    PARAM_WARMUP(context);
+    _started = false;
+  }
+  void cleanup(SHContext *context) { PARAM_CLEANUP(context); }
+
+  PARAM_REQUIRED_VARIABLES();
+  SHTypeInfo compose(const SHInstanceData &data) {
+    PARAM_COMPOSE_REQUIRED_VARIABLES(data);
+    return outputTypes().elements[0];
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    using namespace Framing;
+    _buffer.clear();
+    if (!_started) {
+      writeHeader(_buffer, StreamIdentifier, MagicSize);
+      _buffer.insert(_buffer.end(), Magic, Magic + MagicSize);
+      _started = true;
+    }
+
+    _block.resize(snappy::MaxCompressedLength(MaxBlockSize));
+    auto data = input.payload.bytesValue;
+    size_t left = input.payload.bytesSize;
+    while (left > 0) {
+      size_t size = std::min(left, MaxBlockSize);
+      auto checksum = maskedChecksum(data, size);
+      size_t compressedSize;
+      snappy::RawCompress((const char *)data, size, _block.data(), &compressedSize);
+      // blocks that do not shrink are stored as they are
+      if (compressedSize < size - (size / 8)) {
+        writeHeader(_buffer, CompressedData, ChecksumSize + compressedSize);
+        writeU32(_buffer, checksum);
+        _buffer.insert(_buffer.end(), _block.data(), _block.data() + compressedSize);
+      } else {
+        writeHeader(_buffer, UncompressedData, ChecksumSize + size);
+        writeU32(_buffer, checksum);
+        _buffer.insert(_buffer.end(), data, data + size);
+      }
+      data += size;
+      left -= size;
+    }
+
+    if (_finish.get().payload.boolValue)
+      _started = false;
+    return Var(_buffer.data(), uint32_t(_buffer.size()));
+  }
+};
+
+struct DecompressStream {
+  static SHOptionalString help() {
+    return SHCCSTR("Decompresses a Snappy framing format stream chunk by chunk. Chunks can be split anywhere, incomplete "
+                   "frames are kept until the rest arrives.");
+  }
+  static SHOptionalString inputHelp() { return SHCCSTR("The next chunk of compressed bytes."); }
+  static SHOptionalString outputHelp() { return SHCCSTR("The bytes decompressed from the complete frames, might be empty."); }
+
+  static SHTypesInfo inputTypes() { return CoreInfo::BytesType; }
+  static SHTypesInfo outputTypes() { return CoreInfo::BytesType; }
+
+  std::vector<uint8_t> _pending;
+  std::vector<uint8_t> _buffer;
+  bool _started{};
+
+  void warmup(SHContext *context) {
+    _pending.clear();
+    _started = false;
+  }
+
+  // Returns the number of bytes consumed, 0 if the frame is incomplete
+  size_t frame(const uint8_t *data, size_t size) {
+    using namespace Framing;
+    if (size < HeaderSize)
+      return 0;
+    uint8_t type = data[0];
+    size_t length = size_t(data[1]) | size_t(data[2]) << 8 | size_t(data[3]) << 16;
+    if (size < HeaderSize + length)
+      return 0;
+    auto body = data + HeaderSize;
+
+    if (type == StreamIdentifier) {
+      if (length != MagicSize || memcmp(body, Magic, MagicSize) != 0)
+        throw ActivationError("Snappy.DecompressStream, invalid stream identifier");
+      _started = true;
+    } else if (!_started) {
+      throw ActivationError("Snappy.DecompressStream, missing stream identifier");
+    } else if (type == CompressedData || type == UncompressedData) {
+      if (length < ChecksumSize)
+        throw ActivationError("Snappy.DecompressStream, truncated frame");
+      auto checksum = readU32(body);
+      auto payload = body + ChecksumSize;
+      auto payloadSize = length - ChecksumSize;
+      auto offset = _buffer.size();
+      if (type == CompressedData) {
+        size_t len;
+        if (!snappy::GetUncompressedLength((const char *)payload, payloadSize, &len) || len > MaxBlockSize)
+          throw ActivationError("Snappy.DecompressStream, invalid compressed frame");
+        _buffer.resize(offset + len);
+        if (!snappy::RawUncompress((const char *)payload, payloadSize, (char *)_buffer.data() + offset))
+          throw ActivationError("Snappy.DecompressStream, invalid compressed frame");
+      } else {
+        if (payloadSize > MaxBlockSize)
+          throw ActivationError("Snappy.DecompressStream, invalid uncompressed frame");
+        _buffer.insert(_buffer.end(), payload, payload + payloadSize);
+      }
+      if (maskedChecksum(_buffer.data() + offset, _buffer.size() - offset) != checksum)
+        throw ActivationError("Snappy.DecompressStream, checksum mismatch");
+    } else if (type < 0x80) {
+      throw ActivationError(fmt::format("Snappy.DecompressStream, unsupported frame type: {}", int(type)));
+    }
+    // padding and other skippable frames are ignored
+    return HeaderSize + length;
+  }
+
+  SHVar activate(SHContext *context, const SHVar &input) {
+    _buffer.clear();
+
+    // avoid copying when nothing is left over from the previous chunk
+    const uint8_t *data = input.payload.bytesValue;
+    size_t size = input.payload.bytesSize;
+    if (!_pending.empty()) {
+      _pending.insert(_pending.end(), data, data + size);
+      data = _pending.data();
+      size = _pending.size();
+    }
+
+    size_t offset = 0;
+    while (size_t consumed = frame(data + offset, size - offset))
+      offset += consumed;
+
+    if (data == _pending.data()) {
+      _pending.erase(_pending.begin(), _pending.begin() + offset);
+    } else {
+      _pending.assign(data + offset, data + size);
+    }
+
+    // easy fix for null term strings
+    auto len = _buffer.size();
+    _buffer.push_back(0);
+    return Var(_buffer.data(), uint32_t(len));
+  }
+};
+
 } // namespace Snappy
 SHARDS_REGISTER_FN(snappy) {
   REGISTER_SHARD("Snappy.Compress", Snappy::Compress);
   REGISTER_SHARD("Snappy.Decompress", Snappy::Decompress);
+  REGISTER_SHARD("Snappy.CompressStream", Snappy::CompressStream);
+  REGISTER_SHARD("Snappy.DecompressStream", Snappy::DecompressStream);
 }
 } // namespace shards
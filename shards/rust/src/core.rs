@@ -23,6 +23,7 @@ use crate::util::from_raw_parts_allow_null;
 use core::convert::TryInto;
 use core::ffi::c_void;
 use core::slice;
+use futures::future::{AbortHandle, Abortable, Aborted};
 use futures_util::pin_mut;
 use std::ffi::CStr;
 use std::ffi::CString;
@@ -489,6 +490,12 @@ unsafe extern "C" fn cancel_blocking_c_call<T: BlockingShard>(
   (*(*data).caller).cancel_activation(&*context);
 }
 
+struct FutureCallData<F: Future> {
+  // taken by the worker thread, still here if the work was dropped before starting
+  future: Option<Abortable<F>>,
+  abort: AbortHandle,
+}
+
 unsafe extern "C" fn activate_future_c_call<
   F: Future<Output = Result<R, &'static str>> + Send + 'static,
   R: Into<ClonedVar>,
@@ -496,8 +503,12 @@ unsafe extern "C" fn activate_future_c_call<
   _context: *mut SHContext,
   arg2: *mut c_void,
 ) -> SHVar {
-  let f = arg2 as *mut F;
-  let res = futures::executor::block_on(f.read()); // this will consume f
+  let data = arg2 as *mut FutureCallData<F>;
+  let f = (*data).future.take().unwrap_unchecked();
+  let res = match futures::executor::block_on(f) {
+    Ok(res) => res,
+    Err(Aborted) => Err("Cancelled"),
+  };
   match res {
     Ok(value) => {
       // SAFETY: We are unsafely managing memory here on purpose because run_future returns a ClonedVar
@@ -519,6 +530,12 @@ unsafe extern "C" fn activate_future_c_call<
   }
 }
 
+unsafe extern "C" fn cancel_future_c_call<F: Future>(_context: *mut SHContext, arg2: *mut c_void) {
+  // the wire is stopping, wake the worker up so it returns at the future's next await point
+  let data = arg2 as *mut FutureCallData<F>;
+  (*data).abort.abort();
+}
+
 pub fn run_future<
   'a,
   F: Future<Output = Result<R, &'static str>> + Send + 'static,
@@ -529,18 +546,20 @@ pub fn run_future<
 ) -> Result<ClonedVar, &'static str> {
   unsafe {
     let ctx = context as *const SHContext as *mut SHContext;
-    let data_ptr = &f as *const F as *mut F as *mut c_void;
+    let (abort, registration) = AbortHandle::new_pair();
+    let mut data = FutureCallData {
+      future: Some(Abortable::new(f, registration)),
+      abort,
+    };
+    let data_ptr = &mut data as *mut FutureCallData<F> as *mut c_void;
     // see note in activate_future_c_call
     let result = ClonedVar((*Core).asyncActivate.unwrap_unchecked()(
       ctx,
       data_ptr,
       Some(activate_future_c_call::<F, R>),
-      None,
+      Some(cancel_future_c_call::<F>),
     ));
 
-    // before exiting, we need to forget f, otherwise we double free
-    std::mem::forget(f);
-
     if result.0.flags & SHVAR_FLAGS_ABORT as u16 != 0 {
       Err("Failed to run future")
     } else {
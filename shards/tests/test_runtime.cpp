@@ -10,6 +10,8 @@
 #include <shards/core/async.hpp>
 #include <shards/core/runtime.hpp>
 #include <shards/core/serialization.hpp>
+#include <shards/core/serialization_compact.hpp>
+#include <shards/core/serialization_stream.hpp>
 #include <shards/linalg_shim.hpp>
 #include <shards/wire_dsl.hpp>
 #include "shards/core/wire_doppelganger_pool.hpp"
@@ -1239,6 +1241,399 @@ TEST_CASE("AWAIT/AWAITNE") {
 #endif
 }
 
+TEST_CASE("TidePool priorities and deadlines") {
+#if HAS_ASYNC_SUPPORT && SH_ENABLE_TIDE_POOL
+  struct TestWork : TidePool::Work {
+    virtual ~TestWork() {}
+    virtual void call() { called = true; }
+    virtual void expired() { wasExpired = true; }
+
+    std::atomic_bool called{false};
+    std::atomic_bool wasExpired{false};
+  };
+
+  auto &pool = getTidePool();
+  auto expiredBefore = pool.stats(WorkPriority::Critical).expired.load();
+  auto startedBefore = pool.stats(WorkPriority::High).started.load();
+
+  TestWork late;
+  late.priority = WorkPriority::Critical;
+  late.deadline = TidePool::Clock::now() - std::chrono::milliseconds(1);
+  pool.schedule(&late);
+
+  TestWork onTime;
+  onTime.priority = WorkPriority::High;
+  onTime.deadline = TidePool::Clock::now() + std::chrono::seconds(10);
+  pool.schedule(&onTime);
+
+  while (!late.wasExpired || !onTime.called) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+
+  CHECK(!late.called);
+  CHECK(!onTime.wasExpired);
+  CHECK(pool.stats(WorkPriority::Critical).expired.load() == expiredBefore + 1);
+  CHECK(pool.stats(WorkPriority::High).started.load() == startedBefore + 1);
+#endif
+}
+
+TEST_CASE("TidePool cancellation") {
+#if HAS_ASYNC_SUPPORT && SH_ENABLE_TIDE_POOL
+  struct TestWork : TidePool::Work {
+    virtual ~TestWork() {}
+    virtual void call() { called = true; }
+    virtual void dropped() { wasDropped = true; }
+
+    bool called{false};
+    bool wasDropped{false};
+  };
+
+  auto &pool = getTidePool();
+
+  // work that was cancelled while queued is dropped once dequeued
+  TestWork cancelled;
+  cancelled.state = TidePool::Work::State::Cancelled;
+  CHECK(!pool.run(&cancelled));
+  CHECK(cancelled.wasDropped);
+  CHECK(!cancelled.called);
+
+  // running work can't be cancelled anymore
+  TestWork running;
+  running.state = TidePool::Work::State::Running;
+  CHECK(!pool.cancel(&running));
+
+  CancellationToken token;
+  CHECK(!token.cancelled());
+  token.cancel();
+  CHECK(token.cancelled());
+#endif
+}
+
+TEST_CASE("Await cancellation") {
+#if HAS_ASYNC_SUPPORT && SH_ENABLE_TIDE_POOL
+  auto mesh = SHMesh::make();
+  auto wire = SHWire::make("await-cancellation");
+
+  std::atomic_bool started{false};
+  std::atomic_bool observed{false};
+  std::function<SHVar(SHContext *, const SHVar &)> f = [&](SHContext *context, const SHVar &input) {
+    return awaitne(
+        context,
+        [&](const CancellationToken &token) -> SHVar {
+          started = true;
+          // stands for chunked work that checks the token in between chunks
+          while (!token.cancelled())
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+          observed = true;
+          return SHVar{};
+        },
+        [] {});
+  };
+
+  auto unsafeActivate = createShard("UnsafeActivate!");
+  auto vf = Var(reinterpret_cast<int64_t>(&f));
+  unsafeActivate->setParam(unsafeActivate, 0, &vf);
+  wire->addShard(unsafeActivate);
+
+  mesh->schedule(wire);
+  while (!started) {
+    mesh->tick();
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  CHECK(!observed);
+
+  // stopping the wire while the work runs must signal it and wait for it to return
+  stop(wire.get());
+  CHECK(observed);
+  mesh->terminate();
+#endif
+}
+
+TEST_CASE("Serialization two-pass and bulk sequences") {
+  SeqVar floats;
+  for (int i = 0; i < 1000; i++) {
+    floats.push_back(Var(float(i), float(i) * 2.0f, float(i) * 3.0f, float(i) * 4.0f));
+  }
+
+  SeqVar mixed;
+  for (int i = 0; i < 32; i++) {
+    mixed.push_back(Var(int64_t(i)));
+  }
+  mixed.push_back(Var("not blittable"));
+
+  SeqVar nested;
+  nested.push_back(floats);
+  nested.push_back(mixed);
+
+  for (const SHVar &source : std::initializer_list<SHVar>{floats, mixed, nested}) {
+    Serialization classic;
+    std::vector<uint8_t> classicBuffer;
+    BufferRefWriter w{classicBuffer};
+    classic.serialize(source, w);
+
+    Serialization twoPass;
+    std::vector<uint8_t> twoPassBuffer;
+    CHECK(twoPass.serializedSize(source) == classicBuffer.size());
+    CHECK(twoPass.serializeInto(source, twoPassBuffer) == classicBuffer.size());
+    CHECK(twoPassBuffer == classicBuffer);
+
+    TEST_SERIALIZATION(source);
+  }
+
+  // Recycle an output sequence that holds elements of another type
+  Serialization ws;
+  std::vector<uint8_t> buffer;
+  ws.serializeInto(floats, buffer);
+  OwnedVar output(mixed);
+  Serialization rs;
+  BufferRefReader r(buffer);
+  rs.deserialize(r, output);
+  CHECK(output == floats);
+
+  // Objects are serialized once, their callbacks are not run by a size pass
+  static int serializeCalls = 0;
+  static uint8_t objectData[] = {1, 2, 3, 4, 5};
+  SHObjectInfo info{};
+  info.name = "TestObject";
+  info.serialize = [](SHPointer, uint8_t **data, uint64_t *len, SHPointer *) -> SHBool {
+    serializeCalls++;
+    *data = objectData;
+    *len = sizeof(objectData);
+    return true;
+  };
+  info.free = [](SHPointer) {};
+  SHVar object{};
+  object.valueType = SHType::Object;
+  object.payload.objectValue = objectData;
+  object.flags = SHVAR_FLAGS_USES_OBJINFO;
+  object.objectInfo = &info;
+
+  Serialization os;
+  std::vector<uint8_t> objectBuffer{0xFF};
+  CHECK(os.serializeInto(object, objectBuffer, 1) == sizeof(SHType) + sizeof(int64_t) + sizeof(uint64_t) + sizeof(objectData));
+  CHECK(serializeCalls == 1);
+  CHECK(objectBuffer[0] == 0xFF);
+  CHECK(objectBuffer.size() == 1 + sizeof(SHType) + sizeof(int64_t) + sizeof(uint64_t) + sizeof(objectData));
+}
+
+TEST_CASE("Serialization views") {
+  std::vector<uint8_t> blob(4096, 0xAB);
+  TableVar source;
+  source["name"] = Var("Hello Pandas");
+  source["blob"] = Var(blob.data(), uint32_t(blob.size()));
+
+  Serialization ws;
+  std::vector<uint8_t> buffer;
+  ws.serializeInto(source, buffer);
+
+  Serialization rs;
+  rs.views = true;
+  OwnedVar output;
+  BufferRefReader r(buffer);
+  rs.deserialize(r, output);
+  CHECK(output == source);
+
+  auto inBuffer = [&](const void *ptr) { return ptr >= buffer.data() && ptr < buffer.data() + buffer.size(); };
+  auto &table = asTable(output);
+  CHECK((table["name"].flags & SHVAR_FLAGS_FOREIGN) != 0);
+  CHECK(inBuffer(table["name"].payload.stringValue));
+  CHECK((table["blob"].flags & SHVAR_FLAGS_FOREIGN) != 0);
+  CHECK(inBuffer(table["blob"].payload.bytesValue));
+
+  // Copies of views own their data
+  OwnedVar copy = table["blob"];
+  CHECK((copy.flags & SHVAR_FLAGS_FOREIGN) == 0);
+  CHECK(!inBuffer(copy.payload.bytesValue));
+
+  // Deserializing over a view never recycles the viewed memory
+  Serialization rs2;
+  BufferRefReader r2(buffer);
+  rs2.deserialize(r2, output);
+  CHECK(output == source);
+  CHECK((asTable(output)["blob"].flags & SHVAR_FLAGS_FOREIGN) == 0);
+
+  // Same for elements recycled by the bulk sequence path
+  SeqVar names, ints;
+  for (int i = 0; i < 16; i++) {
+    names.push_back(Var("name"));
+    ints.push_back(Var(i));
+  }
+  std::vector<uint8_t> namesBuffer, intsBuffer;
+  ws.serializeInto(names, namesBuffer);
+  ws.serializeInto(ints, intsBuffer);
+  OwnedVar seqOutput;
+  BufferRefReader r3(namesBuffer);
+  rs.deserialize(r3, seqOutput);
+  CHECK((seqOutput.payload.seqValue.elements[0].flags & SHVAR_FLAGS_FOREIGN) != 0);
+  BufferRefReader r4(intsBuffer);
+  rs.deserialize(r4, seqOutput);
+  CHECK(seqOutput == ints);
+  for (auto &v : seqOutput) {
+    CHECK((v.flags & SHVAR_FLAGS_FOREIGN) == 0);
+  }
+}
+
+TEST_CASE("Compact serialization") {
+  TableVar entity;
+  entity["position"] = Var(1.0, 2.0, 3.0);
+  entity["id"] = Var(42);
+  entity["name"] = Var("player");
+  SeqVar inventory;
+  for (int i = 0; i < 64; i++) {
+    inventory.push_back(Var(i));
+  }
+  entity["inventory"] = inventory;
+
+  TypeInfo type(entity, SHInstanceData{});
+  auto schema = CompactSchemaRegistry::instance().get(*type);
+
+  CompactSerialization ws;
+  std::vector<uint8_t> first;
+  BufferRefWriter w1(first);
+  ws.serializeOnce(entity, *schema, w1);
+  std::vector<uint8_t> second;
+  BufferRefWriter w2(second);
+  ws.serializeOnce(entity, *schema, w2);
+  // Only the first frame embeds the schema
+  CHECK(second.size() < first.size());
+
+  Serialization tagged;
+  std::vector<uint8_t> regular;
+  tagged.serializeInto(entity, regular);
+  CHECK(second.size() * 2 < regular.size());
+
+  CompactSerialization rs;
+  OwnedVar output;
+  BytesReader r1(first.data(), first.size());
+  rs.deserialize(r1, output);
+  CHECK(output == entity);
+  BytesReader r2(second.data(), second.size());
+  rs.deserialize(r2, output);
+  CHECK(output == entity);
+
+  // Regular values are still accepted
+  BytesReader r3(regular.data(), regular.size());
+  rs.deserialize(r3, output);
+  CHECK(output == entity);
+
+  // Values that do not match the schema are rejected
+  TableVar other;
+  other["unknown"] = Var(1);
+  std::vector<uint8_t> bad;
+  BufferRefWriter w3(bad);
+  CHECK_THROWS(ws.serialize(other, *schema, w3, false));
+
+  // An embedded schema sent under another hash is rejected
+  auto forged = first;
+  forged[1] ^= 0xFF;
+  CompactSerialization rs2;
+  BytesReader r4(forged.data(), forged.size());
+  CHECK_THROWS(rs2.deserialize(r4, output));
+
+  // A schema embedded by the other side stays with the stream that read it, the registry does not grow
+  TableVar remote;
+  remote["remote-only"] = Var(7);
+  TypeInfo remoteType(remote, SHInstanceData{});
+  auto remoteHash = deriveTypeHash64(*remoteType);
+  CompactSchema remoteSchema(*remoteType, remoteHash);
+  CompactSerialization remoteWriter;
+  std::vector<uint8_t> embedded;
+  BufferRefWriter w4(embedded);
+  remoteWriter.serializeOnce(remote, remoteSchema, w4);
+  std::vector<uint8_t> bare;
+  BufferRefWriter w5(bare);
+  remoteWriter.serializeOnce(remote, remoteSchema, w5);
+
+  CompactSerialization rs3;
+  BytesReader r5(embedded.data(), embedded.size());
+  rs3.deserialize(r5, output);
+  CHECK(output == remote);
+  BytesReader r6(bare.data(), bare.size());
+  rs3.deserialize(r6, output);
+  CHECK(output == remote);
+  CHECK(rs3.receivedSchemas.size() == 1);
+  CHECK(!CompactSchemaRegistry::instance().find(remoteHash));
+
+  CompactSerialization rs4;
+  BytesReader r7(bare.data(), bare.size());
+  CHECK_THROWS(rs4.deserialize(r7, output));
+}
+
+TEST_CASE("Chunked serialization") {
+  SeqVar big;
+  for (int i = 0; i < 1000; i++) {
+    big.push_back(Var(i));
+  }
+  TableVar first;
+  for (int i = 0; i < 100; i++) {
+    first[fmt::format("key{}", i)] = Var(i);
+  }
+  TableVar second;
+  second["extra"] = Var("value");
+
+  ChunkedSerialization ws;
+  ws.chunkSize = 256;
+  std::vector<uint8_t> stream;
+  BufferRefWriter w(stream);
+  ws.write(big, w);
+  // A record built over several writes
+  ws.write(first, w, false);
+  CHECK(ws.isRecordOpen());
+  CHECK_THROWS(ws.write(big, w));
+  ws.write(second, w, false);
+  ws.endRecord(w);
+  ws.write(Var("single"), w);
+
+  ChunkedSerialization rs;
+  BytesReader r(stream.data(), stream.size());
+  ChunkedSerialization::Header header;
+  OwnedVar chunk;
+  OwnedVar record;
+  size_t resumeOffset = 0;
+
+  auto readRecord = [&]() {
+    size_t chunks = 0;
+    do {
+      REQUIRE(rs.readHeader(r, header));
+      rs.readChunk(r, chunk);
+      ChunkedSerialization::appendChunk(chunk, record, chunks == 0);
+      if (chunks == 0)
+        resumeOffset = r.offset;
+      chunks++;
+    } while (!header.last());
+    return chunks;
+  };
+
+  // Every chunk stays around the chunk size
+  CHECK(readRecord() > 1);
+  CHECK(header.size < 512);
+  CHECK(record == big);
+
+  TableVar merged = first;
+  merged["extra"] = Var("value");
+  CHECK(readRecord() > 1);
+  CHECK(record == merged);
+
+  size_t lastOffset = r.offset;
+  CHECK(readRecord() == 1);
+  CHECK(record == Var("single"));
+  CHECK_FALSE(rs.readHeader(r, header));
+
+  // Reading can resume from any chunk boundary
+  BytesReader resumed(stream.data(), stream.size());
+  resumed.offset = resumeOffset;
+  REQUIRE(rs.readHeader(resumed, header));
+  rs.readChunk(resumed, chunk);
+  CHECK(chunk.valueType == SHType::Seq);
+  CHECK(chunk.payload.seqValue.len == header.count);
+
+  // An incomplete chunk is not consumed
+  BytesReader partial(stream.data(), stream.size() - 1);
+  partial.offset = lastOffset;
+  CHECK_FALSE(rs.readHeader(partial, header));
+  CHECK(partial.offset == lastOffset);
+}
+
 TEST_CASE("TTableVar initialization", "[TTableVar]") {
   SECTION("Default construction") {
     TableVar tv;
@@ -2062,4 +2457,183 @@ TEST_CASE("WireDoppelgangerPool acquire and release", "[WireDoppelgangerPool]")
     REQUIRE(cached);
     REQUIRE(uniqueItems.find(item) != uniqueItems.end());
   }
-}
\ No newline at end of file
+}
+
+#ifndef __EMSCRIPTEN__
+#include <shards/modules/http/static_files.hpp>
+
+TEST_CASE("Http content negotiation") {
+  using namespace shards::Http;
+
+  struct EncodingCase {
+    std::string_view header;
+    bool brotli;
+  };
+  for (auto &c : std::initializer_list<EncodingCase>{
+           {"", false},
+           {"br", true},
+           {"BR", true},
+           {"gzip, deflate, br", true},
+           {"gzip", false},
+           {"identity", false},
+           {"br;q=0", false},
+           {"br; q=0.000", false},
+           {"br;q=0.001", true},
+           {"gzip;q=1.0, br;q=0.5", true},
+           {"*", true},
+           {"*;q=0", false},
+           {"gzip, *", true},
+           {"gzip, *;q=0", false},
+           {"*, br;q=0", false},
+           {"br;q=0, *", false},
+           {"*;q=0, br", true},
+       }) {
+    INFO("Accept-Encoding: " << c.header);
+    CHECK(acceptsEncoding(c.header, "br") == c.brotli);
+  }
+
+  struct EtagCase {
+    std::string_view header;
+    bool matches;
+  };
+  auto etag = makeEtag(0x5f00, 0x2a);
+  REQUIRE(etag == "\"5f00-2a\"");
+  for (auto &c : std::initializer_list<EtagCase>{
+           {"", false},
+           {"*", true},
+           {"\"5f00-2a\"", true},
+           {"W/\"5f00-2a\"", true},
+           {"\"5f00-2b\"", false},
+           {"\"5f00-2a-br\"", false},
+           {"\"x\", \"5f00-2a\"", true},
+           {"\"x\",W/\"5f00-2a\"", true},
+           {"\"5f00-2a\" , \"x\"", true},
+           {"\"x\", \"y\"", false},
+       }) {
+    INFO("If-None-Match: " << c.header);
+    CHECK(etagMatches(c.header, etag) == c.matches);
+  }
+  // the compressed variant has its own etag
+  CHECK(etagMatches("\"5f00-2a-br\"", makeEtag(0x5f00, 0x2a, true)));
+  CHECK(!etagMatches(etag, makeEtag(0x5f00, 0x2a, true)));
+}
+#endif
+
+#if SH_LINUX
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// Looped Http.Server answering each request with its target
+struct EchoServer {
+  std::shared_ptr<SHWire> handler;
+  std::shared_ptr<SHWire> wire;
+
+  EchoServer(uint16_t port, int64_t threads, int64_t maxRequests) {
+    handler = SHWire::make("echo-handler");
+    handler->looped = true;
+    handler->addShard(createShard("Http.Read"));
+    auto take = createShard("Take");
+    auto key = Var("target");
+    take->setParam(take, 0, &key);
+    handler->addShard(take);
+    handler->addShard(createShard("ExpectString"));
+    handler->addShard(createShard("Http.Response"));
+
+    wire = SHWire::make("echo-server");
+    wire->looped = true;
+    auto server = createShard("Http.Server");
+    auto handlerVar = Var(handler);
+    server->setParam(server, 0, &handlerVar);
+    auto portVar = Var(int64_t(port));
+    server->setParam(server, 2, &portVar);
+    auto threadsVar = Var(threads);
+    server->setParam(server, 3, &threadsVar);
+    auto maxRequestsVar = Var(maxRequests);
+    server->setParam(server, 5, &maxRequestsVar);
+    wire->addShard(server);
+  }
+};
+
+// Sends raw requests on a single connection while ticking the mesh, returns what was received until the server closed it
+static std::string httpExchange(SHMesh &mesh, uint16_t port, std::string_view requests) {
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+  auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+  int fd = -1;
+  // the server starts listening on its first activation
+  while (fd < 0 && std::chrono::steady_clock::now() < deadline) {
+    mesh.tick();
+    fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (::connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+  REQUIRE(fd >= 0);
+  DEFER(::close(fd));
+  REQUIRE(::send(fd, requests.data(), requests.size(), 0) == ssize_t(requests.size()));
+
+  std::string received;
+  char buffer[4096];
+  while (std::chrono::steady_clock::now() < deadline) {
+    mesh.tick();
+    auto n = ::recv(fd, buffer, sizeof(buffer), MSG_DONTWAIT);
+    if (n > 0) {
+      received.append(buffer, size_t(n));
+    } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+      return received;
+    } else {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  }
+  FAIL("The server did not close the connection");
+  return received;
+}
+
+static size_t countOf(std::string_view text, std::string_view what) {
+  size_t count = 0;
+  for (auto pos = text.find(what); pos != std::string_view::npos; pos = text.find(what, pos + what.size()))
+    count++;
+  return count;
+}
+
+TEST_CASE("Http.Server pipelining and MaxRequests") {
+  for (int64_t threads : {0, 2}) {
+    INFO("Threads: " << threads);
+    auto mesh = SHMesh::make();
+    DEFER(mesh->terminate());
+
+    // both requests are sent at once, the responses must come back in the same order
+    uint16_t pipelinedPort = uint16_t(7080 + threads);
+    EchoServer pipelined(pipelinedPort, threads, 0);
+    mesh->schedule(pipelined.wire);
+    auto responses = httpExchange(*mesh, pipelinedPort,
+                                  "GET /first HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                                  "GET /second HTTP/1.1\r\nHost: localhost\r\nConnection: close\r\n\r\n");
+    CHECK(countOf(responses, "HTTP/1.1 200 OK") == 2);
+    auto first = responses.find("/first");
+    auto second = responses.find("/second");
+    REQUIRE(first != std::string::npos);
+    REQUIRE(second != std::string::npos);
+    CHECK(first < second);
+
+    // the connection closes once MaxRequests were answered, the third request is never served
+    uint16_t limitedPort = uint16_t(7090 + threads);
+    EchoServer limited(limitedPort, threads, 2);
+    mesh->schedule(limited.wire);
+    responses = httpExchange(*mesh, limitedPort,
+                             "GET /first HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                             "GET /second HTTP/1.1\r\nHost: localhost\r\n\r\n"
+                             "GET /third HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    CHECK(countOf(responses, "HTTP/1.1 200 OK") == 2);
+    CHECK(countOf(responses, "Connection: close") == 1);
+    CHECK(responses.find("/second") != std::string::npos);
+    CHECK(responses.find("/third") == std::string::npos);
+  }
+}
+#endif